@@ -0,0 +1,560 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Haptic loop microbenchmarks.
+///
+/// Times the building blocks of a haptic loop iteration, each of which must
+/// stay well below the 250 us budget of a 4 kHz loop:
+///
+///   project_point_on_segment     closest point of the tube centerline
+///   project_force_on_direction   tube force projection
+///   tube_guidance_force          tube spring-damper, projections included
+///   velocity_estimate            in-loop velocity estimator update
+///   sphere_force                 sphere penetration and damping force
+///   torus_force                  torus nearest-axis and damping force
+///   torus_patch_force            torus force against a physics thread patch
+///   torus_rotation_update        torus reaction and one rigid body step
+///   message_encode               haptic_processor binary message encode
+///   message_decode               haptic_renderer binary message decode
+///   text_encode, text_decode     debug text format, for reference
+///   sphere_loop_iteration        one sphere.cpp loop iteration
+///   torus_loop_iteration         one torus.cpp loop iteration, with the
+///                                physics thread step run inline at 500 Hz
+///
+/// Loop iterations read the scripted device emulator (common/device_emulator.h)
+/// directly, as the dhdc.cpp stub does, and include the loop timing and the
+/// scene publication; set DHD_EMULATOR_DEVICES for several torus tools.
+///
+/// Usage:
+///
+///   haptic_bench [--quick] [--filter=text] [--json=results.json]
+///                [--baseline=results.json] [--tolerance=0.10]
+///
+/// Each benchmark is repeated until it lasts at least 20 ms (2 ms with
+/// --quick), 5 times; the best and the median times per operation are
+/// reported. With --baseline, best times are compared with those of a
+/// previous --json output, and the exit code is non-zero if any benchmark
+/// got slower than its baseline by more than the tolerance.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// C++ library headers
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Eigen library header
+#include <Eigen/Dense>
+
+// Project headers
+#include "device_emulator.h"
+#include "force_models.h"
+#include "haptic_message.h"
+#include "loop_timing.h"
+#include "polyline_centerline.h"
+#include "triple_buffer.h"
+#include "velocity_estimator.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+/// Number of precomputed inputs cycled through by the kernels (power of two).
+constexpr size_t InputCount = 1024;
+
+/// Number of calls between two clock reads.
+constexpr int BatchSize = 64;
+
+/// Rate of the torus physics thread in [Hz], as in torus.cpp.
+constexpr double TorusPhysicsRate = 500.0;
+
+constexpr int Runs = 5;
+
+struct BenchResult
+{
+    std::string name;
+    double best = 0.0;
+    double median = 0.0;
+    uint64_t operations = 0;
+};
+
+struct BenchOptions
+{
+    bool quick = false;
+    std::string filter;
+    std::string jsonPath;
+    std::string baselinePath;
+    double tolerance = 0.10;
+};
+
+class BenchSuite
+{
+public:
+    explicit BenchSuite(const BenchOptions& a_options) :
+        m_options(a_options)
+    {}
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function times 'a_function', which performs one operation per
+    /// call, unless 'a_name' does not match the filter.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    template <typename Function>
+    void run(const std::string& a_name,
+             Function a_function)
+    {
+        if (!m_options.filter.empty() && a_name.find(m_options.filter) == std::string::npos)
+        {
+            return;
+        }
+
+        double minimumTime = m_options.quick ? 2e6 : 2e7;
+        std::array<double, Runs> times;
+        uint64_t operations = 0;
+        for (int run = 0; run < Runs; run++)
+        {
+            uint64_t repeats = 0;
+            double elapsed = 0.0;
+            BenchClock::time_point start = BenchClock::now();
+            do
+            {
+                for (int i = 0; i < BatchSize; i++)
+                {
+                    a_function();
+                }
+                repeats += BatchSize;
+                elapsed = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+            } while (elapsed < minimumTime);
+            times[run] = elapsed / repeats;
+            operations += repeats;
+        }
+        std::sort(times.begin(), times.end());
+
+        BenchResult result { a_name, times[0], times[Runs / 2], operations };
+        std::cout << std::left << std::setw(30) << result.name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << result.best << std::setw(12) << result.median << std::endl;
+        m_results.push_back(result);
+    }
+
+    const std::vector<BenchResult>& results() const
+    {
+        return m_results;
+    }
+
+private:
+    const BenchOptions& m_options;
+    std::vector<BenchResult> m_results;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// JSON output and baseline comparison.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+static bool writeJson(const std::string& a_path,
+                      const std::vector<BenchResult>& a_results)
+{
+    std::ofstream file(a_path);
+    if (!file)
+    {
+        return false;
+    }
+
+    file << "{\n  \"unit\": \"ns_per_op\",\n  \"emulator_devices\": " << DeviceEmulator::instance().deviceCount()
+         << ",\n  \"benchmarks\": [\n" << std::setprecision(4) << std::fixed;
+    for (size_t i = 0; i < a_results.size(); i++)
+    {
+        const BenchResult& result = a_results[i];
+        file << "    { \"name\": \"" << result.name << "\", \"best\": " << result.best << ", \"median\": " << result.median
+             << ", \"operations\": " << result.operations << " }" << (i + 1 < a_results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    return static_cast<bool>(file);
+}
+
+/// Reads the best times of a file written by writeJson(), by benchmark name.
+static bool readBaseline(const std::string& a_path,
+                         std::map<std::string, double>& a_baseline)
+{
+    std::ifstream file(a_path);
+    if (!file)
+    {
+        return false;
+    }
+
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string text = contents.str();
+
+    const std::string nameKey = "\"name\": \"";
+    const std::string bestKey = "\"best\": ";
+    size_t position = 0;
+    while ((position = text.find(nameKey, position)) != std::string::npos)
+    {
+        size_t nameStart = position + nameKey.size();
+        size_t nameEnd = text.find('"', nameStart);
+        size_t best = text.find(bestKey, nameEnd);
+        if (nameEnd == std::string::npos || best == std::string::npos)
+        {
+            break;
+        }
+        a_baseline[text.substr(nameStart, nameEnd - nameStart)] = std::atof(text.c_str() + best + bestKey.size());
+        position = best;
+    }
+    return true;
+}
+
+/// Prints the change of every benchmark relative to 'a_baseline'. Returns the number of regressions.
+static int compareBaseline(const std::vector<BenchResult>& a_results,
+                           const std::map<std::string, double>& a_baseline,
+                           double a_tolerance)
+{
+    std::cout << std::endl << std::left << std::setw(30) << "benchmark" << std::right << std::setw(12) << "best"
+              << std::setw(12) << "baseline" << std::setw(10) << "change" << std::endl;
+
+    int regressions = 0;
+    for (const BenchResult& result : a_results)
+    {
+        auto found = a_baseline.find(result.name);
+        std::cout << std::left << std::setw(30) << result.name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << result.best;
+        if (found == a_baseline.end() || found->second <= 0.0)
+        {
+            std::cout << std::setw(12) << "-" << std::endl;
+            continue;
+        }
+
+        double change = result.best / found->second - 1.0;
+        bool regression = change > a_tolerance;
+        regressions += regression ? 1 : 0;
+        std::cout << std::setw(12) << found->second << std::setw(9) << std::showpos << std::setprecision(1)
+                  << 100.0 * change << "%" << std::noshowpos << (regression ? "  REGRESSION" : "") << std::endl;
+    }
+    return regressions;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Inputs and loop bodies.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+/// Returns tool positions in a cube of half size 'a_extent', about a third of them in contact with 'a_inside'.
+template <typename Predicate>
+static std::vector<Eigen::Vector3d> makePositions(std::mt19937_64& a_random,
+                                                  double a_extent,
+                                                  Predicate a_inside)
+{
+    std::uniform_real_distribution<double> uniform(-a_extent, a_extent);
+    std::vector<Eigen::Vector3d> positions;
+    size_t inside = 0;
+    while (positions.size() < InputCount)
+    {
+        Eigen::Vector3d position(uniform(a_random), uniform(a_random), uniform(a_random));
+        bool contact = a_inside(position);
+        if (contact && 3 * inside > positions.size())
+        {
+            continue;
+        }
+        inside += contact ? 1 : 0;
+        positions.push_back(position);
+    }
+    return positions;
+}
+
+struct SphereScene
+{
+    Eigen::Vector3d toolPosition = Eigen::Vector3d::Zero();
+    Eigen::Vector3d forceTool = Eigen::Vector3d::Zero();
+};
+
+struct TorusScene
+{
+    Eigen::Matrix3d torusRotation = Eigen::Matrix3d::Identity();
+    std::array<Eigen::Vector3d, DeviceEmulator::MaxDevices> toolPositions;
+    std::array<Eigen::Vector3d, DeviceEmulator::MaxDevices> forces;
+};
+
+static bool parseOptions(int argc,
+                         char* argv[],
+                         BenchOptions& a_options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        std::string value = argument.substr(argument.find('=') + 1);
+        if (argument == "--quick") a_options.quick = true;
+        else if (argument.rfind("--filter=", 0) == 0) a_options.filter = value;
+        else if (argument.rfind("--json=", 0) == 0) a_options.jsonPath = value;
+        else if (argument.rfind("--baseline=", 0) == 0) a_options.baselinePath = value;
+        else if (argument.rfind("--tolerance=", 0) == 0) a_options.tolerance = std::atof(value.c_str());
+        else
+        {
+            std::cerr << "error: unknown argument " << argument << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return 1;
+    }
+
+    // Read the baseline first, so that a missing file is reported before the long part.
+    std::map<std::string, double> baseline;
+    if (!options.baselinePath.empty() && !readBaseline(options.baselinePath, baseline))
+    {
+        std::cerr << "error: cannot read baseline " << options.baselinePath << std::endl;
+        return 1;
+    }
+
+    DeviceEmulator& emulator = DeviceEmulator::instance();
+    if (!emulator.open() || !emulator.isScripted())
+    {
+        std::cerr << "error: the benchmark needs a scripted DHD_EMULATOR mode (" << emulator.lastError() << ")" << std::endl;
+        return 1;
+    }
+
+    std::mt19937_64 random(42);
+    const SphereContactModel sphere;
+    TorusContactModel torus;
+    torus.setPose(Eigen::Vector3d::Zero(), Eigen::Matrix3d(Eigen::AngleAxisd(M_PI * 45.0 / 180.0, Eigen::Vector3d(0.0, 1.0, -1.0))));
+    const TubeGuidanceModel guidance;
+    PolylineCenterline centerline;
+    centerline.setPoints({ { 0.060909, -0.00278975, 0.0402634 }, { -0.0415639, -0.0158245, 0.0411088 } });
+
+    std::vector<Eigen::Vector3d> spherePositions = makePositions(random, 0.05, [&](const Eigen::Vector3d& a_position)
+    {
+        return sphere.computeForce(a_position).squaredNorm() > 0.0;
+    });
+    std::vector<Eigen::Vector3d> torusPositions = makePositions(random, 0.09, [&](const Eigen::Vector3d& a_position)
+    {
+        Eigen::Vector3d proxy;
+        return torus.computeForce(a_position, proxy).squaredNorm() > 0.0;
+    });
+    std::vector<Eigen::Vector3d> velocities = makePositions(random, 0.2, [](const Eigen::Vector3d&) { return false; });
+
+    std::vector<HapticMessage> messages(InputCount);
+    std::vector<std::array<char, 128>> texts(InputCount);
+    for (size_t i = 0; i < InputCount; i++)
+    {
+        encodeHapticMessage(messages[i], static_cast<uint32_t>(i), i, spherePositions[i].data(), velocities[i].data());
+        encodeHapticText(texts[i].data(), texts[i].size(), spherePositions[i].data(), velocities[i].data());
+    }
+
+    std::cout << "emulated devices: " << emulator.deviceCount() << std::endl << std::endl
+              << std::left << std::setw(30) << "benchmark" << std::right << std::setw(12) << "best ns"
+              << std::setw(12) << "median ns" << std::endl;
+
+    BenchSuite suite(options);
+    size_t index = 0;
+    volatile double sink = 0.0;
+
+    // Tube centerline.
+    suite.run("project_point_on_segment", [&]()
+    {
+        double projection[3];
+        centerline.project(spherePositions[index++ & (InputCount - 1)].data(), projection);
+        sink = sink + projection[0];
+    });
+    suite.run("project_force_on_direction", [&]()
+    {
+        double projectedForce[3];
+        size_t i = index++ & (InputCount - 1);
+        projectForceOnDirection(velocities[i].data(), spherePositions[i].data(), torusPositions[i].data(), projectedForce);
+        sink = sink + projectedForce[0];
+    });
+    suite.run("tube_guidance_force", [&]()
+    {
+        double projectedPosition[3];
+        double force[3];
+        size_t i = index++ & (InputCount - 1);
+        guidance.computeForce(centerline, spherePositions[i].data(), velocities[i].data(), projectedPosition, force);
+        sink = sink + force[0];
+    });
+
+    // Velocity estimation and contact forces.
+    VelocityEstimator velocityEstimator;
+    double estimatorTime = 0.0;
+    suite.run("velocity_estimate", [&]()
+    {
+        double velocity[3];
+        estimatorTime += 2.5e-4;
+        velocityEstimator.update(estimatorTime, spherePositions[index++ & (InputCount - 1)].data());
+        velocityEstimator.getVelocity(velocity);
+        sink = sink + velocity[0];
+    });
+    suite.run("sphere_force", [&]()
+    {
+        size_t i = index++ & (InputCount - 1);
+        sink = sink + sphere.computeForce(spherePositions[i], velocities[i]).x();
+    });
+    suite.run("torus_force", [&]()
+    {
+        Eigen::Vector3d proxy;
+        size_t i = index++ & (InputCount - 1);
+        sink = sink + torus.computeForce(torusPositions[i], proxy, velocities[i]).x();
+    });
+    std::vector<ContactPatch> torusPatches(InputCount);
+    for (size_t i = 0; i < InputCount; i++)
+    {
+        torusPatches[i] = torus.computePatch(torusPositions[i], 0.0);
+    }
+    suite.run("torus_patch_force", [&]()
+    {
+        Eigen::Vector3d proxy;
+        size_t i = index++ & (InputCount - 1);
+        sink = sink + torus.computePatchForce(torusPatches[i], 1e-3, torusPositions[i], proxy, velocities[i]).x();
+    });
+    suite.run("torus_rotation_update", [&]()
+    {
+        size_t i = index++ & (InputCount - 1);
+        torus.applyReaction(torusPositions[i], velocities[i], 2.5e-4);
+        torus.integrate(torus.stepper.step());
+        sink = sink + torus.rotation(0, 0);
+    });
+
+    // Message codecs.
+    suite.run("message_encode", [&]()
+    {
+        size_t i = index++ & (InputCount - 1);
+        encodeHapticMessage(messages[i], static_cast<uint32_t>(index), index, spherePositions[i].data(), velocities[i].data());
+        sink = sink + messages[i].position[0];
+    });
+    suite.run("message_decode", [&]()
+    {
+        // Same work as applyMessage() of haptic_renderer, without sequence tracking.
+        const HapticMessage* message = decodeHapticMessage(reinterpret_cast<const char*>(&messages[index++ & (InputCount - 1)]),
+                                                           sizeof(HapticMessage));
+        Eigen::Vector3d position = Eigen::Vector3f(message->position[0], message->position[1], message->position[2]).cast<double>();
+        Eigen::Vector3d force = Eigen::Vector3f(message->force[0], message->force[1], message->force[2]).cast<double>();
+        sink = sink + position.x() + force.x();
+    });
+    suite.run("text_encode", [&]()
+    {
+        size_t i = index++ & (InputCount - 1);
+        char buffer[128];
+        sink = sink + encodeHapticText(buffer, sizeof(buffer), spherePositions[i].data(), velocities[i].data());
+    });
+    suite.run("text_decode", [&]()
+    {
+        double position[3];
+        double force[3];
+        decodeHapticText(texts[index++ & (InputCount - 1)].data(), position, force);
+        sink = sink + position[0];
+    });
+
+    // Full loop iterations against the emulated device.
+    LoopTiming sphereTiming;
+    TripleBuffer<SphereScene> sphereScene;
+    VelocityEstimator sphereVelocity;
+    bool sphereSafe = false;
+    suite.run("sphere_loop_iteration", [&]()
+    {
+        sphereTiming.beginIteration();
+        EmulatedSample sample;
+        emulator.sample(sample);
+        SphereScene& scene = sphereScene.back();
+        scene.toolPosition = Eigen::Vector3d(sample.position[0], sample.position[1], sample.position[2]);
+        Eigen::Vector3d toolVelocity;
+        sphereVelocity.update(emulator.time(), scene.toolPosition.data());
+        sphereVelocity.getVelocity(toolVelocity.data());
+        scene.forceTool = sphere.computeForce(scene.toolPosition, toolVelocity);
+        Eigen::Vector3d force = scene.forceTool;
+        if (!sphereSafe)
+        {
+            if (force.norm() == 0.0) sphereSafe = true;
+            else force.setZero();
+        }
+        sink = sink + force.x();
+        sphereScene.publish();
+        sphereTiming.endIteration();
+        emulator.step();
+    });
+
+    // The physics thread of torus.cpp runs inline at its default rate: it applies
+    // the reactions accumulated by the haptic loop, integrates the torus and
+    // computes the patch nearest to every tool.
+    LoopTiming torusTiming;
+    TripleBuffer<TorusScene> torusScene;
+    int deviceCount = emulator.deviceCount();
+    std::vector<VelocityEstimator> torusVelocities(deviceCount);
+    std::vector<Eigen::Vector3d> torusTools(deviceCount, Eigen::Vector3d::Zero());
+    std::vector<ContactPatch> torusToolPatches(deviceCount);
+    Eigen::Vector3d angularImpulse = Eigen::Vector3d::Zero();
+    double physicsTime = emulator.time();
+    suite.run("torus_loop_iteration", [&]()
+    {
+        double time = emulator.time();
+        if (time >= physicsTime + 1.0 / TorusPhysicsRate)
+        {
+            torus.applyImpulse(angularImpulse);
+            angularImpulse.setZero();
+            torus.integrate(time - physicsTime);
+            physicsTime = time;
+            for (int device = 0; device < deviceCount; device++)
+            {
+                torusToolPatches[device] = torus.computePatch(torusTools[device], time);
+            }
+        }
+
+        torusTiming.beginIteration();
+        TorusScene& scene = torusScene.back();
+        for (int device = 0; device < deviceCount; device++)
+        {
+            EmulatedSample sample;
+            emulator.sample(sample, device);
+            torusTools[device] = Eigen::Vector3d(sample.position[0], sample.position[1], sample.position[2]);
+            Eigen::Vector3d velocity;
+            torusVelocities[device].update(time, torusTools[device].data());
+            torusVelocities[device].getVelocity(velocity.data());
+            scene.forces[device] = torus.computePatchForce(torusToolPatches[device], time, torusTools[device],
+                                                           scene.toolPositions[device], velocity);
+            angularImpulse += torus.reactionImpulse(scene.toolPositions[device], scene.forces[device], 1.0 / emulator.rate());
+            sink = sink + scene.forces[device].x();
+        }
+        scene.torusRotation = torus.rotation;
+        torusScene.publish();
+        torusTiming.endIteration();
+        emulator.step();
+    });
+
+    if (!options.jsonPath.empty())
+    {
+        if (!writeJson(options.jsonPath, suite.results()))
+        {
+            std::cerr << "error: cannot write " << options.jsonPath << std::endl;
+            return 1;
+        }
+        std::cout << std::endl << "results written to " << options.jsonPath << std::endl;
+    }
+
+    if (!options.baselinePath.empty())
+    {
+        int regressions = compareBaseline(suite.results(), baseline, options.tolerance);
+        if (regressions > 0)
+        {
+            std::cout << regressions << " benchmark(s) slower than the baseline by more than "
+                      << std::setprecision(0) << 100.0 * options.tolerance << "%" << std::endl;
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,151 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Mesh contact benchmark.
+///
+/// Builds the BVH for meshes of increasing size and times god-object updates
+/// along a device trajectory that slides over the surface, moving 0.1 mm per
+/// step (0.1 m/s at 1 kHz), as well as closest-point queries along the same
+/// path.
+///
+/// Usage: mesh_bvh_bench [mesh.obj|mesh.stl] [--steps=N]
+///
+/// Without a mesh file, UV spheres of 1k to 1M triangles are generated.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// C++ library headers
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Project headers
+#include "god_object.h"
+#include "loop_timing.h"
+#include "mesh_bvh.h"
+#include "triangle_mesh.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+static uint64_t elapsedNs(BenchClock::time_point a_start)
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - a_start).count());
+}
+
+static void benchmark(const std::string& a_name,
+                      const TriangleMesh& a_mesh,
+                      int a_steps)
+{
+    BenchClock::time_point start = BenchClock::now();
+    MeshBvh bvh;
+    bvh.build(a_mesh);
+    double buildMs = elapsedNs(start) * 1e-6;
+
+    // Bounding sphere of the mesh, used to drive the device over its surface.
+    Eigen::Vector3f low = Eigen::Vector3f::Constant(FLT_MAX);
+    Eigen::Vector3f high = Eigen::Vector3f::Constant(-FLT_MAX);
+    for (const Eigen::Vector3f& vertex : a_mesh.vertices)
+    {
+        low = low.cwiseMin(vertex);
+        high = high.cwiseMax(vertex);
+    }
+    Eigen::Vector3d center = (0.5f * (low + high)).cast<double>();
+    double radius = 0.5 * (high - low).cast<double>().maxCoeff();
+
+    // The device spirals around the object, going in and out of contact
+    // with a maximum penetration of 5 % of the radius.
+    double stepLength = 1e-4;
+    auto device = [&](int a_step)
+    {
+        double angle = a_step * stepLength / radius;
+        double height = std::sin(0.05 * angle);
+        double depth = radius * (1.0 - 0.05 * std::sin(7.0 * angle));
+        double ring = std::sqrt(std::max(0.0, 1.0 - height * height));
+        return Eigen::Vector3d(center + depth * Eigen::Vector3d(ring * std::cos(angle), ring * std::sin(angle), height));
+    };
+
+    GodObject godObject(bvh);
+    godObject.reset(center + 2.0 * radius * Eigen::Vector3d::UnitX());
+    LatencyHistogram updateTimes;
+    int contacts = 0;
+    for (int step = 0; step < a_steps; step++)
+    {
+        Eigen::Vector3d position = device(step);
+        start = BenchClock::now();
+        godObject.update(position);
+        updateTimes.record(elapsedNs(start));
+        contacts += godObject.inContact() ? 1 : 0;
+    }
+
+    LatencyHistogram closestTimes;
+    ClosestHit hit;
+    int hint = -1;
+    for (int step = 0; step < a_steps; step++)
+    {
+        Eigen::Vector3d position = device(step);
+        start = BenchClock::now();
+        hint = bvh.closestPoint(position, 0.1 * radius, hit, hint) ? hit.triangle : -1;
+        closestTimes.record(elapsedNs(start));
+    }
+
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(12) << a_name
+              << std::setw(10) << bvh.triangleCount()
+              << std::setw(10) << bvh.memoryBytes() / (1024.0 * 1024.0)
+              << std::setw(10) << buildMs
+              << std::setw(10) << updateTimes.mean() * 1e-3
+              << std::setw(10) << updateTimes.percentile(99.0) * 1e-3
+              << std::setw(10) << updateTimes.max() * 1e-3
+              << std::setw(10) << closestTimes.mean() * 1e-3
+              << std::setw(10) << closestTimes.percentile(99.0) * 1e-3
+              << std::setw(9) << 100.0 * contacts / a_steps << "%" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string path;
+    int steps = 20000;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strncmp(argv[i], "--steps=", 8) == 0)
+        {
+            steps = std::max(1, std::atoi(argv[i] + 8));
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+
+    std::cout << std::setw(12) << "mesh"
+              << std::setw(10) << "tris"
+              << std::setw(10) << "MB"
+              << std::setw(10) << "build ms"
+              << std::setw(10) << "god us"
+              << std::setw(10) << "god p99"
+              << std::setw(10) << "god max"
+              << std::setw(10) << "near us"
+              << std::setw(10) << "near p99"
+              << std::setw(10) << "contact" << std::endl;
+
+    if (!path.empty())
+    {
+        TriangleMesh mesh;
+        if (!mesh.load(path))
+        {
+            std::cerr << "error: cannot load " << path << std::endl;
+            return 1;
+        }
+        benchmark(path.substr(path.find_last_of("/\\") + 1), mesh, steps);
+        return 0;
+    }
+
+    for (size_t count : { 1000, 10000, 100000, 1000000 })
+    {
+        benchmark("sphere", TriangleMesh::makeSphere(0.04, count), steps);
+    }
+    return 0;
+}
@@ -0,0 +1,273 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Many-object scene benchmark.
+///
+/// First checks that the broad phase of ObstacleScene finds the same contacts
+/// and forces as the contact kernel run on every obstacle, before and after
+/// moving the obstacles, and with obstacles larger than the cells. Then
+/// times one haptic loop iteration against the number of obstacles, at a
+/// constant density so that the tool touches about the same number of
+/// obstacles whatever the scene size:
+///
+///   brute force  the contact kernel on every obstacle
+///   grid         the broad phase query and the kernel on its candidates
+///   moving       every obstacle moved by a small step, then the grid query
+///
+/// Usage: obstacle_scene_bench [--quick]
+///
+/// Returns a non-zero exit code if any equivalence check fails.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// C++ library headers
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Project headers
+#include "force_models.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+/// Obstacles of radius 2 to 5 mm per cubic meter, about one obstacle per
+/// 1 cm cube.
+constexpr double ObstacleDensity = 1e6;
+
+/// Edge length in [m] of the cube that holds 'a_count' obstacles.
+static double sceneSize(size_t a_count)
+{
+    return std::cbrt(a_count / ObstacleDensity);
+}
+
+static void makeScene(ObstacleContactModel& a_model,
+                      size_t a_count,
+                      std::mt19937_64& a_random)
+{
+    double size = sceneSize(a_count);
+    std::uniform_real_distribution<double> coordinate(-0.5 * size, 0.5 * size);
+    std::uniform_real_distribution<double> radius(0.002, 0.005);
+    a_model.scene.clear();
+    a_model.scene.reserve(a_count);
+    for (size_t i = 0; i < a_count; i++)
+    {
+        a_model.scene.add(Eigen::Vector3d(coordinate(a_random), coordinate(a_random), coordinate(a_random)), radius(a_random));
+    }
+}
+
+/// Tool positions of a random walk with steps of about 0.1 mm, as at 1 kHz.
+static std::vector<Eigen::Vector3d> makeToolPath(size_t a_obstacleCount,
+                                                 size_t a_count,
+                                                 std::mt19937_64& a_random)
+{
+    double half = 0.5 * sceneSize(a_obstacleCount);
+    std::normal_distribution<double> step(0.0, 1e-4);
+    std::vector<Eigen::Vector3d> path(a_count);
+    Eigen::Vector3d position = Eigen::Vector3d::Zero();
+    for (Eigen::Vector3d& point : path)
+    {
+        position += Eigen::Vector3d(step(a_random), step(a_random), step(a_random));
+        position = position.cwiseMax(-half).cwiseMin(half);
+        point = position;
+    }
+    return path;
+}
+
+static Eigen::Vector3d bruteForce(const ObstacleContactModel& a_model,
+                                  const Eigen::Vector3d& a_toolPosition,
+                                  size_t& a_contactCount)
+{
+    Eigen::Vector3d force = Eigen::Vector3d::Zero();
+    a_contactCount = 0;
+    for (size_t i = 0; i < a_model.scene.size(); i++)
+    {
+        ContactGeometry contact;
+        force += makeContactKernel(SphereShape(a_model.scene.center(i), a_model.scene.radius(i)),
+                                   unilateral(Spring(a_model.stiffness) + NormalDamper(a_model.damping)),
+                                   a_model.toolRadius).compute(a_toolPosition, Eigen::Vector3d::Zero(), contact);
+        if (contact.valid && contact.penetration > 0.0)
+        {
+            a_contactCount++;
+        }
+    }
+    return force;
+}
+
+/// Compares the grid queries of 'a_model' along 'a_path' with bruteForce().
+static void checkQueries(const ObstacleContactModel& a_model,
+                         const std::vector<Eigen::Vector3d>& a_path,
+                         const char* a_case,
+                         int& a_failures,
+                         size_t& a_checks)
+{
+    for (size_t i = 0; i < a_path.size(); i++)
+    {
+        // Spread the queries over the whole scene.
+        Eigen::Vector3d toolPosition = a_path[i] * (1.0 + 20.0 * i / a_path.size());
+        size_t expectedCount = 0;
+        Eigen::Vector3d expected = bruteForce(a_model, toolPosition, expectedCount);
+        size_t resultCount = 0;
+        Eigen::Vector3d result = a_model.computeForce(toolPosition, Eigen::Vector3d::Zero(), &resultCount);
+        a_checks++;
+        if (resultCount != expectedCount || (result - expected).norm() > 1e-9 * (1.0 + expected.norm()))
+        {
+            if (a_failures++ < 10)
+            {
+                std::cerr << "mismatch: " << a_model.scene.size() << " obstacles, cell " << a_model.scene.cellSize() << ", " << a_case
+                          << ", query " << i << ": " << resultCount << " contacts instead of " << expectedCount << std::endl;
+            }
+        }
+    }
+}
+
+static bool checkEquivalence(std::mt19937_64& a_random)
+{
+    int failures = 0;
+    size_t checks = 0;
+    std::normal_distribution<double> drift(0.0, 5e-3);
+
+    for (size_t count : { 0, 1, 2, 10, 100, 1000, 5000 })
+    {
+        // Small cells, kept small, exercise queries over several cells and
+        // hash collisions.
+        for (double cellSize : { 0.004, ObstacleScene::DefaultCellSize })
+        {
+            ObstacleContactModel model;
+            model.scene.setCellSize(cellSize);
+            if (cellSize < ObstacleScene::DefaultCellSize)
+            {
+                model.scene.setQueryRadius(0.0);
+            }
+            makeScene(model, count, a_random);
+            std::vector<Eigen::Vector3d> path = makeToolPath(std::max<size_t>(count, 1), 200, a_random);
+
+            for (const char* pass : { "before moving", "after moving" })
+            {
+                checkQueries(model, path, pass, failures, checks);
+
+                // Move every obstacle, most of them to another cell, and check again.
+                for (size_t i = 0; i < model.scene.size(); i++)
+                {
+                    model.scene.move(i, model.scene.center(i) + Eigen::Vector3d(drift(a_random), drift(a_random), drift(a_random)));
+                }
+            }
+        }
+    }
+
+    // Obstacles larger than the cells grow them to the reach of the tool.
+    ObstacleContactModel model;
+    makeScene(model, 1000, a_random);
+    std::uniform_real_distribution<double> coordinate(-0.05, 0.05);
+    std::uniform_real_distribution<double> radius(0.01, 0.04);
+    for (int i = 0; i < 20; i++)
+    {
+        model.scene.add(Eigen::Vector3d(coordinate(a_random), coordinate(a_random), coordinate(a_random)), radius(a_random));
+    }
+    checks++;
+    if (model.scene.cellSize() < model.toolRadius + model.scene.maxRadius())
+    {
+        failures++;
+        std::cerr << "cells of " << model.scene.cellSize() << " m smaller than the reach of "
+                  << model.toolRadius + model.scene.maxRadius() << " m" << std::endl;
+    }
+    checkQueries(model, makeToolPath(1000, 200, a_random), "large obstacles", failures, checks);
+
+    std::cout << "equivalence: " << checks << " checks, " << failures << " failures" << std::endl;
+    return failures == 0;
+}
+
+template <typename Function>
+static double timeNs(Function a_function)
+{
+    // Repeat until the measurement lasts at least 20 ms, keep the best of 3.
+    double best = DBL_MAX;
+    for (int run = 0; run < 3; run++)
+    {
+        size_t repeats = 0;
+        BenchClock::time_point start = BenchClock::now();
+        double elapsed = 0.0;
+        do
+        {
+            a_function();
+            repeats++;
+            elapsed = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+        } while (elapsed < 2e7);
+        best = std::min(best, elapsed / repeats);
+    }
+    return best;
+}
+
+int main(int argc, char* argv[])
+{
+    bool quick = (argc > 1 && std::strcmp(argv[1], "--quick") == 0);
+    std::mt19937_64 random(42);
+
+    if (!checkEquivalence(random))
+    {
+        return 1;
+    }
+    if (quick)
+    {
+        return 0;
+    }
+
+    std::cout << std::endl << "ns per haptic loop iteration" << std::endl
+              << std::setw(10) << "obstacles" << std::setw(10) << "contacts"
+              << std::setw(14) << "brute force" << std::setw(10) << "grid"
+              << std::setw(12) << "moving" << std::endl;
+
+    constexpr size_t PathLength = 4096;
+    volatile double sink = 0.0;
+    for (size_t count : { 10, 100, 1000, 10000, 100000 })
+    {
+        ObstacleContactModel model;
+        makeScene(model, count, random);
+        std::vector<Eigen::Vector3d> path = makeToolPath(count, PathLength, random);
+
+        size_t contacts = 0;
+        for (const Eigen::Vector3d& toolPosition : path)
+        {
+            size_t contactCount = 0;
+            model.computeForce(toolPosition, Eigen::Vector3d::Zero(), &contactCount);
+            contacts += contactCount;
+        }
+
+        size_t step = 0;
+        double brute = timeNs([&]()
+        {
+            size_t contactCount = 0;
+            sink = sink + bruteForce(model, path[step++ % PathLength], contactCount)(0);
+        });
+        double grid = timeNs([&]()
+        {
+            sink = sink + model.computeForce(path[step++ % PathLength])(0);
+        });
+
+        // Obstacles oscillate by 1 mm around their position, crossing cells.
+        std::vector<Eigen::Vector3d> rest(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            rest[i] = model.scene.center(i);
+        }
+        double moving = timeNs([&]()
+        {
+            double offset = 1e-3 * std::sin(1e-2 * step);
+            for (size_t i = 0; i < count; i++)
+            {
+                model.scene.move(i, rest[i] + Eigen::Vector3d::Constant(offset));
+            }
+            sink = sink + model.computeForce(path[step++ % PathLength])(0);
+        });
+
+        std::cout << std::fixed << std::setprecision(1)
+                  << std::setw(10) << count << std::setw(10) << static_cast<double>(contacts) / PathLength
+                  << std::setw(14) << brute << std::setw(10) << grid
+                  << std::setw(12) << moving << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,324 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Point to segment projection benchmark.
+///
+/// First checks that the scalar, SSE2 and AVX2 paths of SegmentKernel return
+/// bit-identical results, and that they match the per-segment reference
+/// projection (the former projectPointOnSegment of the tube simulator, which
+/// recomputes the segment norm and direction on every call). Then times the
+/// reference and each kernel path for several segment and point counts.
+///
+/// Usage: segment_kernel_bench [--quick]
+///
+/// Returns a non-zero exit code if any equivalence check fails.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// C++ library headers
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Project headers
+#include "segment_kernel.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Reference implementation, one segment given by its end points at a time.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+static void projectPointOnSegment(const double a_point[3],
+                                  const double a_A[3],
+                                  const double a_B[3],
+                                  double a_projection[3])
+{
+    double Ap[] = { a_point[0] - a_A[0], a_point[1] - a_A[1], a_point[2] - a_A[2] };
+    double AB[] = { a_B[0] - a_A[0], a_B[1] - a_A[1], a_B[2] - a_A[2] };
+    double norm = std::sqrt(AB[0] * AB[0] + AB[1] * AB[1] + AB[2] * AB[2]);
+    if (norm <= 1e-6)
+    {
+        std::memcpy(a_projection, a_point, 3 * sizeof(double));
+        return;
+    }
+
+    double direction[3] = { AB[0] / norm, AB[1] / norm, AB[2] / norm };
+    double projectionRatio = Ap[0] * direction[0] + Ap[1] * direction[1] + Ap[2] * direction[2];
+    if (projectionRatio < 0.0)
+    {
+        std::memcpy(a_projection, a_A, 3 * sizeof(double));
+    }
+    else if (projectionRatio > norm)
+    {
+        std::memcpy(a_projection, a_B, 3 * sizeof(double));
+    }
+    else
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            a_projection[i] = a_A[i] + projectionRatio * direction[i];
+        }
+    }
+}
+
+struct Polyline
+{
+    std::vector<double> points;
+    SegmentSoA segments;
+};
+
+/// Random walk polyline of 'a_count' segments with steps of about 1 mm.
+static Polyline makePolyline(size_t a_count,
+                             std::mt19937_64& a_random)
+{
+    std::normal_distribution<double> step(0.0, 1e-3);
+    Polyline polyline;
+    double point[3] = {};
+    polyline.points.insert(polyline.points.end(), point, point + 3);
+    for (size_t i = 0; i < a_count; i++)
+    {
+        double next[3] = { point[0] + step(a_random), point[1] + step(a_random), point[2] + step(a_random) };
+
+        // Repeat a few segments to exercise ties.
+        if (i % 97 == 13 && i >= 2)
+        {
+            std::memcpy(next, &polyline.points[3 * (i - 1)], 3 * sizeof(double));
+        }
+
+        double direction[3] = { next[0] - point[0], next[1] - point[1], next[2] - point[2] };
+        double length = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+        for (double& value : direction)
+        {
+            value /= length;
+        }
+        polyline.segments.push_back(point, direction, length);
+        polyline.points.insert(polyline.points.end(), next, next + 3);
+        std::memcpy(point, next, sizeof(point));
+    }
+    return polyline;
+}
+
+static std::vector<double> makePoints(const Polyline& a_polyline,
+                                      size_t a_count,
+                                      std::mt19937_64& a_random)
+{
+    std::normal_distribution<double> offset(0.0, 2e-3);
+    std::uniform_int_distribution<size_t> vertex(0, a_polyline.points.size() / 3 - 1);
+    std::vector<double> points(3 * a_count);
+    for (size_t i = 0; i < a_count; i++)
+    {
+        size_t index = vertex(a_random);
+        for (int j = 0; j < 3; j++)
+        {
+            // Every eighth point lies exactly on a vertex.
+            points[3 * i + j] = a_polyline.points[3 * index + j] + ((i % 8 == 0) ? 0.0 : offset(a_random));
+        }
+    }
+    return points;
+}
+
+static std::vector<SegmentProjection> runKernel(const SegmentKernel& a_kernel,
+                                                const Polyline& a_polyline,
+                                                const std::vector<double>& a_points)
+{
+    std::vector<SegmentProjection> results(a_points.size() / 3);
+    a_kernel.findClosest(a_polyline.segments, 0, a_polyline.segments.size(), a_points.data(), results.size(), results.data());
+    return results;
+}
+
+static double runReference(const Polyline& a_polyline,
+                           const double a_point[3],
+                           double a_projection[3])
+{
+    double best = DBL_MAX;
+    for (size_t i = 0; i < a_polyline.segments.size(); i++)
+    {
+        double projection[3];
+        projectPointOnSegment(a_point, &a_polyline.points[3 * i], &a_polyline.points[3 * i + 3], projection);
+        double dx = projection[0] - a_point[0];
+        double dy = projection[1] - a_point[1];
+        double dz = projection[2] - a_point[2];
+        double squared = dx * dx + dy * dy + dz * dz;
+        if (squared < best)
+        {
+            best = squared;
+            std::memcpy(a_projection, projection, sizeof(projection));
+        }
+    }
+    return best;
+}
+
+static bool checkEquivalence(std::mt19937_64& a_random)
+{
+    const SegmentKernel::Isa isas[] = { SegmentKernel::Isa::Scalar, SegmentKernel::Isa::Sse2, SegmentKernel::Isa::Avx2 };
+    int failures = 0;
+    size_t checks = 0;
+
+    for (size_t count : { 1, 2, 3, 4, 5, 7, 8, 9, 31, 64, 1000 })
+    {
+        Polyline polyline = makePolyline(count, a_random);
+        std::vector<double> points = makePoints(polyline, 256, a_random);
+        std::vector<SegmentProjection> expected = runKernel(SegmentKernel(SegmentKernel::Isa::Scalar), polyline, points);
+
+        for (SegmentKernel::Isa isa : isas)
+        {
+            SegmentKernel kernel(isa);
+            if (kernel.isa() != isa)
+            {
+                continue;
+            }
+            std::vector<SegmentProjection> results = runKernel(kernel, polyline, points);
+            for (size_t i = 0; i < results.size(); i++)
+            {
+                checks++;
+                if (results[i].segment != expected[i].segment
+                    || results[i].squaredDistance != expected[i].squaredDistance
+                    || std::memcmp(results[i].point, expected[i].point, sizeof(results[i].point)) != 0)
+                {
+                    if (failures++ < 10)
+                    {
+                        std::cerr << "mismatch: " << SegmentKernel::name(isa) << ", " << count << " segments, point " << i
+                                  << ": segment " << results[i].segment << " instead of " << expected[i].segment << std::endl;
+                    }
+                }
+            }
+        }
+
+        // The reference uses another formula, compare distances with a tolerance.
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            double projection[3];
+            double squared = runReference(polyline, &points[3 * i], projection);
+            checks++;
+            if (std::abs(std::sqrt(squared) - std::sqrt(expected[i].squaredDistance)) > 1e-12)
+            {
+                if (failures++ < 10)
+                {
+                    std::cerr << "mismatch with reference: " << count << " segments, point " << i << std::endl;
+                }
+            }
+        }
+    }
+
+    // Ranges processed in several calls must give the same result as one call.
+    Polyline polyline = makePolyline(1000, a_random);
+    std::vector<double> points = makePoints(polyline, 64, a_random);
+    SegmentKernel kernel;
+    std::vector<SegmentProjection> whole = runKernel(kernel, polyline, points);
+    std::vector<SegmentProjection> pieces(whole.size());
+    for (size_t first = 0; first < polyline.segments.size(); first += 37)
+    {
+        size_t count = std::min<size_t>(37, polyline.segments.size() - first);
+        kernel.findClosest(polyline.segments, first, count, points.data(), pieces.size(), pieces.data());
+    }
+    for (size_t i = 0; i < whole.size(); i++)
+    {
+        checks++;
+        if (whole[i].segment != pieces[i].segment || whole[i].squaredDistance != pieces[i].squaredDistance)
+        {
+            if (failures++ < 10)
+            {
+                std::cerr << "mismatch between whole and split ranges, point " << i << std::endl;
+            }
+        }
+    }
+
+    std::cout << "equivalence: " << checks << " checks, " << failures << " failures" << std::endl;
+    return failures == 0;
+}
+
+template <typename Function>
+static double timeNs(size_t a_operations,
+                     Function a_function)
+{
+    // Repeat until the measurement lasts at least 20 ms, keep the best of 3.
+    double best = DBL_MAX;
+    for (int run = 0; run < 3; run++)
+    {
+        size_t repeats = 0;
+        BenchClock::time_point start = BenchClock::now();
+        double elapsed = 0.0;
+        do
+        {
+            // Batch calls so that reading the clock does not dominate small sizes.
+            for (int i = 0; i < 64; i++)
+            {
+                a_function();
+            }
+            repeats += 64;
+            elapsed = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+        } while (elapsed < 2e7);
+        best = std::min(best, elapsed / (repeats * a_operations));
+    }
+    return best;
+}
+
+int main(int argc, char* argv[])
+{
+    bool quick = (argc > 1 && std::strcmp(argv[1], "--quick") == 0);
+    std::mt19937_64 random(42);
+
+    std::cout << "cpu: " << SegmentKernel::name(SegmentKernel::detect()) << std::endl;
+    if (!checkEquivalence(random))
+    {
+        return 1;
+    }
+    if (quick)
+    {
+        return 0;
+    }
+
+    std::cout << std::endl << "ns per point-segment pair" << std::endl
+              << std::setw(10) << "segments" << std::setw(8) << "points"
+              << std::setw(12) << "reference" << std::setw(10) << "scalar"
+              << std::setw(10) << "sse2" << std::setw(10) << "avx2" << std::endl;
+
+    volatile double sink = 0.0;
+    for (size_t segmentCount : { 8, 64, 1024, 65536 })
+    {
+        Polyline polyline = makePolyline(segmentCount, random);
+        for (size_t pointCount : { 1, 8 })
+        {
+            std::vector<double> points = makePoints(polyline, pointCount, random);
+            size_t pairs = segmentCount * pointCount;
+
+            double reference = timeNs(pairs, [&]()
+            {
+                for (size_t i = 0; i < pointCount; i++)
+                {
+                    double projection[3];
+                    sink = sink + runReference(polyline, &points[3 * i], projection);
+                }
+            });
+
+            std::cout << std::fixed << std::setprecision(3)
+                      << std::setw(10) << segmentCount << std::setw(8) << pointCount
+                      << std::setw(12) << reference;
+            for (SegmentKernel::Isa isa : { SegmentKernel::Isa::Scalar, SegmentKernel::Isa::Sse2, SegmentKernel::Isa::Avx2 })
+            {
+                SegmentKernel kernel(isa);
+                if (kernel.isa() != isa)
+                {
+                    std::cout << std::setw(10) << "-";
+                    continue;
+                }
+                std::vector<SegmentProjection> results(pointCount);
+                double time = timeNs(pairs, [&]()
+                {
+                    std::fill(results.begin(), results.end(), SegmentProjection {});
+                    kernel.findClosest(polyline.segments, 0, segmentCount, points.data(), pointCount, results.data());
+                    sink = sink + results[0].squaredDistance;
+                });
+                std::cout << std::setw(10) << time;
+            }
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
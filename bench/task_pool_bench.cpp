@@ -0,0 +1,268 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Parallel narrow phase benchmark.
+///
+/// A long instrument, sampled as a line of tool spheres, moves through a
+/// dense obstacle scene. First checks that the TaskPool returns the same
+/// contacts and forces as the batch computed serially, and that a batch
+/// cancelled at its deadline returns the last complete result without
+/// blocking the next ones. Then runs a 1 kHz haptic loop for several
+/// instrument lengths and reports the serial time and the pool latency
+/// (acquire to result) with its misses at a 1 ms deadline.
+///
+/// Usage: task_pool_bench [--quick] [--workers=N]
+///
+/// Returns a non-zero exit code if any check fails.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// C++ library headers
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Project headers
+#include "force_models.h"
+#include "task_pool.h"
+
+using BenchClock = TaskPool<ObstacleContactBatch>::Clock;
+
+/// Obstacles of radius 2 to 5 mm, about one per 1 cm cube, in a 46 cm cube.
+constexpr size_t ObstacleCount = 100000;
+constexpr double SceneSize = 0.464;
+
+/// Spacing of the tool spheres along the instrument in [m].
+constexpr double ToolSpacing = 4e-4;
+
+static void makeScene(ObstacleContactModel& a_model,
+                      std::mt19937_64& a_random)
+{
+    std::uniform_real_distribution<double> coordinate(-0.5 * SceneSize, 0.5 * SceneSize);
+    std::uniform_real_distribution<double> radius(0.002, 0.005);
+    a_model.scene.reserve(ObstacleCount);
+    for (size_t i = 0; i < ObstacleCount; i++)
+    {
+        a_model.scene.add(Eigen::Vector3d(coordinate(a_random), coordinate(a_random), coordinate(a_random)), radius(a_random));
+    }
+}
+
+/// Fills 'a_batch' with an instrument of 'a_count' spheres along x, its tip at 'a_tip'.
+static void fillInstrument(ObstacleContactBatch& a_batch,
+                           const ObstacleContactModel& a_model,
+                           size_t a_count,
+                           const Eigen::Vector3d& a_tip)
+{
+    a_batch.model = &a_model;
+    a_batch.toolPositions.resize(a_count);
+    a_batch.toolVelocities.assign(a_count, Eigen::Vector3d(0.0, 0.0, 0.01));
+    for (size_t i = 0; i < a_count; i++)
+    {
+        a_batch.toolPositions[i] = a_tip - Eigen::Vector3d(i * ToolSpacing, 0.0, 0.0);
+    }
+}
+
+static Eigen::Vector3d tipAt(size_t a_iteration)
+{
+    // Slow sweep across the scene, about 10 cm/s at 1 kHz.
+    double phase = 1e-4 * a_iteration;
+    return Eigen::Vector3d(0.2, 0.2 * std::sin(phase), 0.2 * std::cos(1.3 * phase));
+}
+
+static bool sameResult(const ObstacleContactBatch::Result& a_result,
+                       const ObstacleContactBatch::Result& a_expected)
+{
+    return a_result.contactCount == a_expected.contactCount
+        && (a_result.force - a_expected.force).norm() <= 1e-9 * (1.0 + a_expected.force.norm());
+}
+
+static bool checkEquivalence(TaskPool<ObstacleContactBatch>& a_pool,
+                             const ObstacleContactModel& a_model)
+{
+    int failures = 0;
+    size_t checks = 0;
+    ObstacleContactBatch serial;
+
+    for (size_t count : { 0, 1, 3, 7, 64, 1000 })
+    {
+        for (size_t iteration = 0; iteration < 200; iteration++)
+        {
+            Eigen::Vector3d tip = tipAt(37 * iteration);
+            fillInstrument(serial, a_model, count, tip);
+            ObstacleContactBatch::Result expected;
+            serial.compute(0, count, expected);
+
+            ObstacleContactBatch* batch = nullptr;
+            for (int attempt = 0; attempt < 1000 && batch == nullptr; attempt++)
+            {
+                batch = a_pool.acquire();
+            }
+            if (batch == nullptr)
+            {
+                std::cerr << "acquire refused 1000 times in a row" << std::endl;
+                return false;
+            }
+            fillInstrument(*batch, a_model, count, tip);
+            a_pool.submit();
+            ObstacleContactBatch::Result result;
+            bool complete = a_pool.wait(BenchClock::now() + std::chrono::seconds(1), result);
+            checks++;
+            if (!complete || !sameResult(result, expected))
+            {
+                if (failures++ < 10)
+                {
+                    std::cerr << "mismatch: " << count << " tool spheres, iteration " << iteration << ": "
+                              << result.contactCount << " contacts instead of " << expected.contactCount << std::endl;
+                }
+            }
+        }
+    }
+
+    // A batch past its deadline returns the last complete result, and the
+    // pool accepts a new batch once the workers have left the cancelled one.
+    ObstacleContactBatch::Result last = a_pool.lastResult();
+    ObstacleContactBatch* batch = a_pool.acquire();
+    if (batch != nullptr)
+    {
+        fillInstrument(*batch, a_model, 1000, tipAt(0));
+        a_pool.submit();
+        ObstacleContactBatch::Result result;
+        checks++;
+        if (a_pool.wait(BenchClock::now() - std::chrono::seconds(1), result) || !sameResult(result, last))
+        {
+            failures++;
+            std::cerr << "late batch did not return the last result" << std::endl;
+        }
+    }
+    BenchClock::time_point giveUp = BenchClock::now() + std::chrono::seconds(1);
+    while ((batch = a_pool.acquire()) == nullptr && BenchClock::now() < giveUp)
+    {
+        std::this_thread::yield();
+    }
+    checks++;
+    if (batch == nullptr)
+    {
+        failures++;
+        std::cerr << "pool still busy 1 s after a cancelled batch" << std::endl;
+    }
+    else
+    {
+        fillInstrument(*batch, a_model, 64, tipAt(0));
+        fillInstrument(serial, a_model, 64, tipAt(0));
+        ObstacleContactBatch::Result expected;
+        serial.compute(0, 64, expected);
+        a_pool.submit();
+        ObstacleContactBatch::Result result;
+        checks++;
+        if (!a_pool.wait(BenchClock::now() + std::chrono::seconds(1), result) || !sameResult(result, expected))
+        {
+            failures++;
+            std::cerr << "batch after a cancelled batch failed" << std::endl;
+        }
+    }
+
+    std::cout << "equivalence: " << checks << " checks, " << failures << " failures" << std::endl;
+    return failures == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    bool quick = false;
+    int workerCount = -1;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument == "--quick")
+        {
+            quick = true;
+        }
+        else if (argument.rfind("--workers=", 0) == 0)
+        {
+            workerCount = std::atoi(argument.c_str() + 10);
+        }
+    }
+
+    std::mt19937_64 random(42);
+    ObstacleContactModel model;
+    makeScene(model, random);
+
+    TaskPool<ObstacleContactBatch> pool;
+    pool.start(workerCount);
+    std::cout << "cores: " << std::thread::hardware_concurrency() << ", workers: " << pool.workerCount()
+              << " (" << pool.pinnedWorkerCount() << " pinned)" << std::endl;
+
+    if (!checkEquivalence(pool, model))
+    {
+        return 1;
+    }
+    if (quick)
+    {
+        return 0;
+    }
+
+    std::cout << std::endl << "1 kHz loop, 1 ms deadline, us per iteration" << std::endl
+              << std::setw(8) << "spheres" << std::setw(10) << "contacts" << std::setw(10) << "serial"
+              << std::setw(10) << "median" << std::setw(10) << "p99" << std::setw(10) << "max"
+              << std::setw(8) << "missed" << std::setw(9) << "refused" << std::endl;
+
+    constexpr size_t Iterations = 2000;
+    for (size_t count : { 16, 64, 256, 1024 })
+    {
+        // Serial reference, on the same instrument path.
+        ObstacleContactBatch serial;
+        double serialTime = 0.0;
+        size_t contacts = 0;
+        for (size_t iteration = 0; iteration < Iterations; iteration++)
+        {
+            fillInstrument(serial, model, count, tipAt(iteration));
+            ObstacleContactBatch::Result result;
+            BenchClock::time_point start = BenchClock::now();
+            serial.compute(0, count, result);
+            serialTime += std::chrono::duration<double, std::micro>(BenchClock::now() - start).count();
+            contacts += result.contactCount;
+        }
+
+        // Pool, paced at 1 kHz so that the workers see the loop idle time.
+        uint64_t missed = pool.missed();
+        uint64_t refused = pool.refused();
+        std::vector<double> latencies;
+        latencies.reserve(Iterations);
+        BenchClock::time_point period = BenchClock::now();
+        for (size_t iteration = 0; iteration < Iterations; iteration++)
+        {
+            period += std::chrono::milliseconds(1);
+            BenchClock::time_point start = BenchClock::now();
+            ObstacleContactBatch::Result result;
+            ObstacleContactBatch* batch = pool.acquire();
+            if (batch != nullptr)
+            {
+                fillInstrument(*batch, model, count, tipAt(iteration));
+                pool.submit();
+                pool.wait(start + std::chrono::milliseconds(1), result);
+            }
+            latencies.push_back(std::chrono::duration<double, std::micro>(BenchClock::now() - start).count());
+            while (BenchClock::now() < period)
+            {
+                std::this_thread::yield();
+            }
+        }
+        std::sort(latencies.begin(), latencies.end());
+
+        std::cout << std::fixed << std::setprecision(1)
+                  << std::setw(8) << count << std::setw(10) << static_cast<double>(contacts) / Iterations
+                  << std::setw(10) << serialTime / Iterations
+                  << std::setw(10) << latencies[Iterations / 2]
+                  << std::setw(10) << latencies[Iterations * 99 / 100]
+                  << std::setw(10) << latencies.back()
+                  << std::setw(8) << pool.missed() - missed
+                  << std::setw(9) << pool.refused() - refused << std::endl;
+    }
+    return 0;
+}
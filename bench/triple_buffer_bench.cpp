@@ -0,0 +1,159 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// TripleBuffer stress test.
+///
+/// A writer thread publishes snapshots as fast as it can while a reader
+/// thread fetches them as fast as it can, as the haptic and graphics
+/// threads do with common/triple_buffer.h. Every word of a snapshot holds
+/// its sequence number, so the reader detects a snapshot written while it
+/// was being read (torn), and a snapshot older than the one it read before
+/// (regression). Runs for several snapshot sizes, from one cache line to a
+/// scene-sized snapshot.
+///
+/// Usage: triple_buffer_bench [--quick] [--seconds=S]
+///
+/// Returns a non-zero exit code if any snapshot is torn or goes back in time.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// C++ library headers
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// Project headers
+#include "triple_buffer.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+template <size_t WordCount>
+struct Snapshot
+{
+    uint64_t words[WordCount] = {};
+};
+
+struct StressResult
+{
+    uint64_t published = 0;
+    uint64_t updates = 0;
+    uint64_t reads = 0;
+    uint64_t torn = 0;
+    uint64_t regressions = 0;
+};
+
+template <size_t WordCount>
+static StressResult stress(double a_seconds)
+{
+    TripleBuffer<Snapshot<WordCount>> buffer;
+    std::atomic<bool> running { true };
+    StressResult result;
+
+    // The writer fills the whole snapshot with its sequence number, one word
+    // at a time, so that a reader sharing its buffer sees mixed numbers.
+    std::thread writer([&]()
+    {
+        uint64_t sequence = 0;
+        while (running.load(std::memory_order_relaxed))
+        {
+            sequence++;
+            Snapshot<WordCount>& snapshot = buffer.back();
+            for (size_t i = 0; i < WordCount; i++)
+            {
+                snapshot.words[i] = sequence;
+            }
+            buffer.publish();
+        }
+        result.published = sequence;
+    });
+
+    // The reader checks the front buffer after every update, and reads it
+    // again between updates, while the writer keeps publishing.
+    std::thread reader([&]()
+    {
+        uint64_t previous = 0;
+        while (running.load(std::memory_order_relaxed))
+        {
+            if (buffer.update())
+            {
+                result.updates++;
+            }
+            const Snapshot<WordCount>& snapshot = buffer.front();
+            uint64_t sequence = snapshot.words[0];
+            for (size_t i = 1; i < WordCount; i++)
+            {
+                if (snapshot.words[i] != sequence)
+                {
+                    result.torn++;
+                    break;
+                }
+            }
+            if (sequence < previous)
+            {
+                result.regressions++;
+            }
+            previous = sequence;
+            result.reads++;
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(a_seconds));
+    running = false;
+    writer.join();
+    reader.join();
+    return result;
+}
+
+template <size_t WordCount>
+static bool report(double a_seconds)
+{
+    StressResult result = stress<WordCount>(a_seconds);
+    std::cout << std::setw(8) << WordCount * sizeof(uint64_t)
+              << std::setw(14) << result.published
+              << std::setw(14) << result.updates
+              << std::setw(14) << result.reads
+              << std::setw(8) << result.torn
+              << std::setw(8) << result.regressions << std::endl;
+    return result.torn == 0 && result.regressions == 0 && result.updates > 0;
+}
+
+int main(int argc, char* argv[])
+{
+    double seconds = 1.0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument == "--quick")
+        {
+            seconds = 0.1;
+        }
+        else if (argument.rfind("--seconds=", 0) == 0)
+        {
+            seconds = std::atof(argument.c_str() + 10);
+        }
+        else
+        {
+            std::cerr << "usage: triple_buffer_bench [--quick] [--seconds=S]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "cores: " << std::thread::hardware_concurrency() << ", " << seconds << " s per size" << std::endl
+              << std::setw(8) << "bytes" << std::setw(14) << "published" << std::setw(14) << "updates"
+              << std::setw(14) << "reads" << std::setw(8) << "torn" << std::setw(8) << "older" << std::endl;
+
+    bool passed = true;
+    passed &= report<8>(seconds);
+    passed &= report<64>(seconds);
+    passed &= report<512>(seconds);
+    if (!passed)
+    {
+        std::cerr << "torn or out of order snapshots" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,219 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Keyboard and pointer input for the device emulator, without a window.
+///
+/// On Windows, keys are read from the console with _kbhit()/_getch(), held
+/// keys with GetAsyncKeyState() and the pointer with GetCursorPos().
+///
+/// On POSIX systems, the terminal is switched to non-canonical mode without
+/// echo on first use (and restored at exit, or on SIGINT and SIGTERM before
+/// their previous handling), so that single key presses are read from stdin
+/// as they are typed. A key is reported held while the terminal keeps
+/// repeating it, and there is no pointer. The terminal is polled at most once
+/// per PollPeriod, so that a haptic loop polling input every iteration does
+/// not make a system call every iteration.
+///
+/// Not thread safe: use it from a single thread, e.g. the haptic thread.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+
+// Platform specific headers
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <conio.h>
+#include <windows.h>
+#else
+#include <csignal>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+class ConsoleInput
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// Minimum time between two reads of the terminal.
+    static constexpr std::chrono::milliseconds PollPeriod { 5 };
+
+    /// Time a key stays held after its last repeat. Terminals repeat held keys about every 30 ms.
+    static constexpr std::chrono::milliseconds KeyHoldTime { 100 };
+
+    static ConsoleInput& instance()
+    {
+        static ConsoleInput input;
+        return input;
+    }
+
+    /// Returns true if a key press is waiting to be read by getKey().
+    bool keyHit()
+    {
+#ifdef _WIN32
+        return _kbhit() != 0;
+#else
+        poll();
+        return m_queueHead != m_queueTail;
+#endif
+    }
+
+    /// Returns the next key press, or 0 if there is none.
+    int getKey()
+    {
+#ifdef _WIN32
+        return _kbhit() ? _getch() : 0;
+#else
+        poll();
+        if (m_queueHead == m_queueTail)
+        {
+            return 0;
+        }
+        return m_queue[m_queueTail++ % m_queue.size()];
+#endif
+    }
+
+    /// Returns true while the letter or digit key 'a_key' (upper case) is held down.
+    bool keyDown(char a_key)
+    {
+#ifdef _WIN32
+        return (GetAsyncKeyState(a_key) & 0x8000) != 0;
+#else
+        poll();
+        Clock::time_point pressed = m_lastPress[static_cast<unsigned char>(a_key)];
+        return pressed != Clock::time_point() && Clock::now() - pressed < KeyHoldTime;
+#endif
+    }
+
+    /// Reads the screen position of the pointer in pixels. Returns false if there is no pointer.
+    bool cursorPosition(long& a_x,
+                        long& a_y)
+    {
+#ifdef _WIN32
+        POINT position;
+        if (!GetCursorPos(&position))
+        {
+            return false;
+        }
+        a_x = position.x;
+        a_y = position.y;
+        return true;
+#else
+        (void)a_x;
+        (void)a_y;
+        return false;
+#endif
+    }
+
+private:
+    ConsoleInput() = default;
+
+#ifndef _WIN32
+    /// Moves the key presses typed since the last call into the queue.
+    void poll()
+    {
+        Clock::time_point now = Clock::now();
+        if (now - m_lastPoll < PollPeriod)
+        {
+            return;
+        }
+        m_lastPoll = now;
+
+        if (!m_terminalReady)
+        {
+            m_terminalReady = true;
+            enterRawMode();
+        }
+
+        pollfd descriptor { STDIN_FILENO, POLLIN, 0 };
+        unsigned char keys[64];
+        while (::poll(&descriptor, 1, 0) > 0 && (descriptor.revents & POLLIN))
+        {
+            ssize_t count = ::read(STDIN_FILENO, keys, sizeof(keys));
+            if (count <= 0)
+            {
+                break;
+            }
+            for (ssize_t i = 0; i < count; i++)
+            {
+                unsigned char key = keys[i];
+                m_lastPress[(key >= 'a' && key <= 'z') ? key - 'a' + 'A' : key] = now;
+                if (m_queueHead - m_queueTail < m_queue.size())
+                {
+                    m_queue[m_queueHead++ % m_queue.size()] = key;
+                }
+            }
+        }
+    }
+
+    /// Disables line buffering and echo on an interactive terminal until exit.
+    static void enterRawMode()
+    {
+        if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &savedTerminal()) != 0)
+        {
+            return;
+        }
+        termios raw = savedTerminal();
+        raw.c_lflag &= ~static_cast<tcflag_t>(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0)
+        {
+            std::atexit([]() { tcsetattr(STDIN_FILENO, TCSANOW, &savedTerminal()); });
+            restoreOnSignal(SIGINT);
+            restoreOnSignal(SIGTERM);
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function installs a handler of 'a_signal' that restores the
+    /// terminal, which atexit() handlers do not do on a fatal signal, then
+    /// reinstalls the previous handler and raises the signal again.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    static void restoreOnSignal(int a_signal)
+    {
+        struct sigaction action {};
+        action.sa_handler = [](int a_received)
+        {
+            // Only async-signal-safe calls.
+            tcsetattr(STDIN_FILENO, TCSANOW, &savedTerminal());
+            sigaction(a_received, &previousAction(a_received), nullptr);
+            raise(a_received);
+        };
+        sigemptyset(&action.sa_mask);
+        sigaction(a_signal, &action, &previousAction(a_signal));
+    }
+
+    static struct sigaction& previousAction(int a_signal)
+    {
+        static struct sigaction interrupt {};
+        static struct sigaction terminate {};
+        return (a_signal == SIGINT) ? interrupt : terminate;
+    }
+
+    static termios& savedTerminal()
+    {
+        static termios terminal;
+        return terminal;
+    }
+
+    bool m_terminalReady = false;
+    Clock::time_point m_lastPoll;
+    std::array<Clock::time_point, 256> m_lastPress {};
+    std::array<int, 64> m_queue {};
+    uint64_t m_queueHead = 0;
+    uint64_t m_queueTail = 0;
+#endif
+};
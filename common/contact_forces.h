@@ -0,0 +1,500 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Shapes and force terms composed at compile time into contact kernels.
+///
+/// A shape returns the closest point of its surface to a query point, the
+/// outward unit normal there and the signed distance (negative inside). A
+/// force term computes a force from the resulting ContactGeometry. Terms
+/// are combined with operator+ and wrapped by unilateral(), projected() and
+/// saturated(); a ContactKernel binds a shape, a force and a tool radius:
+///
+///   auto kernel = makeContactKernel(SphereShape(center, 0.03),
+///                                   unilateral(Spring(1000.0) + NormalDamper(3.0)),
+///                                   0.005);
+///   Eigen::Vector3d force = kernel.compute(toolPosition, toolVelocity);
+///
+/// Every shape and term is a concrete type and every call is inline, so
+/// the kernel of each scene compiles to a single function without virtual
+/// dispatch, as fast as the hand-written force it replaces. The scenes of
+/// the applications are built from these kernels in force_models.h.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+// Eigen library header
+#include <Eigen/Dense>
+
+// Project headers
+#include "polyline_centerline.h"
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Geometry of a tool against a shape, input of the force terms.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+struct ContactGeometry
+{
+    Eigen::Vector3d toolPosition = Eigen::Vector3d::Zero();
+    Eigen::Vector3d toolVelocity = Eigen::Vector3d::Zero();
+
+    /// Closest point of the shape surface, and outward unit normal there.
+    Eigen::Vector3d surfacePoint = Eigen::Vector3d::Zero();
+    Eigen::Vector3d normal = Eigen::Vector3d::Zero();
+
+    /// Tool radius minus the signed distance of the tool center to the
+    /// surface: positive when the tool penetrates the shape.
+    double penetration = 0.0;
+
+    /// False if the normal is undefined (e.g. at the center of a sphere);
+    /// force terms return no force then.
+    bool valid = false;
+
+    /// Returns the tool center pushed back onto the surface if it penetrates.
+    Eigen::Vector3d proxy() const
+    {
+        return (penetration > 0.0) ? Eigen::Vector3d(toolPosition + penetration * normal) : toolPosition;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Shapes
+//
+// bool closest(const Eigen::Vector3d& a_point, Eigen::Vector3d& a_surfacePoint,
+//              Eigen::Vector3d& a_normal, double& a_distance) const
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct SphereShape
+{
+    Eigen::Vector3d center = Eigen::Vector3d::Zero();
+    double radius = 0.0;
+
+    SphereShape() = default;
+
+    SphereShape(const Eigen::Vector3d& a_center,
+                double a_radius) :
+        center(a_center),
+        radius(a_radius)
+    {}
+
+    bool closest(const Eigen::Vector3d& a_point,
+                 Eigen::Vector3d& a_surfacePoint,
+                 Eigen::Vector3d& a_normal,
+                 double& a_distance) const
+    {
+        Eigen::Vector3d offset = a_point - center;
+        double norm = offset.norm();
+        if (norm <= 0.0)
+        {
+            return false;
+        }
+        a_normal = offset / norm;
+        a_surfacePoint = center + radius * a_normal;
+        a_distance = norm - radius;
+        return true;
+    }
+};
+
+/// Half-space behind the plane through 'point' of outward unit 'normal'.
+struct PlaneShape
+{
+    Eigen::Vector3d point = Eigen::Vector3d::Zero();
+    Eigen::Vector3d normal = Eigen::Vector3d::UnitZ();
+
+    PlaneShape() = default;
+
+    PlaneShape(const Eigen::Vector3d& a_point,
+               const Eigen::Vector3d& a_normal) :
+        point(a_point),
+        normal(a_normal)
+    {}
+
+    bool closest(const Eigen::Vector3d& a_point,
+                 Eigen::Vector3d& a_surfacePoint,
+                 Eigen::Vector3d& a_normal,
+                 double& a_distance) const
+    {
+        a_distance = (a_point - point).dot(normal);
+        a_normal = normal;
+        a_surfacePoint = a_point - a_distance * normal;
+        return true;
+    }
+};
+
+/// Torus of axis z centered at the origin.
+struct TorusShape
+{
+    /// Points closer to the medial circle than this in [m] have no normal.
+    static constexpr double MinCoreDistance = 0.001;
+
+    /// Radius of the medial circle and of the tube in [m].
+    double outerRadius = 0.0;
+    double innerRadius = 0.0;
+
+    TorusShape() = default;
+
+    TorusShape(double a_outerRadius,
+               double a_innerRadius) :
+        outerRadius(a_outerRadius),
+        innerRadius(a_innerRadius)
+    {}
+
+    bool closest(const Eigen::Vector3d& a_point,
+                 Eigen::Vector3d& a_surfacePoint,
+                 Eigen::Vector3d& a_normal,
+                 double& a_distance) const
+    {
+        // Nearest point of the medial circle, through the projection onto the torus plane.
+        if (a_point.squaredNorm() <= 1e-10)
+        {
+            return false;
+        }
+        Eigen::Vector3d projection(a_point(0), a_point(1), 0.0);
+        Eigen::Vector3d axisPoint = outerRadius * projection.normalized();
+
+        Eigen::Vector3d offset = a_point - axisPoint;
+        double coreDistance = offset.norm();
+        if (coreDistance <= MinCoreDistance)
+        {
+            return false;
+        }
+        a_normal = offset / coreDistance;
+        a_surfacePoint = axisPoint + innerRadius * a_normal;
+        a_distance = coreDistance - innerRadius;
+        return true;
+    }
+};
+
+/// Segment A-B, a capsule of null radius.
+struct SegmentShape
+{
+    Eigen::Vector3d a = Eigen::Vector3d::Zero();
+    Eigen::Vector3d b = Eigen::Vector3d::Zero();
+
+    SegmentShape() = default;
+
+    SegmentShape(const Eigen::Vector3d& a_a,
+                 const Eigen::Vector3d& a_b) :
+        a(a_a),
+        b(a_b)
+    {}
+
+    bool closest(const Eigen::Vector3d& a_point,
+                 Eigen::Vector3d& a_surfacePoint,
+                 Eigen::Vector3d& a_normal,
+                 double& a_distance) const
+    {
+        Eigen::Vector3d segment = b - a;
+        double lengthSquared = segment.squaredNorm();
+        double ratio = (lengthSquared > 0.0) ? std::clamp((a_point - a).dot(segment) / lengthSquared, 0.0, 1.0) : 0.0;
+        a_surfacePoint = a + ratio * segment;
+        return normalFromSurfacePoint(a_point, a_surfacePoint, a_normal, a_distance);
+    }
+
+    /// Normal and distance of 'a_point' to its closest point of a curve; undefined on the curve.
+    static bool normalFromSurfacePoint(const Eigen::Vector3d& a_point,
+                                       const Eigen::Vector3d& a_surfacePoint,
+                                       Eigen::Vector3d& a_normal,
+                                       double& a_distance)
+    {
+        Eigen::Vector3d offset = a_point - a_surfacePoint;
+        a_distance = offset.norm();
+        if (a_distance <= 1e-6)
+        {
+            return false;
+        }
+        a_normal = offset / a_distance;
+        return true;
+    }
+};
+
+/// Polyline centerline, searched with its warm start (not thread safe).
+struct CenterlineShape
+{
+    PolylineCenterline* centerline = nullptr;
+
+    CenterlineShape() = default;
+
+    explicit CenterlineShape(PolylineCenterline& a_centerline) :
+        centerline(&a_centerline)
+    {}
+
+    bool closest(const Eigen::Vector3d& a_point,
+                 Eigen::Vector3d& a_surfacePoint,
+                 Eigen::Vector3d& a_normal,
+                 double& a_distance) const
+    {
+        if (centerline->segmentCount() == 0)
+        {
+            return false;
+        }
+        centerline->project(a_point.data(), a_surfacePoint.data());
+        return SegmentShape::normalFromSurfacePoint(a_point, a_surfacePoint, a_normal, a_distance);
+    }
+};
+
+/// Signed distance field sampled through 'double sample(const double[3], double a_gradient[3]) const'.
+template <typename Field>
+struct FieldShape
+{
+    const Field* field = nullptr;
+
+    FieldShape() = default;
+
+    explicit FieldShape(const Field& a_field) :
+        field(&a_field)
+    {}
+
+    bool closest(const Eigen::Vector3d& a_point,
+                 Eigen::Vector3d& a_surfacePoint,
+                 Eigen::Vector3d& a_normal,
+                 double& a_distance) const
+    {
+        Eigen::Vector3d gradient;
+        a_distance = field->sample(a_point.data(), gradient.data());
+        double norm = gradient.norm();
+        if (norm <= 1e-6)
+        {
+            return false;
+        }
+        a_normal = gradient / norm;
+        a_surfacePoint = a_point - a_distance * a_normal;
+        return true;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Force terms
+//
+// Eigen::Vector3d compute(const ContactGeometry& a_contact) const
+//
+// Terms derive from ForceTerm, which enables operator+. Unless wrapped by
+// unilateral(), they apply whether or not the tool penetrates the shape,
+// e.g. to pull a tool towards a curve.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct ForceTerm {};
+
+template <typename Term>
+using IsForceTerm = std::is_base_of<ForceTerm, Term>;
+
+/// Penalty spring along the normal: stiffness * penetration, in [N/m].
+struct Spring : ForceTerm
+{
+    double stiffness;
+
+    explicit Spring(double a_stiffness) :
+        stiffness(a_stiffness)
+    {}
+
+    Eigen::Vector3d compute(const ContactGeometry& a_contact) const
+    {
+        return (stiffness * a_contact.penetration) * a_contact.normal;
+    }
+};
+
+/// Viscous damping of the normal tool velocity, in [N/(m/s)].
+struct NormalDamper : ForceTerm
+{
+    double damping;
+
+    explicit NormalDamper(double a_damping) :
+        damping(a_damping)
+    {}
+
+    Eigen::Vector3d compute(const ContactGeometry& a_contact) const
+    {
+        return (-damping * a_contact.toolVelocity.dot(a_contact.normal)) * a_contact.normal;
+    }
+};
+
+/// Viscous damping of the tool velocity, in [N/(m/s)].
+struct Damper : ForceTerm
+{
+    double damping;
+
+    explicit Damper(double a_damping) :
+        damping(a_damping)
+    {}
+
+    Eigen::Vector3d compute(const ContactGeometry& a_contact) const
+    {
+        return -damping * a_contact.toolVelocity;
+    }
+};
+
+template <typename First, typename Second>
+struct SumTerm : ForceTerm
+{
+    First first;
+    Second second;
+
+    SumTerm(const First& a_first,
+            const Second& a_second) :
+        first(a_first),
+        second(a_second)
+    {}
+
+    Eigen::Vector3d compute(const ContactGeometry& a_contact) const
+    {
+        return first.compute(a_contact) + second.compute(a_contact);
+    }
+};
+
+/// Only applies while the tool penetrates, and never pulls the tool into the shape.
+template <typename Term>
+struct UnilateralTerm : ForceTerm
+{
+    Term term;
+
+    explicit UnilateralTerm(const Term& a_term) :
+        term(a_term)
+    {}
+
+    Eigen::Vector3d compute(const ContactGeometry& a_contact) const
+    {
+        if (a_contact.penetration <= 0.0)
+        {
+            return Eigen::Vector3d::Zero();
+        }
+        Eigen::Vector3d force = term.compute(a_contact);
+        double normalForce = force.dot(a_contact.normal);
+        return (normalForce < 0.0) ? Eigen::Vector3d(force - normalForce * a_contact.normal) : force;
+    }
+};
+
+/// Keeps the normal component only, e.g. to remove the damping along a guide.
+template <typename Term>
+struct ProjectedTerm : ForceTerm
+{
+    Term term;
+
+    explicit ProjectedTerm(const Term& a_term) :
+        term(a_term)
+    {}
+
+    Eigen::Vector3d compute(const ContactGeometry& a_contact) const
+    {
+        return term.compute(a_contact).dot(a_contact.normal) * a_contact.normal;
+    }
+};
+
+/// Clamps the force magnitude to 'maxForce' in [N], e.g. the device limit.
+template <typename Term>
+struct SaturatedTerm : ForceTerm
+{
+    Term term;
+    double maxForce;
+
+    SaturatedTerm(const Term& a_term,
+                  double a_maxForce) :
+        term(a_term),
+        maxForce(a_maxForce)
+    {}
+
+    Eigen::Vector3d compute(const ContactGeometry& a_contact) const
+    {
+        Eigen::Vector3d force = term.compute(a_contact);
+        double squaredNorm = force.squaredNorm();
+        return (squaredNorm > maxForce * maxForce) ? Eigen::Vector3d(force * (maxForce / std::sqrt(squaredNorm))) : force;
+    }
+};
+
+template <typename First, typename Second,
+          typename = std::enable_if_t<IsForceTerm<First>::value && IsForceTerm<Second>::value>>
+SumTerm<First, Second> operator+(const First& a_first,
+                                 const Second& a_second)
+{
+    return SumTerm<First, Second>(a_first, a_second);
+}
+
+template <typename Term>
+UnilateralTerm<Term> unilateral(const Term& a_term)
+{
+    return UnilateralTerm<Term>(a_term);
+}
+
+template <typename Term>
+ProjectedTerm<Term> projected(const Term& a_term)
+{
+    return ProjectedTerm<Term>(a_term);
+}
+
+template <typename Term>
+SaturatedTerm<Term> saturated(const Term& a_term,
+                              double a_maxForce)
+{
+    return SaturatedTerm<Term>(a_term, a_maxForce);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// A spherical tool of radius 'toolRadius' against 'shape', under 'force'.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Shape, typename Force>
+struct ContactKernel
+{
+    Shape shape;
+    Force force;
+    double toolRadius;
+
+    ContactKernel(const Shape& a_shape,
+                  const Force& a_force,
+                  double a_toolRadius) :
+        shape(a_shape),
+        force(a_force),
+        toolRadius(a_toolRadius)
+    {}
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function returns the force applied on a tool at 'a_toolPosition',
+    /// moving at 'a_toolVelocity'. 'a_contact' receives the contact geometry
+    /// (e.g. for the proxy or the closest surface point).
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    Eigen::Vector3d compute(const Eigen::Vector3d& a_toolPosition,
+                            const Eigen::Vector3d& a_toolVelocity,
+                            ContactGeometry& a_contact) const
+    {
+        a_contact.toolPosition = a_toolPosition;
+        a_contact.toolVelocity = a_toolVelocity;
+        double distance = 0.0;
+        a_contact.valid = shape.closest(a_toolPosition, a_contact.surfacePoint, a_contact.normal, distance);
+        if (!a_contact.valid)
+        {
+            a_contact.penetration = 0.0;
+            return Eigen::Vector3d::Zero();
+        }
+        a_contact.penetration = toolRadius - distance;
+        return force.compute(a_contact);
+    }
+
+    Eigen::Vector3d compute(const Eigen::Vector3d& a_toolPosition,
+                            const Eigen::Vector3d& a_toolVelocity = Eigen::Vector3d::Zero()) const
+    {
+        ContactGeometry contact;
+        return compute(a_toolPosition, a_toolVelocity, contact);
+    }
+};
+
+template <typename Shape, typename Force>
+ContactKernel<Shape, Force> makeContactKernel(const Shape& a_shape,
+                                              const Force& a_force,
+                                              double a_toolRadius)
+{
+    return ContactKernel<Shape, Force>(a_shape, a_force, a_toolRadius);
+}
@@ -0,0 +1,51 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Local surface patch of a moving shape, exchanged between a slow physics
+/// thread and a fast haptic loop.
+///
+/// The physics thread steps the scene dynamics at its own rate and, for each
+/// tool, publishes the tangent plane of the nearest surface point with the
+/// velocity of that point. The haptic loop renders forces against the plane,
+/// moved along its velocity since the patch was computed, so its cost does
+/// not depend on the scene dynamics and the force stays continuous between
+/// physics steps. The plane is a first order approximation of the surface,
+/// accurate while the tool stays close to the patch point, i.e. as long as
+/// the tool moves little during one physics period.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+
+// Eigen library header
+#include <Eigen/Dense>
+
+// Project headers
+#include "contact_forces.h"
+
+struct ContactPatch
+{
+    /// Patches older than this in [s] are not moved any further, in case the
+    /// physics thread stalls.
+    static constexpr double MaxExtrapolation = 0.01;
+
+    /// Nearest surface point, outward unit normal and velocity of the surface
+    /// point in [m/s], at 'time' in [s] on the haptic loop clock.
+    Eigen::Vector3d point = Eigen::Vector3d::Zero();
+    Eigen::Vector3d normal = Eigen::Vector3d::UnitZ();
+    Eigen::Vector3d velocity = Eigen::Vector3d::Zero();
+    double time = 0.0;
+
+    /// False if no surface point could be found (e.g. on the torus medial
+    /// circle); the haptic loop renders no force then.
+    bool valid = false;
+
+    /// Returns the tangent plane moved to 'a_time'.
+    PlaneShape planeAt(double a_time) const
+    {
+        double elapsed = std::clamp(a_time - time, 0.0, MaxExtrapolation);
+        return PlaneShape(point + elapsed * velocity, normal);
+    }
+};
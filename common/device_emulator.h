@@ -0,0 +1,488 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Scripted haptic device emulator used by the dhdc.cpp stub.
+///
+/// The emulator replaces the physical device with a deterministic trajectory
+/// that advances on a fixed virtual clock: one device tick per force command
+/// sent to the device, independently of wall time. This makes every run
+/// reproducible and lets the haptic loops run at full speed without a desk,
+/// a mouse or a window.
+///
+/// The emulator is configured through environment variables read when the
+/// device is opened:
+///
+///   DHD_EMULATOR           mouse | sine | random | approach | file:<path>
+///                          (default: mouse on Windows, sine elsewhere;
+///                          without a pointer, mouse mode is driven by the
+///                          W/S, A/D and R/F keys typed in the terminal)
+///   DHD_EMULATOR_RATE      virtual clock rate in [Hz], 1000 to 10000
+///                          (default: 1000)
+///   DHD_EMULATOR_DURATION  virtual duration in [s] after which the device
+///                          reports the end of the trajectory (default: 0,
+///                          meaning endless for generators)
+///   DHD_EMULATOR_SEED      random walk seed, 0 mapped to a non-zero
+///                          generator state (default: 1)
+///   DHD_EMULATOR_DEVICES   number of emulated devices, 1 to MaxDevices
+///                          (default: 1)
+///
+/// With several devices, generated trajectories are shifted in time by
+/// DeviceTimeOffset per device index, random walks use one seed per device,
+/// and trajectory files are replayed identically on every device. The
+/// virtual clock advances on force commands sent to device 0 only, so that
+/// a loop servicing N devices still advances it once per iteration.
+///
+/// Trajectory files contain one sample per virtual tick, one per line:
+///
+///   x y z [vx vy vz [buttons]]
+///
+/// Positions are in [m], velocities in [m/s], and buttons is a bit mask.
+/// Either every line or no line gives velocities; missing velocities are
+/// computed by finite differences. Lines starting with '#' are ignored.
+///
+/// Once the trajectory is finished, dhdGetPosition() fails with an error and
+/// dhdKbHit()/dhdKbGet() report a 'q' key press so that every loop exits.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct EmulatedSample
+{
+    double position[3] = {};
+    double velocity[3] = {};
+    int buttons = 0;
+};
+
+class DeviceEmulator
+{
+public:
+    enum class Mode
+    {
+        Mouse,
+        Sine,
+        RandomWalk,
+        Approach,
+        File
+    };
+
+    /// Minimum and maximum virtual clock rate in [Hz].
+    static constexpr double MinRate = 1000.0;
+    static constexpr double MaxRate = 10000.0;
+
+    /// Maximum number of emulated devices.
+    static constexpr int MaxDevices = 16;
+
+    /// Time shift between the generated trajectories of successive devices in [s].
+    static constexpr double DeviceTimeOffset = 0.25;
+
+    /// Random walk generator state used in place of a zero seed.
+    static constexpr uint64_t ZeroSeedState = 0x9E3779B97F4A7C15ULL;
+
+    static DeviceEmulator& instance()
+    {
+        static DeviceEmulator emulator;
+        return emulator;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function reads the emulator configuration from the environment and
+    /// resets the virtual clock. It returns false if the configuration is
+    /// invalid (e.g. a trajectory file that cannot be read).
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool open()
+    {
+        m_tick = 0;
+        m_finished = false;
+        m_lastError = "No error";
+
+#ifdef _WIN32
+        m_mode = Mode::Mouse;
+#else
+        m_mode = Mode::Sine;
+#endif
+        std::string mode = readEnvironment("DHD_EMULATOR", "");
+        if (mode == "mouse")
+        {
+            m_mode = Mode::Mouse;
+        }
+        else if (mode == "sine")
+        {
+            m_mode = Mode::Sine;
+        }
+        else if (mode == "random")
+        {
+            m_mode = Mode::RandomWalk;
+        }
+        else if (mode == "approach")
+        {
+            m_mode = Mode::Approach;
+        }
+        else if (mode.rfind("file:", 0) == 0)
+        {
+            m_mode = Mode::File;
+            if (!loadTrajectory(mode.substr(5)))
+            {
+                return false;
+            }
+        }
+        else if (!mode.empty())
+        {
+            m_lastError = "unknown DHD_EMULATOR mode";
+            return false;
+        }
+
+        m_rate = std::clamp(std::atof(readEnvironment("DHD_EMULATOR_RATE", "1000").c_str()), MinRate, MaxRate);
+        m_duration = std::max(0.0, std::atof(readEnvironment("DHD_EMULATOR_DURATION", "0").c_str()));
+        m_seed = std::strtoull(readEnvironment("DHD_EMULATOR_SEED", "1").c_str(), nullptr, 10);
+        int deviceCount = std::clamp(std::atoi(readEnvironment("DHD_EMULATOR_DEVICES", "1").c_str()), 1, MaxDevices);
+        m_devices.assign(deviceCount, DeviceState {});
+        for (int i = 0; i < deviceCount; i++)
+        {
+            // xorshift stays at zero from a zero state.
+            m_devices[i].random = (m_seed + i != 0) ? m_seed + i : ZeroSeedState;
+        }
+
+        m_open = true;
+        return true;
+    }
+
+    bool isOpen() const
+    {
+        return m_open;
+    }
+
+    /// Returns the number of emulated devices.
+    int deviceCount() const
+    {
+        return static_cast<int>(m_devices.size());
+    }
+
+    /// Returns true if positions are scripted rather than read from the mouse.
+    bool isScripted() const
+    {
+        return m_mode != Mode::Mouse;
+    }
+
+    /// Returns true once the scripted trajectory has been fully played.
+    bool isFinished() const
+    {
+        return m_finished;
+    }
+
+    double rate() const
+    {
+        return m_rate;
+    }
+
+    /// Returns the virtual time in [s].
+    double time() const
+    {
+        return static_cast<double>(m_tick) / m_rate;
+    }
+
+    const char* lastError() const
+    {
+        return m_lastError;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function returns the state of device 'a_device' at the current
+    /// virtual tick. It returns false once the trajectory is finished, or if
+    /// the device does not exist.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool sample(EmulatedSample& a_sample,
+                int a_device = 0)
+    {
+        if (a_device < 0 || a_device >= deviceCount())
+        {
+            m_lastError = "invalid emulated device ID";
+            return false;
+        }
+
+        DeviceState& device = m_devices[a_device];
+        if (!device.hasSample || device.sampledTick != m_tick)
+        {
+            if (!evaluate(m_tick, a_device, device.current))
+            {
+                m_finished = true;
+                m_lastError = "emulated trajectory finished";
+                return false;
+            }
+            device.sampledTick = m_tick;
+            device.hasSample = true;
+        }
+
+        a_sample = device.current;
+        return true;
+    }
+
+    /// Advances the virtual clock by one device tick on commands to device 0.
+    void step(int a_device = 0)
+    {
+        if (a_device == 0)
+        {
+            m_tick++;
+        }
+    }
+
+    /// Advances the virtual clock until time() reaches 'a_time' in [s], e.g. once per rendered frame.
+    void advanceTo(double a_time)
+    {
+        while (time() < a_time)
+        {
+            m_tick++;
+        }
+    }
+
+private:
+    DeviceEmulator() = default;
+
+    static std::string readEnvironment(const char* a_name,
+                                       const char* a_default)
+    {
+        const char* value = std::getenv(a_name);
+        return (value != nullptr) ? std::string(value) : std::string(a_default);
+    }
+
+    bool loadTrajectory(const std::string& a_path)
+    {
+        std::ifstream file(a_path);
+        if (!file)
+        {
+            m_lastError = "cannot open emulator trajectory file";
+            return false;
+        }
+
+        m_trajectory.clear();
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+
+            std::istringstream stream(line);
+            EmulatedSample sample;
+            if (!(stream >> sample.position[0] >> sample.position[1] >> sample.position[2]))
+            {
+                continue;
+            }
+
+            // Mark missing velocities with NaN, they are filled in below.
+            if (!(stream >> sample.velocity[0] >> sample.velocity[1] >> sample.velocity[2]))
+            {
+                sample.velocity[0] = sample.velocity[1] = sample.velocity[2] = NAN;
+            }
+            stream >> sample.buttons;
+            m_trajectory.push_back(sample);
+        }
+
+        if (m_trajectory.empty())
+        {
+            m_lastError = "empty emulator trajectory file";
+            return false;
+        }
+
+        // Decide on the whole file, a velocity column may not come and go.
+        size_t withVelocity = std::count_if(m_trajectory.begin(), m_trajectory.end(),
+                                            [](const EmulatedSample& a_sample) { return !std::isnan(a_sample.velocity[0]); });
+        if (withVelocity != 0 && withVelocity != m_trajectory.size())
+        {
+            m_lastError = "emulator trajectory file mixes lines with and without velocities";
+            return false;
+        }
+        m_fileHasVelocity = (withVelocity != 0);
+        return true;
+    }
+
+    struct DeviceState
+    {
+        uint64_t random = 1;
+        uint64_t sampledTick = 0;
+        bool hasSample = false;
+        EmulatedSample current;
+        EmulatedSample randomWalk;
+        uint64_t randomWalkTick = 0;
+    };
+
+    /// Returns a uniform deviate in [-1, 1] from a platform independent generator.
+    static double nextUniform(uint64_t& a_state)
+    {
+        // xorshift64*, so that a given seed yields the same walk everywhere.
+        a_state ^= a_state >> 12;
+        a_state ^= a_state << 25;
+        a_state ^= a_state >> 27;
+        uint64_t bits = (a_state * 2685821657736338717ULL) >> 11;
+        return 2.0 * (static_cast<double>(bits) / 9007199254740992.0) - 1.0;
+    }
+
+    bool evaluate(uint64_t a_tick,
+                  int a_device,
+                  EmulatedSample& a_sample)
+    {
+        double t = static_cast<double>(a_tick) / m_rate;
+        if (m_duration > 0.0 && t >= m_duration)
+        {
+            return false;
+        }
+        t += a_device * DeviceTimeOffset;
+        DeviceState& device = m_devices[a_device];
+
+        switch (m_mode)
+        {
+            case Mode::Mouse:
+            {
+                return true;
+            }
+
+            case Mode::Sine:
+            {
+                // Linear chirp from 0.2 Hz to 5 Hz over 20 s on each axis, with
+                // phase offsets so that the tool sweeps a 3D volume around the origin.
+                constexpr double Amplitude = 0.05;
+                constexpr double StartFrequency = 0.2;
+                constexpr double EndFrequency = 5.0;
+                constexpr double SweepPeriod = 20.0;
+                constexpr double Phase[3] = { 0.0, 0.5 * M_PI, 0.25 * M_PI };
+                constexpr double Scale[3] = { 1.0, 0.7, 0.5 };
+
+                double ts = std::fmod(t, SweepPeriod);
+                double k = (EndFrequency - StartFrequency) / SweepPeriod;
+                double angle = 2.0 * M_PI * (StartFrequency * ts + 0.5 * k * ts * ts);
+                double angularRate = 2.0 * M_PI * (StartFrequency + k * ts);
+                for (int i = 0; i < 3; i++)
+                {
+                    double frequencyScale = 1.0 + 0.1 * i;
+                    a_sample.position[i] = Amplitude * Scale[i] * std::sin(frequencyScale * angle + Phase[i]);
+                    a_sample.velocity[i] = Amplitude * Scale[i] * frequencyScale * angularRate * std::cos(frequencyScale * angle + Phase[i]);
+                }
+                a_sample.buttons = 0;
+                return true;
+            }
+
+            case Mode::RandomWalk:
+            {
+                // Random acceleration with a weak spring towards the origin and some
+                // damping, bounded to the device workspace.
+                constexpr double Acceleration = 20.0;
+                constexpr double Stiffness = 25.0;
+                constexpr double Damping = 2.0;
+                constexpr double WorkspaceRadius = 0.08;
+
+                double dt = 1.0 / m_rate;
+                while (device.randomWalkTick < a_tick)
+                {
+                    for (int i = 0; i < 3; i++)
+                    {
+                        double& p = device.randomWalk.position[i];
+                        double& v = device.randomWalk.velocity[i];
+                        v += dt * (Acceleration * nextUniform(device.random) - Stiffness * p - Damping * v);
+                        p += dt * v;
+                        if (std::abs(p) > WorkspaceRadius)
+                        {
+                            p = std::copysign(WorkspaceRadius, p);
+                            v = 0.0;
+                        }
+                    }
+                    device.randomWalkTick++;
+                }
+                a_sample = device.randomWalk;
+                return true;
+            }
+
+            case Mode::Approach:
+            {
+                // Approach the origin along x, penetrate, dwell and retract, with the
+                // button held while in contact. Each cycle lasts 2 s.
+                constexpr double StartDistance = 0.1;
+                constexpr double EndDistance = 0.015;
+                constexpr double MoveTime = 0.8;
+                constexpr double DwellTime = 0.2;
+                constexpr double CycleTime = 2.0 * MoveTime + 2.0 * DwellTime;
+
+                double tc = std::fmod(t, CycleTime);
+                double x = StartDistance;
+                double vx = 0.0;
+                double speed = (StartDistance - EndDistance) / MoveTime;
+                if (tc < MoveTime)
+                {
+                    x = StartDistance - speed * tc;
+                    vx = -speed;
+                }
+                else if (tc < MoveTime + DwellTime)
+                {
+                    x = EndDistance;
+                }
+                else if (tc < 2.0 * MoveTime + DwellTime)
+                {
+                    x = EndDistance + speed * (tc - MoveTime - DwellTime);
+                    vx = speed;
+                }
+
+                a_sample.position[0] = x;
+                a_sample.position[1] = 0.0;
+                a_sample.position[2] = 0.0;
+                a_sample.velocity[0] = vx;
+                a_sample.velocity[1] = 0.0;
+                a_sample.velocity[2] = 0.0;
+                a_sample.buttons = (x < 0.04) ? 1 : 0;
+                return true;
+            }
+
+            case Mode::File:
+            {
+                if (a_tick >= m_trajectory.size())
+                {
+                    return false;
+                }
+
+                a_sample = m_trajectory[a_tick];
+                if (!m_fileHasVelocity)
+                {
+                    const EmulatedSample& previous = m_trajectory[(a_tick > 0) ? a_tick - 1 : 0];
+                    for (int i = 0; i < 3; i++)
+                    {
+                        a_sample.velocity[i] = (a_sample.position[i] - previous.position[i]) * m_rate;
+                    }
+                }
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+#ifdef _WIN32
+    Mode m_mode = Mode::Mouse;
+#else
+    Mode m_mode = Mode::Sine;
+#endif
+    double m_rate = 1000.0;
+    double m_duration = 0.0;
+    uint64_t m_seed = 1;
+    uint64_t m_tick = 0;
+    bool m_open = false;
+    bool m_finished = false;
+    const char* m_lastError = "No error";
+    std::vector<DeviceState> m_devices = std::vector<DeviceState>(1);
+    std::vector<EmulatedSample> m_trajectory;
+    bool m_fileHasVelocity = true;
+};
@@ -0,0 +1,463 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Force models of the haptic examples.
+///
+/// The contact and guidance forces of sphere.cpp, torus.cpp, the haptic
+/// services and the tube simulator, with no device, window or clock: every
+/// input (tool position, velocity, time step) is passed in. The applications
+/// and the offline replay tool (tools/telemetry_replay.cpp) run the same
+/// code, so a force model can be regression tested on recorded sessions.
+///
+/// Each model is a set of named parameters over a contact kernel of
+/// contact_forces.h, built inline at every call.
+///
+/// Default parameters are those of the applications.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <cmath>
+#include <vector>
+
+// Eigen library header
+#include <Eigen/Dense>
+
+// Project headers
+#include "contact_forces.h"
+#include "contact_patch.h"
+#include "obstacle_scene.h"
+#include "polyline_centerline.h"
+#include "rigid_body.h"
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Penalty contact between a spherical tool and a fixed sphere (sphere.cpp
+/// and the haptic services).
+///
+////////////////////////////////////////////////////////////////////////////////
+
+struct SphereContactModel
+{
+    Eigen::Vector3d position = Eigen::Vector3d::Zero();
+
+    /// Sphere and tool radii in [m].
+    double radius = 0.03;
+    double toolRadius = 0.005;
+
+    /// Contact stiffness in [N/m].
+    double stiffness = 1000.0;
+
+    /// Contact damping in [N/(m/s)], applied along the normal while penetrating.
+    double damping = 3.0;
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function returns the force applied on a tool at 'a_toolPosition',
+    /// moving at 'a_toolVelocity'. The damping term only slows the tool down
+    /// and never pulls it into the sphere.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    Eigen::Vector3d computeForce(const Eigen::Vector3d& a_toolPosition,
+                                 const Eigen::Vector3d& a_toolVelocity = Eigen::Vector3d::Zero()) const
+    {
+        return makeContactKernel(SphereShape(position, radius),
+                                 unilateral(Spring(stiffness) + NormalDamper(damping)),
+                                 toolRadius).compute(a_toolPosition, a_toolVelocity);
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Penalty contact between a spherical tool and a scene of many spherical
+/// obstacles (sphere.cpp --obstacles). The broad phase of the scene selects
+/// the obstacles the tool touches, and only those run the contact kernel, so
+/// the cost depends on the number of contacts rather than on the scene size.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+struct ObstacleContactModel
+{
+    /// Obstacles, whose grid cells grow with the reach of the tool. Call
+    /// scene.setQueryRadius() after changing the tool radius.
+    ObstacleScene scene;
+
+    /// Tool radius in [m].
+    double toolRadius = 0.005;
+
+    /// Contact stiffness in [N/m].
+    double stiffness = 1000.0;
+
+    /// Contact damping in [N/(m/s)], applied along the normal while penetrating.
+    double damping = 3.0;
+
+    ObstacleContactModel()
+    {
+        scene.setQueryRadius(toolRadius);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function returns the sum of the forces applied by the obstacles
+    /// on a tool at 'a_toolPosition', moving at 'a_toolVelocity'. If given,
+    /// 'a_contactCount' receives the number of obstacles in contact.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    Eigen::Vector3d computeForce(const Eigen::Vector3d& a_toolPosition,
+                                 const Eigen::Vector3d& a_toolVelocity = Eigen::Vector3d::Zero(),
+                                 size_t* a_contactCount = nullptr) const
+    {
+        Eigen::Vector3d force = Eigen::Vector3d::Zero();
+        size_t count = scene.query(a_toolPosition, toolRadius, [&](size_t a_index)
+        {
+            force += makeContactKernel(SphereShape(scene.center(a_index), scene.radius(a_index)),
+                                       unilateral(Spring(stiffness) + NormalDamper(damping)),
+                                       toolRadius).compute(a_toolPosition, a_toolVelocity);
+        });
+        if (a_contactCount != nullptr)
+        {
+            *a_contactCount = count;
+        }
+        return force;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Contacts of a tool made of many spheres (e.g. sampled along a long
+/// instrument) with the obstacles of 'model', as a batch of a TaskPool of
+/// task_pool.h: one item per tool sphere.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+struct ObstacleContactBatch
+{
+    struct Result
+    {
+        Eigen::Vector3d force = Eigen::Vector3d::Zero();
+        size_t contactCount = 0;
+
+        Result& operator+=(const Result& a_other)
+        {
+            force += a_other.force;
+            contactCount += a_other.contactCount;
+            return *this;
+        }
+    };
+
+    const ObstacleContactModel* model = nullptr;
+
+    /// Positions and velocities of the tool spheres, of radius model->toolRadius.
+    std::vector<Eigen::Vector3d> toolPositions;
+    std::vector<Eigen::Vector3d> toolVelocities;
+
+    size_t size() const
+    {
+        return toolPositions.size();
+    }
+
+    void compute(size_t a_begin,
+                 size_t a_end,
+                 Result& a_partial) const
+    {
+        for (size_t i = a_begin; i < a_end; i++)
+        {
+            size_t count = 0;
+            a_partial.force += model->computeForce(toolPositions[i], toolVelocities[i], &count);
+            a_partial.contactCount += count;
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Penalty contact between spherical tools and a torus free to rotate about
+/// its center (torus.cpp). The torus axis is the local z axis.
+///
+/// One simulation step is: computeForce() and applyReaction() for every
+/// tool, stop() if requested, then integrate().
+///
+/// Split across a physics thread and a haptic loop, the physics thread
+/// runs applyImpulse() with the reactions accumulated by the haptic loop,
+/// integrate(), then computePatch() for every tool; the haptic loop runs
+/// computePatchForce() and reactionImpulse() against the latest patches.
+///
+/// The torus is a rigid body pinned at its center, integrated at a fixed
+/// step whatever the time steps passed to integrate(). Call setPose() after
+/// changing its mass, damping or radii.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+struct TorusContactModel
+{
+    /// Torus pose, advanced by integrate() and set by setPose(). 'rotation'
+    /// is the orientation of 'body', as a matrix for the contact computations.
+    Eigen::Vector3d position = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+
+    /// Radius of the medial circle and of the tube in [m].
+    double outerRadius = 0.05;
+    double innerRadius = 0.027;
+    double toolRadius = 0.005;
+
+    /// Contact stiffness in [N/m].
+    double stiffness = 1000.0;
+
+    /// Contact damping in [N/(m/s)], applied along the normal while penetrating.
+    double contactDamping = 3.0;
+
+    /// Mass of the torus in [kg], and damping of its rotation in [1/s].
+    double mass = 330.0;
+    double damping = 1.0;
+
+    /// Rotation dynamics of the torus, and the fixed step they are integrated at.
+    RigidBody body;
+    FixedStepAccumulator stepper { 1e-3 };
+
+    TorusContactModel()
+    {
+        setPose(position, rotation);
+    }
+
+    /// Places the torus at rest at 'a_position' with 'a_rotation'.
+    void setPose(const Eigen::Vector3d& a_position,
+                 const Eigen::Matrix3d& a_rotation)
+    {
+        position = a_position;
+        rotation = a_rotation;
+        body.position = a_position;
+        body.setOrientation(Eigen::Quaterniond(a_rotation));
+        body.angularDamping = damping;
+        body.setMass(0.0, RigidBody::torusInertia(mass, outerRadius, innerRadius));
+        body.stop();
+        stepper.reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function computes the contact force between the torus and a tool
+    /// at 'a_toolPosition', moving at 'a_toolVelocity', in world coordinates.
+    /// 'a_toolProxy' receives the tool position constrained to the torus
+    /// surface. The damping term uses the tool velocity alone, the rotation
+    /// of the torus being slow in comparison.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    Eigen::Vector3d computeForce(const Eigen::Vector3d& a_toolPosition,
+                                 Eigen::Vector3d& a_toolProxy,
+                                 const Eigen::Vector3d& a_toolVelocity = Eigen::Vector3d::Zero()) const
+    {
+        // Compute the contact in the local coordinates of the torus; the inverse
+        // rotation is evaluated once rather than transposed in each product.
+        const Eigen::Matrix3d inverseRotation = rotation.transpose();
+        ContactGeometry contact;
+        Eigen::Vector3d forceLocal = makeContactKernel(TorusShape(outerRadius, innerRadius),
+                                                       unilateral(Spring(stiffness) + NormalDamper(contactDamping)),
+                                                       toolRadius).compute(inverseRotation * (a_toolPosition - position),
+                                                                           inverseRotation * a_toolVelocity,
+                                                                           contact);
+        a_toolProxy = position + rotation * contact.proxy();
+        return rotation * forceLocal;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function returns the surface patch of the torus nearest to a tool
+    /// at 'a_toolPosition', for the pose reached by integrate() up to
+    /// 'a_time'. The pose lags 'a_time' by the time left over by the fixed
+    /// step, which the patch time accounts for.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    ContactPatch computePatch(const Eigen::Vector3d& a_toolPosition,
+                              double a_time) const
+    {
+        ContactPatch patch;
+        patch.time = a_time - stepper.remainder();
+        Eigen::Vector3d localPoint;
+        Eigen::Vector3d localNormal;
+        double distance = 0.0;
+        patch.valid = TorusShape(outerRadius, innerRadius).closest(rotation.transpose() * (a_toolPosition - position),
+                                                                   localPoint, localNormal, distance);
+        if (patch.valid)
+        {
+            patch.point = position + rotation * localPoint;
+            patch.normal = rotation * localNormal;
+            patch.velocity = body.angularVelocity.cross(patch.point - position);
+        }
+        return patch;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function computes the contact force between 'a_patch', at
+    /// 'a_time', and a tool at 'a_toolPosition' moving at 'a_toolVelocity',
+    /// with the same parameters as computeForce(). The damping term uses the
+    /// tool velocity relative to the patch.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    Eigen::Vector3d computePatchForce(const ContactPatch& a_patch,
+                                      double a_time,
+                                      const Eigen::Vector3d& a_toolPosition,
+                                      Eigen::Vector3d& a_toolProxy,
+                                      const Eigen::Vector3d& a_toolVelocity = Eigen::Vector3d::Zero()) const
+    {
+        if (!a_patch.valid)
+        {
+            a_toolProxy = a_toolPosition;
+            return Eigen::Vector3d::Zero();
+        }
+        ContactGeometry contact;
+        Eigen::Vector3d force = makeContactKernel(a_patch.planeAt(a_time),
+                                                  unilateral(Spring(stiffness) + NormalDamper(contactDamping)),
+                                                  toolRadius).compute(a_toolPosition, a_toolVelocity - a_patch.velocity, contact);
+        a_toolProxy = contact.proxy();
+        return force;
+    }
+
+    /// Returns the angular impulse on the torus of 'a_forceOnTool', applied at 'a_toolProxy' during 'a_timeStep'.
+    Eigen::Vector3d reactionImpulse(const Eigen::Vector3d& a_toolProxy,
+                                    const Eigen::Vector3d& a_forceOnTool,
+                                    double a_timeStep) const
+    {
+        return -a_timeStep * (a_toolProxy - position).cross(a_forceOnTool);
+    }
+
+    /// Accumulates the reaction of 'a_forceOnTool', applied at 'a_toolProxy', on the torus angular velocity.
+    void applyReaction(const Eigen::Vector3d& a_toolProxy,
+                       const Eigen::Vector3d& a_forceOnTool,
+                       double a_timeStep)
+    {
+        applyImpulse(reactionImpulse(a_toolProxy, a_forceOnTool, a_timeStep));
+    }
+
+    /// Accumulates 'a_angularImpulse' on the torus angular velocity.
+    void applyImpulse(const Eigen::Vector3d& a_angularImpulse)
+    {
+        body.applyAngularImpulse(a_angularImpulse);
+    }
+
+    /// Stops the torus rotation.
+    void stop()
+    {
+        body.stop();
+    }
+
+    /// Advances the torus rotation by 'a_timeStep' in [s], in fixed steps.
+    void integrate(double a_timeStep)
+    {
+        int steps = stepper.advance(a_timeStep);
+        if (steps == 0)
+        {
+            return;
+        }
+        for (; steps > 0; steps--)
+        {
+            body.step(stepper.step());
+        }
+        rotation = body.rotation();
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// This function computes the projection of a 'force' onto a direction
+/// defined by two points 'A' and 'B'. The projection is returned as the point
+/// 'projectedForce'.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+inline void projectForceOnDirection(const double a_force[3],
+                                    const double a_A[3],
+                                    const double a_B[3],
+                                    double a_projectedForce[3])
+{
+    // Compute AB segment vector.
+    double AB[3] =
+    {
+     a_B[0] - a_A[0],
+     a_B[1] - a_A[1],
+     a_B[2] - a_A[2]
+    };
+
+    // Compute the segment norm, and return the current input point if it is too small.
+    double norm = std::sqrt(AB[0] * AB[0] + AB[1] * AB[1] + AB[2] * AB[2]);
+    if (norm <= 1e-6)
+    {
+        a_projectedForce[0] = 0.0;
+        a_projectedForce[1] = 0.0;
+        a_projectedForce[2] = 0.0;
+
+        return;
+    }
+
+    // Compute the segment direction unit vector.
+    double direction[3] =
+    {
+     AB[0] / norm,
+     AB[1] / norm,
+     AB[2] / norm,
+    };
+
+    // Compute the projection ratio.
+    double projectionRatio = a_force[0] * direction[0] + a_force[1] * direction[1] + a_force[2] * direction[2];
+
+    // Compute the force projection on the segment.
+    a_projectedForce[0] = projectionRatio * direction[0];
+    a_projectedForce[1] = projectionRatio * direction[1];
+    a_projectedForce[2] = projectionRatio * direction[2];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Spring-damper guidance towards a tube centerline (tube simulator).
+///
+////////////////////////////////////////////////////////////////////////////////
+
+struct TubeGuidanceModel
+{
+    /// Guidance spring stiffness in [N/m].
+    double stiffness = 2000.0;
+
+    /// Guidance spring damping in [N/(m/s)].
+    double damping = 20.0;
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function computes the force that keeps a device at 'a_position',
+    /// moving at 'a_velocity', on 'a_centerline'. 'a_projectedPosition'
+    /// receives the closest point of the centerline. The force is null if the
+    /// centerline is empty.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    void computeForce(PolylineCenterline& a_centerline,
+                      const double a_position[3],
+                      const double a_velocity[3],
+                      double a_projectedPosition[3],
+                      double a_force[3]) const
+    {
+        // The spring pulls the device towards its projection on the centerline; the
+        // projection of the force onto the normal removes all unwanted components
+        // (e.g. damping along the "free" direction).
+        ContactGeometry contact;
+        Eigen::Vector3d force = makeContactKernel(CenterlineShape(a_centerline),
+                                                  projected(Spring(stiffness) + Damper(damping)),
+                                                  0.0).compute(Eigen::Vector3d(a_position[0], a_position[1], a_position[2]),
+                                                               Eigen::Vector3d(a_velocity[0], a_velocity[1], a_velocity[2]),
+                                                               contact);
+        if (a_centerline.segmentCount() > 0)
+        {
+            a_projectedPosition[0] = contact.surfacePoint(0);
+            a_projectedPosition[1] = contact.surfacePoint(1);
+            a_projectedPosition[2] = contact.surfacePoint(2);
+        }
+        a_force[0] = force(0);
+        a_force[1] = force(1);
+        a_force[2] = force(2);
+    }
+};
@@ -0,0 +1,204 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Cache of tessellated shapes compiled into OpenGL display lists.
+///
+/// Each shape is tessellated once per parameter set, the first time it is
+/// drawn, and replayed from its display list afterwards. Drawing a cached
+/// shape allocates nothing and evaluates no trigonometric function, so the
+/// frame time and memory use of the graphics loop stay flat however long
+/// the session lasts.
+///
+/// Display lists are used rather than vertex buffers because the examples
+/// create a legacy OpenGL 2.1 context, where buffer objects would need an
+/// extension loader on Windows. All functions must be called from the
+/// thread owning the OpenGL context, and clear() before the context is
+/// destroyed.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <vector>
+
+// Platform specific headers
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+// GLU library headers
+#include <GL/glu.h>
+
+class GeometryCache
+{
+public:
+    GeometryCache() = default;
+    GeometryCache(const GeometryCache&) = delete;
+    GeometryCache& operator=(const GeometryCache&) = delete;
+
+    /// Same as gluSphere() with a default quadric.
+    void drawSphere(double a_radius,
+                    int a_slices,
+                    int a_stacks)
+    {
+        Entry* entry = find(Shape::Sphere, a_radius, 0.0, 0.0, a_slices, a_stacks);
+        if (entry == nullptr)
+        {
+            entry = compile(Shape::Sphere, a_radius, 0.0, 0.0, a_slices, a_stacks);
+            GLUquadric* quadric = gluNewQuadric();
+            gluSphere(quadric, a_radius, a_slices, a_stacks);
+            gluDeleteQuadric(quadric);
+            glEndList();
+        }
+        glCallList(entry->list);
+    }
+
+    /// Same as gluCylinder() with a default quadric, a zero top radius draws a cone.
+    void drawCylinder(double a_baseRadius,
+                      double a_topRadius,
+                      double a_height,
+                      int a_slices,
+                      int a_stacks)
+    {
+        Entry* entry = find(Shape::Cylinder, a_baseRadius, a_topRadius, a_height, a_slices, a_stacks);
+        if (entry == nullptr)
+        {
+            entry = compile(Shape::Cylinder, a_baseRadius, a_topRadius, a_height, a_slices, a_stacks);
+            GLUquadric* quadric = gluNewQuadric();
+            gluCylinder(quadric, a_baseRadius, a_topRadius, a_height, a_slices, a_stacks);
+            gluDeleteQuadric(quadric);
+            glEndList();
+        }
+        glCallList(entry->list);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function draws a torus around the z axis, of radius
+    /// 'a_outerRadius' from the center to the tube axis and of tube radius
+    /// 'a_innerRadius', with normals and texture coordinates.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    void drawTorus(double a_outerRadius,
+                   double a_innerRadius,
+                   int a_majorSegments,
+                   int a_minorSegments)
+    {
+        Entry* entry = find(Shape::Torus, a_outerRadius, a_innerRadius, 0.0, a_majorSegments, a_minorSegments);
+        if (entry == nullptr)
+        {
+            entry = compile(Shape::Torus, a_outerRadius, a_innerRadius, 0.0, a_majorSegments, a_minorSegments);
+            tessellateTorus(a_outerRadius, a_innerRadius, a_majorSegments, a_minorSegments);
+            glEndList();
+        }
+        glCallList(entry->list);
+    }
+
+    /// Number of cached shapes.
+    size_t size() const
+    {
+        return m_entries.size();
+    }
+
+    /// Deletes all display lists. The OpenGL context must still be current.
+    void clear()
+    {
+        for (const Entry& entry : m_entries)
+        {
+            glDeleteLists(entry.list, 1);
+        }
+        m_entries.clear();
+    }
+
+private:
+    enum class Shape
+    {
+        Sphere,
+        Cylinder,
+        Torus
+    };
+
+    struct Entry
+    {
+        Shape shape;
+        double parameters[3];
+        int segments[2];
+        GLuint list;
+    };
+
+    Entry* find(Shape a_shape,
+                double a_p0,
+                double a_p1,
+                double a_p2,
+                int a_s0,
+                int a_s1)
+    {
+        // A handful of shapes are cached, a linear search is the fastest lookup.
+        for (Entry& entry : m_entries)
+        {
+            if (entry.shape == a_shape && entry.parameters[0] == a_p0 && entry.parameters[1] == a_p1
+                && entry.parameters[2] == a_p2 && entry.segments[0] == a_s0 && entry.segments[1] == a_s1)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    /// Adds an entry and opens its display list; the caller tessellates the shape and calls glEndList().
+    Entry* compile(Shape a_shape,
+                   double a_p0,
+                   double a_p1,
+                   double a_p2,
+                   int a_s0,
+                   int a_s1)
+    {
+        m_entries.push_back(Entry { a_shape, { a_p0, a_p1, a_p2 }, { a_s0, a_s1 }, glGenLists(1) });
+        glNewList(m_entries.back().list, GL_COMPILE);
+        return &m_entries.back();
+    }
+
+    static void tessellateTorus(double a_outerRadius,
+                                double a_innerRadius,
+                                int a_majorSegments,
+                                int a_minorSegments)
+    {
+        double majorStep = 2.0 * M_PI / a_majorSegments;
+        double minorStep = 2.0 * M_PI / a_minorSegments;
+        for (int majorIndex = 0; majorIndex < a_majorSegments; ++majorIndex)
+        {
+            double a0 = majorIndex * majorStep;
+            double a1 = a0 + majorStep;
+            GLdouble x0 = std::cos(a0);
+            GLdouble y0 = std::sin(a0);
+            GLdouble x1 = std::cos(a1);
+            GLdouble y1 = std::sin(a1);
+
+            glBegin(GL_TRIANGLE_STRIP);
+            for (int minorIndex = 0; minorIndex <= a_minorSegments; ++minorIndex)
+            {
+                double b = minorIndex * minorStep;
+                GLdouble c = std::cos(b);
+                GLdouble r = a_innerRadius * c + a_outerRadius;
+                GLdouble z = a_innerRadius * std::sin(b);
+
+                glNormal3d(x0 * c, y0 * c, z / a_innerRadius);
+                glTexCoord2d(majorIndex / static_cast<GLdouble>(a_majorSegments), minorIndex / static_cast<GLdouble>(a_minorSegments));
+                glVertex3d(x0 * r, y0 * r, z);
+
+                glNormal3d(x1 * c, y1 * c, z / a_innerRadius);
+                glTexCoord2d((majorIndex + 1) / static_cast<GLdouble>(a_majorSegments), minorIndex / static_cast<GLdouble>(a_minorSegments));
+                glVertex3d(x1 * r, y1 * r, z);
+            }
+            glEnd();
+        }
+    }
+
+    std::vector<Entry> m_entries;
+};
@@ -0,0 +1,187 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// God-object (proxy) contact rendering against a triangle mesh.
+///
+/// The proxy is a point that follows the device but cannot cross the mesh
+/// surface. Every haptic step it moves from its previous position toward the
+/// device position; each surface met on the way becomes a constraint plane,
+/// the goal is projected onto the active planes (up to three, which pins the
+/// proxy in a corner) and the move is repeated. The rendered force is a
+/// spring between the proxy and the device.
+///
+/// Because the proxy only travels the distance covered by the device in one
+/// step, every query is a short segment next to the previous contact, and
+/// the previous contact triangle is passed to the BVH as a hint.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <cmath>
+
+// Eigen library header
+#include <Eigen/Dense>
+
+// Project headers
+#include "mesh_bvh.h"
+
+class GodObject
+{
+public:
+    static constexpr int MaxConstraints = 3;
+
+    explicit GodObject(const MeshBvh& a_mesh) :
+        m_mesh(a_mesh)
+    {
+    }
+
+    /// Sets the spring stiffness between proxy and device in [N/m].
+    void setStiffness(double a_stiffness)
+    {
+        m_stiffness = a_stiffness;
+    }
+
+    /// Sets the distance kept between the proxy and the surface in [m].
+    void setSurfaceOffset(double a_offset)
+    {
+        m_offset = a_offset;
+    }
+
+    /// Places the proxy at 'a_position' and forgets all contacts.
+    void reset(const Eigen::Vector3d& a_position)
+    {
+        m_proxy = a_position;
+        m_constraintCount = 0;
+        m_lastTriangle = -1;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function moves the proxy toward 'a_device' and returns the force
+    /// to apply to the device, in [N].
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    Eigen::Vector3d update(const Eigen::Vector3d& a_device)
+    {
+        m_constraintCount = 0;
+        Eigen::Vector3d goal = a_device;
+
+        for (int iteration = 0; iteration <= MaxConstraints; iteration++)
+        {
+            if ((goal - m_proxy).squaredNorm() < 1e-18)
+            {
+                break;
+            }
+
+            RayHit hit;
+            if (!m_mesh.raycast(m_proxy, goal, hit, m_lastTriangle))
+            {
+                m_proxy = goal;
+                break;
+            }
+
+            // Stop on the surface, offset along its normal, and constrain the
+            // remaining motion to the plane of the triangle.
+            m_proxy = hit.point + m_offset * hit.normal;
+            m_lastTriangle = hit.triangle;
+            if (iteration == MaxConstraints)
+            {
+                break;
+            }
+            addConstraint(hit.normal, hit.normal.dot(hit.point) + m_offset);
+            if (!projectGoal(a_device, goal))
+            {
+                break;
+            }
+        }
+
+        if (m_constraintCount == 0)
+        {
+            m_lastTriangle = -1;
+        }
+        return m_stiffness * (m_proxy - a_device);
+    }
+
+    const Eigen::Vector3d& proxy() const
+    {
+        return m_proxy;
+    }
+
+    bool inContact() const
+    {
+        return m_constraintCount > 0;
+    }
+
+    /// Triangle touched during the last update, -1 if none.
+    int contactTriangle() const
+    {
+        return m_lastTriangle;
+    }
+
+private:
+    void addConstraint(const Eigen::Vector3d& a_normal,
+                       double a_distance)
+    {
+        // Replace a plane that is (nearly) parallel to the new one, e.g. a
+        // neighbouring triangle of a flat region.
+        for (int i = 0; i < m_constraintCount; i++)
+        {
+            if (m_normals[i].dot(a_normal) > 0.9999)
+            {
+                m_normals[i] = a_normal;
+                m_distances[i] = a_distance;
+                return;
+            }
+        }
+        m_normals[m_constraintCount] = a_normal;
+        m_distances[m_constraintCount] = a_distance;
+        m_constraintCount++;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function projects 'a_device' onto the active constraint planes,
+    /// i.e. finds the closest point x with n_i . x = d_i, by solving
+    /// (N N^T) lambda = N g - d and x = g - N^T lambda. Returns false if the
+    /// planes leave no freedom of motion.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool projectGoal(const Eigen::Vector3d& a_device,
+                     Eigen::Vector3d& a_goal)
+    {
+        if (m_constraintCount >= 3)
+        {
+            return false;
+        }
+
+        int count = m_constraintCount;
+        Eigen::Matrix<double, Eigen::Dynamic, 3, 0, 3, 3> normals(count, 3);
+        Eigen::Matrix<double, Eigen::Dynamic, 1, 0, 3, 1> residual(count);
+        for (int i = 0; i < count; i++)
+        {
+            normals.row(i) = m_normals[i].transpose();
+            residual(i) = m_normals[i].dot(a_device) - m_distances[i];
+        }
+
+        Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, 3, 3> gram = normals * normals.transpose();
+        Eigen::LDLT<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, 3, 3>> solver(gram);
+        if (solver.info() != Eigen::Success || std::abs(gram.determinant()) < 1e-9)
+        {
+            return false;
+        }
+        a_goal = a_device - normals.transpose() * solver.solve(residual);
+        return true;
+    }
+
+    const MeshBvh& m_mesh;
+    double m_stiffness = 300.0;
+    double m_offset = 1e-5;
+    Eigen::Vector3d m_proxy = Eigen::Vector3d::Zero();
+    Eigen::Vector3d m_normals[MaxConstraints];
+    double m_distances[MaxConstraints] = {};
+    int m_constraintCount = 0;
+    int m_lastTriangle = -1;
+};
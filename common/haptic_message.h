@@ -0,0 +1,240 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Binary message exchanged between haptic_processor and haptic_renderer.
+///
+/// Each datagram carries exactly one fixed-size, little-endian HapticMessage.
+/// The layout only uses naturally aligned fields, so a message can be decoded
+/// in place from any 8-byte aligned receive buffer without copying.
+///
+///   offset  size  field
+///        0     2  magic      HapticMessageMagic
+///        2     1  version    HapticMessageVersion
+///        3     1  flags      reserved, 0
+///        4     4  sequence   incremented by one for each message sent
+///        8     8  timestamp  source steady clock time in [ns]
+///       16    12  position   tool position in [m], 3 x float32
+///       28    12  force      tool force in [N], 3 x float32
+///
+/// The former "x y z fx fy fz" text format is still accepted as a debug
+/// format. It carries no sequence number or timestamp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+#error "haptic_message.h assumes a little-endian host"
+#endif
+
+constexpr uint16_t HapticMessageMagic = 0x5448;
+constexpr uint8_t HapticMessageVersion = 1;
+
+struct HapticMessage
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint32_t sequence;
+    uint64_t timestamp;
+    float position[3];
+    float force[3];
+};
+
+static_assert(sizeof(HapticMessage) == 40, "unexpected HapticMessage size");
+static_assert(offsetof(HapticMessage, sequence) == 4, "unexpected HapticMessage layout");
+static_assert(offsetof(HapticMessage, timestamp) == 8, "unexpected HapticMessage layout");
+static_assert(offsetof(HapticMessage, position) == 16, "unexpected HapticMessage layout");
+static_assert(offsetof(HapticMessage, force) == 28, "unexpected HapticMessage layout");
+
+/// Returns the steady clock time in [ns] used to timestamp messages.
+inline uint64_t hapticMessageClock()
+{
+    using namespace std::chrono;
+    return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// This function fills 'a_message' in place with the given sample.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+inline void encodeHapticMessage(HapticMessage& a_message,
+                                uint32_t a_sequence,
+                                uint64_t a_timestamp,
+                                const double a_position[3],
+                                const double a_force[3])
+{
+    a_message.magic = HapticMessageMagic;
+    a_message.version = HapticMessageVersion;
+    a_message.flags = 0;
+    a_message.sequence = a_sequence;
+    a_message.timestamp = a_timestamp;
+    for (int i = 0; i < 3; i++)
+    {
+        a_message.position[i] = static_cast<float>(a_position[i]);
+        a_message.force[i] = static_cast<float>(a_force[i]);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// This function returns a pointer to the message stored in 'a_buffer', or
+/// nullptr if the buffer does not hold a valid binary message. The buffer
+/// must be aligned on 8 bytes and outlive the returned pointer.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+inline const HapticMessage* decodeHapticMessage(const char* a_buffer,
+                                                size_t a_length)
+{
+    if (a_length != sizeof(HapticMessage) || (reinterpret_cast<uintptr_t>(a_buffer) % alignof(HapticMessage)) != 0)
+    {
+        return nullptr;
+    }
+
+    const HapticMessage* message = reinterpret_cast<const HapticMessage*>(a_buffer);
+    if (message->magic != HapticMessageMagic || message->version != HapticMessageVersion)
+    {
+        return nullptr;
+    }
+
+    return message;
+}
+
+/// Formats a sample in the text debug format. Returns the message length.
+inline int encodeHapticText(char* a_buffer,
+                            size_t a_size,
+                            const double a_position[3],
+                            const double a_force[3])
+{
+    return std::snprintf(a_buffer, a_size, "%.10f %.10f %.10f %.10f %.10f %.10f",
+                         a_position[0], a_position[1], a_position[2],
+                         a_force[0], a_force[1], a_force[2]);
+}
+
+/// Parses a null terminated sample in the text debug format.
+inline bool decodeHapticText(const char* a_buffer,
+                             double a_position[3],
+                             double a_force[3])
+{
+    return std::sscanf(a_buffer, "%lf %lf %lf %lf %lf %lf",
+                       &a_position[0], &a_position[1], &a_position[2],
+                       &a_force[0], &a_force[1], &a_force[2]) == 6;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Receiver side accounting of lost, reordered and duplicated messages based
+/// on their sequence numbers. Wrap-around of the 32-bit counter is handled.
+///
+/// The last WindowSize sequence numbers are remembered, so a late message is
+/// told from a duplicate, and only the first copy of a late message is taken
+/// off the lost count. A sender that restarts numbers its messages from 0
+/// again: a sequence number more than MaxReorder behind the newest one, or
+/// behind it but with a newer source timestamp, starts a new stream instead
+/// of being dropped as late.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+class SequenceTracker
+{
+public:
+    /// Number of sequence numbers remembered behind the newest one.
+    static constexpr int WindowSize = 64;
+
+    /// Messages further behind the newest one mean a sender restart.
+    static constexpr int32_t MaxReorder = 1000;
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function accounts for a received sequence number, with the source
+    /// timestamp of the message if it has one (0 otherwise). It returns true
+    /// if the message is newer than any message received so far, and false if
+    /// it is a late or duplicated message that should not be applied.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool update(uint32_t a_sequence,
+                uint64_t a_timestamp = 0)
+    {
+        m_received++;
+        if (m_received == 1)
+        {
+            restart(a_sequence, a_timestamp);
+            return true;
+        }
+
+        int32_t gap = static_cast<int32_t>(a_sequence - m_newest);
+        if (gap > 0)
+        {
+            m_lost += static_cast<uint64_t>(gap - 1);
+            m_window = (gap < WindowSize) ? (m_window << gap) | 1 : 1;
+            m_newest = a_sequence;
+            m_newestTimestamp = a_timestamp;
+            return true;
+        }
+        if (gap == 0)
+        {
+            m_duplicated++;
+            return false;
+        }
+
+        // A message behind the newest one, from a restarted sender?
+        bool newerSource = (a_timestamp != 0 && m_newestTimestamp != 0 && a_timestamp > m_newestTimestamp);
+        if (gap < -MaxReorder || newerSource)
+        {
+            m_restarts++;
+            restart(a_sequence, a_timestamp);
+            return true;
+        }
+
+        // A late message, previously counted as lost, or a duplicate of one.
+        if (-gap < WindowSize)
+        {
+            uint64_t bit = uint64_t(1) << -gap;
+            if ((m_window & bit) != 0)
+            {
+                m_duplicated++;
+                return false;
+            }
+            m_window |= bit;
+        }
+        m_reordered++;
+        if (m_lost > 0)
+        {
+            m_lost--;
+        }
+        return false;
+    }
+
+    uint64_t received() const { return m_received; }
+    uint64_t lost() const { return m_lost; }
+    uint64_t reordered() const { return m_reordered; }
+    uint64_t duplicated() const { return m_duplicated; }
+    uint64_t restarts() const { return m_restarts; }
+
+private:
+    void restart(uint32_t a_sequence,
+                 uint64_t a_timestamp)
+    {
+        m_newest = a_sequence;
+        m_newestTimestamp = a_timestamp;
+        m_window = 1;
+    }
+
+    uint32_t m_newest = 0;
+    uint64_t m_newestTimestamp = 0;
+    uint64_t m_window = 0;
+    uint64_t m_received = 0;
+    uint64_t m_lost = 0;
+    uint64_t m_reordered = 0;
+    uint64_t m_duplicated = 0;
+    uint64_t m_restarts = 0;
+};
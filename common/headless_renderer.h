@@ -0,0 +1,532 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Headless offscreen rendering with frame time measurement.
+///
+/// OffscreenContext creates an OpenGL compatibility context without any
+/// window or monitor: an EGL pbuffer on the Mesa surfaceless platform on
+/// Linux, so that a software renderer such as llvmpipe works on a build
+/// machine without a display, and a hidden GLFW window on Windows.
+///
+/// runHeadlessFrames() renders a fixed number of frames of a scripted
+/// scene and measures for each frame the CPU time spent issuing OpenGL
+/// commands, the time then spent waiting in glFinish(), the GPU time (with
+/// timer queries when the context supports them) and the total frame time.
+/// Software renderers rasterize when the commands are flushed, so the
+/// glFinish() wait is the meaningful GPU cost there; timer queries of
+/// llvmpipe do not measure rasterization. Frames can be dumped as binary PPM
+/// images for visual diffing.
+///
+/// Command line options, parsed by HeadlessOptions::parse():
+///
+///   --headless            render offscreen instead of opening a window
+///   --frames=N            number of frames to render (default: 600)
+///   --size=WxH            framebuffer size (default: 640x400)
+///   --frame-rate=F        scripted scene time step is 1/F s (default: 60)
+///   --dump=DIR            write every rendered frame to DIR/frame_NNNNN.ppm
+///   --dump-every=N        only write one frame out of N (default: 1)
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Platform specific headers
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <GL/gl.h>
+#include <GLFW/glfw3.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#endif
+
+// Project headers
+#include "loop_timing.h"
+
+struct HeadlessOptions
+{
+    bool enabled = false;
+    int frames = 600;
+    int width = 640;
+    int height = 400;
+    double frameRate = 60.0;
+    std::string dumpDirectory;
+    int dumpEvery = 1;
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function parses one command line argument. Returns false if it
+    /// is not a headless option, so that the caller can handle it.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool parse(const std::string& a_argument)
+    {
+        if (a_argument == "--headless")
+        {
+            enabled = true;
+        }
+        else if (a_argument.rfind("--frames=", 0) == 0)
+        {
+            frames = std::max(1, std::atoi(a_argument.c_str() + 9));
+        }
+        else if (a_argument.rfind("--size=", 0) == 0)
+        {
+            int w = 0;
+            int h = 0;
+            if (std::sscanf(a_argument.c_str() + 7, "%dx%d", &w, &h) == 2 && w > 0 && h > 0)
+            {
+                width = w;
+                height = h;
+            }
+        }
+        else if (a_argument.rfind("--frame-rate=", 0) == 0)
+        {
+            frameRate = std::max(1.0, std::atof(a_argument.c_str() + 13));
+        }
+        else if (a_argument.rfind("--dump=", 0) == 0)
+        {
+            dumpDirectory = a_argument.substr(7);
+        }
+        else if (a_argument.rfind("--dump-every=", 0) == 0)
+        {
+            dumpEvery = std::max(1, std::atoi(a_argument.c_str() + 13));
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+};
+
+class OffscreenContext
+{
+public:
+    OffscreenContext() = default;
+    OffscreenContext(const OffscreenContext&) = delete;
+    OffscreenContext& operator=(const OffscreenContext&) = delete;
+
+    ~OffscreenContext()
+    {
+        destroy();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function creates an OpenGL context rendering into a 'a_width' x
+    /// 'a_height' offscreen framebuffer and makes it current on the calling
+    /// thread. Returns false on failure, in which case lastError() describes
+    /// the problem.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool create(int a_width,
+                int a_height)
+    {
+        destroy();
+        m_width = a_width;
+        m_height = a_height;
+
+#ifdef _WIN32
+        if (!glfwInit())
+        {
+            return fail("cannot initialize GLFW");
+        }
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_DOUBLEBUFFER, GLFW_FALSE);
+        m_window = glfwCreateWindow(a_width, a_height, "headless", nullptr, nullptr);
+        if (m_window == nullptr)
+        {
+            glfwTerminate();
+            return fail("cannot create a hidden GLFW window");
+        }
+        glfwMakeContextCurrent(m_window);
+#else
+        // Prefer the surfaceless platform, which needs neither X11 nor a GPU.
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay
+            = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (getPlatformDisplay != nullptr)
+        {
+            m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        }
+        if (m_display == EGL_NO_DISPLAY)
+        {
+            m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        }
+        if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, nullptr, nullptr))
+        {
+            m_display = EGL_NO_DISPLAY;
+            return fail("cannot initialize EGL");
+        }
+
+        const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_DEPTH_SIZE, 24,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(m_display, configAttributes, &config, 1, &configCount) || configCount == 0)
+        {
+            return fail("no EGL configuration supports desktop OpenGL pbuffers");
+        }
+
+        const EGLint surfaceAttributes[] = { EGL_WIDTH, a_width, EGL_HEIGHT, a_height, EGL_NONE };
+        m_surface = eglCreatePbufferSurface(m_display, config, surfaceAttributes);
+        eglBindAPI(EGL_OPENGL_API);
+        m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, nullptr);
+        if (m_surface == EGL_NO_SURFACE || m_context == EGL_NO_CONTEXT
+            || !eglMakeCurrent(m_display, m_surface, m_surface, m_context))
+        {
+            return fail("cannot create an EGL OpenGL context");
+        }
+#endif
+        return true;
+    }
+
+    void destroy()
+    {
+#ifdef _WIN32
+        if (m_window != nullptr)
+        {
+            glfwDestroyWindow(m_window);
+            glfwTerminate();
+            m_window = nullptr;
+        }
+#else
+        if (m_display != EGL_NO_DISPLAY)
+        {
+            eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (m_context != EGL_NO_CONTEXT)
+            {
+                eglDestroyContext(m_display, m_context);
+            }
+            if (m_surface != EGL_NO_SURFACE)
+            {
+                eglDestroySurface(m_display, m_surface);
+            }
+            eglTerminate(m_display);
+        }
+        m_display = EGL_NO_DISPLAY;
+        m_surface = EGL_NO_SURFACE;
+        m_context = EGL_NO_CONTEXT;
+#endif
+    }
+
+    int width() const
+    {
+        return m_width;
+    }
+
+    int height() const
+    {
+        return m_height;
+    }
+
+    const std::string& lastError() const
+    {
+        return m_error;
+    }
+
+    /// Returns the address of an OpenGL function, or nullptr if it is not available.
+    void* getProcAddress(const char* a_name) const
+    {
+#ifdef _WIN32
+        return reinterpret_cast<void*>(glfwGetProcAddress(a_name));
+#else
+        return reinterpret_cast<void*>(eglGetProcAddress(a_name));
+#endif
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function reads back the framebuffer and writes it to 'a_path' as
+    /// a binary PPM image. The pixel buffer is reused between calls.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool writePpm(const std::string& a_path)
+    {
+        size_t rowSize = size_t(m_width) * 3;
+        m_pixels.resize(rowSize * m_height);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, m_width, m_height, GL_RGB, GL_UNSIGNED_BYTE, m_pixels.data());
+
+        FILE* file = std::fopen(a_path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        std::fprintf(file, "P6\n%d %d\n255\n", m_width, m_height);
+
+        // OpenGL rows start at the bottom, PPM rows at the top.
+        bool written = true;
+        for (int row = m_height - 1; row >= 0 && written; row--)
+        {
+            written = std::fwrite(&m_pixels[row * rowSize], 1, rowSize, file) == rowSize;
+        }
+        return (std::fclose(file) == 0) && written;
+    }
+
+private:
+    bool fail(const std::string& a_error)
+    {
+        m_error = a_error;
+        destroy();
+        return false;
+    }
+
+    int m_width = 0;
+    int m_height = 0;
+    std::string m_error;
+    std::vector<unsigned char> m_pixels;
+#ifdef _WIN32
+    GLFWwindow* m_window = nullptr;
+#else
+    EGLDisplay m_display = EGL_NO_DISPLAY;
+    EGLSurface m_surface = EGL_NO_SURFACE;
+    EGLContext m_context = EGL_NO_CONTEXT;
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// CPU, GPU and total time of rendered frames.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+class FrameTiming
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// Loads timer query functions if the current context supports them.
+    void initialize(const OffscreenContext& a_context)
+    {
+        const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+        bool supported = (extensions != nullptr) && (std::strstr(extensions, "GL_ARB_timer_query") != nullptr);
+        if (supported)
+        {
+            m_genQueries = reinterpret_cast<GenQueries>(a_context.getProcAddress("glGenQueries"));
+            m_deleteQueries = reinterpret_cast<DeleteQueries>(a_context.getProcAddress("glDeleteQueries"));
+            m_beginQuery = reinterpret_cast<BeginQuery>(a_context.getProcAddress("glBeginQuery"));
+            m_endQuery = reinterpret_cast<EndQuery>(a_context.getProcAddress("glEndQuery"));
+            m_getQueryResult = reinterpret_cast<GetQueryResult>(a_context.getProcAddress("glGetQueryObjectui64v"));
+        }
+        if (m_genQueries && m_deleteQueries && m_beginQuery && m_endQuery && m_getQueryResult)
+        {
+            m_genQueries(1, &m_query);
+        }
+    }
+
+    /// Deletes the timer query. The context must still be current.
+    void release()
+    {
+        if (m_query != 0)
+        {
+            m_deleteQueries(1, &m_query);
+            m_query = 0;
+        }
+    }
+
+    bool hasGpuTime() const
+    {
+        return m_query != 0;
+    }
+
+    /// Marks the start of a frame, before any OpenGL command is issued.
+    void beginFrame()
+    {
+        if (m_query != 0)
+        {
+            m_beginQuery(TimeElapsed, m_query);
+        }
+        m_frameStart = Clock::now();
+    }
+
+    /// Marks the end of a frame, once all its OpenGL commands have been issued.
+    void endFrame()
+    {
+        Clock::time_point submitted = Clock::now();
+        if (m_query != 0)
+        {
+            m_endQuery(TimeElapsed);
+        }
+        glFinish();
+        Clock::time_point finished = Clock::now();
+
+        uint64_t frame = nanoseconds(finished - m_frameStart);
+        m_cpu.record(nanoseconds(submitted - m_frameStart));
+        m_finish.record(nanoseconds(finished - submitted));
+        m_frame.record(frame);
+        if (m_query != 0)
+        {
+            // Some drivers return garbage for the first query, which cannot exceed the frame time.
+            uint64_t elapsed = 0;
+            m_getQueryResult(m_query, QueryResult, &elapsed);
+            if (elapsed <= frame)
+            {
+                m_gpu.record(elapsed);
+            }
+        }
+    }
+
+    /// Ends a frame that failed to render, without recording it, so that no
+    /// query is left active.
+    void abortFrame()
+    {
+        if (m_query != 0)
+        {
+            m_endQuery(TimeElapsed);
+        }
+    }
+
+    uint64_t frames() const
+    {
+        return m_frame.count();
+    }
+
+    /// Prints percentiles of the CPU, GPU and total frame times in [ms].
+    void printReport(std::ostream& a_stream) const
+    {
+        a_stream << "frame timing (" << frames() << " frames)" << std::endl;
+        a_stream << "               mean       p50       p90       p99     p99.9       max  [ms]" << std::endl;
+        printHistogram(a_stream, "cpu", m_cpu);
+        printHistogram(a_stream, "finish", m_finish);
+        if (hasGpuTime())
+        {
+            printHistogram(a_stream, "gpu", m_gpu);
+        }
+        else
+        {
+            a_stream << std::setw(10) << "gpu" << "  (timer queries not supported)" << std::endl;
+        }
+        printHistogram(a_stream, "frame", m_frame);
+    }
+
+private:
+    static constexpr GLenum TimeElapsed = 0x88BF;
+    static constexpr GLenum QueryResult = 0x8866;
+
+    using GenQueries = void (APIENTRY*)(GLsizei, GLuint*);
+    using DeleteQueries = void (APIENTRY*)(GLsizei, const GLuint*);
+    using BeginQuery = void (APIENTRY*)(GLenum, GLuint);
+    using EndQuery = void (APIENTRY*)(GLenum);
+    using GetQueryResult = void (APIENTRY*)(GLuint, GLenum, uint64_t*);
+
+    static uint64_t nanoseconds(Clock::duration a_duration)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(a_duration).count());
+    }
+
+    static void printHistogram(std::ostream& a_stream,
+                               const char* a_name,
+                               const LatencyHistogram& a_histogram)
+    {
+        constexpr double Percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+        a_stream << std::fixed << std::setprecision(3) << std::setw(10) << a_name
+                 << std::setw(10) << a_histogram.mean() / 1e6;
+        for (double percentile : Percentiles)
+        {
+            a_stream << std::setw(10) << a_histogram.percentile(percentile) / 1e6;
+        }
+        a_stream << std::setw(10) << a_histogram.max() / 1e6 << std::endl;
+    }
+
+    LatencyHistogram m_cpu;
+    LatencyHistogram m_finish;
+    LatencyHistogram m_gpu;
+    LatencyHistogram m_frame;
+    Clock::time_point m_frameStart;
+    GLuint m_query = 0;
+    GenQueries m_genQueries = nullptr;
+    DeleteQueries m_deleteQueries = nullptr;
+    BeginQuery m_beginQuery = nullptr;
+    EndQuery m_endQuery = nullptr;
+    GetQueryResult m_getQueryResult = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// This function renders 'a_options.frames' frames. For each frame it calls
+/// 'a_prepare(time)' with the scripted scene time in [s], untimed, then
+/// 'a_render()', which issues the OpenGL commands of the frame and returns
+/// a negative value on error. The context must be current and the OpenGL
+/// state initialized. Prints the timing report to 'a_stream' and returns 0
+/// on success.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Prepare, typename Render>
+int runHeadlessFrames(const HeadlessOptions& a_options,
+                      OffscreenContext& a_context,
+                      std::ostream& a_stream,
+                      Prepare a_prepare,
+                      Render a_render)
+{
+    if (!a_options.dumpDirectory.empty())
+    {
+        std::error_code error;
+        std::filesystem::create_directories(a_options.dumpDirectory, error);
+    }
+
+    FrameTiming timing;
+    timing.initialize(a_context);
+    a_stream << "headless: " << glGetString(GL_RENDERER) << ", " << a_context.width() << "x" << a_context.height()
+             << ", " << a_options.frames << " frames" << std::endl;
+
+    int result = 0;
+    for (int frame = 0; frame < a_options.frames; frame++)
+    {
+        a_prepare(frame / a_options.frameRate);
+
+        timing.beginFrame();
+        if (a_render() < 0)
+        {
+            a_stream << "error: failed to render frame " << frame << std::endl;
+            timing.abortFrame();
+            result = -1;
+            break;
+        }
+        timing.endFrame();
+
+        if (!a_options.dumpDirectory.empty() && frame % a_options.dumpEvery == 0)
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "/frame_%05d.ppm", frame);
+            if (!a_context.writePpm(a_options.dumpDirectory + name))
+            {
+                a_stream << "error: cannot write " << a_options.dumpDirectory << name << std::endl;
+                result = -1;
+                break;
+            }
+        }
+    }
+
+    timing.printReport(a_stream);
+    timing.release();
+    return result;
+}
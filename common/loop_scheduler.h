@@ -0,0 +1,260 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Fixed-rate loop scheduler with absolute deadlines.
+///
+/// Each iteration has an absolute deadline, one period after the previous one,
+/// so the loop rate does not depend on the iteration compute time. The
+/// scheduler sleeps until shortly before the deadline (clock_nanosleep with
+/// TIMER_ABSTIME on Linux, a high resolution waitable timer on Windows) and
+/// spins for the remaining time to absorb the OS wake-up latency.
+///
+/// When an iteration finishes after its deadline, the overrun is counted and
+/// the catch-up policy decides what happens next:
+///
+///   Skip   drop the missed periods and realign on the next period boundary
+///   Burst  run the missed iterations back to back, up to MaxBurstPeriods
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Platform specific headers
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <ctime>
+#endif
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+class LoopScheduler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class CatchUpPolicy
+    {
+        Skip,
+        Burst
+    };
+
+    /// Default range of loop rates in [Hz], that of a haptic loop.
+    static constexpr double MinRate = 500.0;
+    static constexpr double MaxRate = 8000.0;
+
+    /// Maximum number of late periods replayed by the Burst policy.
+    static constexpr int64_t MaxBurstPeriods = 10;
+
+    LoopScheduler()
+    {
+#ifdef _WIN32
+        // CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, available since Windows 10 1803.
+        m_timer = CreateWaitableTimerExW(nullptr, nullptr, 0x00000002, TIMER_ALL_ACCESS);
+        if (m_timer == nullptr)
+        {
+            m_timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+        }
+#endif
+    }
+
+    ~LoopScheduler()
+    {
+#ifdef _WIN32
+        if (m_timer != nullptr)
+        {
+            CloseHandle(m_timer);
+        }
+#endif
+    }
+
+    LoopScheduler(const LoopScheduler&) = delete;
+    LoopScheduler& operator=(const LoopScheduler&) = delete;
+
+    /// Sets the range of rates in [Hz] accepted by setRate(), for a loop that
+    /// is not a haptic loop. Does not change the current rate.
+    void setRateRange(double a_minRate,
+                      double a_maxRate)
+    {
+        m_minRate = a_minRate;
+        m_maxRate = a_maxRate;
+    }
+
+    double minRate() const
+    {
+        return m_minRate;
+    }
+
+    double maxRate() const
+    {
+        return m_maxRate;
+    }
+
+    /// Sets the loop rate in [Hz]. Returns false, keeping the current rate,
+    /// if it is outside [minRate(), maxRate()].
+    bool setRate(double a_rate)
+    {
+        if (!(a_rate >= m_minRate && a_rate <= m_maxRate))
+        {
+            return false;
+        }
+        m_period = std::chrono::nanoseconds(static_cast<int64_t>(1e9 / a_rate));
+        return true;
+    }
+
+    double rate() const
+    {
+        return 1e9 / static_cast<double>(m_period.count());
+    }
+
+    /// Sets how long before each deadline the scheduler stops sleeping and spins.
+    void setSpinTime(std::chrono::nanoseconds a_spinTime)
+    {
+        m_spinTime = a_spinTime;
+    }
+
+    void setCatchUpPolicy(CatchUpPolicy a_policy)
+    {
+        m_policy = a_policy;
+    }
+
+    CatchUpPolicy catchUpPolicy() const
+    {
+        return m_policy;
+    }
+
+    /// Parses "skip" or "burst". Returns false for any other value.
+    static bool parseCatchUpPolicy(const std::string& a_name,
+                                   CatchUpPolicy& a_policy)
+    {
+        if (a_name == "skip")
+        {
+            a_policy = CatchUpPolicy::Skip;
+            return true;
+        }
+        if (a_name == "burst")
+        {
+            a_policy = CatchUpPolicy::Burst;
+            return true;
+        }
+        return false;
+    }
+
+    /// Anchors the first deadline one period from now.
+    void start()
+    {
+        m_deadline = Clock::now() + m_period;
+        m_overruns = 0;
+        m_skippedPeriods = 0;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function waits until the current iteration deadline and computes
+    /// the next one. It returns false if the deadline had already passed.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool waitForNextPeriod()
+    {
+        bool onTime = true;
+        Clock::time_point now = Clock::now();
+        if (now > m_deadline)
+        {
+            m_overruns++;
+            onTime = false;
+            int64_t late = (now - m_deadline) / m_period;
+            if (m_policy == CatchUpPolicy::Burst && late < MaxBurstPeriods)
+            {
+                // Run immediately, the following deadlines stay on the original grid.
+                m_deadline += m_period;
+                return onTime;
+            }
+
+            // Drop the missed periods and wait for the next period boundary.
+            m_deadline += (late + 1) * m_period;
+            m_skippedPeriods += static_cast<uint64_t>(late + 1);
+        }
+
+        sleepUntil(m_deadline - m_spinTime);
+        while (Clock::now() < m_deadline)
+        {
+            spinPause();
+        }
+
+        m_deadline += m_period;
+        return onTime;
+    }
+
+    uint64_t overruns() const
+    {
+        return m_overruns;
+    }
+
+    uint64_t skippedPeriods() const
+    {
+        return m_skippedPeriods;
+    }
+
+private:
+    void sleepUntil(Clock::time_point a_time)
+    {
+#ifdef _WIN32
+        Clock::duration remaining = a_time - Clock::now();
+        if (remaining <= Clock::duration::zero())
+        {
+            return;
+        }
+        if (m_timer != nullptr)
+        {
+            // Relative due time in 100 ns units.
+            LARGE_INTEGER dueTime;
+            dueTime.QuadPart = -static_cast<LONGLONG>(std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count() / 100);
+            if (SetWaitableTimer(m_timer, &dueTime, 0, nullptr, nullptr, FALSE))
+            {
+                WaitForSingleObject(m_timer, INFINITE);
+                return;
+            }
+        }
+        Sleep(static_cast<DWORD>(std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count()));
+#else
+        // std::chrono::steady_clock is CLOCK_MONOTONIC on the supported POSIX platforms.
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(a_time.time_since_epoch()).count();
+        timespec deadline { static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000) };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR)
+        {
+            // Interrupted by a signal, sleep again until the same absolute deadline.
+        }
+#endif
+    }
+
+    static void spinPause()
+    {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+#endif
+    }
+
+    std::chrono::nanoseconds m_period { 1000000 };
+    double m_minRate = MinRate;
+    double m_maxRate = MaxRate;
+    std::chrono::nanoseconds m_spinTime { 100000 };
+    CatchUpPolicy m_policy = CatchUpPolicy::Skip;
+    Clock::time_point m_deadline;
+    uint64_t m_overruns = 0;
+    uint64_t m_skippedPeriods = 0;
+#ifdef _WIN32
+    HANDLE m_timer = nullptr;
+#endif
+};
@@ -0,0 +1,358 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Low overhead timing instrumentation for haptic loops.
+///
+/// The haptic thread calls beginIteration() at the top and endIteration() at
+/// the bottom of each loop iteration. Compute time, period and period jitter
+/// (the deviation from the nominal period) are accumulated in log-linear
+/// histograms with about 3% resolution from 1 ns to 1000 s. Histograms have a
+/// single writer and use relaxed atomics only, so any other thread may read
+/// them at any time without locking or disturbing the haptic loop.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Single writer, lock-free histogram of durations in [ns].
+///
+////////////////////////////////////////////////////////////////////////////////
+
+class LatencyHistogram
+{
+public:
+    /// Values below 2^SubBucketBits are stored exactly, larger values keep
+    /// SubBucketBits - 1 significant bits.
+    static constexpr int SubBucketBits = 6;
+    static constexpr int SubBucketCount = 1 << SubBucketBits;
+    static constexpr int HalfSubBucketCount = SubBucketCount / 2;
+    static constexpr int MaxMagnitude = 40;
+    static constexpr int BucketCount = SubBucketCount + (MaxMagnitude - SubBucketBits + 1) * HalfSubBucketCount;
+
+    /// Records one value. Must only be called from the owning thread.
+    void record(uint64_t a_value)
+    {
+        increment(m_buckets[bucketIndex(a_value)]);
+        increment(m_count);
+        m_sum.store(m_sum.load(std::memory_order_relaxed) + a_value, std::memory_order_relaxed);
+        if (a_value > m_max.load(std::memory_order_relaxed))
+        {
+            m_max.store(a_value, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t count() const
+    {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const
+    {
+        return m_max.load(std::memory_order_relaxed);
+    }
+
+    double mean() const
+    {
+        uint64_t count = m_count.load(std::memory_order_relaxed);
+        return (count > 0) ? static_cast<double>(m_sum.load(std::memory_order_relaxed)) / count : 0.0;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function returns the value below which 'a_percentile' percent of
+    /// the recorded values fall. It may be called from any thread.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    uint64_t percentile(double a_percentile) const
+    {
+        uint64_t total = 0;
+        for (const auto& bucket : m_buckets)
+        {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+        if (total == 0)
+        {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(std::clamp(a_percentile, 0.0, 100.0) / 100.0 * (total - 1)) + 1;
+        uint64_t cumulated = 0;
+        for (int index = 0; index < BucketCount; index++)
+        {
+            cumulated += m_buckets[index].load(std::memory_order_relaxed);
+            if (cumulated >= rank)
+            {
+                return std::min(bucketValue(index), max());
+            }
+        }
+        return max();
+    }
+
+private:
+    static void increment(std::atomic<uint64_t>& a_counter)
+    {
+        a_counter.store(a_counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static int magnitude(uint64_t a_value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, a_value);
+        return static_cast<int>(index);
+#else
+        return 63 - __builtin_clzll(a_value);
+#endif
+    }
+
+    static int bucketIndex(uint64_t a_value)
+    {
+        if (a_value < SubBucketCount)
+        {
+            return static_cast<int>(a_value);
+        }
+
+        int m = std::min(magnitude(a_value), MaxMagnitude);
+        int shift = m - SubBucketBits + 1;
+        int subBucket = static_cast<int>(std::min<uint64_t>(a_value >> shift, SubBucketCount - 1));
+        return SubBucketCount + (m - SubBucketBits) * HalfSubBucketCount + (subBucket - HalfSubBucketCount);
+    }
+
+    /// Returns the midpoint of the range of values stored in a bucket.
+    static uint64_t bucketValue(int a_index)
+    {
+        if (a_index < SubBucketCount)
+        {
+            return static_cast<uint64_t>(a_index);
+        }
+
+        int m = SubBucketBits + (a_index - SubBucketCount) / HalfSubBucketCount;
+        int subBucket = HalfSubBucketCount + (a_index - SubBucketCount) % HalfSubBucketCount;
+        int shift = m - SubBucketBits + 1;
+        return (static_cast<uint64_t>(subBucket) << shift) + ((uint64_t(1) << shift) >> 1);
+    }
+
+    std::array<std::atomic<uint64_t>, BucketCount> m_buckets {};
+    std::atomic<uint64_t> m_count { 0 };
+    std::atomic<uint64_t> m_sum { 0 };
+    std::atomic<uint64_t> m_max { 0 };
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Per-iteration timing of a haptic loop running at a nominal rate.
+///
+/// A loop paced by the device rather than by a scheduler has no rate to
+/// configure, and the device reports its rate only once forces flow. Unless
+/// set, the nominal period is then the median period of the first
+/// WarmUpIterations iterations, which count in no jitter or overrun.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+class LoopTiming
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// Number of periods measured for the nominal period, when it is not set.
+    static constexpr size_t WarmUpIterations = 1024;
+
+    /// Sets the nominal loop rate in [Hz], used for jitter and overrun accounting.
+    void setNominalRate(double a_rate)
+    {
+        m_nominalPeriod = static_cast<uint64_t>(1e9 / std::max(a_rate, 1.0));
+    }
+
+    /// Nominal loop rate in [Hz], 0 while it is being measured.
+    /// Haptic thread only, or once the loop has stopped.
+    double nominalRate() const
+    {
+        return (m_nominalPeriod > 0) ? 1e9 / static_cast<double>(m_nominalPeriod) : 0.0;
+    }
+
+    /// Marks the start of an iteration. Must be called from the haptic thread.
+    void beginIteration()
+    {
+        Clock::time_point now = Clock::now();
+        if (m_started)
+        {
+            uint64_t period = nanoseconds(now - m_iterationStart);
+            m_period.record(period);
+            m_lastPeriod = period;
+            if (m_nominalPeriod > 0)
+            {
+                m_jitter.record((period > m_nominalPeriod) ? period - m_nominalPeriod : m_nominalPeriod - period);
+            }
+            else
+            {
+                measureNominalPeriod(period);
+            }
+        }
+        else
+        {
+            m_firstIteration = now;
+            m_started = true;
+        }
+        m_iterationStart = now;
+    }
+
+    /// Marks the end of an iteration. Must be called from the haptic thread.
+    void endIteration()
+    {
+        Clock::time_point now = Clock::now();
+        uint64_t compute = nanoseconds(now - m_iterationStart);
+        m_compute.record(compute);
+        m_lastCompute = compute;
+
+        // An iteration overruns when its computation alone exceeds the nominal period.
+        if (m_nominalPeriod > 0 && compute > m_nominalPeriod)
+        {
+            m_overruns.store(m_overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        m_iterations.store(m_iterations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_lastIterationEnd.store(nanoseconds(now - m_firstIteration), std::memory_order_release);
+    }
+
+    const LatencyHistogram& compute() const { return m_compute; }
+    const LatencyHistogram& period() const { return m_period; }
+    const LatencyHistogram& jitter() const { return m_jitter; }
+
+    /// Compute time of the last finished iteration in [ns]. Haptic thread only.
+    uint64_t lastCompute() const
+    {
+        return m_lastCompute;
+    }
+
+    /// Period between the last two iteration starts in [ns]. Haptic thread only.
+    uint64_t lastPeriod() const
+    {
+        return m_lastPeriod;
+    }
+
+    uint64_t iterations() const
+    {
+        return m_iterations.load(std::memory_order_relaxed);
+    }
+
+    uint64_t overruns() const
+    {
+        return m_overruns.load(std::memory_order_relaxed);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function returns the loop rate in [Hz] measured since its
+    /// previous call. It is meant to be polled from a single reader thread,
+    /// e.g. the graphics loop.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    double sampleRate()
+    {
+        uint64_t iterations = m_iterations.load(std::memory_order_relaxed);
+        uint64_t time = m_lastIterationEnd.load(std::memory_order_acquire);
+        double rate = 0.0;
+        if (time > m_sampledTime)
+        {
+            rate = 1e9 * static_cast<double>(iterations - m_sampledIterations) / static_cast<double>(time - m_sampledTime);
+        }
+        m_sampledIterations = iterations;
+        m_sampledTime = time;
+        return rate;
+    }
+
+    /// Prints a one line summary of the loop rate and jitter.
+    void printStatus(std::ostream& a_stream)
+    {
+        double rate = sampleRate();
+        a_stream << std::fixed << std::setprecision(3)
+                 << "haptic rate: " << rate / 1000.0 << " kHz"
+                 << " | jitter p99.9: " << m_jitter.percentile(99.9) / 1000.0 << " us"
+                 << " | compute p99.9: " << m_compute.percentile(99.9) / 1000.0 << " us"
+                 << " | overruns: " << overruns();
+    }
+
+    /// Prints percentiles of all histograms.
+    void printReport(std::ostream& a_stream) const
+    {
+        a_stream << "haptic loop timing (" << iterations() << " iterations, " << overruns() << " overruns, ";
+        if (m_nominalPeriod > 0)
+        {
+            a_stream << "nominal period " << m_nominalPeriod / 1000.0 << " us)" << std::endl;
+        }
+        else
+        {
+            a_stream << "nominal period not measured yet)" << std::endl;
+        }
+        a_stream << "               mean       p50       p90       p99     p99.9    p99.99       max  [us]" << std::endl;
+        printHistogram(a_stream, "compute", m_compute);
+        printHistogram(a_stream, "period", m_period);
+        printHistogram(a_stream, "jitter", m_jitter);
+    }
+
+private:
+    static uint64_t nanoseconds(Clock::duration a_duration)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(a_duration).count());
+    }
+
+    /// Takes the median of the first WarmUpIterations periods as the nominal period.
+    void measureNominalPeriod(uint64_t a_period)
+    {
+        m_warmUpPeriods[m_warmUpCount++] = a_period;
+        if (m_warmUpCount == WarmUpIterations)
+        {
+            auto median = m_warmUpPeriods.begin() + WarmUpIterations / 2;
+            std::nth_element(m_warmUpPeriods.begin(), median, m_warmUpPeriods.end());
+            m_nominalPeriod = std::max<uint64_t>(*median, 1);
+        }
+    }
+
+    static void printHistogram(std::ostream& a_stream,
+                               const char* a_name,
+                               const LatencyHistogram& a_histogram)
+    {
+        constexpr double Percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+        a_stream << std::fixed << std::setprecision(2) << std::setw(10) << a_name
+                 << std::setw(10) << a_histogram.mean() / 1000.0;
+        for (double percentile : Percentiles)
+        {
+            a_stream << std::setw(10) << a_histogram.percentile(percentile) / 1000.0;
+        }
+        a_stream << std::setw(10) << a_histogram.max() / 1000.0 << std::endl;
+    }
+
+    LatencyHistogram m_compute;
+    LatencyHistogram m_period;
+    LatencyHistogram m_jitter;
+    std::atomic<uint64_t> m_iterations { 0 };
+    std::atomic<uint64_t> m_overruns { 0 };
+    std::atomic<uint64_t> m_lastIterationEnd { 0 };
+    uint64_t m_nominalPeriod = 0;
+    std::array<uint64_t, WarmUpIterations> m_warmUpPeriods {};
+    size_t m_warmUpCount = 0;
+    uint64_t m_lastCompute = 0;
+    uint64_t m_lastPeriod = 0;
+    bool m_started = false;
+    Clock::time_point m_firstIteration;
+    Clock::time_point m_iterationStart;
+
+    // Reader side state for sampleRate().
+    uint64_t m_sampledIterations = 0;
+    uint64_t m_sampledTime = 0;
+};
@@ -0,0 +1,618 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Bounding volume hierarchy over a triangle mesh for haptic queries.
+///
+/// The tree is built once with a binned surface area heuristic and stored as
+/// a flat array of 32-byte nodes, siblings next to each other, with the
+/// triangles reordered so that every leaf references a contiguous range.
+/// Triangle data is stored in single precision as (v0, v1 - v0, v2 - v0, n),
+/// which is all the queries need.
+///
+/// Both queries accept a hint, the triangle found by the previous haptic
+/// step. It is tested first so that the search starts with a tight bound and
+/// only visits the part of the tree near the previous contact.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Eigen library header
+#include <Eigen/Dense>
+
+// Project headers
+#include "triangle_mesh.h"
+
+struct RayHit
+{
+    /// Fraction of the segment at which the hit occurs, in [0, 1].
+    double t = 1.0;
+    Eigen::Vector3d point = Eigen::Vector3d::Zero();
+    Eigen::Vector3d normal = Eigen::Vector3d::Zero();
+    int triangle = -1;
+};
+
+struct ClosestHit
+{
+    double distance = DBL_MAX;
+    Eigen::Vector3d point = Eigen::Vector3d::Zero();
+    Eigen::Vector3d normal = Eigen::Vector3d::Zero();
+    int triangle = -1;
+};
+
+class MeshBvh
+{
+public:
+    static constexpr int MaxLeafSize = 4;
+    static constexpr int BinCount = 12;
+    static constexpr int MaxDepth = 64;
+
+    struct Node
+    {
+        float min[3];
+        uint32_t leftOrFirst;
+        float max[3];
+        uint32_t count;
+    };
+
+    static_assert(sizeof(Node) == 32, "BVH nodes must stay 32 bytes");
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function builds the hierarchy over 'a_mesh'. The mesh is not
+    /// referenced after the call.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    void build(const TriangleMesh& a_mesh)
+    {
+        size_t count = a_mesh.triangles.size();
+        m_triangles.clear();
+        m_nodes.clear();
+        m_sourceIndex.resize(count);
+
+        // Compute the triangle bounds and centroids used by the build.
+        std::vector<Bounds> bounds(count);
+        std::vector<Eigen::Vector3f> centroids(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const auto& triangle = a_mesh.triangles[i];
+            bounds[i].grow(a_mesh.vertices[triangle[0]]);
+            bounds[i].grow(a_mesh.vertices[triangle[1]]);
+            bounds[i].grow(a_mesh.vertices[triangle[2]]);
+            centroids[i] = (a_mesh.vertices[triangle[0]] + a_mesh.vertices[triangle[1]] + a_mesh.vertices[triangle[2]]) / 3.0f;
+            m_sourceIndex[i] = static_cast<uint32_t>(i);
+        }
+
+        m_nodes.reserve(2 * count / MaxLeafSize + 1);
+        m_nodes.push_back(Node {});
+        m_nodes[0].leftOrFirst = 0;
+        m_nodes[0].count = static_cast<uint32_t>(count);
+        if (count > 0)
+        {
+            subdivide(0, bounds, centroids, 0);
+        }
+        m_nodes.shrink_to_fit();
+
+        // Store the triangles in leaf order.
+        m_triangles.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const auto& triangle = a_mesh.triangles[m_sourceIndex[i]];
+            Eigen::Vector3f v0 = a_mesh.vertices[triangle[0]];
+            Eigen::Vector3f e1 = a_mesh.vertices[triangle[1]] - v0;
+            Eigen::Vector3f e2 = a_mesh.vertices[triangle[2]] - v0;
+            Eigen::Vector3f normal = e1.cross(e2);
+            float norm = normal.norm();
+            m_triangles[i] = Triangle { v0, e1, e2, (norm > 0.0f) ? Eigen::Vector3f(normal / norm) : Eigen::Vector3f::Zero() };
+        }
+    }
+
+    size_t triangleCount() const
+    {
+        return m_triangles.size();
+    }
+
+    size_t nodeCount() const
+    {
+        return m_nodes.size();
+    }
+
+    size_t memoryBytes() const
+    {
+        return m_nodes.size() * sizeof(Node) + m_triangles.size() * (sizeof(Triangle) + sizeof(uint32_t));
+    }
+
+    /// Returns the index of triangle 'a_triangle' in the source mesh.
+    uint32_t sourceTriangle(int a_triangle) const
+    {
+        return m_sourceIndex[a_triangle];
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function finds the first front-facing triangle crossed by the
+    /// segment from 'a_start' to 'a_end'. Back faces are ignored so that a
+    /// point can always leave the object. Returns true on a hit.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool raycast(const Eigen::Vector3d& a_start,
+                 const Eigen::Vector3d& a_end,
+                 RayHit& a_hit,
+                 int a_hint = -1) const
+    {
+        if (m_triangles.empty())
+        {
+            return false;
+        }
+
+        Ray ray;
+        ray.origin = a_start.cast<float>();
+        ray.direction = (a_end - a_start).cast<float>();
+        for (int i = 0; i < 3; i++)
+        {
+            ray.inverse[i] = (ray.direction(i) != 0.0f) ? 1.0f / ray.direction(i) : FLT_MAX;
+        }
+
+        float bestT = 1.0f;
+        int best = -1;
+        if (a_hint >= 0 && a_hint < static_cast<int>(m_triangles.size()))
+        {
+            intersectTriangle(ray, a_hint, bestT, best);
+        }
+
+        uint32_t stack[MaxDepth];
+        int stackSize = 0;
+        uint32_t nodeIndex = 0;
+        while (true)
+        {
+            const Node& node = m_nodes[nodeIndex];
+            if (node.count > 0)
+            {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+                {
+                    intersectTriangle(ray, static_cast<int>(i), bestT, best);
+                }
+            }
+            else
+            {
+                // Visit the nearest child first.
+                uint32_t left = node.leftOrFirst;
+                uint32_t right = left + 1;
+                float leftT = intersectBounds(ray, m_nodes[left], bestT);
+                float rightT = intersectBounds(ray, m_nodes[right], bestT);
+                if (leftT > rightT)
+                {
+                    std::swap(leftT, rightT);
+                    std::swap(left, right);
+                }
+                if (leftT != FLT_MAX)
+                {
+                    if (rightT != FLT_MAX && stackSize < MaxDepth)
+                    {
+                        stack[stackSize++] = right;
+                    }
+                    nodeIndex = left;
+                    continue;
+                }
+            }
+
+            if (stackSize == 0)
+            {
+                break;
+            }
+            nodeIndex = stack[--stackSize];
+        }
+
+        if (best < 0)
+        {
+            return false;
+        }
+
+        const Triangle& triangle = m_triangles[best];
+        a_hit.t = bestT;
+        a_hit.point = a_start + bestT * (a_end - a_start);
+        a_hit.normal = triangle.normal.cast<double>();
+        a_hit.triangle = best;
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function finds the point of the mesh closest to 'a_point' within
+    /// 'a_maxDistance'. Returns true if such a point exists.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool closestPoint(const Eigen::Vector3d& a_point,
+                      double a_maxDistance,
+                      ClosestHit& a_hit,
+                      int a_hint = -1) const
+    {
+        if (m_triangles.empty())
+        {
+            return false;
+        }
+
+        Eigen::Vector3f point = a_point.cast<float>();
+        float bestSquared = static_cast<float>(a_maxDistance * a_maxDistance);
+        int best = -1;
+        Eigen::Vector3f bestPoint;
+
+        auto testTriangle = [&](int a_index)
+        {
+            Eigen::Vector3f candidate = closestPointOnTriangle(point, m_triangles[a_index]);
+            float squared = (candidate - point).squaredNorm();
+            if (squared < bestSquared)
+            {
+                bestSquared = squared;
+                best = a_index;
+                bestPoint = candidate;
+            }
+        };
+
+        if (a_hint >= 0 && a_hint < static_cast<int>(m_triangles.size()))
+        {
+            testTriangle(a_hint);
+        }
+
+        uint32_t stack[MaxDepth];
+        int stackSize = 0;
+        uint32_t nodeIndex = 0;
+        if (boundsSquaredDistance(point, m_nodes[0]) > bestSquared)
+        {
+            return false;
+        }
+        while (true)
+        {
+            const Node& node = m_nodes[nodeIndex];
+            if (node.count > 0)
+            {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+                {
+                    testTriangle(static_cast<int>(i));
+                }
+            }
+            else
+            {
+                uint32_t left = node.leftOrFirst;
+                uint32_t right = left + 1;
+                float leftDistance = boundsSquaredDistance(point, m_nodes[left]);
+                float rightDistance = boundsSquaredDistance(point, m_nodes[right]);
+                if (leftDistance > rightDistance)
+                {
+                    std::swap(leftDistance, rightDistance);
+                    std::swap(left, right);
+                }
+                if (leftDistance <= bestSquared)
+                {
+                    if (rightDistance <= bestSquared && stackSize < MaxDepth)
+                    {
+                        stack[stackSize++] = right;
+                    }
+                    nodeIndex = left;
+                    continue;
+                }
+            }
+
+            // Pop the next node that may still hold a closer triangle.
+            bool found = false;
+            while (stackSize > 0)
+            {
+                nodeIndex = stack[--stackSize];
+                if (boundsSquaredDistance(point, m_nodes[nodeIndex]) <= bestSquared)
+                {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+            {
+                break;
+            }
+        }
+
+        if (best < 0)
+        {
+            return false;
+        }
+
+        a_hit.distance = std::sqrt(static_cast<double>(bestSquared));
+        a_hit.point = bestPoint.cast<double>();
+        a_hit.normal = m_triangles[best].normal.cast<double>();
+        a_hit.triangle = best;
+        return true;
+    }
+
+private:
+    struct Triangle
+    {
+        Eigen::Vector3f v0;
+        Eigen::Vector3f e1;
+        Eigen::Vector3f e2;
+        Eigen::Vector3f normal;
+    };
+
+    struct Ray
+    {
+        Eigen::Vector3f origin;
+        Eigen::Vector3f direction;
+        float inverse[3];
+    };
+
+    struct Bounds
+    {
+        Eigen::Vector3f min = Eigen::Vector3f::Constant(FLT_MAX);
+        Eigen::Vector3f max = Eigen::Vector3f::Constant(-FLT_MAX);
+
+        void grow(const Eigen::Vector3f& a_point)
+        {
+            min = min.cwiseMin(a_point);
+            max = max.cwiseMax(a_point);
+        }
+
+        void grow(const Bounds& a_bounds)
+        {
+            min = min.cwiseMin(a_bounds.min);
+            max = max.cwiseMax(a_bounds.max);
+        }
+
+        float area() const
+        {
+            Eigen::Vector3f extent = max - min;
+            if (extent(0) < 0.0f)
+            {
+                return 0.0f;
+            }
+            return extent(0) * extent(1) + extent(1) * extent(2) + extent(2) * extent(0);
+        }
+    };
+
+    void subdivide(uint32_t a_nodeIndex,
+                   const std::vector<Bounds>& a_bounds,
+                   const std::vector<Eigen::Vector3f>& a_centroids,
+                   int a_depth)
+    {
+        uint32_t first = m_nodes[a_nodeIndex].leftOrFirst;
+        uint32_t count = m_nodes[a_nodeIndex].count;
+
+        Bounds nodeBounds;
+        Bounds centroidBounds;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            nodeBounds.grow(a_bounds[m_sourceIndex[i]]);
+            centroidBounds.grow(a_centroids[m_sourceIndex[i]]);
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            m_nodes[a_nodeIndex].min[i] = nodeBounds.min(i);
+            m_nodes[a_nodeIndex].max[i] = nodeBounds.max(i);
+        }
+
+        if (count <= MaxLeafSize || a_depth >= MaxDepth - 1)
+        {
+            return;
+        }
+
+        // Find the best split plane over all axes with a binned SAH.
+        int bestAxis = -1;
+        int bestBin = 0;
+        float bestCost = nodeBounds.area() * count;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float low = centroidBounds.min(axis);
+            float high = centroidBounds.max(axis);
+            if (high <= low)
+            {
+                continue;
+            }
+
+            Bounds bins[BinCount];
+            uint32_t binCounts[BinCount] = {};
+            float scale = BinCount / (high - low);
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                uint32_t source = m_sourceIndex[i];
+                int bin = std::min(BinCount - 1, static_cast<int>((a_centroids[source](axis) - low) * scale));
+                binCounts[bin]++;
+                bins[bin].grow(a_bounds[source]);
+            }
+
+            float leftArea[BinCount - 1];
+            uint32_t leftCount[BinCount - 1];
+            Bounds accumulated;
+            uint32_t sum = 0;
+            for (int i = 0; i < BinCount - 1; i++)
+            {
+                sum += binCounts[i];
+                accumulated.grow(bins[i]);
+                leftCount[i] = sum;
+                leftArea[i] = accumulated.area();
+            }
+
+            accumulated = Bounds {};
+            sum = 0;
+            for (int i = BinCount - 1; i > 0; i--)
+            {
+                sum += binCounts[i];
+                accumulated.grow(bins[i]);
+                float cost = leftCount[i - 1] * leftArea[i - 1] + sum * accumulated.area();
+                if (leftCount[i - 1] > 0 && sum > 0 && cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = i;
+                }
+            }
+        }
+
+        if (bestAxis < 0)
+        {
+            return;
+        }
+
+        // Partition the triangles around the split plane.
+        float low = centroidBounds.min(bestAxis);
+        float scale = BinCount / (centroidBounds.max(bestAxis) - low);
+        uint32_t* begin = m_sourceIndex.data() + first;
+        uint32_t* middle = std::partition(begin, begin + count, [&](uint32_t a_source)
+        {
+            return std::min(BinCount - 1, static_cast<int>((a_centroids[a_source](bestAxis) - low) * scale)) < bestBin;
+        });
+        uint32_t leftCount = static_cast<uint32_t>(middle - begin);
+        if (leftCount == 0 || leftCount == count)
+        {
+            return;
+        }
+
+        uint32_t left = static_cast<uint32_t>(m_nodes.size());
+        m_nodes.push_back(Node {});
+        m_nodes.push_back(Node {});
+        m_nodes[left].leftOrFirst = first;
+        m_nodes[left].count = leftCount;
+        m_nodes[left + 1].leftOrFirst = first + leftCount;
+        m_nodes[left + 1].count = count - leftCount;
+        m_nodes[a_nodeIndex].leftOrFirst = left;
+        m_nodes[a_nodeIndex].count = 0;
+
+        subdivide(left, a_bounds, a_centroids, a_depth + 1);
+        subdivide(left + 1, a_bounds, a_centroids, a_depth + 1);
+    }
+
+    /// Returns the entry distance of the ray into a node, or FLT_MAX if it misses.
+    static float intersectBounds(const Ray& a_ray,
+                                 const Node& a_node,
+                                 float a_maxT)
+    {
+        float tmin = 0.0f;
+        float tmax = a_maxT;
+        for (int i = 0; i < 3; i++)
+        {
+            float t0 = (a_node.min[i] - a_ray.origin(i)) * a_ray.inverse[i];
+            float t1 = (a_node.max[i] - a_ray.origin(i)) * a_ray.inverse[i];
+            if (t0 > t1)
+            {
+                std::swap(t0, t1);
+            }
+            tmin = std::max(tmin, t0);
+            tmax = std::min(tmax, t1);
+        }
+        return (tmin <= tmax) ? tmin : FLT_MAX;
+    }
+
+    /// Moller-Trumbore intersection with front faces only.
+    void intersectTriangle(const Ray& a_ray,
+                           int a_index,
+                           float& a_bestT,
+                           int& a_best) const
+    {
+        const Triangle& triangle = m_triangles[a_index];
+        if (a_ray.direction.dot(triangle.normal) >= 0.0f)
+        {
+            return;
+        }
+
+        Eigen::Vector3f p = a_ray.direction.cross(triangle.e2);
+        float determinant = triangle.e1.dot(p);
+        if (std::abs(determinant) < 1e-20f)
+        {
+            return;
+        }
+        float inverse = 1.0f / determinant;
+        Eigen::Vector3f s = a_ray.origin - triangle.v0;
+        float u = s.dot(p) * inverse;
+        if (u < 0.0f || u > 1.0f)
+        {
+            return;
+        }
+        Eigen::Vector3f q = s.cross(triangle.e1);
+        float v = a_ray.direction.dot(q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+        {
+            return;
+        }
+        float t = triangle.e2.dot(q) * inverse;
+        if (t >= 0.0f && t < a_bestT)
+        {
+            a_bestT = t;
+            a_best = a_index;
+        }
+    }
+
+    static float boundsSquaredDistance(const Eigen::Vector3f& a_point,
+                                       const Node& a_node)
+    {
+        float squared = 0.0f;
+        for (int i = 0; i < 3; i++)
+        {
+            float d = std::max(std::max(a_node.min[i] - a_point(i), 0.0f), a_point(i) - a_node.max[i]);
+            squared += d * d;
+        }
+        return squared;
+    }
+
+    /// Closest point on a triangle (Ericson, Real-Time Collision Detection, 5.1.5).
+    static Eigen::Vector3f closestPointOnTriangle(const Eigen::Vector3f& a_point,
+                                                  const Triangle& a_triangle)
+    {
+        const Eigen::Vector3f& a = a_triangle.v0;
+        const Eigen::Vector3f& ab = a_triangle.e1;
+        const Eigen::Vector3f& ac = a_triangle.e2;
+        Eigen::Vector3f ap = a_point - a;
+
+        float d1 = ab.dot(ap);
+        float d2 = ac.dot(ap);
+        if (d1 <= 0.0f && d2 <= 0.0f)
+        {
+            return a;
+        }
+
+        Eigen::Vector3f bp = ap - ab;
+        float d3 = ab.dot(bp);
+        float d4 = ac.dot(bp);
+        if (d3 >= 0.0f && d4 <= d3)
+        {
+            return a + ab;
+        }
+
+        float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        {
+            return a + (d1 / (d1 - d3)) * ab;
+        }
+
+        Eigen::Vector3f cp = ap - ac;
+        float d5 = ab.dot(cp);
+        float d6 = ac.dot(cp);
+        if (d6 >= 0.0f && d5 <= d6)
+        {
+            return a + ac;
+        }
+
+        float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        {
+            return a + (d2 / (d2 - d6)) * ac;
+        }
+
+        float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+        {
+            return a + ab + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (ac - ab);
+        }
+
+        float denominator = 1.0f / (va + vb + vc);
+        return a + ab * (vb * denominator) + ac * (vc * denominator);
+    }
+
+    std::vector<Node> m_nodes;
+    std::vector<Triangle> m_triangles;
+    std::vector<uint32_t> m_sourceIndex;
+};
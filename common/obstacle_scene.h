@@ -0,0 +1,356 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Scene of many spherical obstacles with a uniform grid broad phase.
+///
+/// Obstacles are stored as a structure of arrays (center coordinates and
+/// radius in separate arrays), so that the bounding tests of a query read
+/// contiguous memory. Each obstacle is registered in the grid cell of its
+/// center; cells are hashed into a power of two table of buckets, each an
+/// intrusive doubly linked list of obstacle indices, so there is no storage
+/// per cell and the grid is unbounded.
+///
+/// move() updates an obstacle in constant time and only touches the grid
+/// when its center changes cell, without allocating, so obstacles can be
+/// moved from the haptic loop. add() may grow the table.
+///
+/// query() visits the obstacles whose sphere overlaps a query sphere. It
+/// scans the cells within reach of the query, reach being the query radius
+/// plus the largest obstacle radius, i.e. at most 3 x 3 x 3 cells with cells
+/// as large as the reach, whatever the number of obstacles. Cells about the
+/// reach are the best trade-off between the number of cells scanned and the
+/// number of obstacles tested per cell. With setQueryRadius(), add() grows
+/// the cells whenever a larger obstacle makes the reach exceed them.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Eigen library header
+#include <Eigen/Dense>
+
+class ObstacleScene
+{
+public:
+    /// Default cell edge length in [m], about the reach of a 5 mm tool among
+    /// obstacles of a few millimeters.
+    static constexpr double DefaultCellSize = 0.01;
+
+    explicit ObstacleScene(double a_cellSize = DefaultCellSize)
+    {
+        setCellSize(a_cellSize);
+    }
+
+    /// Sets the cell edge length in [m] and rebuilds the grid.
+    void setCellSize(double a_cellSize)
+    {
+        m_cellSize = a_cellSize;
+        m_inverseCellSize = 1.0 / a_cellSize;
+        rebuild(m_heads.size());
+    }
+
+    double cellSize() const
+    {
+        return m_cellSize;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function sets the largest radius passed to query(), 0 to keep the
+    /// cell size as set. Otherwise the cells grow to at least the reach of
+    /// such queries, now and as larger obstacles are added, by at least half
+    /// their size each time so that the grid is rebuilt only a few times.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    void setQueryRadius(double a_radius)
+    {
+        m_queryRadius = a_radius;
+        if (!fitsReach())
+        {
+            growCells();
+        }
+    }
+
+    double queryRadius() const
+    {
+        return m_queryRadius;
+    }
+
+    void clear()
+    {
+        for (std::vector<double>* array : { &m_centerX, &m_centerY, &m_centerZ, &m_radius })
+        {
+            array->clear();
+        }
+        m_cells.clear();
+        m_next.clear();
+        m_previous.clear();
+        std::fill(m_heads.begin(), m_heads.end(), -1);
+        m_maxRadius = 0.0;
+    }
+
+    void reserve(size_t a_count)
+    {
+        for (std::vector<double>* array : { &m_centerX, &m_centerY, &m_centerZ, &m_radius })
+        {
+            array->reserve(a_count);
+        }
+        m_cells.reserve(a_count);
+        m_next.reserve(a_count);
+        m_previous.reserve(a_count);
+        if (a_count > m_heads.size())
+        {
+            rebuild(a_count);
+        }
+    }
+
+    size_t size() const
+    {
+        return m_radius.size();
+    }
+
+    bool empty() const
+    {
+        return m_radius.empty();
+    }
+
+    /// Adds an obstacle and returns its index.
+    size_t add(const Eigen::Vector3d& a_center,
+               double a_radius)
+    {
+        size_t index = size();
+        m_centerX.push_back(a_center(0));
+        m_centerY.push_back(a_center(1));
+        m_centerZ.push_back(a_center(2));
+        m_radius.push_back(a_radius);
+        m_cells.push_back(cellOf(a_center(0), a_center(1), a_center(2)));
+        m_next.push_back(-1);
+        m_previous.push_back(-1);
+        m_maxRadius = std::max(m_maxRadius, a_radius);
+
+        // Keep cells as large as the reach, and at most one obstacle per
+        // bucket on average.
+        if (!fitsReach())
+        {
+            growCells();
+        }
+        else if (size() > m_heads.size())
+        {
+            rebuild(2 * size());
+        }
+        else
+        {
+            link(static_cast<int32_t>(index));
+        }
+        return index;
+    }
+
+    /// Moves obstacle 'a_index' to 'a_center'.
+    void move(size_t a_index,
+              const Eigen::Vector3d& a_center)
+    {
+        m_centerX[a_index] = a_center(0);
+        m_centerY[a_index] = a_center(1);
+        m_centerZ[a_index] = a_center(2);
+        Cell cell = cellOf(a_center(0), a_center(1), a_center(2));
+        if (cell != m_cells[a_index])
+        {
+            int32_t index = static_cast<int32_t>(a_index);
+            unlink(index);
+            m_cells[a_index] = cell;
+            link(index);
+        }
+    }
+
+    Eigen::Vector3d center(size_t a_index) const
+    {
+        return Eigen::Vector3d(m_centerX[a_index], m_centerY[a_index], m_centerZ[a_index]);
+    }
+
+    double radius(size_t a_index) const
+    {
+        return m_radius[a_index];
+    }
+
+    /// Largest obstacle radius added since the last clear().
+    double maxRadius() const
+    {
+        return m_maxRadius;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function calls 'a_visitor(index)' once for every obstacle whose
+    /// sphere overlaps the sphere of center 'a_point' and radius 'a_radius',
+    /// and returns the number of obstacles visited.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    template <typename Visitor>
+    size_t query(const Eigen::Vector3d& a_point,
+                 double a_radius,
+                 Visitor&& a_visitor) const
+    {
+        if (empty())
+        {
+            return 0;
+        }
+
+        double reach = a_radius + m_maxRadius;
+        Cell low = cellOf(a_point(0) - reach, a_point(1) - reach, a_point(2) - reach);
+        Cell high = cellOf(a_point(0) + reach, a_point(1) + reach, a_point(2) + reach);
+        size_t visited = 0;
+        Cell cell;
+        for (cell.x = low.x; cell.x <= high.x; cell.x++)
+        {
+            for (cell.y = low.y; cell.y <= high.y; cell.y++)
+            {
+                for (cell.z = low.z; cell.z <= high.z; cell.z++)
+                {
+                    for (int32_t i = m_heads[bucketOf(cell)]; i >= 0; i = m_next[i])
+                    {
+                        // Skip obstacles of other cells hashed to the same bucket.
+                        if (m_cells[i] != cell)
+                        {
+                            continue;
+                        }
+                        double dx = m_centerX[i] - a_point(0);
+                        double dy = m_centerY[i] - a_point(1);
+                        double dz = m_centerZ[i] - a_point(2);
+                        double overlap = m_radius[i] + a_radius;
+                        if (dx * dx + dy * dy + dz * dz < overlap * overlap)
+                        {
+                            a_visitor(static_cast<size_t>(i));
+                            visited++;
+                        }
+                    }
+                }
+            }
+        }
+        return visited;
+    }
+
+private:
+    struct Cell
+    {
+        int32_t x = 0;
+        int32_t y = 0;
+        int32_t z = 0;
+
+        bool operator==(const Cell& a_other) const
+        {
+            return x == a_other.x && y == a_other.y && z == a_other.z;
+        }
+
+        bool operator!=(const Cell& a_other) const
+        {
+            return !(*this == a_other);
+        }
+    };
+
+    Cell cellOf(double a_x,
+                double a_y,
+                double a_z) const
+    {
+        Cell cell;
+        cell.x = floorToInt(a_x * m_inverseCellSize);
+        cell.y = floorToInt(a_y * m_inverseCellSize);
+        cell.z = floorToInt(a_z * m_inverseCellSize);
+        return cell;
+    }
+
+    /// std::floor is a library call without SSE4.1, truncate and correct instead.
+    static int32_t floorToInt(double a_value)
+    {
+        int32_t truncated = static_cast<int32_t>(a_value);
+        return truncated - ((a_value < truncated) ? 1 : 0);
+    }
+
+    size_t bucketOf(const Cell& a_cell) const
+    {
+        uint32_t hash = (static_cast<uint32_t>(a_cell.x) * 73856093u)
+                      ^ (static_cast<uint32_t>(a_cell.y) * 19349663u)
+                      ^ (static_cast<uint32_t>(a_cell.z) * 83492791u);
+        return hash & (m_heads.size() - 1);
+    }
+
+    void link(int32_t a_index)
+    {
+        int32_t& head = m_heads[bucketOf(m_cells[a_index])];
+        m_previous[a_index] = -1;
+        m_next[a_index] = head;
+        if (head >= 0)
+        {
+            m_previous[head] = a_index;
+        }
+        head = a_index;
+    }
+
+    void unlink(int32_t a_index)
+    {
+        int32_t next = m_next[a_index];
+        int32_t previous = m_previous[a_index];
+        if (previous >= 0)
+        {
+            m_next[previous] = next;
+        }
+        else
+        {
+            m_heads[bucketOf(m_cells[a_index])] = next;
+        }
+        if (next >= 0)
+        {
+            m_previous[next] = previous;
+        }
+    }
+
+    bool fitsReach() const
+    {
+        return m_queryRadius <= 0.0 || m_queryRadius + m_maxRadius <= m_cellSize;
+    }
+
+    void growCells()
+    {
+        m_cellSize = std::max(m_queryRadius + m_maxRadius, 1.5 * m_cellSize);
+        m_inverseCellSize = 1.0 / m_cellSize;
+        rebuild(std::max(m_heads.size(), 2 * size()));
+    }
+
+    /// Resizes the table to the power of two not less than 'a_count' and
+    /// relinks every obstacle.
+    void rebuild(size_t a_count)
+    {
+        size_t bucketCount = 64;
+        while (bucketCount < a_count)
+        {
+            bucketCount *= 2;
+        }
+        m_heads.assign(bucketCount, -1);
+        for (size_t i = 0; i < size(); i++)
+        {
+            m_cells[i] = cellOf(m_centerX[i], m_centerY[i], m_centerZ[i]);
+            link(static_cast<int32_t>(i));
+        }
+    }
+
+    double m_cellSize = DefaultCellSize;
+    double m_inverseCellSize = 1.0 / DefaultCellSize;
+    double m_maxRadius = 0.0;
+    double m_queryRadius = 0.0;
+
+    std::vector<double> m_centerX;
+    std::vector<double> m_centerY;
+    std::vector<double> m_centerZ;
+    std::vector<double> m_radius;
+
+    std::vector<Cell> m_cells;
+    std::vector<int32_t> m_next;
+    std::vector<int32_t> m_previous;
+    std::vector<int32_t> m_heads;
+};
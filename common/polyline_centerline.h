@@ -0,0 +1,355 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Polyline centerline for tube guidance constraints.
+///
+/// The centerline is a list of points joined by segments. The start point,
+/// unit direction and length of every segment are computed once at load
+/// time and stored as a structure of arrays, so that leaves of segments are
+/// scanned with the vectorized SegmentKernel.
+///
+/// Nearest segment search is coherent: each query starts from the segment
+/// found by the previous one and walks along the path while the distance
+/// decreases. That distance then bounds a search in a bounding box tree
+/// built over consecutive runs of segments, so that a fold of the path
+/// passing closer to the tool is never missed: when the tool follows the
+/// path only the few nodes around it are visited, and when it jumps the
+/// same search finds the new nearest segment in logarithmic time.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Project headers
+#include "segment_kernel.h"
+
+class PolylineCenterline
+{
+public:
+    /// Segments shorter than this length in [m] are dropped.
+    static constexpr double MinSegmentLength = 1e-6;
+
+    /// Maximum number of segments visited by the warm start walk.
+    static constexpr int WarmStartSteps = 16;
+
+    /// Number of consecutive segments per tree leaf.
+    static constexpr size_t LeafSize = 8;
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function loads a centerline from a text file holding one point
+    /// "x y z" per line, in [m]. Empty lines and lines starting with '#' are
+    /// ignored. Returns false if the file cannot be read or defines no segment.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool load(const std::string& a_path)
+    {
+        std::ifstream file(a_path);
+        if (!file)
+        {
+            return false;
+        }
+
+        std::vector<std::array<double, 3>> points;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream stream(line);
+            std::array<double, 3> point;
+            if (line.empty() || line[0] == '#' || !(stream >> point[0] >> point[1] >> point[2]))
+            {
+                continue;
+            }
+            points.push_back(point);
+        }
+
+        setPoints(points);
+        return !m_segments.empty();
+    }
+
+    /// Builds the segments and the search tree from a list of points.
+    void setPoints(const std::vector<std::array<double, 3>>& a_points)
+    {
+        m_points = 0;
+        m_segments.clear();
+        m_lastSegment = -1;
+        m_warmStartHits = 0;
+        m_treeHits = 0;
+
+        m_segments.reserve(a_points.size());
+        for (size_t i = 0; i + 1 < a_points.size(); i++)
+        {
+            double direction[3];
+            double lengthSquared = 0.0;
+            for (int j = 0; j < 3; j++)
+            {
+                direction[j] = a_points[i + 1][j] - a_points[i][j];
+                lengthSquared += direction[j] * direction[j];
+            }
+            double length = std::sqrt(lengthSquared);
+            if (length <= MinSegmentLength)
+            {
+                continue;
+            }
+            for (int j = 0; j < 3; j++)
+            {
+                direction[j] /= length;
+            }
+            m_segments.push_back(a_points[i].data(), direction, length);
+        }
+        m_points = a_points.size();
+
+        buildTree();
+    }
+
+    size_t pointCount() const
+    {
+        return m_points;
+    }
+
+    size_t segmentCount() const
+    {
+        return m_segments.size();
+    }
+
+    const SegmentSoA& segments() const
+    {
+        return m_segments;
+    }
+
+    const SegmentKernel& kernel() const
+    {
+        return m_kernel;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function computes the projection of 'a_point' onto the closest
+    /// segment of the centerline and returns the index of that segment, or
+    /// -1 if the centerline is empty (in which case 'a_projection' receives
+    /// 'a_point').
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    int project(const double a_point[3],
+                double a_projection[3])
+    {
+        if (m_segments.empty())
+        {
+            std::copy(a_point, a_point + 3, a_projection);
+            return -1;
+        }
+
+        int best = -1;
+        double bestSquared = DBL_MAX;
+        if (m_lastSegment >= 0)
+        {
+            // Walk from the previous segment while the distance decreases.
+            best = m_lastSegment;
+            bestSquared = SegmentKernel::squaredDistance(m_segments, best, a_point);
+            for (int step = 0; step < WarmStartSteps; step++)
+            {
+                int next = best;
+                double nextSquared = bestSquared;
+                for (int candidate : { best - 1, best + 1 })
+                {
+                    if (candidate >= 0 && candidate < static_cast<int>(m_segments.size()))
+                    {
+                        double squared = SegmentKernel::squaredDistance(m_segments, candidate, a_point);
+                        if (squared < nextSquared)
+                        {
+                            next = candidate;
+                            nextSquared = squared;
+                        }
+                    }
+                }
+                if (next == best)
+                {
+                    break;
+                }
+                best = next;
+                bestSquared = nextSquared;
+            }
+        }
+
+        if (searchTree(a_point, best, bestSquared))
+        {
+            m_treeHits++;
+        }
+        else
+        {
+            m_warmStartHits++;
+        }
+
+        SegmentProjection projection;
+        m_kernel.findClosest(m_segments, best, 1, a_point, 1, &projection);
+        std::copy(projection.point, projection.point + 3, a_projection);
+        m_lastSegment = best;
+        return best;
+    }
+
+    /// Number of queries answered by the walk from the previous segment.
+    uint64_t warmStartHits() const
+    {
+        return m_warmStartHits;
+    }
+
+    /// Number of queries where the tree found a closer segment (jump or fold).
+    uint64_t treeHits() const
+    {
+        return m_treeHits;
+    }
+
+private:
+    struct Box
+    {
+        double min[3];
+        double max[3];
+    };
+
+    void buildTree()
+    {
+        size_t leafCount = (m_segments.size() + LeafSize - 1) / LeafSize;
+        m_leafOffset = 1;
+        while (m_leafOffset < leafCount)
+        {
+            m_leafOffset *= 2;
+        }
+
+        // Empty nodes keep an inverted box, which is infinitely far from any point.
+        Box empty;
+        for (int i = 0; i < 3; i++)
+        {
+            empty.min[i] = DBL_MAX;
+            empty.max[i] = -DBL_MAX;
+        }
+        m_nodes.assign(2 * m_leafOffset, empty);
+
+        for (size_t index = 0; index < m_segments.size(); index++)
+        {
+            double start[3] = { m_segments.startX[index], m_segments.startY[index], m_segments.startZ[index] };
+            double direction[3] = { m_segments.directionX[index], m_segments.directionY[index], m_segments.directionZ[index] };
+            Box& leaf = m_nodes[m_leafOffset + index / LeafSize];
+            for (int i = 0; i < 3; i++)
+            {
+                double end = start[i] + m_segments.length[index] * direction[i];
+                leaf.min[i] = std::min({ leaf.min[i], start[i], end });
+                leaf.max[i] = std::max({ leaf.max[i], start[i], end });
+            }
+        }
+        for (size_t node = m_leafOffset - 1; node >= 1; node--)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                m_nodes[node].min[i] = std::min(m_nodes[2 * node].min[i], m_nodes[2 * node + 1].min[i]);
+                m_nodes[node].max[i] = std::max(m_nodes[2 * node].max[i], m_nodes[2 * node + 1].max[i]);
+            }
+        }
+    }
+
+    static double boxSquaredDistance(const double a_point[3],
+                                     const Box& a_box)
+    {
+        double squared = 0.0;
+        for (int i = 0; i < 3; i++)
+        {
+            double delta = std::max({ a_box.min[i] - a_point[i], 0.0, a_point[i] - a_box.max[i] });
+            squared += delta * delta;
+        }
+        return squared;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function searches the tree for a segment closer than
+    /// 'a_bestSquared', visiting the nearest child first and skipping every
+    /// node farther than the best distance found so far. Returns true if a
+    /// closer segment was found.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool searchTree(const double a_point[3],
+                    int& a_best,
+                    double& a_bestSquared) const
+    {
+        bool improved = false;
+        size_t stack[64];
+        int stackSize = 0;
+        size_t node = 1;
+        while (true)
+        {
+            if (node >= m_leafOffset)
+            {
+                // Scan the leaf segments with the vectorized kernel.
+                size_t first = (node - m_leafOffset) * LeafSize;
+                size_t last = std::min(first + LeafSize, m_segments.size());
+                SegmentProjection projection;
+                projection.squaredDistance = a_bestSquared;
+                m_kernel.findClosest(m_segments, first, last - first, a_point, 1, &projection);
+                if (projection.segment >= 0)
+                {
+                    a_best = projection.segment;
+                    a_bestSquared = projection.squaredDistance;
+                    improved = true;
+                }
+            }
+            else
+            {
+                size_t near = 2 * node;
+                size_t far = 2 * node + 1;
+                double nearSquared = boxSquaredDistance(a_point, m_nodes[near]);
+                double farSquared = boxSquaredDistance(a_point, m_nodes[far]);
+                if (farSquared < nearSquared)
+                {
+                    std::swap(near, far);
+                    std::swap(nearSquared, farSquared);
+                }
+                if (nearSquared < a_bestSquared)
+                {
+                    if (farSquared < a_bestSquared)
+                    {
+                        stack[stackSize++] = far;
+                    }
+                    node = near;
+                    continue;
+                }
+            }
+
+            // Pop the next node that may still hold a closer segment.
+            node = 0;
+            while (stackSize > 0 && node == 0)
+            {
+                size_t candidate = stack[--stackSize];
+                if (boxSquaredDistance(a_point, m_nodes[candidate]) < a_bestSquared)
+                {
+                    node = candidate;
+                }
+            }
+            if (node == 0)
+            {
+                return improved;
+            }
+        }
+    }
+
+    SegmentSoA m_segments;
+    SegmentKernel m_kernel;
+    size_t m_points = 0;
+    int m_lastSegment = -1;
+    uint64_t m_warmStartHits = 0;
+    uint64_t m_treeHits = 0;
+
+    std::vector<Box> m_nodes;
+    size_t m_leafOffset = 1;
+};
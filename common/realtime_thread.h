@@ -0,0 +1,278 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Real-time thread setup for haptic loops.
+///
+/// RealtimeThread starts a std::thread that, before running its body, pins
+/// itself to a dedicated core, switches to a real-time scheduling class and
+/// prefaults its stack. The process memory is locked and the heap prefaulted
+/// beforehand so that the haptic loop takes no page faults after startup.
+///
+/// Every setting may be refused by the OS (e.g. SCHED_FIFO and mlockall
+/// require CAP_SYS_NICE / CAP_IPC_LOCK or matching rlimits on Linux), so each
+/// step is recorded in a RealtimeThreadReport rather than treated as fatal.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+
+// Platform specific headers
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#endif
+
+struct RealtimeThreadConfig
+{
+    /// Core the thread is pinned to, -1 for the last core, -2 to leave it unpinned.
+    int core = -1;
+
+    /// SCHED_FIFO priority on Linux (1 to 99). On Windows any positive value
+    /// selects THREAD_PRIORITY_TIME_CRITICAL, 0 keeps the default priority.
+    int priority = 80;
+
+    /// Lock all current and future process memory in RAM and, with glibc,
+    /// keep freed heap memory mapped (process-wide malloc settings).
+    bool lockMemory = true;
+
+    /// Amount of heap touched and kept mapped before the thread starts, in [bytes].
+    size_t prefaultHeapBytes = 8 * 1024 * 1024;
+};
+
+struct RealtimeThreadReport
+{
+    bool pinned = false;
+    bool realtimeScheduling = false;
+    bool memoryLocked = false;
+    bool mallocTuned = false;
+    bool heapPrefaulted = false;
+    bool stackPrefaulted = false;
+    int core = -1;
+    std::string details;
+
+    void print(std::ostream& a_stream) const
+    {
+        a_stream << "haptic thread: "
+                 << "core " << (pinned ? std::to_string(core) : std::string("not pinned"))
+                 << ", real-time scheduling " << (realtimeScheduling ? "on" : "off")
+                 << ", memory " << (memoryLocked ? "locked" : "not locked")
+                 << ", malloc " << (mallocTuned ? "never trims" : "default")
+                 << ", heap " << (heapPrefaulted ? "prefaulted" : "not prefaulted")
+                 << ", stack " << (stackPrefaulted ? "prefaulted" : "not prefaulted") << std::endl;
+        if (!details.empty())
+        {
+            a_stream << details;
+        }
+    }
+};
+
+class RealtimeThread
+{
+public:
+    /// Size of the stack region touched by the thread before running its body.
+    static constexpr size_t PrefaultStackBytes = 256 * 1024;
+
+    RealtimeThread() = default;
+    RealtimeThread(const RealtimeThread&) = delete;
+    RealtimeThread& operator=(const RealtimeThread&) = delete;
+
+    ~RealtimeThread()
+    {
+        join();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function applies the process-wide settings, starts the thread,
+    /// and returns once the thread has configured itself, so that report()
+    /// is complete when start() returns.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    void start(const RealtimeThreadConfig& a_config,
+               std::function<void()> a_body)
+    {
+        m_report = RealtimeThreadReport {};
+        lockProcessMemory(a_config);
+
+        std::atomic<bool> configured { false };
+        m_thread = std::thread([this, a_config, body = std::move(a_body), &configured]()
+        {
+            configureCurrentThread(a_config);
+            prefaultStack();
+            m_report.stackPrefaulted = true;
+            configured.store(true, std::memory_order_release);
+            body();
+        });
+
+        while (!configured.load(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    void join()
+    {
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    const RealtimeThreadReport& report() const
+    {
+        return m_report;
+    }
+
+private:
+    void fail(const std::string& a_setting,
+              int a_error)
+    {
+        m_report.details += "  warning: " + a_setting + " not applied (" + std::strerror(a_error) + ")\n";
+    }
+
+    void lockProcessMemory(const RealtimeThreadConfig& a_config)
+    {
+#ifdef _WIN32
+        if (a_config.lockMemory)
+        {
+            // Reserve a working set large enough for the process so that its
+            // pages are not trimmed while the haptic loop runs.
+            SIZE_T minimum = 64 * 1024 * 1024 + a_config.prefaultHeapBytes;
+            m_report.memoryLocked = SetProcessWorkingSetSize(GetCurrentProcess(), minimum, 2 * minimum) != 0;
+            if (!m_report.memoryLocked)
+            {
+                m_report.details += "  warning: working set reservation not applied (error " + std::to_string(GetLastError()) + ")\n";
+            }
+        }
+#else
+        if (a_config.lockMemory)
+        {
+            m_report.memoryLocked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+            if (!m_report.memoryLocked)
+            {
+                fail("mlockall", errno);
+            }
+
+#ifdef __GLIBC__
+            // Never give heap memory back to the OS, nor serve allocations with
+            // mmap, so that prefaulted pages stay mapped.
+            m_report.mallocTuned = mallopt(M_TRIM_THRESHOLD, -1) == 1 && mallopt(M_MMAP_MAX, 0) == 1;
+            if (!m_report.mallocTuned)
+            {
+                m_report.details += "  warning: malloc trim and mmap thresholds not applied\n";
+            }
+#endif
+        }
+#endif
+
+        if (a_config.prefaultHeapBytes > 0)
+        {
+            char* block = static_cast<char*>(std::malloc(a_config.prefaultHeapBytes));
+            if (block != nullptr)
+            {
+                for (size_t offset = 0; offset < a_config.prefaultHeapBytes; offset += 4096)
+                {
+                    reinterpret_cast<volatile char*>(block)[offset] = 0;
+                }
+                std::free(block);
+                m_report.heapPrefaulted = true;
+            }
+        }
+    }
+
+    void configureCurrentThread(const RealtimeThreadConfig& a_config)
+    {
+        int coreCount = static_cast<int>(std::thread::hardware_concurrency());
+        int core = (a_config.core == -1) ? coreCount - 1 : a_config.core;
+        if (a_config.core == -1 && coreCount < 2)
+        {
+            // Leave a single core machine alone.
+            core = -2;
+        }
+
+#ifdef _WIN32
+        if (core >= 0)
+        {
+            m_report.pinned = SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+            m_report.core = core;
+            if (!m_report.pinned)
+            {
+                m_report.details += "  warning: thread affinity not applied (error " + std::to_string(GetLastError()) + ")\n";
+            }
+        }
+        if (a_config.priority > 0)
+        {
+            m_report.realtimeScheduling = SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+            if (!m_report.realtimeScheduling)
+            {
+                m_report.details += "  warning: thread priority not applied (error " + std::to_string(GetLastError()) + ")\n";
+            }
+        }
+#else
+#ifdef __linux__
+        if (core >= 0)
+        {
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(core, &cpuSet);
+            int error = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+            m_report.pinned = (error == 0);
+            m_report.core = core;
+            if (error != 0)
+            {
+                fail("thread affinity", error);
+            }
+        }
+#endif
+        if (a_config.priority > 0)
+        {
+            sched_param parameters {};
+            parameters.sched_priority = a_config.priority;
+            int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters);
+            m_report.realtimeScheduling = (error == 0);
+            if (error != 0)
+            {
+                fail("SCHED_FIFO", error);
+            }
+        }
+#endif
+    }
+
+    static void prefaultStack()
+    {
+        // Read every touched page back, so that the compiler keeps the buffer.
+        volatile unsigned char stack[PrefaultStackBytes];
+        unsigned char touched = 0;
+        for (size_t offset = 0; offset < PrefaultStackBytes; offset += 4096)
+        {
+            stack[offset] = 0;
+            touched |= stack[offset];
+        }
+        (void)touched;
+    }
+
+    std::thread m_thread;
+    RealtimeThreadReport m_report;
+};
@@ -0,0 +1,261 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Rigid body dynamics at a fixed time step.
+///
+/// RigidBody integrates a body with a quaternion orientation, a mass and a
+/// diagonal inertia tensor in body coordinates (principal axes), with
+/// semi-implicit (symplectic) Euler steps: velocities are updated from the
+/// accumulated forces and torques first, including the gyroscopic torque,
+/// then the pose is advanced with the new velocities. Damping is applied
+/// implicitly, so it is stable for any time step. A body slower than
+/// RestVelocity is put to rest, so that a damped body reaches exact zero
+/// instead of going through denormal numbers, and costs nothing to step.
+///
+/// The orientation is advanced with the first order quaternion derivative,
+/// without trigonometric functions, and its rotation matrix is computed once
+/// per step for both the dynamics and the callers. It is renormalized every
+/// RenormalizationInterval steps. The norm error between renormalizations
+/// stays below (|w| dt)^2 RenormalizationInterval / 8, i.e. 1e-5 for a body
+/// spinning at 3 rad/s with 1 ms steps.
+///
+/// FixedStepAccumulator turns variable wall clock time steps into a whole
+/// number of fixed steps, carrying the remainder over to the next call, so
+/// that a simulation gives the same result whatever the rate and jitter of
+/// the loop that runs it:
+///
+///   for (int steps = accumulator.advance(elapsed); steps > 0; steps--)
+///   {
+///       body.step(accumulator.step());
+///   }
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <cmath>
+
+// Eigen library header
+#include <Eigen/Dense>
+
+class RigidBody
+{
+public:
+    /// The orientation is renormalized every this many steps.
+    static constexpr int RenormalizationInterval = 8;
+
+    /// Linear and angular speeds under which the body is put to rest, in [m/s] and [rad/s].
+    static constexpr double RestVelocity = 1e-9;
+
+    /// Position of the center of mass.
+    Eigen::Vector3d position = Eigen::Vector3d::Zero();
+
+    /// Linear and angular velocities in world coordinates, in [m/s] and [rad/s].
+    Eigen::Vector3d linearVelocity = Eigen::Vector3d::Zero();
+    Eigen::Vector3d angularVelocity = Eigen::Vector3d::Zero();
+
+    /// Linear and angular damping in [1/s].
+    double linearDamping = 0.0;
+    double angularDamping = 0.0;
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function sets the mass in [kg] and the principal moments of
+    /// inertia about the center of mass, along the body axes, in [kg m^2]. A
+    /// null mass makes the body immovable in translation, e.g. for a body
+    /// pinned at its center.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    void setMass(double a_mass,
+                 const Eigen::Vector3d& a_inertia)
+    {
+        m_inverseMass = (a_mass > 0.0) ? 1.0 / a_mass : 0.0;
+        m_inertia = a_inertia;
+        m_inverseInertia = a_inertia.cwiseInverse();
+    }
+
+    /// Principal moments of inertia of a solid torus of axis z, of radius 'a_major' of the medial circle and 'a_minor' of the tube.
+    static Eigen::Vector3d torusInertia(double a_mass,
+                                        double a_major,
+                                        double a_minor)
+    {
+        double axial = a_mass * (a_major * a_major + 0.75 * a_minor * a_minor);
+        double diametral = a_mass * (0.5 * a_major * a_major + 0.625 * a_minor * a_minor);
+        return Eigen::Vector3d(diametral, diametral, axial);
+    }
+
+    /// Principal moments of inertia of a solid sphere of radius 'a_radius'.
+    static Eigen::Vector3d sphereInertia(double a_mass,
+                                         double a_radius)
+    {
+        return Eigen::Vector3d::Constant(0.4 * a_mass * a_radius * a_radius);
+    }
+
+    /// Principal moments of inertia of a solid box of edge lengths 'a_size'.
+    static Eigen::Vector3d boxInertia(double a_mass,
+                                      const Eigen::Vector3d& a_size)
+    {
+        Eigen::Vector3d squared = a_size.cwiseProduct(a_size);
+        return a_mass / 12.0 * Eigen::Vector3d(squared(1) + squared(2), squared(0) + squared(2), squared(0) + squared(1));
+    }
+
+    /// Orientation, body to world.
+    const Eigen::Quaterniond& orientation() const
+    {
+        return m_orientation;
+    }
+
+    /// Orientation as a rotation matrix.
+    const Eigen::Matrix3d& rotation() const
+    {
+        return m_rotation;
+    }
+
+    void setOrientation(const Eigen::Quaterniond& a_orientation)
+    {
+        m_orientation = a_orientation.normalized();
+        m_rotation = m_orientation.toRotationMatrix();
+        m_steps = 0;
+    }
+
+    /// Accumulates 'a_force' applied at 'a_point' in world coordinates until the next step.
+    void applyForce(const Eigen::Vector3d& a_force,
+                    const Eigen::Vector3d& a_point)
+    {
+        m_force += a_force;
+        m_torque += (a_point - position).cross(a_force);
+    }
+
+    /// Accumulates 'a_torque' in world coordinates until the next step.
+    void applyTorque(const Eigen::Vector3d& a_torque)
+    {
+        m_torque += a_torque;
+    }
+
+    /// Changes the velocities at once by 'a_impulse' applied at 'a_point' in world coordinates.
+    void applyImpulse(const Eigen::Vector3d& a_impulse,
+                      const Eigen::Vector3d& a_point)
+    {
+        linearVelocity += m_inverseMass * a_impulse;
+        applyAngularImpulse((a_point - position).cross(a_impulse));
+    }
+
+    /// Changes the angular velocity at once by 'a_angularImpulse' in world coordinates.
+    void applyAngularImpulse(const Eigen::Vector3d& a_angularImpulse)
+    {
+        angularVelocity += m_rotation * m_inverseInertia.cwiseProduct(m_rotation.transpose() * a_angularImpulse);
+    }
+
+    /// Stops the body and discards the accumulated forces and torques.
+    void stop()
+    {
+        linearVelocity.setZero();
+        angularVelocity.setZero();
+        m_force.setZero();
+        m_torque.setZero();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function advances the body by 'a_timeStep' in [s] under the
+    /// accumulated forces and torques, then clears them.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    void step(double a_timeStep)
+    {
+        // Update the linear velocity, then the position.
+        linearVelocity = (linearVelocity + (a_timeStep * m_inverseMass) * m_force) / (1.0 + linearDamping * a_timeStep);
+        if (linearVelocity.squaredNorm() < RestVelocity * RestVelocity)
+        {
+            linearVelocity.setZero();
+        }
+        position += a_timeStep * linearVelocity;
+        m_force.setZero();
+
+        // Update the angular velocity in body coordinates, where the inertia
+        // tensor is constant, with the gyroscopic torque w x (I w).
+        Eigen::Vector3d bodyVelocity = m_rotation.transpose() * angularVelocity;
+        Eigen::Vector3d bodyTorque = m_rotation.transpose() * m_torque - bodyVelocity.cross(m_inertia.cwiseProduct(bodyVelocity));
+        bodyVelocity += a_timeStep * m_inverseInertia.cwiseProduct(bodyTorque);
+        angularVelocity = m_rotation * bodyVelocity / (1.0 + angularDamping * a_timeStep);
+        m_torque.setZero();
+        if (angularVelocity.squaredNorm() < RestVelocity * RestVelocity)
+        {
+            angularVelocity.setZero();
+            return;
+        }
+
+        // Advance the orientation: dq/dt = 1/2 (0, w) q.
+        Eigen::Quaterniond spin(0.0, angularVelocity(0), angularVelocity(1), angularVelocity(2));
+        m_orientation.coeffs() += (0.5 * a_timeStep) * (spin * m_orientation).coeffs();
+        if (++m_steps >= RenormalizationInterval)
+        {
+            m_orientation.normalize();
+            m_steps = 0;
+        }
+        m_rotation = m_orientation.toRotationMatrix();
+    }
+
+private:
+    Eigen::Quaterniond m_orientation = Eigen::Quaterniond::Identity();
+    Eigen::Matrix3d m_rotation = Eigen::Matrix3d::Identity();
+    double m_inverseMass = 1.0;
+    Eigen::Vector3d m_inertia = Eigen::Vector3d::Ones();
+    Eigen::Vector3d m_inverseInertia = Eigen::Vector3d::Ones();
+    Eigen::Vector3d m_force = Eigen::Vector3d::Zero();
+    Eigen::Vector3d m_torque = Eigen::Vector3d::Zero();
+    int m_steps = 0;
+};
+
+class FixedStepAccumulator
+{
+public:
+    /// Elapsed time beyond this many steps per call is dropped, so that a
+    /// stalled loop does not try to catch up with an ever longer burst.
+    static constexpr int DefaultMaxSteps = 10;
+
+    explicit FixedStepAccumulator(double a_step = 1e-3,
+                                  int a_maxSteps = DefaultMaxSteps) :
+        m_step(a_step),
+        m_maxSteps(a_maxSteps)
+    {}
+
+    /// Fixed time step in [s].
+    double step() const
+    {
+        return m_step;
+    }
+
+    /// Time carried over to the next call in [s], less than one step.
+    double remainder() const
+    {
+        return m_accumulated;
+    }
+
+    void reset()
+    {
+        m_accumulated = 0.0;
+    }
+
+    /// Adds 'a_elapsed' in [s] and returns the number of fixed steps to run now.
+    int advance(double a_elapsed)
+    {
+        m_accumulated += std::max(a_elapsed, 0.0);
+        int steps = static_cast<int>(m_accumulated / m_step);
+        if (steps > m_maxSteps)
+        {
+            m_accumulated = 0.0;
+            return m_maxSteps;
+        }
+        m_accumulated -= steps * m_step;
+        return steps;
+    }
+
+private:
+    double m_step;
+    int m_maxSteps;
+    double m_accumulated = 0.0;
+};
@@ -0,0 +1,426 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Bricked signed distance field, memory-mapped from a baked file.
+///
+/// The field covers a box of cells split into bricks of 7 x 7 x 7 cells.
+/// Only bricks crossing the narrow band around the surface are stored, as
+/// 8 x 8 x 8 samples (the last layer duplicates the first layer of the next
+/// brick) so that any cell is interpolated from a single brick. Bricks away
+/// from the surface are flagged as entirely inside or outside.
+///
+/// File layout (little-endian):
+///
+///   SdfFileHeader                  64-byte aligned
+///   uint32_t index[brick count]    brick slot, or EmptyOutside / EmptyInside
+///   int16_t  samples[stored][512]  64-byte aligned, distance = sample * quantization
+///   float    interior[corners]     64-byte aligned, distance at the brick corners
+///
+/// The file is mapped read-only, so opening it costs no parsing nor copy.
+/// A haptic query is one brick index lookup and one trilinear interpolation,
+/// which also yields the gradient, whatever the complexity of the shape.
+///
+/// Inside the object, beyond the narrow band, the stored distance is clamped
+/// and has no gradient. The baker therefore also stores a coarse interior
+/// field, the distance at the (brickCount + 1)^3 brick corners, interpolated
+/// like the fine field. Deeper than the band, the distance and gradient come
+/// from it, so a tool pushed deep into the object is still pushed out.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Platform specific headers
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct SdfFileHeader
+{
+    static constexpr uint32_t Magic = 0x46445348;
+    static constexpr uint32_t Version = 2;
+    static constexpr uint32_t BrickCells = 7;
+    static constexpr uint32_t BrickSamples = BrickCells + 1;
+    static constexpr uint32_t SamplesPerBrick = BrickSamples * BrickSamples * BrickSamples;
+    static constexpr uint32_t EmptyOutside = 0xFFFFFFFF;
+    static constexpr uint32_t EmptyInside = 0xFFFFFFFE;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t brickCells;
+    uint32_t brickCount[3];
+    uint32_t storedBricks;
+
+    /// Position of the first sample and distance between samples, in [m].
+    float origin[3];
+    float voxelSize;
+
+    /// Distances are clamped to [-band, band], and stored as int16 multiples of quantization.
+    float band;
+    float quantization;
+
+    uint64_t indexOffset;
+    uint64_t brickOffset;
+    uint64_t interiorOffset;
+    uint64_t fileSize;
+
+    char description[64];
+};
+
+static_assert(sizeof(SdfFileHeader) % 8 == 0, "SDF header must keep 64-bit fields aligned");
+
+class SdfField
+{
+public:
+    SdfField() = default;
+    SdfField(const SdfField&) = delete;
+    SdfField& operator=(const SdfField&) = delete;
+
+    ~SdfField()
+    {
+        close();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function maps the baked field 'a_path'. Returns false if the file
+    /// cannot be mapped or is not a valid field of a supported version, in
+    /// which case lastError() describes the problem.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool open(const std::string& a_path)
+    {
+        close();
+        if (!map(a_path))
+        {
+            return false;
+        }
+
+        const SdfFileHeader* header = reinterpret_cast<const SdfFileHeader*>(m_data);
+        if (m_size < sizeof(SdfFileHeader) || header->magic != SdfFileHeader::Magic)
+        {
+            return fail("not a signed distance field file");
+        }
+        if (header->version != SdfFileHeader::Version || header->headerSize != sizeof(SdfFileHeader)
+            || header->brickCells != SdfFileHeader::BrickCells)
+        {
+            return fail("unsupported signed distance field version");
+        }
+
+        uint64_t brickCount = uint64_t(header->brickCount[0]) * header->brickCount[1] * header->brickCount[2];
+        if (header->fileSize != m_size
+            || header->indexOffset + brickCount * sizeof(uint32_t) > m_size
+            || header->brickOffset % 64 != 0
+            || header->brickOffset + uint64_t(header->storedBricks) * SdfFileHeader::SamplesPerBrick * sizeof(int16_t) > m_size
+            || header->interiorOffset % 64 != 0
+            || header->interiorOffset + cornerCount(*header) * sizeof(float) > m_size)
+        {
+            return fail("truncated signed distance field file");
+        }
+
+        m_header = header;
+        m_index = reinterpret_cast<const uint32_t*>(m_data + header->indexOffset);
+        m_bricks = reinterpret_cast<const int16_t*>(m_data + header->brickOffset);
+        m_interior = reinterpret_cast<const float*>(m_data + header->interiorOffset);
+        m_cells[0] = static_cast<int>(header->brickCount[0] * SdfFileHeader::BrickCells);
+        m_cells[1] = static_cast<int>(header->brickCount[1] * SdfFileHeader::BrickCells);
+        m_cells[2] = static_cast<int>(header->brickCount[2] * SdfFileHeader::BrickCells);
+        m_inverseVoxelSize = 1.0 / header->voxelSize;
+
+        for (uint64_t i = 0; i < brickCount; i++)
+        {
+            if (m_index[i] < SdfFileHeader::EmptyInside && m_index[i] >= header->storedBricks)
+            {
+                return fail("corrupted brick index");
+            }
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (m_data != nullptr)
+        {
+            UnmapViewOfFile(m_data);
+        }
+        if (m_mapping != nullptr)
+        {
+            CloseHandle(m_mapping);
+        }
+        if (m_file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(m_file);
+        }
+        m_mapping = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_data != nullptr)
+        {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+#endif
+        m_data = nullptr;
+        m_size = 0;
+        m_header = nullptr;
+        m_interior = nullptr;
+    }
+
+    bool isOpen() const
+    {
+        return m_header != nullptr;
+    }
+
+    const std::string& lastError() const
+    {
+        return m_error;
+    }
+
+    const SdfFileHeader& header() const
+    {
+        return *m_header;
+    }
+
+    /// Size of the mapped file in [bytes].
+    size_t memoryBytes() const
+    {
+        return m_size;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function touches every page of the mapping. Call it before the
+    /// haptic loop starts so that queries never take a page fault.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    void prefault() const
+    {
+        volatile char sum = 0;
+        for (size_t offset = 0; offset < m_size; offset += 4096)
+        {
+            sum = sum + m_data[offset];
+        }
+        (void)sum;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function returns the signed distance at 'a_point' (negative
+    /// inside) and its gradient in 'a_gradient'. Outside the object beyond the
+    /// narrow band, and outside the field, the distance is clamped to band and
+    /// the gradient is zero. Inside beyond the band, the distance and gradient
+    /// are those of the coarse interior field.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    double sample(const double a_point[3],
+                  double a_gradient[3]) const
+    {
+        const SdfFileHeader& header = *m_header;
+        int cell[3];
+        double fraction[3];
+        for (int i = 0; i < 3; i++)
+        {
+            double coordinate = (a_point[i] - header.origin[i]) * m_inverseVoxelSize;
+            if (!(coordinate >= 0.0 && coordinate <= m_cells[i]))
+            {
+                a_gradient[0] = a_gradient[1] = a_gradient[2] = 0.0;
+                return header.band;
+            }
+            cell[i] = std::min(static_cast<int>(coordinate), m_cells[i] - 1);
+            fraction[i] = coordinate - cell[i];
+        }
+
+        int brick[3];
+        int local[3];
+        for (int i = 0; i < 3; i++)
+        {
+            brick[i] = cell[i] / static_cast<int>(SdfFileHeader::BrickCells);
+            local[i] = cell[i] - brick[i] * static_cast<int>(SdfFileHeader::BrickCells);
+        }
+
+        size_t brickIndex = (size_t(brick[2]) * header.brickCount[1] + brick[1]) * header.brickCount[0] + brick[0];
+        uint32_t slot = m_index[brickIndex];
+        if (slot == SdfFileHeader::EmptyOutside)
+        {
+            a_gradient[0] = a_gradient[1] = a_gradient[2] = 0.0;
+            return header.band;
+        }
+        if (slot == SdfFileHeader::EmptyInside)
+        {
+            return sampleInterior(a_point, brickIndex, a_gradient);
+        }
+
+        // Load the 8 corners of the cell.
+        constexpr int Stride = SdfFileHeader::BrickSamples;
+        const int16_t* base = m_bricks + size_t(slot) * SdfFileHeader::SamplesPerBrick
+                            + (local[2] * Stride + local[1]) * Stride + local[0];
+        double c000 = base[0];
+        double c100 = base[1];
+        double c010 = base[Stride];
+        double c110 = base[Stride + 1];
+        double c001 = base[Stride * Stride];
+        double c101 = base[Stride * Stride + 1];
+        double c011 = base[Stride * Stride + Stride];
+        double c111 = base[Stride * Stride + Stride + 1];
+
+        // Trilinear interpolation and its analytic derivatives.
+        double x = fraction[0];
+        double y = fraction[1];
+        double z = fraction[2];
+        double c00 = c000 + x * (c100 - c000);
+        double c10 = c010 + x * (c110 - c010);
+        double c01 = c001 + x * (c101 - c001);
+        double c11 = c011 + x * (c111 - c011);
+        double c0 = c00 + y * (c10 - c00);
+        double c1 = c01 + y * (c11 - c01);
+
+        double dx0 = (c100 - c000) + y * ((c110 - c010) - (c100 - c000));
+        double dx1 = (c101 - c001) + y * ((c111 - c011) - (c101 - c001));
+        double scale = header.quantization * m_inverseVoxelSize;
+        a_gradient[0] = (dx0 + z * (dx1 - dx0)) * scale;
+        a_gradient[1] = ((c10 - c00) + z * ((c11 - c01) - (c10 - c00))) * scale;
+        a_gradient[2] = (c1 - c0) * scale;
+
+        // A corner clamped inside distorts the gradient, down to zero when all
+        // are: continue with the interior field, as in an empty inside brick.
+        double lowest = std::min({ c000, c100, c010, c110, c001, c101, c011, c111 });
+        if (lowest * header.quantization <= -header.band + header.quantization)
+        {
+            return sampleInterior(a_point, brickIndex, a_gradient);
+        }
+        return (c0 + z * (c1 - c0)) * header.quantization;
+    }
+
+    /// Number of interior field samples, one per brick corner.
+    static uint64_t cornerCount(const SdfFileHeader& a_header)
+    {
+        return uint64_t(a_header.brickCount[0] + 1) * (a_header.brickCount[1] + 1) * (a_header.brickCount[2] + 1);
+    }
+
+private:
+    /// Distance and gradient of the coarse interior field, at least band deep.
+    double sampleInterior(const double a_point[3],
+                          size_t a_brick,
+                          double a_gradient[3]) const
+    {
+        const SdfFileHeader& header = *m_header;
+
+        // Corner (0, 0, 0) of the brick and position of the point in the brick.
+        size_t brick[3] = { a_brick % header.brickCount[0],
+                            (a_brick / header.brickCount[0]) % header.brickCount[1],
+                            a_brick / (size_t(header.brickCount[0]) * header.brickCount[1]) };
+        double brickSize = header.voxelSize * SdfFileHeader::BrickCells;
+        double fraction[3];
+        for (int i = 0; i < 3; i++)
+        {
+            fraction[i] = std::clamp((a_point[i] - header.origin[i]) / brickSize - brick[i], 0.0, 1.0);
+        }
+        size_t strideY = header.brickCount[0] + 1;
+        size_t strideZ = strideY * (header.brickCount[1] + 1);
+        const float* base = m_interior + (brick[2] * strideZ + brick[1] * strideY + brick[0]);
+        double c000 = base[0];
+        double c100 = base[1];
+        double c010 = base[strideY];
+        double c110 = base[strideY + 1];
+        double c001 = base[strideZ];
+        double c101 = base[strideZ + 1];
+        double c011 = base[strideZ + strideY];
+        double c111 = base[strideZ + strideY + 1];
+
+        double x = fraction[0];
+        double y = fraction[1];
+        double z = fraction[2];
+        double c00 = c000 + x * (c100 - c000);
+        double c10 = c010 + x * (c110 - c010);
+        double c01 = c001 + x * (c101 - c001);
+        double c11 = c011 + x * (c111 - c011);
+        double c0 = c00 + y * (c10 - c00);
+        double c1 = c01 + y * (c11 - c01);
+
+        double dx0 = (c100 - c000) + y * ((c110 - c010) - (c100 - c000));
+        double dx1 = (c101 - c001) + y * ((c111 - c011) - (c101 - c001));
+        double scale = 1.0 / brickSize;
+        a_gradient[0] = (dx0 + z * (dx1 - dx0)) * scale;
+        a_gradient[1] = ((c10 - c00) + z * ((c11 - c01) - (c10 - c00))) * scale;
+        a_gradient[2] = (c1 - c0) * scale;
+        return std::min(c0 + z * (c1 - c0), -static_cast<double>(header.band));
+    }
+
+    bool fail(const std::string& a_error)
+    {
+        m_error = a_error;
+        close();
+        return false;
+    }
+
+    bool map(const std::string& a_path)
+    {
+#ifdef _WIN32
+        m_file = CreateFileA(a_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER size;
+        if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+        {
+            return fail("cannot open " + a_path);
+        }
+        m_size = static_cast<size_t>(size.QuadPart);
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        m_data = (m_mapping != nullptr) ? static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+        if (m_data == nullptr)
+        {
+            return fail("cannot map " + a_path);
+        }
+#else
+        int fd = ::open(a_path.c_str(), O_RDONLY);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0 || status.st_size == 0)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            return fail("cannot open " + a_path);
+        }
+        void* address = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED)
+        {
+            return fail("cannot map " + a_path);
+        }
+        m_data = static_cast<const char*>(address);
+        m_size = static_cast<size_t>(status.st_size);
+#endif
+        return true;
+    }
+
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    const SdfFileHeader* m_header = nullptr;
+    const uint32_t* m_index = nullptr;
+    const int16_t* m_bricks = nullptr;
+    int m_cells[3] = {};
+    double m_inverseVoxelSize = 1.0;
+    const float* m_interior = nullptr;
+    std::string m_error;
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#endif
+};
@@ -0,0 +1,407 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Batched point to segment projection.
+///
+/// Segments are stored as a structure of arrays (start, unit direction and
+/// length in separate arrays) so that AVX2 and SSE2 can process four or two
+/// segments per instruction. The kernel projects one or more points onto a
+/// range of segments and keeps, for each point, the closest projection.
+///
+/// The instruction set is selected at run time; every path performs the same
+/// floating-point operations in the same order (no FMA), so all of them
+/// return bit-identical results, ties going to the lowest segment index.
+/// This holds only if the compiler does not contract the scalar path into
+/// FMA: targets including this header build with -ffp-contract=off
+/// (/fp:precise with MSVC).
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <vector>
+
+// Platform specific headers
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SEGMENT_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(SEGMENT_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SEGMENT_KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SEGMENT_KERNEL_TARGET(isa)
+#endif
+
+class SegmentSoA
+{
+public:
+    void clear()
+    {
+        for (std::vector<double>* array : arrays())
+        {
+            array->clear();
+        }
+    }
+
+    void reserve(size_t a_count)
+    {
+        for (std::vector<double>* array : arrays())
+        {
+            array->reserve(a_count);
+        }
+    }
+
+    /// Appends a segment given by its start point, unit direction and length.
+    void push_back(const double a_start[3],
+                   const double a_direction[3],
+                   double a_length)
+    {
+        startX.push_back(a_start[0]);
+        startY.push_back(a_start[1]);
+        startZ.push_back(a_start[2]);
+        directionX.push_back(a_direction[0]);
+        directionY.push_back(a_direction[1]);
+        directionZ.push_back(a_direction[2]);
+        length.push_back(a_length);
+    }
+
+    size_t size() const
+    {
+        return length.size();
+    }
+
+    bool empty() const
+    {
+        return length.empty();
+    }
+
+    std::vector<double> startX;
+    std::vector<double> startY;
+    std::vector<double> startZ;
+    std::vector<double> directionX;
+    std::vector<double> directionY;
+    std::vector<double> directionZ;
+    std::vector<double> length;
+
+private:
+    std::vector<std::vector<double>*> arrays()
+    {
+        return { &startX, &startY, &startZ, &directionX, &directionY, &directionZ, &length };
+    }
+};
+
+struct SegmentProjection
+{
+    double point[3] = {};
+    double squaredDistance = DBL_MAX;
+    int segment = -1;
+};
+
+class SegmentKernel
+{
+public:
+    enum class Isa
+    {
+        Scalar,
+        Sse2,
+        Avx2
+    };
+
+    /// Returns the widest instruction set supported by the CPU and the OS.
+    static Isa detect()
+    {
+#if defined(SEGMENT_KERNEL_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] >= 7)
+        {
+            __cpuid(info, 1);
+            bool osSavesAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+            __cpuidex(info, 7, 0);
+            if (osSavesAvx && (info[1] & (1 << 5)) != 0)
+            {
+                return Isa::Avx2;
+            }
+        }
+        return Isa::Sse2;
+#elif defined(SEGMENT_KERNEL_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return Isa::Avx2;
+        }
+        return __builtin_cpu_supports("sse2") ? Isa::Sse2 : Isa::Scalar;
+#else
+        return Isa::Scalar;
+#endif
+    }
+
+    static const char* name(Isa a_isa)
+    {
+        switch (a_isa)
+        {
+            case Isa::Avx2: return "avx2";
+            case Isa::Sse2: return "sse2";
+            default: return "scalar";
+        }
+    }
+
+    SegmentKernel() :
+        m_isa(detect())
+    {
+    }
+
+    /// Selects an instruction set, clamped to what the CPU supports.
+    explicit SegmentKernel(Isa a_isa) :
+        m_isa(std::min(a_isa, detect()))
+    {
+    }
+
+    Isa isa() const
+    {
+        return m_isa;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function projects 'a_pointCount' points (x, y, z interleaved in
+    /// 'a_points') onto the segments [a_first, a_first + a_count) of
+    /// 'a_segments'. Each entry of 'a_results' is replaced only if one of the
+    /// segments is strictly closer to its point than the current entry, so
+    /// the function can be called on successive ranges; initialize the
+    /// results with default constructed SegmentProjection values.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    void findClosest(const SegmentSoA& a_segments,
+                     size_t a_first,
+                     size_t a_count,
+                     const double* a_points,
+                     size_t a_pointCount,
+                     SegmentProjection* a_results) const
+    {
+        for (size_t i = 0; i < a_pointCount; i++)
+        {
+            const double* point = a_points + 3 * i;
+            double bestSquared = a_results[i].squaredDistance;
+            size_t best = SIZE_MAX;
+
+            size_t index = a_first;
+            size_t last = a_first + a_count;
+#ifdef SEGMENT_KERNEL_X86
+            if (m_isa == Isa::Avx2)
+            {
+                index = closestAvx2(a_segments, index, last, point, bestSquared, best);
+            }
+            else if (m_isa == Isa::Sse2)
+            {
+                index = closestSse2(a_segments, index, last, point, bestSquared, best);
+            }
+#endif
+            closestScalar(a_segments, index, last, point, bestSquared, best);
+
+            if (best != SIZE_MAX)
+            {
+                SegmentProjection& result = a_results[i];
+                double ratio = projectionRatio(a_segments, best, point);
+                result.point[0] = a_segments.startX[best] + ratio * a_segments.directionX[best];
+                result.point[1] = a_segments.startY[best] + ratio * a_segments.directionY[best];
+                result.point[2] = a_segments.startZ[best] + ratio * a_segments.directionZ[best];
+                result.squaredDistance = bestSquared;
+                result.segment = static_cast<int>(best);
+            }
+        }
+    }
+
+    /// Squared distance from a point to one segment, as computed by every path.
+    static double squaredDistance(const SegmentSoA& a_segments,
+                                  size_t a_index,
+                                  const double a_point[3])
+    {
+        double ratio = projectionRatio(a_segments, a_index, a_point);
+        double dx = (a_segments.startX[a_index] + ratio * a_segments.directionX[a_index]) - a_point[0];
+        double dy = (a_segments.startY[a_index] + ratio * a_segments.directionY[a_index]) - a_point[1];
+        double dz = (a_segments.startZ[a_index] + ratio * a_segments.directionZ[a_index]) - a_point[2];
+        return (dx * dx + dy * dy) + dz * dz;
+    }
+
+private:
+    static double projectionRatio(const SegmentSoA& a_segments,
+                                  size_t a_index,
+                                  const double a_point[3])
+    {
+        double ratio = ((a_point[0] - a_segments.startX[a_index]) * a_segments.directionX[a_index]
+                      + (a_point[1] - a_segments.startY[a_index]) * a_segments.directionY[a_index])
+                      + (a_point[2] - a_segments.startZ[a_index]) * a_segments.directionZ[a_index];
+        return std::min(std::max(ratio, 0.0), a_segments.length[a_index]);
+    }
+
+    static void closestScalar(const SegmentSoA& a_segments,
+                              size_t a_index,
+                              size_t a_last,
+                              const double a_point[3],
+                              double& a_bestSquared,
+                              size_t& a_best)
+    {
+        for (; a_index < a_last; a_index++)
+        {
+            double squared = squaredDistance(a_segments, a_index, a_point);
+            if (squared < a_bestSquared)
+            {
+                a_bestSquared = squared;
+                a_best = a_index;
+            }
+        }
+    }
+
+#ifdef SEGMENT_KERNEL_X86
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// The vector paths keep the closest segment of each lane, then reduce the
+    /// lanes, and return the first index left for the scalar tail.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    SEGMENT_KERNEL_TARGET("avx2")
+    static size_t closestAvx2(const SegmentSoA& a_segments,
+                              size_t a_index,
+                              size_t a_last,
+                              const double a_point[3],
+                              double& a_bestSquared,
+                              size_t& a_best)
+    {
+        if (a_last - a_index < 4)
+        {
+            return a_index;
+        }
+
+        __m256d px = _mm256_set1_pd(a_point[0]);
+        __m256d py = _mm256_set1_pd(a_point[1]);
+        __m256d pz = _mm256_set1_pd(a_point[2]);
+        __m256d zero = _mm256_setzero_pd();
+        __m256d bestSquared = _mm256_set1_pd(a_bestSquared);
+        __m256d bestIndex = _mm256_set1_pd(-1.0);
+        __m256d laneIndex = _mm256_setr_pd(0.0, 1.0, 2.0, 3.0);
+
+        for (; a_index + 4 <= a_last; a_index += 4)
+        {
+            __m256d sx = _mm256_loadu_pd(&a_segments.startX[a_index]);
+            __m256d sy = _mm256_loadu_pd(&a_segments.startY[a_index]);
+            __m256d sz = _mm256_loadu_pd(&a_segments.startZ[a_index]);
+            __m256d dx = _mm256_loadu_pd(&a_segments.directionX[a_index]);
+            __m256d dy = _mm256_loadu_pd(&a_segments.directionY[a_index]);
+            __m256d dz = _mm256_loadu_pd(&a_segments.directionZ[a_index]);
+            __m256d length = _mm256_loadu_pd(&a_segments.length[a_index]);
+
+            __m256d ratio = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(px, sx), dx),
+                                                        _mm256_mul_pd(_mm256_sub_pd(py, sy), dy)),
+                                          _mm256_mul_pd(_mm256_sub_pd(pz, sz), dz));
+            ratio = _mm256_min_pd(_mm256_max_pd(ratio, zero), length);
+
+            __m256d ex = _mm256_sub_pd(_mm256_add_pd(sx, _mm256_mul_pd(ratio, dx)), px);
+            __m256d ey = _mm256_sub_pd(_mm256_add_pd(sy, _mm256_mul_pd(ratio, dy)), py);
+            __m256d ez = _mm256_sub_pd(_mm256_add_pd(sz, _mm256_mul_pd(ratio, dz)), pz);
+            __m256d squared = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ex, ex), _mm256_mul_pd(ey, ey)), _mm256_mul_pd(ez, ez));
+
+            __m256d closer = _mm256_cmp_pd(squared, bestSquared, _CMP_LT_OQ);
+            __m256d index = _mm256_add_pd(_mm256_set1_pd(static_cast<double>(a_index)), laneIndex);
+            bestSquared = _mm256_blendv_pd(bestSquared, squared, closer);
+            bestIndex = _mm256_blendv_pd(bestIndex, index, closer);
+        }
+
+        alignas(32) double squared[4];
+        alignas(32) double index[4];
+        _mm256_store_pd(squared, bestSquared);
+        _mm256_store_pd(index, bestIndex);
+        reduceLanes(squared, index, 4, a_bestSquared, a_best);
+        return a_index;
+    }
+
+    SEGMENT_KERNEL_TARGET("sse2")
+    static size_t closestSse2(const SegmentSoA& a_segments,
+                              size_t a_index,
+                              size_t a_last,
+                              const double a_point[3],
+                              double& a_bestSquared,
+                              size_t& a_best)
+    {
+        if (a_last - a_index < 2)
+        {
+            return a_index;
+        }
+
+        __m128d px = _mm_set1_pd(a_point[0]);
+        __m128d py = _mm_set1_pd(a_point[1]);
+        __m128d pz = _mm_set1_pd(a_point[2]);
+        __m128d zero = _mm_setzero_pd();
+        __m128d bestSquared = _mm_set1_pd(a_bestSquared);
+        __m128d bestIndex = _mm_set1_pd(-1.0);
+        __m128d laneIndex = _mm_setr_pd(0.0, 1.0);
+
+        for (; a_index + 2 <= a_last; a_index += 2)
+        {
+            __m128d sx = _mm_loadu_pd(&a_segments.startX[a_index]);
+            __m128d sy = _mm_loadu_pd(&a_segments.startY[a_index]);
+            __m128d sz = _mm_loadu_pd(&a_segments.startZ[a_index]);
+            __m128d dx = _mm_loadu_pd(&a_segments.directionX[a_index]);
+            __m128d dy = _mm_loadu_pd(&a_segments.directionY[a_index]);
+            __m128d dz = _mm_loadu_pd(&a_segments.directionZ[a_index]);
+            __m128d length = _mm_loadu_pd(&a_segments.length[a_index]);
+
+            __m128d ratio = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_sub_pd(px, sx), dx),
+                                                  _mm_mul_pd(_mm_sub_pd(py, sy), dy)),
+                                       _mm_mul_pd(_mm_sub_pd(pz, sz), dz));
+            ratio = _mm_min_pd(_mm_max_pd(ratio, zero), length);
+
+            __m128d ex = _mm_sub_pd(_mm_add_pd(sx, _mm_mul_pd(ratio, dx)), px);
+            __m128d ey = _mm_sub_pd(_mm_add_pd(sy, _mm_mul_pd(ratio, dy)), py);
+            __m128d ez = _mm_sub_pd(_mm_add_pd(sz, _mm_mul_pd(ratio, dz)), pz);
+            __m128d squared = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ex, ex), _mm_mul_pd(ey, ey)), _mm_mul_pd(ez, ez));
+
+            // SSE2 has no blend: select with and/andnot/or.
+            __m128d closer = _mm_cmplt_pd(squared, bestSquared);
+            __m128d index = _mm_add_pd(_mm_set1_pd(static_cast<double>(a_index)), laneIndex);
+            bestSquared = _mm_or_pd(_mm_and_pd(closer, squared), _mm_andnot_pd(closer, bestSquared));
+            bestIndex = _mm_or_pd(_mm_and_pd(closer, index), _mm_andnot_pd(closer, bestIndex));
+        }
+
+        alignas(16) double squared[2];
+        alignas(16) double index[2];
+        _mm_store_pd(squared, bestSquared);
+        _mm_store_pd(index, bestIndex);
+        reduceLanes(squared, index, 2, a_bestSquared, a_best);
+        return a_index;
+    }
+#endif
+
+    /// Picks the closest lane, the lowest segment index on ties.
+    static void reduceLanes(const double* a_squared,
+                            const double* a_index,
+                            int a_lanes,
+                            double& a_bestSquared,
+                            size_t& a_best)
+    {
+        for (int lane = 0; lane < a_lanes; lane++)
+        {
+            if (a_index[lane] < 0.0)
+            {
+                continue;
+            }
+            size_t index = static_cast<size_t>(a_index[lane]);
+            if (a_squared[lane] < a_bestSquared || (a_squared[lane] == a_bestSquared && index < a_best))
+            {
+                a_bestSquared = a_squared[lane];
+                a_best = index;
+            }
+        }
+    }
+
+    Isa m_isa;
+};
@@ -0,0 +1,357 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Shared-memory transport for HapticMessage between processes on one host.
+///
+/// The segment holds a single producer ring of cache-line sized slots. Each
+/// slot is protected by its own sequence counter (seqlock), so the producer
+/// never waits for the consumer: a slow consumer simply loses old samples,
+/// which it detects from the message sequence numbers. The producer hot path
+/// is a handful of stores and involves no system call, unless the consumer
+/// is asleep waiting for data, in which case it is woken up with a futex
+/// (Linux) or a named event (Windows).
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Platform specific headers
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+// Project headers
+#include "haptic_message.h"
+
+/// Name of the shared-memory segment used by default by both executables.
+constexpr const char* DefaultShmRingName = "haptic_tube_ring";
+
+class ShmRing
+{
+public:
+    static constexpr uint32_t Magic = 0x48524E47;
+    static constexpr uint32_t Version = 1;
+    static constexpr uint32_t Capacity = 1024;
+
+    ShmRing() = default;
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    ~ShmRing()
+    {
+        close();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function creates or opens the shared-memory segment 'a_name'. The
+    /// producer (re)initializes the ring; the consumer only maps it, and must
+    /// call isReady() before reading if it started before the producer.
+    /// Returns false on failure.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool open(const std::string& a_name,
+              bool a_producer)
+    {
+        close();
+        m_producer = a_producer;
+        m_attached = false;
+
+#ifdef _WIN32
+        std::string name = "Local\\" + a_name;
+        m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(Segment), name.c_str());
+        if (m_mapping == nullptr)
+        {
+            return false;
+        }
+        m_segment = static_cast<Segment*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(Segment)));
+        std::string eventName = name + "_event";
+        m_event = CreateEventA(nullptr, FALSE, FALSE, eventName.c_str());
+        if (m_segment == nullptr || m_event == nullptr)
+        {
+            close();
+            return false;
+        }
+#else
+        std::string name = "/" + a_name;
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd < 0)
+        {
+            return false;
+        }
+        if (ftruncate(fd, sizeof(Segment)) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void* address = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED)
+        {
+            return false;
+        }
+        m_segment = static_cast<Segment*>(address);
+#endif
+
+        if (m_producer)
+        {
+            initialize();
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (m_segment != nullptr)
+        {
+            UnmapViewOfFile(m_segment);
+        }
+        if (m_event != nullptr)
+        {
+            CloseHandle(m_event);
+        }
+        if (m_mapping != nullptr)
+        {
+            CloseHandle(m_mapping);
+        }
+        m_event = nullptr;
+        m_mapping = nullptr;
+#else
+        if (m_segment != nullptr)
+        {
+            munmap(m_segment, sizeof(Segment));
+        }
+#endif
+        m_segment = nullptr;
+    }
+
+    /// Returns true once the producer has initialized the segment.
+    bool isReady() const
+    {
+        return m_segment != nullptr
+            && m_segment->header.magic.load(std::memory_order_acquire) == Magic
+            && m_segment->header.version == Version;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// Producer side. beginWrite() returns the next slot message, which is
+    /// filled in place and made visible by endWrite().
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    HapticMessage& beginWrite()
+    {
+        Slot& slot = m_segment->slots[m_writeIndex % Capacity];
+        slot.sequence.store(2 * m_writeIndex + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return slot.message;
+    }
+
+    void endWrite()
+    {
+        Slot& slot = m_segment->slots[m_writeIndex % Capacity];
+        slot.sequence.store(2 * m_writeIndex + 2, std::memory_order_release);
+        m_writeIndex++;
+        m_segment->header.writeIndex.store(m_writeIndex, std::memory_order_seq_cst);
+
+        // Only enter the kernel when the consumer is actually sleeping.
+        if (m_segment->header.waiters.load(std::memory_order_seq_cst) != 0)
+        {
+            wake();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// Consumer side. This function copies the newest message into
+    /// 'a_message' and returns true if it has not been read before.
+    /// 'a_pending' receives the number of messages published since the
+    /// previous read, i.e. the depth of the queue that was skipped.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool readLatest(HapticMessage& a_message,
+                    uint64_t& a_pending)
+    {
+        a_pending = 0;
+        if (!isReady())
+        {
+            return false;
+        }
+
+        // Start from the newest message when attaching to a running producer.
+        if (!m_attached)
+        {
+            uint64_t writeIndex = m_segment->header.writeIndex.load(std::memory_order_acquire);
+            m_readIndex = (writeIndex > 0) ? writeIndex - 1 : 0;
+            m_attached = true;
+        }
+
+        for (int attempt = 0; attempt < 4; attempt++)
+        {
+            uint64_t writeIndex = m_segment->header.writeIndex.load(std::memory_order_acquire);
+            if (writeIndex == m_readIndex)
+            {
+                return false;
+            }
+
+            uint64_t index = writeIndex - 1;
+            const Slot& slot = m_segment->slots[index % Capacity];
+            uint64_t before = slot.sequence.load(std::memory_order_acquire);
+            std::memcpy(&a_message, &slot.message, sizeof(HapticMessage));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t after = slot.sequence.load(std::memory_order_relaxed);
+
+            // Retry if the slot was being rewritten while it was copied.
+            if (before == 2 * index + 2 && after == before)
+            {
+                a_pending = (writeIndex > m_readIndex) ? writeIndex - m_readIndex : 1;
+                m_readIndex = writeIndex;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function blocks the consumer until a new message is published or
+    /// 'a_timeoutMs' milliseconds elapsed. Returns true if data is available.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool wait(int a_timeoutMs)
+    {
+        if (!isReady())
+        {
+            sleepMs(a_timeoutMs);
+            return false;
+        }
+
+        Header& header = m_segment->header;
+        uint32_t wakeCount = header.wakeCount.load(std::memory_order_seq_cst);
+        header.waiters.fetch_add(1, std::memory_order_seq_cst);
+        bool available = header.writeIndex.load(std::memory_order_seq_cst) != m_readIndex;
+        if (!available)
+        {
+#ifdef _WIN32
+            WaitForSingleObject(m_event, static_cast<DWORD>(a_timeoutMs));
+#elif defined(__linux__)
+            timespec timeout { a_timeoutMs / 1000, (a_timeoutMs % 1000) * 1000000L };
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&header.wakeCount), FUTEX_WAIT, wakeCount, &timeout, nullptr, 0);
+#else
+            (void)wakeCount;
+            sleepMs(1);
+#endif
+        }
+        header.waiters.fetch_sub(1, std::memory_order_seq_cst);
+        return header.writeIndex.load(std::memory_order_acquire) != m_readIndex;
+    }
+
+private:
+    struct alignas(64) Header
+    {
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint32_t capacity;
+        alignas(64) std::atomic<uint64_t> writeIndex;
+        alignas(64) std::atomic<uint32_t> waiters;
+        std::atomic<uint32_t> wakeCount;
+    };
+
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> sequence;
+        HapticMessage message;
+    };
+
+    struct Segment
+    {
+        Header header;
+        Slot slots[Capacity];
+    };
+
+    static_assert(sizeof(Slot) == 64, "ring slots must fill exactly one cache line");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared atomics must be lock-free");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be lock-free");
+
+    void initialize()
+    {
+        Header& header = m_segment->header;
+
+        // Resume the sequence of a previous producer so that a running consumer
+        // never sees the write index go backwards.
+        if (isReady() && header.capacity == Capacity)
+        {
+            m_writeIndex = header.writeIndex.load(std::memory_order_relaxed);
+            return;
+        }
+
+        header.magic.store(0, std::memory_order_relaxed);
+        header.version = Version;
+        header.capacity = Capacity;
+        header.writeIndex.store(0, std::memory_order_relaxed);
+        header.waiters.store(0, std::memory_order_relaxed);
+        header.wakeCount.store(0, std::memory_order_relaxed);
+        for (Slot& slot : m_segment->slots)
+        {
+            slot.sequence.store(0, std::memory_order_relaxed);
+            std::memset(&slot.message, 0, sizeof(HapticMessage));
+        }
+        m_writeIndex = 0;
+        header.magic.store(Magic, std::memory_order_release);
+    }
+
+    void wake()
+    {
+        Header& header = m_segment->header;
+        header.wakeCount.fetch_add(1, std::memory_order_seq_cst);
+#ifdef _WIN32
+        SetEvent(m_event);
+#elif defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&header.wakeCount), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#endif
+    }
+
+    static void sleepMs(int a_milliseconds)
+    {
+#ifdef _WIN32
+        Sleep(static_cast<DWORD>(a_milliseconds));
+#else
+        timespec duration { a_milliseconds / 1000, (a_milliseconds % 1000) * 1000000L };
+        nanosleep(&duration, nullptr);
+#endif
+    }
+
+    Segment* m_segment = nullptr;
+    bool m_producer = false;
+    uint64_t m_writeIndex = 0;
+    uint64_t m_readIndex = 0;
+    bool m_attached = false;
+#ifdef _WIN32
+    HANDLE m_mapping = nullptr;
+    HANDLE m_event = nullptr;
+#endif
+};
@@ -0,0 +1,432 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Work-stealing pool that computes batches for a haptic loop within a
+/// deadline.
+///
+/// The haptic thread fills a batch (e.g. the contacts of the spheres of a
+/// long instrument), submits it and waits for its reduced result until a
+/// deadline. The items are split evenly between the workers, each pinned to
+/// a core other than the haptic core, and the haptic thread itself. Each
+/// computes chunks of 'grain' items from its own range into its own partial
+/// result, then steals the upper half of the next non-empty range. Ranges
+/// are packed (begin, end) pairs updated with compare and swap, so nothing
+/// is ever locked and a preempted worker only delays the items it claimed.
+///
+/// If the deadline passes first, the batch is cancelled and wait() returns
+/// the last complete result, to be rendered for one more iteration. Workers
+/// still inside the cancelled batch finish their current chunk; until they
+/// have, acquire() refuses a new batch rather than waiting, and the caller
+/// renders the last result again.
+///
+/// A batch type provides:
+///
+///   struct Batch
+///   {
+///       struct Result;    // default constructed neutral element, with +=
+///       size_t size() const;
+///       void compute(size_t a_begin, size_t a_end, Result& a_partial) const;
+///   };
+///
+/// Partial results are summed in no particular order, so floating-point
+/// results may differ in the last bits from run to run.
+///
+/// Idle workers yield for IdleSpinTime after each batch, so that a loop at
+/// 1 kHz or more finds them awake, then poll every IdleSleepTime.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Platform specific headers
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+// Project headers
+#include "realtime_thread.h"
+
+template <typename Batch>
+class TaskPool
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using Result = typename Batch::Result;
+
+    /// Default number of items per chunk.
+    static constexpr size_t DefaultGrain = 4;
+
+    /// Idle workers yield this long after a batch, then sleep between polls.
+    static constexpr std::chrono::microseconds IdleSpinTime { 2000 };
+    static constexpr std::chrono::microseconds IdleSleepTime { 200 };
+
+    /// Without workers, the batches are computed by the haptic thread alone.
+    TaskPool() :
+        m_slots(new Slot[1]),
+        m_slotCount(1)
+    {}
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    ~TaskPool()
+    {
+        stop();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function starts 'a_workerCount' workers, -1 for one per core but
+    /// the haptic core and one core left for the graphics, so none with less
+    /// than two cores besides the haptic core. Workers are pinned to the
+    /// cores other than 'a_hapticCore', -1 for the last core as in
+    /// RealtimeThreadConfig, and left unpinned when there are not enough.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    void start(int a_workerCount = -1,
+               int a_hapticCore = -1,
+               size_t a_grain = DefaultGrain)
+    {
+        stop();
+        int coreCount = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+        int hapticCore = (a_hapticCore == -1) ? coreCount - 1 : a_hapticCore;
+        int workerCount = (a_workerCount < 0) ? std::max(coreCount - 2, 0) : a_workerCount;
+
+        m_grain = static_cast<uint32_t>(std::max<size_t>(a_grain, 1));
+        m_slotCount = workerCount + 1;
+        m_slots.reset(new Slot[m_slotCount]);
+        m_running.store(true, std::memory_order_release);
+
+        int core = 0;
+        for (int i = 0; i < workerCount; i++)
+        {
+            while (core == hapticCore)
+            {
+                core++;
+            }
+            RealtimeThreadConfig config;
+            config.core = (core < coreCount) ? core : -2;
+            config.priority = 0;
+            config.lockMemory = false;
+            config.prefaultHeapBytes = 0;
+            core++;
+
+            m_workers.emplace_back(new RealtimeThread());
+            m_workers.back()->start(config, [this, i]() { runWorker(i + 1); });
+        }
+    }
+
+    void stop()
+    {
+        m_running.store(false, std::memory_order_release);
+        for (std::unique_ptr<RealtimeThread>& worker : m_workers)
+        {
+            worker->join();
+        }
+        m_workers.clear();
+        m_slots.reset(new Slot[1]);
+        m_slotCount = 1;
+        m_pending = false;
+    }
+
+    int workerCount() const
+    {
+        return static_cast<int>(m_workers.size());
+    }
+
+    /// Number of cores the workers could be pinned to.
+    int pinnedWorkerCount() const
+    {
+        int count = 0;
+        for (const std::unique_ptr<RealtimeThread>& worker : m_workers)
+        {
+            count += worker->report().pinned ? 1 : 0;
+        }
+        return count;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function cancels what is left of the previous batch and returns
+    /// the batch to fill before submit(), or nullptr if workers are still
+    /// finishing a chunk of a cancelled batch. It never waits.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    Batch* acquire()
+    {
+        cancel();
+
+        // Close the batch to the workers, then make sure none is inside it.
+        // Both sides use sequentially consistent operations, so a worker
+        // entering after the check sees the batch closed.
+        uint32_t sequence = m_sequence.load(std::memory_order_relaxed);
+        m_sequence.store(sequence + 1);
+        if (m_active.load() != 0)
+        {
+            m_sequence.store(sequence);
+            m_refused++;
+            return nullptr;
+        }
+        m_closed = true;
+        return &m_batch;
+    }
+
+    /// Splits the batch returned by acquire() between the threads and starts it.
+    void submit()
+    {
+        if (!m_closed)
+        {
+            return;
+        }
+        uint32_t count = static_cast<uint32_t>(m_batch.size());
+        for (int i = 0; i < m_slotCount; i++)
+        {
+            uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(count) * i / m_slotCount);
+            uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(count) * (i + 1) / m_slotCount);
+            m_slots[i].range.store(pack(begin, end), std::memory_order_relaxed);
+            m_slots[i].partial = Result {};
+        }
+        m_count = count;
+        m_done.store(0, std::memory_order_relaxed);
+        m_closed = false;
+        m_pending = true;
+
+        // Open the batch; the release makes the batch and ranges visible.
+        m_sequence.store(m_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function computes chunks of the submitted batch on the calling
+    /// thread until the batch is complete or 'a_deadline' has passed. It
+    /// returns true and the reduced result in 'a_result' if the batch is
+    /// complete; otherwise it cancels the batch, returns false and the last
+    /// complete result in 'a_result'.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool wait(Clock::time_point a_deadline,
+              Result& a_result)
+    {
+        if (!m_pending)
+        {
+            a_result = m_lastResult;
+            return false;
+        }
+
+        Slot& slot = m_slots[0];
+        while (m_done.load(std::memory_order_acquire) < m_count)
+        {
+            if (Clock::now() >= a_deadline)
+            {
+                cancel();
+                m_missed++;
+                a_result = m_lastResult;
+                return false;
+            }
+            uint32_t begin = 0;
+            uint32_t end = 0;
+            if (claim(0, begin, end))
+            {
+                m_batch.compute(begin, end, slot.partial);
+                m_done.fetch_add(end - begin, std::memory_order_acq_rel);
+            }
+            else
+            {
+                spinPause();
+            }
+        }
+
+        Result total = slot.partial;
+        for (int i = 1; i < m_slotCount; i++)
+        {
+            total += m_slots[i].partial;
+        }
+        m_pending = false;
+        m_completed++;
+        m_lastResult = total;
+        a_result = total;
+        return true;
+    }
+
+    /// Last complete result, the fallback when a batch misses its deadline.
+    const Result& lastResult() const
+    {
+        return m_lastResult;
+    }
+
+    /// Batches completed, cancelled at their deadline, and refused by acquire().
+    uint64_t completed() const
+    {
+        return m_completed;
+    }
+
+    uint64_t missed() const
+    {
+        return m_missed;
+    }
+
+    uint64_t refused() const
+    {
+        return m_refused;
+    }
+
+private:
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> range { 0 };
+        Result partial {};
+    };
+
+    static uint64_t pack(uint32_t a_begin,
+                         uint32_t a_end)
+    {
+        return (static_cast<uint64_t>(a_begin) << 32) | a_end;
+    }
+
+    static void spinPause()
+    {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+#endif
+    }
+
+    /// Empties every range and moves to a new sequence number, so that no new
+    /// chunk of the pending batch starts.
+    void cancel()
+    {
+        if (!m_pending)
+        {
+            return;
+        }
+        for (int i = 0; i < m_slotCount; i++)
+        {
+            m_slots[i].range.store(0, std::memory_order_relaxed);
+        }
+        m_sequence.store(m_sequence.load(std::memory_order_relaxed) + 2, std::memory_order_release);
+        m_pending = false;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function claims the next chunk of the range of slot 'a_slot', or
+    /// else steals half of another range, keeps it as the range of 'a_slot'
+    /// and claims its first chunk. It returns false if no items are left.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool claim(int a_slot,
+               uint32_t& a_begin,
+               uint32_t& a_end)
+    {
+        std::atomic<uint64_t>& own = m_slots[a_slot].range;
+        uint64_t range = own.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(range >> 32) < static_cast<uint32_t>(range))
+        {
+            uint32_t begin = static_cast<uint32_t>(range >> 32);
+            uint32_t end = static_cast<uint32_t>(range);
+            uint32_t next = std::min(end, begin + m_grain);
+            if (own.compare_exchange_weak(range, pack(next, end), std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                a_begin = begin;
+                a_end = next;
+                return true;
+            }
+        }
+
+        for (int i = 1; i < m_slotCount; i++)
+        {
+            std::atomic<uint64_t>& victim = m_slots[(a_slot + i) % m_slotCount].range;
+            range = victim.load(std::memory_order_acquire);
+            while (static_cast<uint32_t>(range >> 32) < static_cast<uint32_t>(range))
+            {
+                uint32_t begin = static_cast<uint32_t>(range >> 32);
+                uint32_t end = static_cast<uint32_t>(range);
+
+                // Take the whole range if it is a single chunk, else its upper half.
+                uint32_t middle = (end - begin <= m_grain) ? begin : begin + (end - begin) / 2;
+                if (victim.compare_exchange_weak(range, pack(begin, middle), std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    a_begin = middle;
+                    a_end = std::min(end, middle + m_grain);
+                    own.store(pack(a_end, end), std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void runWorker(int a_slot)
+    {
+        Slot& slot = m_slots[a_slot];
+        uint32_t seen = 0;
+        Clock::time_point idleSince = Clock::now();
+        while (m_running.load(std::memory_order_acquire))
+        {
+            uint32_t sequence = m_sequence.load(std::memory_order_acquire);
+            if ((sequence & 1) != 0 || sequence == seen)
+            {
+                if (Clock::now() - idleSince < IdleSpinTime)
+                {
+                    std::this_thread::yield();
+                }
+                else
+                {
+                    std::this_thread::sleep_for(IdleSleepTime);
+                }
+                continue;
+            }
+
+            // Enter the batch only if it was not closed in the meantime.
+            m_active.fetch_add(1);
+            if (m_sequence.load() == sequence)
+            {
+                seen = sequence;
+                uint32_t begin = 0;
+                uint32_t end = 0;
+                while (m_sequence.load(std::memory_order_relaxed) == sequence && claim(a_slot, begin, end))
+                {
+                    m_batch.compute(begin, end, slot.partial);
+                    m_done.fetch_add(end - begin, std::memory_order_acq_rel);
+                }
+            }
+            m_active.fetch_sub(1, std::memory_order_release);
+            idleSince = Clock::now();
+        }
+    }
+
+    Batch m_batch;
+    std::unique_ptr<Slot[]> m_slots;
+    int m_slotCount = 0;
+    uint32_t m_grain = DefaultGrain;
+    std::vector<std::unique_ptr<RealtimeThread>> m_workers;
+
+    std::atomic<bool> m_running { false };
+
+    /// Even while a batch is open to the workers, odd while it is being filled.
+    std::atomic<uint32_t> m_sequence { 0 };
+
+    /// Number of workers inside the current batch, and items computed.
+    std::atomic<int> m_active { 0 };
+    std::atomic<uint32_t> m_done { 0 };
+
+    // State of the haptic thread.
+    uint32_t m_count = 0;
+    bool m_closed = false;
+    bool m_pending = false;
+    Result m_lastResult {};
+    uint64_t m_completed = 0;
+    uint64_t m_missed = 0;
+    uint64_t m_refused = 0;
+};
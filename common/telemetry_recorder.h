@@ -0,0 +1,633 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Full rate telemetry recording of haptic loops.
+///
+/// The haptic thread pushes one fixed size TelemetrySample per iteration
+/// into a wait-free single producer, single consumer ring: a push is a few
+/// stores and one release store, and never waits. When the ring is full the
+/// sample is dropped and counted, so a stalled disk can never stall the
+/// haptic loop. A background writer thread drains the ring into chunks of
+/// ChunkSamples samples and appends them to the file.
+///
+/// Memory is bounded by the ring and one chunk buffer, plus one index entry
+/// per chunk (about 100 KB per hour at 4 kHz).
+///
+/// File layout (little-endian):
+///
+///   TelemetryFileHeader
+///   { TelemetryChunkHeader, TelemetrySample[sampleCount] } per chunk
+///   TelemetryIndexEntry[chunkCount]     written by close()
+///
+/// close() writes the chunk index and patches the header with its offset.
+/// If the process dies before, TelemetryReader rebuilds the index by
+/// walking the chunk headers, losing at most the samples not yet written.
+///
+/// Every write is checked. After a failed write (e.g. a full disk) the writer
+/// stops recording, so the ring fills up and further samples are dropped;
+/// close() still indexes the chunks written before, and lastError() tells
+/// what failed.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Project headers
+#include "loop_timing.h"
+
+struct TelemetrySample
+{
+    /// Device time in [ns].
+    uint64_t time;
+
+    /// Tool position in [m], velocity in [m/s] and force sent to the device in [N].
+    float position[3];
+    float velocity[3];
+    float force[3];
+
+    uint32_t buttons;
+    uint32_t iteration;
+
+    /// Compute time of the previous iteration and period of the current one in [ns].
+    uint32_t computeTime;
+    uint32_t period;
+
+    uint16_t device;
+    uint16_t reserved;
+};
+
+static_assert(sizeof(TelemetrySample) == 64, "telemetry samples must stay one cache line");
+
+struct TelemetryFileHeader
+{
+    static constexpr uint32_t Magic = 0x4D4C5448;
+    static constexpr uint32_t Version = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t sampleSize;
+
+    /// Nominal loop rate in [Hz], 0 if unknown.
+    double nominalRate;
+
+    /// Written by close(), zero while recording.
+    uint64_t indexOffset;
+    uint64_t chunkCount;
+    uint64_t sampleCount;
+    uint64_t droppedCount;
+
+    char description[72];
+};
+
+struct TelemetryChunkHeader
+{
+    static constexpr uint32_t Magic = 0x4B4E4843;
+
+    uint32_t magic;
+    uint32_t sampleCount;
+    uint64_t firstTime;
+    uint64_t lastTime;
+    uint64_t reserved;
+};
+
+struct TelemetryIndexEntry
+{
+    /// File offset of the chunk header.
+    uint64_t offset;
+    uint64_t firstTime;
+    uint64_t lastTime;
+    uint32_t sampleCount;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(TelemetryFileHeader) == 128, "telemetry header layout changed");
+static_assert(sizeof(TelemetryChunkHeader) == 32, "telemetry chunk header layout changed");
+static_assert(sizeof(TelemetryIndexEntry) == 32, "telemetry index layout changed");
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Wait-free single producer, single consumer ring of telemetry samples.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+class TelemetryRing
+{
+public:
+    /// Allocates the ring. 'a_capacity' is rounded up to a power of two.
+    void allocate(size_t a_capacity)
+    {
+        size_t capacity = 1;
+        while (capacity < a_capacity)
+        {
+            capacity *= 2;
+        }
+        m_samples.assign(capacity, TelemetrySample {});
+        m_mask = capacity - 1;
+        m_cachedTail = 0;
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    /// Appends a sample. Returns false if the ring is full. Producer thread only.
+    bool push(const TelemetrySample& a_sample)
+    {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_cachedTail > m_mask)
+        {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head - m_cachedTail > m_mask)
+            {
+                return false;
+            }
+        }
+        m_samples[head & m_mask] = a_sample;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Removes up to 'a_count' samples into 'a_samples'. Returns the number removed. Consumer thread only.
+    size_t pop(TelemetrySample* a_samples,
+               size_t a_count)
+    {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        size_t count = static_cast<size_t>(std::min<uint64_t>(head - tail, a_count));
+        for (size_t i = 0; i < count; i++)
+        {
+            a_samples[i] = m_samples[(tail + i) & m_mask];
+        }
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    std::vector<TelemetrySample> m_samples;
+    uint64_t m_mask = 0;
+
+    // Producer and consumer indices on separate cache lines.
+    alignas(64) std::atomic<uint64_t> m_head { 0 };
+    uint64_t m_cachedTail = 0;
+    alignas(64) std::atomic<uint64_t> m_tail { 0 };
+};
+
+class TelemetryRecorder
+{
+public:
+    /// Ring capacity in samples, about 16 s at 4 kHz.
+    static constexpr size_t RingCapacity = 1 << 16;
+
+    /// Number of samples per file chunk, about 1 s at 4 kHz.
+    static constexpr uint32_t ChunkSamples = 4096;
+
+    /// Writer thread polling period when the ring is empty, in [ms].
+    static constexpr int WriterPeriod = 10;
+
+    TelemetryRecorder() = default;
+    TelemetryRecorder(const TelemetryRecorder&) = delete;
+    TelemetryRecorder& operator=(const TelemetryRecorder&) = delete;
+
+    ~TelemetryRecorder()
+    {
+        close();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function creates the file 'a_path', allocates the ring and starts
+    /// the writer thread. Call it before the haptic loop starts. Returns false
+    /// if the file cannot be created or written.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool open(const std::string& a_path,
+              double a_nominalRate,
+              const std::string& a_description)
+    {
+        close();
+        m_error.clear();
+        m_failed.store(false, std::memory_order_relaxed);
+        m_file = std::fopen(a_path.c_str(), "wb");
+        if (m_file == nullptr)
+        {
+            m_error = "cannot create " + a_path;
+            return false;
+        }
+
+        m_header = TelemetryFileHeader {};
+        m_header.magic = TelemetryFileHeader::Magic;
+        m_header.version = TelemetryFileHeader::Version;
+        m_header.headerSize = sizeof(TelemetryFileHeader);
+        m_header.sampleSize = sizeof(TelemetrySample);
+        m_header.nominalRate = a_nominalRate;
+        std::strncpy(m_header.description, a_description.c_str(), sizeof(m_header.description) - 1);
+        if (std::fwrite(&m_header, sizeof(m_header), 1, m_file) != 1)
+        {
+            m_error = std::string("cannot write ") + a_path + " (" + std::strerror(errno) + ")";
+            std::fclose(m_file);
+            m_file = nullptr;
+            return false;
+        }
+        m_offset = sizeof(m_header);
+
+        m_ring.allocate(RingCapacity);
+        m_chunk.resize(ChunkSamples);
+        m_chunkSize = 0;
+        m_index.clear();
+        m_pushed = 0;
+        m_dropped.store(0, std::memory_order_relaxed);
+        m_running.store(true, std::memory_order_relaxed);
+        m_writer = std::thread([this]() { writeLoop(); });
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function stops the writer thread once the ring is drained, writes
+    /// the last chunk and the chunk index, and closes the file. Call it after
+    /// the haptic loop has stopped. Returns false if any write failed, in
+    /// which case lastError() describes the first failure.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool close()
+    {
+        if (m_file == nullptr)
+        {
+            return m_error.empty();
+        }
+        m_running.store(false, std::memory_order_relaxed);
+        m_writer.join();
+        drain();
+        writeChunk();
+
+        // After a failed write, the index goes right after the last chunk written in full.
+        m_header.indexOffset = m_offset;
+        m_header.chunkCount = m_index.size();
+        m_header.droppedCount = m_dropped.load(std::memory_order_relaxed);
+        bool written = (!m_failed.load(std::memory_order_relaxed) || std::fseek(m_file, static_cast<long>(m_offset), SEEK_SET) == 0)
+                    && std::fwrite(m_index.data(), sizeof(TelemetryIndexEntry), m_index.size(), m_file) == m_index.size()
+                    && std::fseek(m_file, 0, SEEK_SET) == 0
+                    && std::fwrite(&m_header, sizeof(m_header), 1, m_file) == 1;
+        written = (std::fclose(m_file) == 0) && written;
+        if (!written)
+        {
+            fail("cannot write the telemetry index");
+        }
+        m_file = nullptr;
+        return m_error.empty();
+    }
+
+    /// Sets the nominal loop rate in [Hz] written to the header by close(),
+    /// for a rate only known once the loop has run. Call it before close().
+    void setNominalRate(double a_rate)
+    {
+        m_header.nominalRate = a_rate;
+    }
+
+    bool isOpen() const
+    {
+        return m_file != nullptr;
+    }
+
+    const std::string& lastError() const
+    {
+        return m_error;
+    }
+
+    /// Queues a sample. Returns false if it was dropped. Haptic thread only, never blocks.
+    bool push(const TelemetrySample& a_sample)
+    {
+        if (!m_ring.push(a_sample))
+        {
+            m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        m_pushed++;
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function fills a sample from the haptic loop state and queues it.
+    /// 'a_time' is the device time in [s], 'a_timing' the loop timing of the
+    /// calling haptic thread. Vectors may be null.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool record(double a_time,
+                const double a_position[3],
+                const double a_velocity[3],
+                const double a_force[3],
+                uint32_t a_buttons,
+                const LoopTiming& a_timing,
+                uint16_t a_device = 0)
+    {
+        TelemetrySample sample = {};
+        sample.time = static_cast<uint64_t>(std::max(0.0, a_time) * 1e9);
+        for (int i = 0; i < 3; i++)
+        {
+            sample.position[i] = a_position ? static_cast<float>(a_position[i]) : 0.0f;
+            sample.velocity[i] = a_velocity ? static_cast<float>(a_velocity[i]) : 0.0f;
+            sample.force[i] = a_force ? static_cast<float>(a_force[i]) : 0.0f;
+        }
+        sample.buttons = a_buttons;
+        sample.iteration = static_cast<uint32_t>(a_timing.iterations());
+        sample.computeTime = static_cast<uint32_t>(std::min<uint64_t>(a_timing.lastCompute(), UINT32_MAX));
+        sample.period = static_cast<uint32_t>(std::min<uint64_t>(a_timing.lastPeriod(), UINT32_MAX));
+        sample.device = a_device;
+        return push(sample);
+    }
+
+    /// Number of samples queued by the haptic thread. Haptic thread only.
+    uint64_t pushed() const
+    {
+        return m_pushed;
+    }
+
+    /// Number of samples dropped because the ring was full.
+    uint64_t dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    /// Number of samples written in full, valid after close().
+    uint64_t written() const
+    {
+        return m_header.sampleCount;
+    }
+
+private:
+    void writeLoop()
+    {
+        while (m_running.load(std::memory_order_relaxed) && !m_failed.load(std::memory_order_relaxed))
+        {
+            if (drain() == 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(WriterPeriod));
+            }
+        }
+    }
+
+    /// Moves queued samples into chunks, writing every full chunk. Returns the number of samples moved.
+    size_t drain()
+    {
+        size_t total = 0;
+        size_t count;
+        while (!m_failed.load(std::memory_order_relaxed)
+               && (count = m_ring.pop(&m_chunk[m_chunkSize], ChunkSamples - m_chunkSize)) > 0)
+        {
+            total += count;
+            m_chunkSize += count;
+            if (m_chunkSize == ChunkSamples)
+            {
+                writeChunk();
+            }
+        }
+        return total;
+    }
+
+    void writeChunk()
+    {
+        if (m_chunkSize == 0 || m_failed.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        TelemetryChunkHeader header = {};
+        header.magic = TelemetryChunkHeader::Magic;
+        header.sampleCount = static_cast<uint32_t>(m_chunkSize);
+        header.firstTime = m_chunk[0].time;
+        header.lastTime = m_chunk[m_chunkSize - 1].time;
+        // Flush every chunk so that a crash loses at most the samples still queued.
+        if (std::fwrite(&header, sizeof(header), 1, m_file) != 1
+            || std::fwrite(m_chunk.data(), sizeof(TelemetrySample), m_chunkSize, m_file) != m_chunkSize
+            || std::fflush(m_file) != 0)
+        {
+            fail("cannot write telemetry chunk");
+            return;
+        }
+
+        m_index.push_back(TelemetryIndexEntry { m_offset, header.firstTime, header.lastTime, header.sampleCount, 0 });
+        m_offset += sizeof(header) + m_chunkSize * sizeof(TelemetrySample);
+        m_header.sampleCount += m_chunkSize;
+        m_chunkSize = 0;
+    }
+
+    /// Stops recording after a failed write, keeping the first error.
+    void fail(const char* a_what)
+    {
+        if (!m_failed.exchange(true, std::memory_order_relaxed))
+        {
+            m_error = std::string(a_what) + " (" + std::strerror(errno) + ")";
+        }
+    }
+
+    TelemetryRing m_ring;
+    std::atomic<uint64_t> m_dropped { 0 };
+    uint64_t m_pushed = 0;
+
+    // Writer thread state.
+    std::thread m_writer;
+    std::atomic<bool> m_running { false };
+    std::atomic<bool> m_failed { false };
+    std::FILE* m_file = nullptr;
+    TelemetryFileHeader m_header = {};
+    std::vector<TelemetrySample> m_chunk;
+    size_t m_chunkSize = 0;
+    std::vector<TelemetryIndexEntry> m_index;
+    uint64_t m_offset = 0;
+    std::string m_error;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Random access reader of telemetry files.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+class TelemetryReader
+{
+public:
+    TelemetryReader() = default;
+    TelemetryReader(const TelemetryReader&) = delete;
+    TelemetryReader& operator=(const TelemetryReader&) = delete;
+
+    ~TelemetryReader()
+    {
+        close();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function opens the recording 'a_path' and loads its chunk index,
+    /// rebuilding it from the chunk headers if the recording was not closed.
+    /// Returns false if the file is not a valid recording.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool open(const std::string& a_path)
+    {
+        close();
+        m_file = std::fopen(a_path.c_str(), "rb");
+        if (m_file == nullptr)
+        {
+            return fail("cannot open " + a_path);
+        }
+        if (std::fread(&m_header, sizeof(m_header), 1, m_file) != 1 || m_header.magic != TelemetryFileHeader::Magic)
+        {
+            return fail("not a telemetry file");
+        }
+        if (m_header.version != TelemetryFileHeader::Version || m_header.headerSize != sizeof(TelemetryFileHeader)
+            || m_header.sampleSize != sizeof(TelemetrySample))
+        {
+            return fail("unsupported telemetry file version");
+        }
+
+        if (m_header.indexOffset != 0)
+        {
+            m_index.resize(m_header.chunkCount);
+            if (!seek(m_header.indexOffset)
+                || std::fread(m_index.data(), sizeof(TelemetryIndexEntry), m_index.size(), m_file) != m_index.size())
+            {
+                return fail("truncated telemetry index");
+            }
+        }
+        else
+        {
+            rebuildIndex();
+        }
+
+        m_sampleCount = 0;
+        for (const TelemetryIndexEntry& entry : m_index)
+        {
+            m_sampleCount += entry.sampleCount;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (m_file != nullptr)
+        {
+            std::fclose(m_file);
+            m_file = nullptr;
+        }
+        m_index.clear();
+        m_sampleCount = 0;
+    }
+
+    const TelemetryFileHeader& header() const
+    {
+        return m_header;
+    }
+
+    const std::string& lastError() const
+    {
+        return m_error;
+    }
+
+    /// Returns true if the recording was closed properly, false if its index was rebuilt.
+    bool isComplete() const
+    {
+        return m_header.indexOffset != 0;
+    }
+
+    size_t chunkCount() const
+    {
+        return m_index.size();
+    }
+
+    uint64_t sampleCount() const
+    {
+        return m_sampleCount;
+    }
+
+    const TelemetryIndexEntry& chunk(size_t a_index) const
+    {
+        return m_index[a_index];
+    }
+
+    /// Returns the index of the first chunk whose samples end at or after 'a_time' in [ns].
+    size_t findChunk(uint64_t a_time) const
+    {
+        auto found = std::lower_bound(m_index.begin(), m_index.end(), a_time,
+                                      [](const TelemetryIndexEntry& a_entry, uint64_t a_value) { return a_entry.lastTime < a_value; });
+        return static_cast<size_t>(found - m_index.begin());
+    }
+
+    /// Reads all samples of chunk 'a_index' into 'a_samples'. Returns false on read error.
+    bool readChunk(size_t a_index,
+                   std::vector<TelemetrySample>& a_samples)
+    {
+        const TelemetryIndexEntry& entry = m_index[a_index];
+        a_samples.resize(entry.sampleCount);
+        return seek(entry.offset + sizeof(TelemetryChunkHeader))
+               && std::fread(a_samples.data(), sizeof(TelemetrySample), entry.sampleCount, m_file) == entry.sampleCount;
+    }
+
+private:
+    bool fail(const std::string& a_error)
+    {
+        m_error = a_error;
+        close();
+        return false;
+    }
+
+    bool seek(uint64_t a_offset)
+    {
+#ifdef _WIN32
+        return _fseeki64(m_file, static_cast<__int64>(a_offset), SEEK_SET) == 0;
+#else
+        return fseeko(m_file, static_cast<off_t>(a_offset), SEEK_SET) == 0;
+#endif
+    }
+
+    uint64_t size()
+    {
+#ifdef _WIN32
+        _fseeki64(m_file, 0, SEEK_END);
+        return static_cast<uint64_t>(_ftelli64(m_file));
+#else
+        fseeko(m_file, 0, SEEK_END);
+        return static_cast<uint64_t>(ftello(m_file));
+#endif
+    }
+
+    /// Walks the chunk headers of a recording that was not closed, up to the first incomplete chunk.
+    void rebuildIndex()
+    {
+        m_index.clear();
+        uint64_t fileSize = size();
+        uint64_t offset = sizeof(TelemetryFileHeader);
+        TelemetryChunkHeader header;
+        while (seek(offset) && std::fread(&header, sizeof(header), 1, m_file) == 1
+               && header.magic == TelemetryChunkHeader::Magic)
+        {
+            uint64_t next = offset + sizeof(header) + uint64_t(header.sampleCount) * sizeof(TelemetrySample);
+            if (next > fileSize)
+            {
+                break;
+            }
+            m_index.push_back(TelemetryIndexEntry { offset, header.firstTime, header.lastTime, header.sampleCount, 0 });
+            offset = next;
+        }
+    }
+
+    std::FILE* m_file = nullptr;
+    TelemetryFileHeader m_header = {};
+    std::vector<TelemetryIndexEntry> m_index;
+    uint64_t m_sampleCount = 0;
+    std::string m_error;
+};
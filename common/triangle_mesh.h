@@ -0,0 +1,228 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Indexed triangle mesh with Wavefront OBJ and STL loaders.
+///
+/// Triangles are expected to be wound counter-clockwise when seen from
+/// outside, so that their geometric normals point out of the object.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Eigen library header
+#include <Eigen/Dense>
+
+struct TriangleMesh
+{
+    std::vector<Eigen::Vector3f> vertices;
+    std::vector<std::array<uint32_t, 3>> triangles;
+
+    /// Scales and translates all vertices.
+    void transform(double a_scale,
+                   const Eigen::Vector3d& a_offset)
+    {
+        for (Eigen::Vector3f& vertex : vertices)
+        {
+            vertex = (a_scale * vertex.cast<double>() + a_offset).cast<float>();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function builds a closed UV sphere with approximately
+    /// 'a_triangleCount' triangles, for tests and benchmarks.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    static TriangleMesh makeSphere(double a_radius,
+                                   size_t a_triangleCount)
+    {
+        int stacks = std::max(2, static_cast<int>(std::sqrt(a_triangleCount / 4.0)));
+        int slices = std::max(3, 2 * stacks);
+
+        TriangleMesh mesh;
+        mesh.vertices.reserve(static_cast<size_t>(stacks + 1) * slices);
+        for (int stack = 0; stack <= stacks; stack++)
+        {
+            double theta = M_PI * stack / stacks;
+            for (int slice = 0; slice < slices; slice++)
+            {
+                double phi = 2.0 * M_PI * slice / slices;
+                mesh.vertices.emplace_back(static_cast<float>(a_radius * std::sin(theta) * std::cos(phi)),
+                                           static_cast<float>(a_radius * std::sin(theta) * std::sin(phi)),
+                                           static_cast<float>(a_radius * std::cos(theta)));
+            }
+        }
+
+        auto index = [slices](int a_stack, int a_slice)
+        {
+            return static_cast<uint32_t>(a_stack * slices + (a_slice % slices));
+        };
+        for (int stack = 0; stack < stacks; stack++)
+        {
+            for (int slice = 0; slice < slices; slice++)
+            {
+                if (stack > 0)
+                {
+                    mesh.triangles.push_back({ index(stack, slice), index(stack + 1, slice), index(stack, slice + 1) });
+                }
+                if (stack < stacks - 1)
+                {
+                    mesh.triangles.push_back({ index(stack, slice + 1), index(stack + 1, slice), index(stack + 1, slice + 1) });
+                }
+            }
+        }
+        return mesh;
+    }
+
+    /// Loads an OBJ or STL file depending on its extension. Returns false on failure.
+    bool load(const std::string& a_path)
+    {
+        std::string extension = a_path.substr(a_path.find_last_of('.') + 1);
+        for (char& c : extension)
+        {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        return (extension == "stl") ? loadStl(a_path) : loadObj(a_path);
+    }
+
+    bool loadObj(const std::string& a_path)
+    {
+        std::ifstream file(a_path);
+        if (!file)
+        {
+            return false;
+        }
+
+        vertices.clear();
+        triangles.clear();
+        std::string line;
+        std::vector<uint32_t> face;
+        while (std::getline(file, line))
+        {
+            std::istringstream stream(line);
+            std::string keyword;
+            stream >> keyword;
+            if (keyword == "v")
+            {
+                Eigen::Vector3f vertex;
+                stream >> vertex(0) >> vertex(1) >> vertex(2);
+                vertices.push_back(vertex);
+            }
+            else if (keyword == "f")
+            {
+                // Faces are "i", "i/t" or "i/t/n", possibly with negative indices;
+                // polygons are triangulated as fans.
+                face.clear();
+                std::string token;
+                while (stream >> token)
+                {
+                    long index = std::strtol(token.c_str(), nullptr, 10);
+                    index = (index < 0) ? static_cast<long>(vertices.size()) + index : index - 1;
+                    face.push_back(static_cast<uint32_t>(index));
+                }
+                for (size_t i = 2; i < face.size(); i++)
+                {
+                    triangles.push_back({ face[0], face[i - 1], face[i] });
+                }
+            }
+        }
+        return isValid();
+    }
+
+    bool loadStl(const std::string& a_path)
+    {
+        std::ifstream file(a_path, std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+
+        vertices.clear();
+        triangles.clear();
+
+        // Binary STL: 80 bytes header, triangle count, then 50 bytes per triangle.
+        char header[80] = {};
+        uint32_t count = 0;
+        file.read(header, sizeof(header));
+        file.read(reinterpret_cast<char*>(&count), sizeof(count));
+        file.seekg(0, std::ios::end);
+        std::streamoff size = file.tellg();
+        if (std::strncmp(header, "solid", 5) != 0 || size == 84 + 50 * static_cast<std::streamoff>(count))
+        {
+            file.seekg(84);
+            for (uint32_t i = 0; i < count && file; i++)
+            {
+                float data[12];
+                uint16_t attributes;
+                file.read(reinterpret_cast<char*>(data), sizeof(data));
+                file.read(reinterpret_cast<char*>(&attributes), sizeof(attributes));
+                addTriangle(Eigen::Vector3f(data[3], data[4], data[5]),
+                            Eigen::Vector3f(data[6], data[7], data[8]),
+                            Eigen::Vector3f(data[9], data[10], data[11]));
+            }
+            return isValid();
+        }
+
+        // ASCII STL.
+        file.clear();
+        file.seekg(0);
+        std::string keyword;
+        Eigen::Vector3f corner[3];
+        int corners = 0;
+        while (file >> keyword)
+        {
+            if (keyword == "vertex")
+            {
+                file >> corner[corners](0) >> corner[corners](1) >> corner[corners](2);
+                if (++corners == 3)
+                {
+                    addTriangle(corner[0], corner[1], corner[2]);
+                    corners = 0;
+                }
+            }
+        }
+        return isValid();
+    }
+
+private:
+    void addTriangle(const Eigen::Vector3f& a_v0,
+                     const Eigen::Vector3f& a_v1,
+                     const Eigen::Vector3f& a_v2)
+    {
+        uint32_t first = static_cast<uint32_t>(vertices.size());
+        vertices.push_back(a_v0);
+        vertices.push_back(a_v1);
+        vertices.push_back(a_v2);
+        triangles.push_back({ first, first + 1, first + 2 });
+    }
+
+    bool isValid() const
+    {
+        for (const auto& triangle : triangles)
+        {
+            for (uint32_t index : triangle)
+            {
+                if (index >= vertices.size())
+                {
+                    return false;
+                }
+            }
+        }
+        return !triangles.empty();
+    }
+};
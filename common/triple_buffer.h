@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Wait-free single producer, single consumer "latest value" exchange.
+///
+/// The writer fills a private back buffer and publishes it with one atomic
+/// exchange; the reader picks up the most recently published buffer with one
+/// atomic exchange. Neither side ever waits for the other, intermediate values
+/// are overwritten, and the reader always sees a complete value.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <atomic>
+#include <cstdint>
+
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() = default;
+
+    explicit TripleBuffer(const T& a_initial)
+    {
+        m_buffers[0].value = a_initial;
+        m_buffers[1].value = a_initial;
+        m_buffers[2].value = a_initial;
+    }
+
+    /// Returns the writer private buffer. Only the writer thread may call it.
+    T& back()
+    {
+        return m_buffers[m_back].value;
+    }
+
+    /// Publishes the writer private buffer. Only the writer thread may call it.
+    void publish()
+    {
+        uint32_t previous = m_middle.exchange(m_back | DirtyFlag, std::memory_order_acq_rel);
+        m_back = previous & IndexMask;
+    }
+
+    /// Copies 'a_value' into the back buffer and publishes it.
+    void write(const T& a_value)
+    {
+        back() = a_value;
+        publish();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function fetches the latest published value, if any, and returns
+    /// true if it is newer than the one previously returned by front(). Only
+    /// the reader thread may call it.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool update()
+    {
+        if ((m_middle.load(std::memory_order_relaxed) & DirtyFlag) == 0)
+        {
+            return false;
+        }
+
+        uint32_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = previous & IndexMask;
+        return true;
+    }
+
+    /// Returns the reader buffer. Only the reader thread may call it.
+    const T& front() const
+    {
+        return m_buffers[m_front].value;
+    }
+
+private:
+    static constexpr uint32_t DirtyFlag = 0x4;
+    static constexpr uint32_t IndexMask = 0x3;
+
+    // Each buffer lives on its own cache line so that the two threads never
+    // write to the same line.
+    struct alignas(64) Slot
+    {
+        T value {};
+    };
+
+    Slot m_buffers[3];
+    alignas(64) std::atomic<uint32_t> m_middle { 1 };
+    alignas(64) uint32_t m_back = 0;
+    alignas(64) uint32_t m_front = 2;
+};
@@ -0,0 +1,261 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Non-blocking UDP socket for the haptic services.
+///
+/// Thin wrapper over Winsock on Windows and BSD sockets elsewhere. Every
+/// call maps to a single system call and is inlined, so the haptic loop pays
+/// nothing for the abstraction. Sockets never block: send() fails instead of
+/// waiting for buffer space, and receivers wait with waitReadable(). On
+/// Linux, receiveBatch() drains up to BatchSize datagrams with a single
+/// recvmmsg() call.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// C++ library headers
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Platform specific headers
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+class UdpSocket
+{
+public:
+#ifdef _WIN32
+    using Handle = SOCKET;
+#else
+    using Handle = int;
+#endif
+
+    /// Maximum number of datagrams received by one receiveBatch() call.
+    static constexpr int BatchSize = 64;
+
+    UdpSocket() = default;
+    UdpSocket(const UdpSocket&) = delete;
+    UdpSocket& operator=(const UdpSocket&) = delete;
+
+    ~UdpSocket()
+    {
+        close();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function creates a non-blocking socket. If 'a_port' is not zero,
+    /// the socket is bound to that port on all interfaces to receive.
+    /// Returns false on failure, see lastError().
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool open(uint16_t a_port = 0)
+    {
+        close();
+        if (!startup())
+        {
+            return fail("cannot initialize the socket library");
+        }
+
+        m_handle = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (m_handle == invalidHandle())
+        {
+            return fail("cannot create UDP socket");
+        }
+
+        if (a_port != 0)
+        {
+            sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_ANY);
+            address.sin_port = htons(a_port);
+            if (::bind(m_handle, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+            {
+                return fail("cannot bind UDP port " + std::to_string(a_port));
+            }
+        }
+
+#ifdef _WIN32
+        u_long mode = 1;
+        bool nonBlocking = (ioctlsocket(m_handle, FIONBIO, &mode) == 0);
+#else
+        int flags = fcntl(m_handle, F_GETFL, 0);
+        bool nonBlocking = (flags >= 0 && fcntl(m_handle, F_SETFL, flags | O_NONBLOCK) == 0);
+#endif
+        if (!nonBlocking)
+        {
+            return fail("cannot make the UDP socket non-blocking");
+        }
+        return true;
+    }
+
+    /// Sets the destination of send(). 'a_host' is a dotted IPv4 address.
+    bool setDestination(const char* a_host,
+                        uint16_t a_port)
+    {
+        m_destination = {};
+        m_destination.sin_family = AF_INET;
+        m_destination.sin_port = htons(a_port);
+        if (inet_pton(AF_INET, a_host, &m_destination.sin_addr) != 1)
+        {
+            m_error = std::string("invalid IPv4 address ") + a_host;
+            return false;
+        }
+        return true;
+    }
+
+    /// Sends one datagram to the destination. Returns the number of bytes sent, or -1 if it would block.
+    int send(const void* a_data,
+             size_t a_size)
+    {
+        return static_cast<int>(::sendto(m_handle, static_cast<const char*>(a_data), static_cast<int>(a_size), 0,
+                                         reinterpret_cast<const sockaddr*>(&m_destination), sizeof(m_destination)));
+    }
+
+    /// Receives one pending datagram. Returns its size, or -1 if none is pending.
+    int receive(void* a_buffer,
+                size_t a_size)
+    {
+        return static_cast<int>(::recv(m_handle, static_cast<char*>(a_buffer), static_cast<int>(a_size), 0));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    ///
+    /// This function receives up to 'a_count' pending datagrams, at most
+    /// BatchSize, into the buffers 'a_buffers' of 'a_size' bytes each.
+    /// 'a_lengths' receives their sizes. Returns the number of datagrams
+    /// received, 0 if none is pending.
+    ///
+    ////////////////////////////////////////////////////////////////////////////
+
+    int receiveBatch(char* const* a_buffers,
+                     size_t a_size,
+                     int* a_lengths,
+                     int a_count)
+    {
+        a_count = std::min(a_count, BatchSize);
+#ifdef __linux__
+        mmsghdr messages[BatchSize];
+        iovec vectors[BatchSize];
+        for (int i = 0; i < a_count; i++)
+        {
+            vectors[i].iov_base = a_buffers[i];
+            vectors[i].iov_len = a_size;
+            messages[i] = {};
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int count = recvmmsg(m_handle, messages, a_count, MSG_DONTWAIT, nullptr);
+        for (int i = 0; i < count; i++)
+        {
+            a_lengths[i] = static_cast<int>(messages[i].msg_len);
+        }
+        return std::max(count, 0);
+#else
+        int count = 0;
+        while (count < a_count)
+        {
+            int length = receive(a_buffers[count], a_size);
+            if (length < 0)
+            {
+                break;
+            }
+            a_lengths[count++] = length;
+        }
+        return count;
+#endif
+    }
+
+    /// Waits up to 'a_milliseconds' for a datagram. Returns true if one is pending.
+    bool waitReadable(int a_milliseconds)
+    {
+#ifdef _WIN32
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(m_handle, &readSet);
+        timeval timeout { a_milliseconds / 1000, (a_milliseconds % 1000) * 1000 };
+        return ::select(0, &readSet, nullptr, nullptr, &timeout) > 0;
+#else
+        pollfd descriptor { m_handle, POLLIN, 0 };
+        return ::poll(&descriptor, 1, a_milliseconds) > 0;
+#endif
+    }
+
+    void close()
+    {
+        if (m_handle != invalidHandle())
+        {
+#ifdef _WIN32
+            ::closesocket(m_handle);
+#else
+            ::close(m_handle);
+#endif
+            m_handle = invalidHandle();
+        }
+    }
+
+    bool isOpen() const
+    {
+        return m_handle != invalidHandle();
+    }
+
+    const std::string& lastError() const
+    {
+        return m_error;
+    }
+
+private:
+    static constexpr Handle invalidHandle()
+    {
+#ifdef _WIN32
+        return INVALID_SOCKET;
+#else
+        return -1;
+#endif
+    }
+
+    /// Initializes Winsock once per process.
+    static bool startup()
+    {
+#ifdef _WIN32
+        static const bool started = []()
+        {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+        return started;
+#else
+        return true;
+#endif
+    }
+
+    bool fail(const std::string& a_error)
+    {
+        m_error = a_error;
+        close();
+        return false;
+    }
+
+    Handle m_handle = invalidHandle();
+    sockaddr_in m_destination = {};
+    std::string m_error;
+};
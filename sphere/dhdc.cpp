@@ -1,10 +1,20 @@
 #include <chrono>
 #include <GLFW/glfw3.h>
 #include <iostream>
-#include <windows.h>
+#include <thread>
 
 #include "dhdc.h"
 
+#include "console_input.h"
+#include "device_emulator.h"
+
+// Dispositivo selecionado por dhdSetDevice, usado quando ID = -1.
+static int currentDevice = 0;
+
+static int resolveDevice (char ID) {
+   return (ID < 0) ? currentDevice : ID;
+}
+
 int __SDK dhdGetOrientationFrame (double matrix[3][3], char ID) {
    double local[3][3] = {
       {1.0, 0.0, 0.0},
@@ -23,6 +33,12 @@ int __SDK dhdGetOrientationFrame (double matrix[3][3], char ID) {
 };
 
 double __SDK dhdGetTime () {
+   // Scripted trajectories run on the emulator virtual clock.
+   DeviceEmulator& emulator = DeviceEmulator::instance();
+   if (emulator.isScripted()) {
+      return emulator.time();
+   }
+
    using namespace std::chrono;
    static auto startTime = steady_clock::now();
    auto now = steady_clock::now();
@@ -31,11 +47,12 @@ double __SDK dhdGetTime () {
 };
 
 double __SDK dhdGetComFreq (char ID) {
-   return 1000;
+   DeviceEmulator& emulator = DeviceEmulator::instance();
+   return emulator.isScripted() ? emulator.rate() : 1000;
 };
 
 const char* __SDK dhdErrorGetLastStr () {
-   return "No error";
+   return DeviceEmulator::instance().lastError();
 };
 
 int __SDK dhdEnableForce (uchar val, char ID) {
@@ -53,32 +70,80 @@ int __SDK dhdGetGripperFingerPos (double *px, double *py, double *pz,  char ID)
 int __SDK dhdGetPosition(double *px, double *py, double *pz, char ID) {
     if (!px || !py || !pz) return DHD_ERROR_INVALID;
 
-    static double keyboardZ = 0.0;
+    // --- Trajetória emulada ---
+    DeviceEmulator& emulator = DeviceEmulator::instance();
+    if (emulator.isScripted()) {
+        EmulatedSample sample;
+        if (!emulator.sample(sample, resolveDevice(ID))) {
+            return -1;
+        }
+        *px = sample.position[0];
+        *py = sample.position[1];
+        *pz = sample.position[2];
+        return DHD_NO_ERROR;
+    }
 
-    // --- Atualiza posição Z com base nas teclas W/S ---
-    SHORT wState = GetAsyncKeyState('W');
-    SHORT sState = GetAsyncKeyState('S');
+    ConsoleInput& input = ConsoleInput::instance();
+    static double keyboardX = 0.0;
+    static double keyboardY = 0.0;
+    static double keyboardZ = 0.0;
     double displacementIncrement = 0.003;
 
-    if (wState & 0x8000) keyboardZ += displacementIncrement;
-    if (sState & 0x8000) keyboardZ -= displacementIncrement;
+    // --- Atualiza posição X com base nas teclas W/S ---
+    if (input.keyDown('W')) keyboardX += displacementIncrement;
+    if (input.keyDown('S')) keyboardX -= displacementIncrement;
 
     // --- Obtém posição do mouse ---
-    POINT cursorPos;
-    if (!GetCursorPos(&cursorPos)) {
-        std::cerr << "Cannot get cursor position.\n";
-        *px = *py = *pz = 0.0;
-        return DHD_ERROR;
+    long cursorX, cursorY;
+    if (input.cursorPosition(cursorX, cursorY)) {
+        double mouseX = -static_cast<double>(cursorY);
+        double mouseY = static_cast<double>(cursorX);
+        *py = 2.9 * (mouseY / 10000.0 - 0.095);
+        *pz = 2.9 * (mouseX / 10000.0 + 0.053);
+    } else {
+        // Sem ponteiro (terminal Linux): teclas A/D movem em Y e R/F em Z
+        if (input.keyDown('D')) keyboardY += displacementIncrement;
+        if (input.keyDown('A')) keyboardY -= displacementIncrement;
+        if (input.keyDown('R')) keyboardZ += displacementIncrement;
+        if (input.keyDown('F')) keyboardZ -= displacementIncrement;
+        *py = keyboardY;
+        *pz = keyboardZ;
     }
+    *px = keyboardX;
+
+    return DHD_NO_ERROR;
+}
 
-    double mouseX = -static_cast<double>(cursorPos.y);
-    double mouseY = static_cast<double>(cursorPos.x);
-    mouseX = 2.9 * (mouseX / 10000.0 + 0.053);
-    mouseY = 2.9 * (mouseY / 10000.0 - 0.095);
+int __SDK dhdGetLinearVelocity(double *vx, double *vy, double *vz, char ID) {
+    if (!vx || !vy || !vz) return DHD_ERROR_INVALID;
+
+    DeviceEmulator& emulator = DeviceEmulator::instance();
+    if (emulator.isScripted()) {
+        EmulatedSample sample;
+        if (!emulator.sample(sample, resolveDevice(ID))) {
+            return -1;
+        }
+        *vx = sample.velocity[0];
+        *vy = sample.velocity[1];
+        *vz = sample.velocity[2];
+        return DHD_NO_ERROR;
+    }
 
-    *px = keyboardZ;
-    *py = mouseY;
-    *pz = mouseX;
+    // --- Derivada numérica da posição do mouse ---
+    static double previousPosition[3] = {};
+    static double previousTime = dhdGetTime();
+    double position[3];
+    if (dhdGetPosition(&position[0], &position[1], &position[2], ID) < 0) {
+        return -1;
+    }
+    double time = dhdGetTime();
+    double dt = time - previousTime;
+    double* velocity[3] = { vx, vy, vz };
+    for (int i = 0; i < 3; i++) {
+        *velocity[i] = (dt > 1e-6) ? (position[i] - previousPosition[i]) / dt : 0.0;
+        previousPosition[i] = position[i];
+    }
+    previousTime = time;
 
     return DHD_NO_ERROR;
 }
@@ -88,11 +153,17 @@ bool __SDK dhdIsLeftHanded (char ID) {
 };
 
 int __SDK dhdSetForceAndGripperForce (double fx, double fy, double fz, double fg, char ID) {
+   DeviceEmulator::instance().step(resolveDevice(ID));
    return 0;
 };
 
+int __SDK dhdSetForceAndTorqueAndGripperForce (double fx, double fy, double fz, double tx, double ty, double tz, double fg, char ID) {
+   DeviceEmulator::instance().step(resolveDevice(ID));
+   return DHD_NO_ERROR;
+};
+
 void __SDK dhdSleep (double sec) {
-   return;
+   std::this_thread::sleep_for(std::chrono::duration<double>(sec));
 };
 
 int __SDK dhdClose (char ID) {
@@ -100,6 +171,10 @@ int __SDK dhdClose (char ID) {
 };
 
 int __SDK dhdOpen () {
+   if (!DeviceEmulator::instance().open()) {
+      return -1;
+   }
+   currentDevice = 0;
    return 0;
 };
 
@@ -108,7 +183,7 @@ const char* __SDK dhdGetSDKVersionStr() {
 };
 
 const char* __SDK dhdGetSystemName (char ID) {
-   return "SystemName";
+   return DeviceEmulator::instance().isScripted() ? "Emulator" : "SystemName";
 };
 
 int __SDK dhdSetDeviceAngleRad (double angle, char ID) {
@@ -116,19 +191,42 @@ int __SDK dhdSetDeviceAngleRad (double angle, char ID) {
 };
 
 int __SDK dhdGetButton (int index, char ID) {
-   return DHD_NO_ERROR;
+   DeviceEmulator& emulator = DeviceEmulator::instance();
+   EmulatedSample sample;
+   if (emulator.isScripted() && emulator.sample(sample, resolveDevice(ID))) {
+      return ((sample.buttons >> index) & 0x1) ? DHD_ON : DHD_OFF;
+   }
+   return DHD_OFF;
 };
 
 int __SDK dhdGetAvailableCount () {
-   return 1;
+   // Lê DHD_EMULATOR_DEVICES sem reiniciar um emulador já aberto.
+   DeviceEmulator& emulator = DeviceEmulator::instance();
+   if (!emulator.isOpen() && !emulator.open()) {
+      return 0;
+   }
+   return emulator.deviceCount();
 };
 
 int __SDK dhdSetDevice (char ID) {
+   if (ID < 0 || ID >= DeviceEmulator::instance().deviceCount()) {
+      return -1;
+   }
+   currentDevice = ID;
    return DHD_NO_ERROR;
 };
 
 int __SDK dhdOpenID (char ID) {
-   return DHD_NO_ERROR;
+   // Todos os dispositivos compartilham o relógio virtual do emulador.
+   DeviceEmulator& emulator = DeviceEmulator::instance();
+   if (!emulator.isOpen() && !emulator.open()) {
+      return -1;
+   }
+   if (ID < 0 || ID >= emulator.deviceCount()) {
+      return -1;
+   }
+   currentDevice = ID;
+   return ID;
 };
 
 int __SDK dhdEmulateButton (uchar val, char ID) {
@@ -140,5 +238,21 @@ bool __SDK dhdHasActiveGripper (char ID) {
 };
 
 int __SDK dhdSetForce (double  fx, double  fy, double  fz, char ID) {
+   DeviceEmulator::instance().step(resolveDevice(ID));
    return DHD_NO_ERROR;
 };
+
+int __SDK dhdKbHit () {
+   // Report a 'q' key press once the emulated trajectory is over.
+   if (DeviceEmulator::instance().isFinished()) {
+      return 1;
+   }
+   return ConsoleInput::instance().keyHit() ? 1 : 0;
+};
+
+char __SDK dhdKbGet () {
+   if (DeviceEmulator::instance().isFinished()) {
+      return 'q';
+   }
+   return static_cast<char>(ConsoleInput::instance().getKey());
+};
@@ -1,24 +1,106 @@
 #include <iostream>
 #include <Eigen/Dense>
 #include <cmath>
-#include <thread>
+#include <cstdlib>
 #include <chrono>
-#include <winsock2.h>
-#include <windows.h>
+#include <cstring>
+#include <string>
 #include "dhdc.h"
+#include "force_models.h"
+#include "god_object.h"
+#include "haptic_message.h"
+#include "loop_scheduler.h"
+#include "loop_timing.h"
+#include "sdf_field.h"
+#include "shm_ring.h"
+#include "telemetry_recorder.h"
+#include "triangle_mesh.h"
+#include "udp_socket.h"
 
-#pragma comment(lib, "ws2_32.lib")
-
-constexpr double SphereRadius = 0.04;
-constexpr double ToolRadius = 0.005;
 constexpr double LinearStiffness = 3000.0;
 
 Eigen::Vector3d toolPosition(0.05, 0.0, 0.0);
 Eigen::Vector3d forceTool;
-const Eigen::Vector3d SpherePosition(0.0, 0.0, 0.0);
+SphereContactModel sphere;  // Mesma esfera desenhada pelo haptic_renderer
+
+int main(int argc, char* argv[]) {
+    // Formato texto apenas para depuração (--text)
+    // Memória compartilhada em vez de UDP (--transport=shm)
+    // Frequência do laço em Hz (--rate=1000) e política de atraso (--catch-up=skip|burst)
+    // Malha OBJ/STL no lugar da esfera (--mesh=arquivo, --mesh-scale=1.0)
+    // Campo de distância pré-calculado por sdf_bake (--sdf=arquivo)
+    // Gravação de telemetria de cada iteração (--record=arquivo)
+    bool textFormat = false;
+    bool sharedMemory = false;
+    std::string meshPath;
+    std::string sdfPath;
+    std::string recordPath;
+    double meshScale = 1.0;
+    LoopScheduler scheduler;
+    scheduler.setRate(1000.0);
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--text") == 0) textFormat = true;
+        if (std::strcmp(argv[i], "--transport=shm") == 0) sharedMemory = true;
+        if (std::strncmp(argv[i], "--rate=", 7) == 0 && !scheduler.setRate(std::atof(argv[i] + 7))) {
+            std::cerr << "Taxa fora do intervalo de " << scheduler.minRate() << " a " << scheduler.maxRate() << " Hz: " << argv[i] + 7 << "\n";
+            return -1;
+        }
+        if (std::strncmp(argv[i], "--catch-up=", 11) == 0) {
+            LoopScheduler::CatchUpPolicy policy;
+            if (LoopScheduler::parseCatchUpPolicy(argv[i] + 11, policy)) scheduler.setCatchUpPolicy(policy);
+            else std::cerr << "Política de atraso desconhecida: " << argv[i] + 11 << "\n";
+        }
+        if (std::strncmp(argv[i], "--mesh=", 7) == 0) meshPath = argv[i] + 7;
+        if (std::strncmp(argv[i], "--mesh-scale=", 13) == 0) meshScale = std::atof(argv[i] + 13);
+        if (std::strncmp(argv[i], "--sdf=", 6) == 0) sdfPath = argv[i] + 6;
+        if (std::strncmp(argv[i], "--record=", 9) == 0) recordPath = argv[i] + 9;
+    }
 
-int main() {
-    std::cout << "Sending haptic tool data over UDP...\n";
+    // Rigidez reduzida a um décimo, como na malha e no campo de distância
+    sphere.stiffness = LinearStiffness / 10.0;
+
+    // Mapeia o campo de distância e carrega as páginas antes do laço
+    SdfField sdf;
+    if (!sdfPath.empty()) {
+        if (!sdf.open(sdfPath)) {
+            std::cerr << "Erro ao abrir o campo de distância " << sdfPath << ": " << sdf.lastError() << "\n";
+            return -1;
+        }
+        sdf.prefault();
+        std::cout << "SDF: " << sdf.header().description << ", " << sdf.memoryBytes() / 1024 << " KB\n";
+        if (sdf.header().band <= sphere.toolRadius) {
+            std::cerr << "Aviso: banda do campo menor que o raio da ferramenta, nenhuma força será gerada.\n";
+        }
+    }
+
+    // Carrega a malha e constrói a BVH antes de iniciar o laço
+    MeshBvh bvh;
+    GodObject godObject(bvh);
+    bool meshContact = !meshPath.empty();
+    if (meshContact) {
+        TriangleMesh mesh;
+        if (!mesh.load(meshPath)) {
+            std::cerr << "Erro ao carregar a malha: " << meshPath << "\n";
+            return -1;
+        }
+        mesh.transform(meshScale, sphere.position);
+        bvh.build(mesh);
+        godObject.setStiffness(LinearStiffness / 10.0);
+        std::cout << "Mesh: " << bvh.triangleCount() << " triangles, "
+                  << bvh.memoryBytes() / 1024 << " KB BVH\n";
+    }
+
+    ShmRing ring;
+    if (sharedMemory && (textFormat || !ring.open(DefaultShmRingName, true))) {
+        std::cerr << "Memória compartilhada indisponível, usando UDP.\n";
+        sharedMemory = false;
+    }
+
+    if (sharedMemory) {
+        std::cout << "Sending haptic tool data over shared memory...\n";
+    } else {
+        std::cout << "Sending haptic tool data over UDP (" << (textFormat ? "text" : "binary") << " format)...\n";
+    }
 
     // Inicia dispositivo háptico
     if (dhdOpen() < 0) {
@@ -27,54 +109,104 @@ int main() {
     }
     dhdEnableForce(DHD_ON);
 
-    // Setup de socket
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2,2), &wsaData);
-    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+    // Setup de socket (não bloqueante: um envio nunca atrasa o laço)
+    UdpSocket sock;
+    if (!sock.open() || !sock.setDestination("127.0.0.1", 9999)) {
+        std::cerr << "Erro ao criar socket UDP: " << sock.lastError() << "\n";
+        dhdClose();
+        return -1;
+    }
 
-    sockaddr_in destAddr{};
-    destAddr.sin_family = AF_INET;
-    destAddr.sin_port = htons(9999);
-    destAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    HapticMessage packet;
+    uint32_t sequence = 0;
+
+    if (meshContact) {
+        double x, y, z;
+        dhdGetPosition(&x, &y, &z);
+        godObject.reset(Eigen::Vector3d(x, y, z));
+    }
+
+    std::cout << "Loop rate: " << scheduler.rate() << " Hz\n";
+    LoopTiming timing;
+    timing.setNominalRate(scheduler.rate());
+
+    // Inicia a thread de escrita da telemetria antes do laço
+    TelemetryRecorder telemetry;
+    if (!recordPath.empty()) {
+        if (!telemetry.open(recordPath, scheduler.rate(), "haptic_processor")) {
+            std::cerr << "Erro ao gravar telemetria: " << telemetry.lastError() << "\n";
+            return -1;
+        }
+        std::cout << "Gravando telemetria em " << recordPath << "\n";
+    }
+    scheduler.start();
 
     while (true) {
+        timing.beginIteration();
+
         // Atualiza posição da ferramenta
         double x, y, z;
-        dhdGetPosition(&x, &y, &z);
+        if (dhdGetPosition(&x, &y, &z) < 0) {
+            std::cerr << "Erro ao ler a posição: " << dhdErrorGetLastStr() << "\n";
+            break;
+        }
         toolPosition = Eigen::Vector3d(x, y, z);
 
-        // Calcula força
-        Eigen::Vector3d delta = toolPosition - SpherePosition;
-        double distance = delta.norm();
-        double penetration = distance - SphereRadius - ToolRadius;
-
-        if (penetration < 0.0 && distance > 1e-6) {
-            forceTool = -penetration * LinearStiffness * delta.normalized();
-            forceTool /= 10.0;
+        // Calcula força (campo de distância, proxy sobre a malha ou esfera analítica)
+        if (sdf.isOpen()) {
+            forceTool = makeContactKernel(FieldShape<SdfField>(sdf), unilateral(Spring(sphere.stiffness)),
+                                          sphere.toolRadius).compute(toolPosition);
+        } else if (meshContact) {
+            forceTool = godObject.update(toolPosition);
         } else {
-            forceTool.setZero();
+            forceTool = sphere.computeForce(toolPosition);
         }
 
         // Aplica força no dispositivo
         dhdSetForce(forceTool.x(), forceTool.y(), forceTool.z());
 
-        // Envia via UDP
-        char message[128];
-        snprintf(message, sizeof(message), "%.10f %.10f %.10f %.10f %.10f %.10f",
-                 toolPosition.x(), toolPosition.y(), toolPosition.z(),
-                 forceTool.x(), forceTool.y(), forceTool.z());
+        // Envia via memória compartilhada ou UDP
+        double position[3] = { toolPosition.x(), toolPosition.y(), toolPosition.z() };
+        double force[3] = { forceTool.x(), forceTool.y(), forceTool.z() };
+        if (sharedMemory) {
+            // Escreve diretamente no slot do anel, sem chamadas de sistema
+            encodeHapticMessage(ring.beginWrite(), sequence++, hapticMessageClock(), position, force);
+            ring.endWrite();
+        } else if (textFormat) {
+            char message[128];
+            int length = encodeHapticText(message, sizeof(message), position, force);
+            sock.send(message, length);
+        } else {
+            encodeHapticMessage(packet, sequence++, hapticMessageClock(), position, force);
+            sock.send(&packet, sizeof(packet));
+        }
+
+        // Grava a iteração sem bloquear o laço
+        if (telemetry.isOpen()) {
+            double velocity[3];
+            dhdGetLinearVelocity(&velocity[0], &velocity[1], &velocity[2]);
+            uint32_t buttons = (dhdGetButton(0) != DHD_OFF) ? 1 : 0;
+            telemetry.record(dhdGetTime(), position, velocity, force, buttons, timing);
+        }
+
+        timing.endIteration();
+
+        // Espera o próximo prazo absoluto (não acumula o tempo de cálculo)
+        scheduler.waitForNextPeriod();
+    }
 
-        sendto(sock, message, strlen(message), 0, (sockaddr*)&destAddr, sizeof(destAddr));
+    timing.printReport(std::cout);
 
-#ifdef PROD_BUILD
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-#else
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-#endif
+    // Escreve as amostras restantes e o índice do arquivo
+    if (telemetry.isOpen()) {
+        if (!telemetry.close()) std::cerr << "Erro ao gravar telemetria: " << telemetry.lastError() << "\n";
+        std::cout << "telemetria: " << telemetry.written() << " amostras gravadas, "
+                  << telemetry.dropped() << " descartadas\n";
     }
+    std::cout << "deadline overruns: " << scheduler.overruns()
+              << ", skipped periods: " << scheduler.skippedPeriods() << "\n";
 
-    closesocket(sock);
-    WSACleanup();
+    sock.close();
     dhdClose();
     return 0;
 }
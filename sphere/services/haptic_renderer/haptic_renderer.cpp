@@ -1,75 +1,197 @@
 #define _USE_MATH_DEFINES
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
-#include <winsock2.h>  // Para comunicação UDP
-#pragma comment(lib, "ws2_32.lib")
+#include <thread>
 
+#ifdef _WIN32
 #define NOMINMAX
 #include "windows.h"
+#endif
 
 #include "GL/glu.h"
 #include <GLFW/glfw3.h>
 
 #include "CMatrixGL.h"
+#include "device_emulator.h"
 #include "FontGL.h"
+#include "force_models.h"
+#include "geometry_cache.h"
+#include "haptic_message.h"
+#include "headless_renderer.h"
+#include "loop_timing.h"
+#include "shm_ring.h"
+#include "triple_buffer.h"
+#include "udp_socket.h"  // Para comunicação UDP
 
 // Constants
-const Eigen::Vector3d SpherePosition(0.0, 0.0, 0.0);
-constexpr double SphereRadius = 0.03;
-constexpr double ToolRadius = 0.005;
+const SphereContactModel Sphere;  // Mesma esfera do haptic_processor
 constexpr int SwapInterval = 1;
+constexpr int ReceiveBatchSize = UdpSocket::BatchSize;
+constexpr int ReceiveBufferSize = 1024;
 
 // Global variables
 GLFWwindow* window = nullptr;
+GeometryCache geometryCache;  // Esferas e cone tesselados uma única vez
 int windowWidth = 0;
 int windowHeight = 0;
 Eigen::Vector3d toolPosition;
 Eigen::Vector3d forceTool;
-
-void setupUDPListener(SOCKET& sock, sockaddr_in& serverAddr) {
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData);
-
-    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (sock == INVALID_SOCKET) {
-        std::cerr << "Erro ao criar socket UDP." << std::endl;
+bool showReceiveStatus = false;
+
+// Amostra mais recente publicada pela thread de recepção
+struct RenderSample {
+    Eigen::Vector3d toolPosition = Eigen::Vector3d::Zero();
+    Eigen::Vector3d forceTool = Eigen::Vector3d::Zero();
+    uint64_t timestamp = 0;
+};
+
+// Contadores da thread de recepção, lidos pela thread gráfica
+struct ReceiveCounters {
+    std::atomic<uint64_t> datagrams { 0 };
+    std::atomic<uint64_t> wakeups { 0 };
+    std::atomic<uint64_t> published { 0 };
+    std::atomic<uint64_t> lastQueueDepth { 0 };
+    std::atomic<uint64_t> maxQueueDepth { 0 };
+};
+
+// Buffer de recepção alinhado para decodificar a mensagem binária diretamente
+struct alignas(HapticMessage) ReceiveBuffer {
+    char data[ReceiveBufferSize];
+};
+
+std::atomic<bool> receiving { true };
+TripleBuffer<RenderSample> latestSample;
+ReceiveCounters receiveCounters;
+SequenceTracker sequenceTracker;
+LatencyHistogram sampleStaleness;
+uint64_t staleFrames = 0;
+
+void setupUDPListener(UdpSocket& sock) {
+    if (!sock.open(9999)) {
+        std::cerr << "Erro ao abrir a porta UDP 9999: " << sock.lastError() << std::endl;
         exit(1);
     }
+}
 
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(9999);
+// Aplica uma mensagem binária; retorna true se 'a_sample' foi atualizada
+bool applyMessage(const HapticMessage& a_message, RenderSample& a_sample) {
+    // Descarta mensagens atrasadas ou duplicadas; um processador reiniciado recomeça a sequência
+    if (!sequenceTracker.update(a_message.sequence, a_message.timestamp)) return false;
+    a_sample.toolPosition = Eigen::Vector3f(a_message.position[0], a_message.position[1], a_message.position[2]).cast<double>();
+    a_sample.forceTool = Eigen::Vector3f(a_message.force[0], a_message.force[1], a_message.force[2]).cast<double>();
+    a_sample.timestamp = a_message.timestamp;
+    return true;
+}
 
-    if (bind(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        std::cerr << "Erro ao bindar porta 9999." << std::endl;
-        exit(1);
+// Decodifica um datagrama; retorna true se 'a_sample' foi atualizada
+bool handleDatagram(char* a_buffer, int a_length, RenderSample& a_sample) {
+    const HapticMessage* message = decodeHapticMessage(a_buffer, a_length);
+    if (message) return applyMessage(*message, a_sample);
+
+    // Formato texto de depuração
+    a_buffer[std::min(a_length, ReceiveBufferSize - 1)] = '\0';
+    double position[3], force[3];
+    if (!decodeHapticText(a_buffer, position, force)) {
+        std::cerr << "Invalid message: " << a_buffer << std::endl;
+        return false;
     }
+    a_sample.toolPosition = Eigen::Vector3d(position[0], position[1], position[2]);
+    a_sample.forceTool = Eigen::Vector3d(force[0], force[1], force[2]);
+    a_sample.timestamp = hapticMessageClock();
+    return true;
+}
 
-    u_long mode = 1;
-    ioctlsocket(sock, FIONBIO, &mode);
+// Lê até ReceiveBatchSize datagramas pendentes; retorna quantos foram lidos
+int receiveBatch(UdpSocket& sock, RenderSample& a_sample, bool& a_updated) {
+    static ReceiveBuffer buffers[ReceiveBatchSize];
+    static char* pointers[ReceiveBatchSize];
+    for (int i = 0; i < ReceiveBatchSize; i++) pointers[i] = buffers[i].data;
+
+    // Uma chamada recvmmsg no Linux, um recv por datagrama nas outras plataformas
+    int lengths[ReceiveBatchSize];
+    int count = sock.receiveBatch(pointers, ReceiveBufferSize - 1, lengths, ReceiveBatchSize);
+    for (int i = 0; i < count; i++) {
+        if (lengths[i] > 0) a_updated |= handleDatagram(buffers[i].data, lengths[i], a_sample);
+    }
+    return count;
 }
 
-void checkForMessage(SOCKET sock) {
-    char buffer[1024] = {};
-    sockaddr_in from;
-    int fromlen = sizeof(from);
-    int bytesReceived = recvfrom(sock, buffer, sizeof(buffer) - 1, 0, (sockaddr*)&from, &fromlen);
+// Atualiza os contadores após esvaziar 'a_queueDepth' mensagens
+void updateReceiveCounters(uint64_t a_queueDepth) {
+    receiveCounters.datagrams.fetch_add(a_queueDepth, std::memory_order_relaxed);
+    receiveCounters.wakeups.fetch_add(1, std::memory_order_relaxed);
+    receiveCounters.lastQueueDepth.store(a_queueDepth, std::memory_order_relaxed);
+    if (a_queueDepth > receiveCounters.maxQueueDepth.load(std::memory_order_relaxed)) {
+        receiveCounters.maxQueueDepth.store(a_queueDepth, std::memory_order_relaxed);
+    }
+}
 
-    if (bytesReceived > 0) {
-        buffer[bytesReceived] = '\0';
+// Thread de recepção: esvazia a fila do socket e publica só a amostra mais recente
+void receiveLoop(UdpSocket& sock) {
+    while (receiving.load(std::memory_order_relaxed)) {
+        // Espera por dados por até 100 ms para poder encerrar
+        if (!sock.waitReadable(100)) continue;
+
+        RenderSample& sample = latestSample.back();
+        bool updated = false;
+        uint64_t queueDepth = 0;
+        int count;
+        while ((count = receiveBatch(sock, sample, updated)) > 0) {
+            queueDepth += count;
+        }
 
-        double x, y, z, fx, fy, fz;
-        int parsed = sscanf(buffer, "%lf %lf %lf %lf %lf %lf", &x, &y, &z, &fx, &fy, &fz);
-        if (parsed == 6) {
-            toolPosition = Eigen::Vector3d(x, y, z);
-            forceTool = Eigen::Vector3d(fx, fy, fz);
-        } else {
-            std::cerr << "Invalid message: " << buffer << std::endl;
+        if (updated) {
+            latestSample.publish();
+            receiveCounters.published.fetch_add(1, std::memory_order_relaxed);
         }
+        updateReceiveCounters(queueDepth);
     }
 }
 
+// Variante em memória compartilhada: lê somente a mensagem mais recente do anel
+void sharedMemoryReceiveLoop(ShmRing& ring) {
+    while (receiving.load(std::memory_order_relaxed)) {
+        if (!ring.wait(100)) continue;
+
+        HapticMessage message;
+        uint64_t queueDepth = 0;
+        if (ring.readLatest(message, queueDepth) && applyMessage(message, latestSample.back())) {
+            latestSample.publish();
+            receiveCounters.published.fetch_add(1, std::memory_order_relaxed);
+        }
+        updateReceiveCounters(queueDepth);
+    }
+}
+
+// Atualiza o estado desenhado com a amostra mais recente, uma vez por quadro
+void updateFromLatestSample() {
+    if (!latestSample.update()) staleFrames++;
+
+    const RenderSample& sample = latestSample.front();
+    toolPosition = sample.toolPosition;
+    forceTool = sample.forceTool;
+
+    // Idade da amostra desenhada (atraso entre o processador e a tela)
+    if (sample.timestamp != 0) {
+        uint64_t now = hapticMessageClock();
+        sampleStaleness.record(now > sample.timestamp ? now - sample.timestamp : 0);
+    }
+}
+
+void printReceiveStatus(std::ostream& a_stream) {
+    a_stream << std::fixed << std::setprecision(3)
+             << "datagrams: " << receiveCounters.datagrams.load(std::memory_order_relaxed)
+             << " | queue depth: " << receiveCounters.lastQueueDepth.load(std::memory_order_relaxed)
+             << " (max " << receiveCounters.maxQueueDepth.load(std::memory_order_relaxed) << ")"
+             << " | staleness p50: " << sampleStaleness.percentile(50.0) / 1e6 << " ms"
+             << " p99: " << sampleStaleness.percentile(99.0) / 1e6 << " ms"
+             << " | stale frames: " << staleFrames;
+}
+
 void drawForceVector(const Eigen::Vector3d& force) {
     if (force.norm() < 1e-6) return;
 
@@ -94,9 +216,7 @@ void drawForceVector(const Eigen::Vector3d& force) {
         glRotated(angle, rotAxis.x(), rotAxis.y(), rotAxis.z());
     }
 
-    GLUquadric* quad = gluNewQuadric();
-    gluCylinder(quad, 0.001, 0.0, 0.003, 16, 1);
-    gluDeleteQuadric(quad);
+    geometryCache.drawCylinder(0.001, 0.0, 0.003, 16, 1);
     glPopMatrix();
     glEnable(GL_LIGHTING);
 }
@@ -105,19 +225,17 @@ int updateGraphics() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     cMatrixGL matrix;
-    matrix.set(SpherePosition);
+    matrix.set(Sphere.position);
     matrix.glMatrixPushMultiply();
-    GLUquadricObj* sphere = gluNewQuadric();
     glEnable(GL_COLOR_MATERIAL);
     glColor3f(0.1f, 0.3f, 0.5f);
-    gluSphere(sphere, SphereRadius, 32, 32);
+    geometryCache.drawSphere(Sphere.radius, 32, 32);
     matrix.glMatrixPop();
 
     matrix.set(toolPosition, Eigen::Matrix3d::Identity());
     matrix.glMatrixPushMultiply();
-    sphere = gluNewQuadric();
     glColor3f(0.8f, 0.8f, 0.8f);
-    gluSphere(sphere, ToolRadius, 32, 32);
+    geometryCache.drawSphere(Sphere.toolRadius, 32, 32);
     drawForceVector(forceTool);
     matrix.glMatrixPop();
 
@@ -141,40 +259,18 @@ void onWindowResized(GLFWwindow* a_window, int a_width, int a_height) {
 
 void onKeyPressed(GLFWwindow* a_window, int a_key, int, int a_action, int) {
     if (a_action != GLFW_PRESS) return;
-    if (a_key == GLFW_KEY_ESCAPE || a_key == GLFW_KEY_Q) exit(0);
+    if (a_key == GLFW_KEY_ESCAPE || a_key == GLFW_KEY_Q) glfwSetWindowShouldClose(a_window, GLFW_TRUE);
+    if (a_key == GLFW_KEY_R) {
+        showReceiveStatus = !showReceiveStatus;
+        std::cout << std::endl;
+    }
 }
 
 void onError(int, const char* a_description) {
     std::cout << "error: " << a_description << std::endl;
 }
 
-int initializeGLFW() {
-    if (!glfwInit()) return -1;
-    glfwSetErrorCallback(onError);
-
-    const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
-    windowWidth = static_cast<int>(0.8 * mode->height);
-    windowHeight = static_cast<int>(0.5 * mode->height);
-    int x = static_cast<int>(0.5 * (mode->width - windowWidth));
-    int y = static_cast<int>(0.5 * mode->height);
-
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-    glfwWindowHint(GLFW_DOUBLEBUFFER, GLFW_TRUE);
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    glfwWindowHint(GLFW_STEREO, GL_FALSE);
-    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
-
-    window = glfwCreateWindow(windowWidth, windowHeight, "Sphere Render Only", nullptr, nullptr);
-    if (!window) return -1;
-    glfwMakeContextCurrent(window);
-    glfwSetKeyCallback(window, onKeyPressed);
-    glfwSetWindowSizeCallback(window, onWindowResized);
-    glfwSetWindowPos(window, x, y);
-    glfwSwapInterval(SwapInterval);
-    glfwShowWindow(window);
-    onWindowResized(window, windowWidth, windowHeight);
-
+void initializeOpenGL() {
     GLfloat mat_ambient[] = { 0.5f, 0.5f, 0.5f };
     GLfloat mat_diffuse[] = { 0.5f, 0.5f, 0.5f };
     GLfloat mat_specular[] = { 0.5f, 0.5f, 0.5f };
@@ -203,19 +299,114 @@ int initializeGLFW() {
 
     glEnable(GL_DEPTH_TEST);
     glClearColor(0.0, 0.0, 0.0, 1.0);
+}
+
+int initializeGLFW() {
+    if (!glfwInit()) return -1;
+    glfwSetErrorCallback(onError);
+
+    // Sem monitor não há janela: use --headless
+    GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+    const GLFWvidmode* mode = monitor ? glfwGetVideoMode(monitor) : nullptr;
+    if (!mode) {
+        std::cout << "error: no monitor found, use --headless to render offscreen" << std::endl;
+        return -1;
+    }
+    windowWidth = static_cast<int>(0.8 * mode->height);
+    windowHeight = static_cast<int>(0.5 * mode->height);
+    int x = static_cast<int>(0.5 * (mode->width - windowWidth));
+    int y = static_cast<int>(0.5 * mode->height);
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_DOUBLEBUFFER, GLFW_TRUE);
+    glfwWindowHint(GLFW_SAMPLES, 4);
+    glfwWindowHint(GLFW_STEREO, GL_FALSE);
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+
+    window = glfwCreateWindow(windowWidth, windowHeight, "Sphere Render Only", nullptr, nullptr);
+    if (!window) return -1;
+    glfwMakeContextCurrent(window);
+    glfwSetKeyCallback(window, onKeyPressed);
+    glfwSetWindowSizeCallback(window, onWindowResized);
+    glfwSetWindowPos(window, x, y);
+    glfwSwapInterval(SwapInterval);
+    glfwShowWindow(window);
+    onWindowResized(window, windowWidth, windowHeight);
+    initializeOpenGL();
     return 0;
 }
 
-int main() {
+// Cena roteirizada pelo emulador, renderizada fora da tela (--headless)
+int runHeadless(const HeadlessOptions& a_options) {
+    OffscreenContext context;
+    if (!context.create(a_options.width, a_options.height)) {
+        std::cout << "error: " << context.lastError() << std::endl;
+        return -1;
+    }
+    initializeOpenGL();
+    onWindowResized(nullptr, a_options.width, a_options.height);
+
+    DeviceEmulator& emulator = DeviceEmulator::instance();
+    if (!emulator.open() || !emulator.isScripted()) {
+        std::cout << "error: headless mode needs a scripted DHD_EMULATOR mode" << std::endl;
+        return -1;
+    }
+
+    int result = runHeadlessFrames(a_options, context, std::cout,
+        [&](double a_time) {
+            // Força de contato com a esfera desenhada
+            EmulatedSample sample;
+            emulator.advanceTo(a_time);
+            emulator.sample(sample);
+            toolPosition = Eigen::Vector3d(sample.position[0], sample.position[1], sample.position[2]);
+            forceTool = Sphere.computeForce(toolPosition);
+        },
+        []() { return updateGraphics(); });
+
+    geometryCache.clear();
+    return result;
+}
+
+int main(int argc, char* argv[]) {
     std::cout << "Visualização sem dispositivo háptico" << std::endl;
+
+    // Memória compartilhada em vez de UDP (--transport=shm)
+    bool sharedMemory = false;
+    HeadlessOptions headless;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--transport=shm") == 0) sharedMemory = true;
+        else headless.parse(argv[i]);
+    }
+    if (headless.enabled) return runHeadless(headless);
+
     if (initializeGLFW() < 0) return -1;
 
-    SOCKET udpSocket;
-    sockaddr_in serverAddr;
-    setupUDPListener(udpSocket, serverAddr);
+    ShmRing ring;
+    if (sharedMemory && !ring.open(DefaultShmRingName, false)) {
+        std::cerr << "Memória compartilhada indisponível, usando UDP." << std::endl;
+        sharedMemory = false;
+    }
+
+    // A porta UDP só é aberta sem memória compartilhada
+    UdpSocket udpSocket;
+    if (!sharedMemory) setupUDPListener(udpSocket);
+    std::thread receiveThread = sharedMemory ? std::thread(sharedMemoryReceiveLoop, std::ref(ring))
+                                             : std::thread(receiveLoop, std::ref(udpSocket));
+
+    std::cout << "press 'r' to toggle display of the receive statistics" << std::endl;
+    std::cout << "      'q' to quit" << std::endl << std::endl;
 
+    double statusTime = glfwGetTime();
     while (!glfwWindowShouldClose(window)) {
-        checkForMessage(udpSocket);
+        updateFromLatestSample();
+
+        if (showReceiveStatus && (glfwGetTime() - statusTime > 0.5)) {
+            statusTime = glfwGetTime();
+            std::cout << "\r";
+            printReceiveStatus(std::cout);
+            std::cout << "    " << std::flush;
+        }
 
         if (updateGraphics() < 0) {
             std::cout << "error: failed to update graphics" << std::endl;
@@ -225,8 +416,21 @@ int main() {
         glfwPollEvents();
     }
 
-    closesocket(udpSocket);
-    WSACleanup();
+    receiving = false;
+    receiveThread.join();
+
+    std::cout << std::endl;
+    printReceiveStatus(std::cout);
+    std::cout << std::endl;
+    std::cout << "messages received: " << sequenceTracker.received()
+              << ", lost: " << sequenceTracker.lost()
+              << ", reordered: " << sequenceTracker.reordered()
+              << ", duplicated: " << sequenceTracker.duplicated()
+              << ", restarts: " << sequenceTracker.restarts()
+              << ", published: " << receiveCounters.published.load() << std::endl;
+
+    udpSocket.close();
+    geometryCache.clear();
     glfwDestroyWindow(window);
     glfwTerminate();
     return 0;
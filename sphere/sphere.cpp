@@ -3,13 +3,20 @@
 // C++ library headers
 #define _USE_MATH_DEFINES
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
+#include <random>
+#include <string>
 
 // Platform specific headers
+#ifdef _WIN32
 #define NOMINMAX
 #include "windows.h"
+#endif
 
 // GLU library headers
 #include "GL/glu.h"
@@ -22,24 +29,47 @@
 
 // Project headers
 #include "CMatrixGL.h"
+#include "device_emulator.h"
 #include "FontGL.h"
+#include "force_models.h"
+#include "geometry_cache.h"
+#include "headless_renderer.h"
+#include "loop_timing.h"
+#include "realtime_thread.h"
+#include "task_pool.h"
+#include "telemetry_recorder.h"
+#include "triple_buffer.h"
+#include "velocity_estimator.h"
 
 // Constants
-const Eigen::Vector3d SpherePosition(0.0, 0.0, 0.0);
-constexpr double SphereRadius = 0.03;
-constexpr double ToolRadius = 0.005;
-constexpr double LinearStiffness = 1000.0;
+const SphereContactModel Sphere;  // Sphere, tool radius and contact stiffness.
+ObstacleContactModel Obstacles;  // Obstacles scattered around the sphere (--obstacles=N).
 constexpr int SwapInterval = 1;
+constexpr double InstrumentSpacing = 0.004;  // Distance between the spheres of the instrument along the tool x axis.
+constexpr std::chrono::microseconds InstrumentBudget { 400 };  // Time left to the instrument contacts in each haptic iteration.
+
+// Scene state shared by the haptic thread with the graphics thread
+struct SceneSnapshot {
+    Eigen::Vector3d toolPosition = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d toolRotation = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d forceTool = Eigen::Vector3d::Zero();
+};
 
 // Global variables
-bool simulationRunning = true;
-bool simulationFinished = false;
+std::atomic<bool> simulationRunning { true };
+std::atomic<bool> simulationFinished { false };
 int toolCount = 0;
-Eigen::Vector3d toolPosition;
-Eigen::Vector3d forceTool;
+TripleBuffer<SceneSnapshot> sceneSnapshot;
 GLFWwindow* window = nullptr;
+GeometryCache geometryCache;
 int windowWidth = 0;
 int windowHeight = 0;
+LoopTiming hapticTiming;
+TelemetryRecorder telemetry;
+RealtimeThread hapticThread;
+bool showHapticRate = false;
+int instrumentSpheres = 1;
+TaskPool<ObstacleContactBatch> instrumentPool;
 
 void drawForceVector(const Eigen::Vector3d& force) {
     if (force.norm() < 1e-6) return;
@@ -65,9 +95,7 @@ void drawForceVector(const Eigen::Vector3d& force) {
         glRotated(angle, rotAxis.x(), rotAxis.y(), rotAxis.z());
     }
 
-    GLUquadric* quad = gluNewQuadric();
-    gluCylinder(quad, 0.001, 0.0, 0.003, 16, 1);
-    gluDeleteQuadric(quad);
+    geometryCache.drawCylinder(0.001, 0.0, 0.003, 16, 1);
     glPopMatrix();
     glEnable(GL_LIGHTING);
 }
@@ -75,41 +103,102 @@ void drawForceVector(const Eigen::Vector3d& force) {
 int updateGraphics() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    double deviceRotation[3][3] = {};
-    if (dhdGetOrientationFrame(deviceRotation) < 0) return -1;
+    // Fetch the latest consistent scene published by the haptic thread.
+    sceneSnapshot.update();
+    const SceneSnapshot& scene = sceneSnapshot.front();
 
     cMatrixGL matrix;
-    matrix.set(SpherePosition);
+    matrix.set(Sphere.position);
     matrix.glMatrixPushMultiply();
-    GLUquadricObj* sphere = gluNewQuadric();
     glEnable(GL_COLOR_MATERIAL);
     glColor3f(0.1f, 0.3f, 0.5f);
-    gluSphere(sphere, SphereRadius, 32, 32);
+    geometryCache.drawSphere(Sphere.radius, 32, 32);
     matrix.glMatrixPop();
 
-    matrix.set(toolPosition, deviceRotation);
+    glColor3f(0.5f, 0.4f, 0.2f);
+    for (size_t i = 0; i < Obstacles.scene.size(); i++)
+    {
+        matrix.set(Obstacles.scene.center(i));
+        matrix.glMatrixPushMultiply();
+        geometryCache.drawSphere(Obstacles.scene.radius(i), 12, 12);
+        matrix.glMatrixPop();
+    }
+
+    matrix.set(scene.toolPosition, scene.toolRotation);
     matrix.glMatrixPushMultiply();
-    sphere = gluNewQuadric();
     glColor3f(0.8f, 0.8f, 0.8f);
-    gluSphere(sphere, ToolRadius, 32, 32);
-    drawForceVector(forceTool);
+    geometryCache.drawSphere(Sphere.toolRadius, 32, 32);
+    for (int i = 1; i < instrumentSpheres; i++) {
+        glPushMatrix();
+        glTranslated(-i * InstrumentSpacing, 0.0, 0.0);
+        geometryCache.drawSphere(Obstacles.toolRadius, 12, 12);
+        glPopMatrix();
+    }
+    drawForceVector(scene.forceTool);
     matrix.glMatrixPop();
 
     GLenum err = glGetError();
     return (err != GL_NO_ERROR) ? -1 : 0;
 }
 
+// Obstacle contacts of an instrument of spheres along the tool x axis, its
+// tip at the tool, computed on the task pool until 'a_deadline'. Past the
+// deadline, the last complete result is rendered again. The spheres share
+// the tool velocity, the rotation of the tool being neglected.
+Eigen::Vector3d computeInstrumentForce(const Eigen::Vector3d& a_tip,
+                                       const Eigen::Matrix3d& a_rotation,
+                                       const Eigen::Vector3d& a_velocity,
+                                       TaskPool<ObstacleContactBatch>::Clock::time_point a_deadline) {
+    ObstacleContactBatch* batch = instrumentPool.acquire();
+    if (batch != nullptr) {
+        batch->model = &Obstacles;
+        batch->toolPositions.resize(instrumentSpheres);
+        batch->toolVelocities.assign(instrumentSpheres, a_velocity);
+        for (int i = 0; i < instrumentSpheres; i++) {
+            batch->toolPositions[i] = a_tip - i * InstrumentSpacing * a_rotation.col(0);
+        }
+        instrumentPool.submit();
+    }
+    ObstacleContactBatch::Result contacts;
+    instrumentPool.wait(a_deadline, contacts);
+    return contacts.force;
+}
+
 void* hapticsLoop(void*) {
     dhdEnableForce(DHD_ON);
+    VelocityEstimator toolVelocityEstimator;
     while (simulationRunning) {
+        hapticTiming.beginIteration();
+        TaskPool<ObstacleContactBatch>::Clock::time_point deadline = TaskPool<ObstacleContactBatch>::Clock::now() + InstrumentBudget;
+
         double px, py, pz;
-        dhdGetPosition(&px, &py, &pz);
+        double rot[3][3] = {};
+        if (dhdGetPosition(&px, &py, &pz) < 0 || dhdGetOrientationFrame(rot) < 0) {
+            // The end of a scripted trajectory is not an error.
+            if (!DeviceEmulator::instance().isFinished()) {
+                std::cout << std::endl << "error: failed to read position (" << dhdErrorGetLastStr() << ")" << std::endl;
+            }
+            break;
+        }
+        SceneSnapshot& scene = sceneSnapshot.back();
+        Eigen::Vector3d& toolPosition = scene.toolPosition;
+        Eigen::Vector3d& forceTool = scene.forceTool;
         toolPosition << px, py, pz;
-
-        Eigen::Vector3d dir = (toolPosition - SpherePosition).normalized();
-        double pen = (toolPosition - SpherePosition).norm() - SphereRadius - ToolRadius;
-        if (pen < 0.0) forceTool = -pen * LinearStiffness * dir;
-        else forceTool.setZero();
+        scene.toolRotation << rot[0][0], rot[0][1], rot[0][2],
+                              rot[1][0], rot[1][1], rot[1][2],
+                              rot[2][0], rot[2][1], rot[2][2];
+
+        // Estimate the tool velocity from the positions for the contact damping.
+        double time = dhdGetTime();
+        Eigen::Vector3d toolVelocity;
+        toolVelocityEstimator.update(time, toolPosition.data());
+        toolVelocityEstimator.getVelocity(toolVelocity.data());
+        forceTool = Sphere.computeForce(toolPosition, toolVelocity);
+        if (instrumentSpheres > 1) {
+            forceTool += computeInstrumentForce(toolPosition, scene.toolRotation, toolVelocity, deadline);
+        } else {
+            forceTool += Obstacles.computeForce(toolPosition, toolVelocity);
+        }
 
         Eigen::Vector3d f = forceTool;
         static bool safe = false;
@@ -118,7 +207,19 @@ void* hapticsLoop(void*) {
             else f.setZero();
         }
         dhdSetForce(f(0), f(1), f(2));
+
+        // Record the iteration without blocking, if requested.
+        if (telemetry.isOpen()) {
+            uint32_t buttons = (dhdGetButton(0) != DHD_OFF) ? 1 : 0;
+            telemetry.record(time, toolPosition.data(), toolVelocity.data(), f.data(), buttons, hapticTiming);
+        }
+
+        // Publish the scene to the graphics thread without blocking.
+        sceneSnapshot.publish();
+
+        hapticTiming.endIteration();
     }
+    simulationRunning = false;
     simulationFinished = true;
     return nullptr;
 }
@@ -131,6 +232,28 @@ void onExit()
     {
         dhdSleep(0.1);
     }
+    hapticThread.join();
+    instrumentPool.stop();
+
+    // Report the haptic loop timing statistics.
+    std::cout << std::endl;
+    hapticTiming.printReport(std::cout);
+    if (instrumentSpheres > 1)
+    {
+        std::cout << "instrument: " << instrumentPool.completed() << " batches completed, " << instrumentPool.missed()
+                  << " past their deadline, " << instrumentPool.refused() << " refused" << std::endl;
+    }
+
+    // Write the remaining telemetry samples and the chunk index.
+    if (telemetry.isOpen())
+    {
+        telemetry.setNominalRate(hapticTiming.nominalRate());
+        if (!telemetry.close())
+        {
+            std::cout << "error: " << telemetry.lastError() << std::endl;
+        }
+        std::cout << "telemetry: " << telemetry.written() << " samples written, " << telemetry.dropped() << " dropped" << std::endl;
+    }
 
     // Close the connection to the haptic device.
     if (dhdClose() < 0)
@@ -180,6 +303,13 @@ void onKeyPressed(GLFWwindow* a_window,
     {
         exit(0);
     }
+
+    // Toggle the display of the haptic rate.
+    if (a_key == GLFW_KEY_R)
+    {
+        showHapticRate = !showHapticRate;
+        std::cout << std::endl;
+    }
 }
 
 void onError(int a_error,
@@ -188,6 +318,44 @@ void onError(int a_error,
     std::cout << "error: " << a_description << std::endl;
 }
 
+void initializeOpenGL()
+{
+    // Define material properties.
+    GLfloat mat_ambient[] = { 0.5f, 0.5f, 0.5f };
+    GLfloat mat_diffuse[] = { 0.5f, 0.5f, 0.5f };
+    GLfloat mat_specular[] = { 0.5f, 0.5f, 0.5f };
+    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, mat_ambient);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, mat_diffuse);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, mat_specular);
+    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 1.0);
+
+    // Define light sources.
+    GLfloat ambient[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+    GLfloat diffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
+    GLfloat specular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glLightfv(GL_LIGHT0, GL_AMBIENT, ambient);
+    glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuse);
+    glLightfv(GL_LIGHT0, GL_SPECULAR, specular);
+    glLightf(GL_LIGHT0, GL_CONSTANT_ATTENUATION, 1.0);
+    glLightf(GL_LIGHT0, GL_LINEAR_ATTENUATION, 0.0);
+    glLightf(GL_LIGHT0, GL_QUADRATIC_ATTENUATION, 0.0);
+
+    GLfloat lightPos[] = { 2.0, 0.0, 0.0, 1.0f };
+    GLfloat lightDir[] = { -1.0, 0.0, 0.0, 1.0f };
+    glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
+    glLightfv(GL_LIGHT0, GL_SPOT_DIRECTION, lightDir);
+    glLightf(GL_LIGHT0, GL_SPOT_CUTOFF, 180);
+    glLightf(GL_LIGHT0, GL_SPOT_EXPONENT, 1.0);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_LIGHT0);
+
+    // Use depth buffering for hidden surface elimination.
+    glEnable(GL_DEPTH_TEST);
+
+    // Clear the OpenGL color buffer.
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+}
+
 int initializeGLFW()
 {
     // Initialize the GLFW library.
@@ -200,7 +368,13 @@ int initializeGLFW()
     glfwSetErrorCallback(onError);
 
     // Compute the desired window size.
-    const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+    const GLFWvidmode* mode = (monitor != nullptr) ? glfwGetVideoMode(monitor) : nullptr;
+    if (mode == nullptr)
+    {
+        std::cout << "error: no monitor found, use --headless to render offscreen" << std::endl;
+        return -1;
+    }
     windowWidth = static_cast<int>(0.8 *  mode->height);
     windowHeight = static_cast<int>(0.5 * mode->height);
     int x = static_cast<int>(0.5 * (mode->width - windowWidth));
@@ -230,40 +404,8 @@ int initializeGLFW()
     // Adjust initial window size
     onWindowResized(window, windowWidth, windowHeight);
 
-    // Define material properties.
-    GLfloat mat_ambient[] = { 0.5f, 0.5f, 0.5f };
-    GLfloat mat_diffuse[] = { 0.5f, 0.5f, 0.5f };
-    GLfloat mat_specular[] = { 0.5f, 0.5f, 0.5f };
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, mat_ambient);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, mat_diffuse);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, mat_specular);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 1.0);
-
-    // Define light sources.
-    GLfloat ambient[] = { 0.5f, 0.5f, 0.5f, 1.0f };
-    GLfloat diffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
-    GLfloat specular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glLightfv(GL_LIGHT0, GL_AMBIENT, ambient);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuse);
-    glLightfv(GL_LIGHT0, GL_SPECULAR, specular);
-    glLightf(GL_LIGHT0, GL_CONSTANT_ATTENUATION, 1.0);
-    glLightf(GL_LIGHT0, GL_LINEAR_ATTENUATION, 0.0);
-    glLightf(GL_LIGHT0, GL_QUADRATIC_ATTENUATION, 0.0);
-
-    GLfloat lightPos[] = { 2.0, 0.0, 0.0, 1.0f };
-    GLfloat lightDir[] = { -1.0, 0.0, 0.0, 1.0f };
-    glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
-    glLightfv(GL_LIGHT0, GL_SPOT_DIRECTION, lightDir);
-    glLightf(GL_LIGHT0, GL_SPOT_CUTOFF, 180);
-    glLightf(GL_LIGHT0, GL_SPOT_EXPONENT, 1.0);
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-
-    // Use depth buffering for hidden surface elimination.
-    glEnable(GL_DEPTH_TEST);
-
-    // Clear the OpenGL color buffer.
-    glClearColor(0.0, 0.0, 0.0, 1.0);
+    // Set up materials and lights.
+    initializeOpenGL();
 
     // Report success.
     return 0;
@@ -283,16 +425,115 @@ int initializeHaptics()
     return 0;
 }
 
+void scatterObstacles(int a_count)
+{
+    // Scatter obstacles of 2 to 5 mm in a 12 cm cube around the sphere, the
+    // same on every run; few radii, so that few display lists are compiled.
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> coordinate(-0.06, 0.06);
+    std::uniform_int_distribution<int> radius(2, 5);
+    Obstacles.scene.reserve(a_count);
+    while (static_cast<int>(Obstacles.scene.size()) < a_count)
+    {
+        Eigen::Vector3d center(coordinate(random), coordinate(random), coordinate(random));
+        double obstacleRadius = 0.001 * radius(random);
+        if ((center - Sphere.position).norm() > Sphere.radius + obstacleRadius)
+        {
+            Obstacles.scene.add(center, obstacleRadius);
+        }
+    }
+}
+
 int initializeSimulation()
 {
     // Initialize all tool positions.
-    toolPosition.setZero();
+    sceneSnapshot.write(SceneSnapshot {});
     return 0;
 }
 
+int runHeadless(const HeadlessOptions& a_options)
+{
+    // Render into an offscreen framebuffer, without window nor monitor.
+    OffscreenContext context;
+    if (!context.create(a_options.width, a_options.height))
+    {
+        std::cout << "error: " << context.lastError() << std::endl;
+        return -1;
+    }
+    initializeOpenGL();
+    onWindowResized(nullptr, a_options.width, a_options.height);
+
+    // Script the tool with the device emulator, so that frames are reproducible.
+    DeviceEmulator& emulator = DeviceEmulator::instance();
+    if (!emulator.open() || !emulator.isScripted())
+    {
+        std::cout << "error: headless mode needs a scripted DHD_EMULATOR mode" << std::endl;
+        return -1;
+    }
+
+    int result = runHeadlessFrames(a_options, context, std::cout,
+        [&](double a_time)
+        {
+            EmulatedSample sample;
+            emulator.advanceTo(a_time);
+            emulator.sample(sample);
+            SceneSnapshot scene;
+            scene.toolPosition << sample.position[0], sample.position[1], sample.position[2];
+            scene.forceTool = Sphere.computeForce(scene.toolPosition) + Obstacles.computeForce(scene.toolPosition);
+            sceneSnapshot.write(scene);
+        },
+        []() { return updateGraphics(); });
+
+    geometryCache.clear();
+    return result;
+}
+
 int main(int argc,
          char* argv[])
 {
+    // Render a scripted scene offscreen and report frame times (--headless),
+    // or record every haptic iteration to a telemetry file (--record=FILE).
+    // Add obstacles around the sphere with --obstacles=N, touched by an
+    // instrument of N spheres with --instrument=N. Run the haptic thread at
+    // real-time priority with --realtime (always in production).
+    HeadlessOptions headless;
+    std::string recordPath;
+    int obstacleCount = 0;
+#ifdef PROD_BUILD
+    bool realtime = true;
+#else
+    bool realtime = false;
+#endif
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument.rfind("--record=", 0) == 0)
+        {
+            recordPath = argument.substr(9);
+        }
+        else if (argument.rfind("--obstacles=", 0) == 0)
+        {
+            obstacleCount = std::max(std::atoi(argument.c_str() + 12), 0);
+        }
+        else if (argument.rfind("--instrument=", 0) == 0)
+        {
+            instrumentSpheres = std::max(std::atoi(argument.c_str() + 13), 1);
+        }
+        else if (argument == "--realtime")
+        {
+            realtime = true;
+        }
+        else if (!headless.parse(argument))
+        {
+            std::cout << "warning: ignoring unknown option " << argument << std::endl;
+        }
+    }
+    scatterObstacles(obstacleCount);
+    if (headless.enabled)
+    {
+        return runHeadless(headless);
+    }
+
     // Display version information.
     std::cout << "OpenGL Sphere Example " << dhdGetSDKVersionStr() << std::endl;
     std::cout << "Copyright (C) 2001-2023 Force Dimension" << std::endl;
@@ -305,6 +546,17 @@ int main(int argc,
         return -1;
     }
 
+    // Start the telemetry writer before the haptic thread.
+    if (!recordPath.empty())
+    {
+        if (!telemetry.open(recordPath, 0.0, "sphere"))
+        {
+            std::cout << "error: " << telemetry.lastError() << std::endl;
+            return -1;
+        }
+        std::cout << "recording telemetry to " << recordPath << std::endl;
+    }
+
     // Open a GLFW window to render the simulation.
     if (initializeGLFW() < 0)
     {
@@ -319,10 +571,24 @@ int main(int argc,
         return -1;
     }
 
-    // Create a high priority haptic thread.
-    DWORD threadHandle;
-    CreateThread(nullptr, 0, (LPTHREAD_START_ROUTINE)(hapticsLoop), nullptr, 0x0000, &threadHandle);
-    SetThreadPriority(&threadHandle, THREAD_PRIORITY_ABOVE_NORMAL);
+    // Create a haptic thread pinned to its own core, at real-time priority
+    // with locked memory in production builds or with --realtime.
+    RealtimeThreadConfig hapticConfig;
+    if (!realtime)
+    {
+        hapticConfig.priority = 0;
+        hapticConfig.lockMemory = false;
+    }
+
+    // Spread the obstacle contacts of a multi-sphere instrument over the
+    // cores left by the haptic and graphics threads.
+    if (instrumentSpheres > 1)
+    {
+        instrumentPool.start(-1, hapticConfig.core);
+        std::cout << "instrument: " << instrumentSpheres << " spheres, " << instrumentPool.workerCount() << " workers" << std::endl;
+    }
+    hapticThread.start(hapticConfig, []() { hapticsLoop(nullptr); });
+    hapticThread.report().print(std::cout);
 
     // Register a callback that stops the haptic thread when the application exits.
     atexit(onExit);
@@ -335,8 +601,18 @@ int main(int argc,
     std::cout << "      'q' to quit" << std::endl << std::endl;
 
     // Main graphic loop
+    double statusTime = glfwGetTime();
     while (simulationRunning && !glfwWindowShouldClose(window))
     {
+        // Display the haptic rate and jitter twice per second.
+        if (showHapticRate && (glfwGetTime() - statusTime > 0.5))
+        {
+            statusTime = glfwGetTime();
+            std::cout << "\r";
+            hapticTiming.printStatus(std::cout);
+            std::cout << "    " << std::flush;
+        }
+
         // Render graphics.
         if (updateGraphics() < 0)
         {
@@ -351,6 +627,9 @@ int main(int argc,
         glfwPollEvents();
     }
 
+    // Release the cached geometry while the OpenGL context still exists.
+    geometryCache.clear();
+
     // Close the GLFW window.
     glfwDestroyWindow(window);
 
@@ -1,14 +1,21 @@
 // C++ library headers
 #define _USE_MATH_DEFINES
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
+#include <string>
+#include <thread>
 #include <vector>
 
 // Platform specific headers
+#ifdef _WIN32
 #define NOMINMAX
 #include "windows.h"
+#endif
 
 // GLU library headers
 #include "GL/glu.h"
@@ -21,16 +28,27 @@
 
 // Project headers
 #include "CMatrixGL.h"
+#include "device_emulator.h"
 #include "FontGL.h"
+#include "force_models.h"
+#include "geometry_cache.h"
+#include "headless_renderer.h"
+#include "loop_scheduler.h"
+#include "loop_timing.h"
+#include "realtime_thread.h"
+#include "telemetry_recorder.h"
+#include "triple_buffer.h"
+#include "velocity_estimator.h"
+
+// Shapes tessellated once and replayed by the graphics thread.
+GeometryCache geometryCache;
 
 class Utils {
     public:
-    inline static Eigen::Vector3d forceOnTool = Eigen::Vector3d::Zero();
-
-    static void drawForceOnTool() {
+    static void drawForceOnTool(const Eigen::Vector3d& a_forceOnTool) {
         Eigen::Vector3d fixedVector(0.03, 0.0, 0.0);
         Eigen::Vector3d start(0.0, 0.0, 0.0);
-        Eigen::Vector3d end = Utils::forceOnTool/1000;
+        Eigen::Vector3d end = a_forceOnTool/1000;
         glDisable(GL_LIGHTING);
         glBegin(GL_LINES);
         glColor3f(1.0f, 0.0f, 0.0f); // Set color to red
@@ -39,7 +57,6 @@ class Utils {
         glEnd();
 
         // Draw the arrow tip as a cone
-        GLUquadric* quad = gluNewQuadric();
         glPushMatrix();
 
         // Move to the end of the vector
@@ -52,11 +69,10 @@ class Utils {
         glRotated(angle, rotationAxis.x(), rotationAxis.y(), rotationAxis.z());
 
         // Draw the cone (radius = 0.003, height = 0.005)
-        gluCylinder(quad, 0.001, 0.0, 0.003, 16, 1);
+        geometryCache.drawCylinder(0.001, 0.0, 0.003, 16, 1);
 
         // Do cleanup operations for OpenGL
         glPopMatrix();
-        gluDeleteQuadric(quad);
         glEnable(GL_LIGHTING);
     };
 };
@@ -64,44 +80,112 @@ class Utils {
 struct HapticDevice
 {
     int deviceId;
+    Eigen::Vector3d devicePosition;
+    Eigen::Vector3d deviceVelocity;
+    VelocityEstimator velocityEstimator;
     Eigen::Vector3d toolPosition;
     Eigen::Matrix3d rotation;
+    Eigen::Vector3d force;
+    bool safeToRenderHaptics;
 
     HapticDevice()
-    : deviceId { -1 }
+    : deviceId { -1 },
+      devicePosition { Eigen::Vector3d::Zero() },
+      deviceVelocity { Eigen::Vector3d::Zero() },
+      toolPosition { Eigen::Vector3d::Zero() },
+      rotation { Eigen::Matrix3d::Identity() },
+      force { Eigen::Vector3d::Zero() },
+      safeToRenderHaptics { false }
     {}
 };
 
 // Constants
-constexpr double Stiffness = 1000.0;
-constexpr double Mass = 1000.0;
-constexpr double Kv = 1.0;
-constexpr float TorusOuterRadius = 0.05f;
-constexpr float TorusInnerRadius = 0.027f;
-constexpr double ToolRadius = 0.005;
+constexpr int MaxDevices = 8;
 constexpr int GlfwSwapInterval = 1;
+constexpr double DefaultPhysicsRate = 500.0;
+constexpr double MinPhysicsRate = 10.0;
+
+// State of one tool as seen by the graphics thread
+struct ToolSnapshot
+{
+    Eigen::Vector3d position = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d forceOnTool = Eigen::Vector3d::Zero();
+};
+
+// Scene state published by the haptic thread for the graphics thread
+struct SceneSnapshot
+{
+    Eigen::Vector3d torusPosition = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d torusRotation = Eigen::Matrix3d::Identity();
+    size_t toolCount = 0;
+    std::array<ToolSnapshot, MaxDevices> tools;
+};
+
+// Torus pose and surface patches published by the physics thread for the haptic thread
+struct PhysicsSnapshot
+{
+    Eigen::Vector3d torusPosition = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d torusRotation = Eigen::Matrix3d::Identity();
+    std::array<ContactPatch, MaxDevices> patches;
+};
+
+// Tool positions and reactions published by the haptic thread for the physics thread.
+// The reactions are running totals, so that none is lost when the physics thread
+// misses intermediate values.
+struct HapticFeedback
+{
+    double time = 0.0;
+    size_t toolCount = 0;
+    std::array<Eigen::Vector3d, MaxDevices> toolPositions;
+    Eigen::Vector3d angularImpulse = Eigen::Vector3d::Zero();
+    uint64_t stopRequests = 0;
+};
 
 // Global variables
-bool simulationRunning = true;
-bool simulationFinished = false;
+std::atomic<bool> simulationRunning { true };
+std::atomic<bool> simulationFinished { false };
+std::atomic<bool> physicsRunning { true };
 GLFWwindow* window = nullptr;
 int windowWidth = 0;
 int windowHeight = 0;
+LoopTiming hapticTiming;
+TelemetryRecorder telemetry;
+RealtimeThread hapticThread;
+std::thread physicsThread;
+LoopScheduler physicsScheduler;
+bool showHapticRate = false;
 std::vector<HapticDevice> devicesList;
-Eigen::Vector3d torusPosition;
-Eigen::Matrix3d torusRotation;
+TorusContactModel torus;  // Torus pose and dynamics, owned by the physics thread; constant contact parameters.
+TripleBuffer<SceneSnapshot> sceneSnapshot;
+TripleBuffer<PhysicsSnapshot> physicsSnapshot;
+TripleBuffer<HapticFeedback> hapticFeedback;
 
 namespace HapticsMetods{
 
 int initializeHaptics()
 {
-    int deviceId = dhdOpenID(0);
-    if (deviceId >= 0)
+    // Open a connection to every available device.
+    int availableCount = std::min(dhdGetAvailableCount(), MaxDevices);
+    for (int deviceIndex = 0; deviceIndex < availableCount; deviceIndex++)
     {
+        int deviceId = dhdOpenID(static_cast<char>(deviceIndex));
+        if (deviceId < 0)
+        {
+            std::cout << "error: failed to open device " << deviceIndex << " (" << dhdErrorGetLastStr() << ")" << std::endl;
+            continue;
+        }
         devicesList.push_back(HapticDevice {});
         HapticDevice& currentDevice = devicesList.back();
         currentDevice.deviceId = deviceId;
-        std::cout << dhdGetSystemName() << " device detected" << std::endl;
+        std::cout << dhdGetSystemName(static_cast<char>(deviceId)) << " device detected (ID " << deviceId << ")" << std::endl;
+    }
+
+    // Report failure if no device could be opened.
+    if (devicesList.empty())
+    {
+        std::cout << "error: no haptic device found" << std::endl;
+        return -1;
     }
     return 0;
 }
@@ -114,135 +198,150 @@ void* hapticsLoop(void* a_userData)
     double py = 0.0;
     double pz = 0.0;
     double rot[3][3] = {};
-    Eigen::Vector3d toolPosition;
-    Eigen::Vector3d toolLocalPosition;
-    Eigen::Vector3d forceLocal;
-    Eigen::Vector3d force;
-    Eigen::Vector3d forceTool;
-    forceTool.setZero();
-    Eigen::Vector3d torusAngularVelocity;
-    torusAngularVelocity.setZero();
+    Eigen::Vector3d angularImpulse = Eigen::Vector3d::Zero();
+    uint64_t stopRequests = 0;
 
     // Enable force on all devices.
     size_t devicesCount = devicesList.size();
-    dhdEnableForce(DHD_ON, devicesList[0].deviceId);
+    for (size_t deviceIndex = 0; deviceIndex < devicesCount; deviceIndex++)
+    {
+        dhdEnableForce(DHD_ON, devicesList[deviceIndex].deviceId);
+    }
 
     // Run the haptic loop.
-    while (simulationRunning)
+    // Every DHD call below passes the device ID explicitly, so the loop never
+    // switches the SDK default device with dhdSetDevice.
+    bool deviceError = false;
+    while (simulationRunning && !deviceError)
     {
+        // Start timing the iteration.
+        hapticTiming.beginIteration();
+
         // Compute time step.
         double time = dhdGetTime();
         double timeStep = time - timePrevious;
         timePrevious = time;
 
-        // Process each device in turn.
-        // Shortcut to the current device.
-        HapticDevice& currentDevice = devicesList[0];
+        // Retrieve the orientation frame and position of every device.
+        for (size_t deviceIndex = 0; deviceIndex < devicesCount && !deviceError; deviceIndex++)
+        {
+            HapticDevice& currentDevice = devicesList[deviceIndex];
+            char deviceId = static_cast<char>(currentDevice.deviceId);
+
+            // Retrieve the device orientation frame (identity for 3-dof devices).
+            if (dhdGetOrientationFrame(rot, deviceId) < 0)
+            {
+                std::cout << std::endl << "error: failed to read rotation of device " << currentDevice.deviceId << " (" << dhdErrorGetLastStr() << ")" << std::endl;
+                deviceError = true;
+                break;
+            }
+            currentDevice.rotation << rot[0][0], rot[0][1], rot[0][2],
+                                      rot[1][0], rot[1][1], rot[1][2],
+                                      rot[2][0], rot[2][1], rot[2][2];
 
-        // Select the active device to receive all subsequent DHD commands.
-        dhdSetDevice(currentDevice.deviceId);
+            // Retrieve the position of the tool attached to the device.
+            if (dhdGetPosition(&px, &py, &pz, deviceId) < 0)
+            {
+                // The end of a scripted trajectory is not an error.
+                if (!DeviceEmulator::instance().isFinished())
+                {
+                    std::cout << std::endl << "error: failed to read position of device " << currentDevice.deviceId << " (" << dhdErrorGetLastStr() << ")" << std::endl;
+                }
+                deviceError = true;
+                break;
+            }
+            currentDevice.devicePosition << px, py, pz;
 
-        // Retrieve the device orientation frame (identity for 3-dof devices).
-        if (dhdGetOrientationFrame(rot) < 0)
-        {
-            std::cout << std::endl << "error: failed to read rotation (" << dhdErrorGetLastStr() << ")" << std::endl;
-            break;
+            // Estimate the device velocity from its positions for the contact damping.
+            currentDevice.velocityEstimator.update(time, currentDevice.devicePosition.data());
+            currentDevice.velocityEstimator.getVelocity(currentDevice.deviceVelocity.data());
         }
-        currentDevice.rotation << rot[0][0], rot[0][1], rot[0][2],
-                                    rot[1][0], rot[1][1], rot[1][2],
-                                    rot[2][0], rot[2][1], rot[2][2];
-
-        // Retrieve the position of all tools attached to devices.
-        // Devices equipped with grippers provide 2 tools, while others only provide 1.
-        if (dhdGetPosition(&px, &py, &pz) < 0)
+        if (deviceError)
         {
-            std::cout << std::endl << "error: failed to read rotation (" << dhdErrorGetLastStr() << ")" << std::endl;
             break;
         }
-        toolPosition << px, py, pz;
 
-        // Compute the position of the tool in the local coordinates of the torus.
-        toolLocalPosition = torusRotation.transpose() * (toolPosition - torusPosition);
+        // Fetch the latest torus surface patches published by the physics thread.
+        physicsSnapshot.update();
+        const PhysicsSnapshot& physics = physicsSnapshot.front();
 
-        // Project the tool position onto the torus plane (z = 0).
-        Eigen::Vector3d toolProjection = toolLocalPosition;
-        toolProjection(2) = 0.0;
-
-        // Search for the nearest point on the torus medial axis.
-        forceLocal.setZero();
-        if (toolLocalPosition.squaredNorm() > 1e-10)
+        // Compute the contact forces of all tools against their patch of the torus,
+        // and accumulate their reactions on the torus.
+        for (size_t deviceIndex = 0; deviceIndex < devicesCount; deviceIndex++)
         {
-            Eigen::Vector3d pointAxisTorus = TorusOuterRadius * toolProjection.normalized();
+            HapticDevice& currentDevice = devicesList[deviceIndex];
+            Eigen::Vector3d forceTool = torus.computePatchForce(physics.patches[deviceIndex], time, currentDevice.devicePosition,
+                                                              currentDevice.toolPosition, currentDevice.deviceVelocity);
 
-            // Compute eventual penetration of the tool inside the torus.
-            Eigen::Vector3d torusToolDirection = toolLocalPosition - pointAxisTorus;
+            // TODO(now): retrieve reactionForce as the negative of forceTool
+            // Accumulate the reaction for the physics thread.
+            angularImpulse += torus.reactionImpulse(currentDevice.toolPosition, forceTool, timeStep);
 
-            // If the tool is inside the torus, compute the force which is proportional to the tool penetration.
-            double distance = torusToolDirection.norm();
-            if ((distance < (TorusInnerRadius + ToolRadius)) && (distance > 0.001))
+            // Only enable haptic rendering once the device is in free space.
+            currentDevice.force = forceTool;
+            if (!currentDevice.safeToRenderHaptics)
             {
-                forceLocal = ((TorusInnerRadius + ToolRadius) - distance) * Stiffness * torusToolDirection.normalized();
-                toolLocalPosition = pointAxisTorus + (TorusInnerRadius + ToolRadius) * torusToolDirection.normalized();
-            }
-
-            // Otherwise, the tool is outside the torus and we have a null force.
-            else
-            {
-                forceLocal.setZero();
+                if (forceTool.norm() == 0.0)
+                {
+                    currentDevice.safeToRenderHaptics = true;
+                }
+                else
+                {
+                    currentDevice.force.setZero();
+                }
             }
         }
 
-        // TODO(now): retrieve reactionForce as the negative of forceTool
-        // Convert the tool reaction force and position to world coordinates.
-        forceTool = torusRotation * forceLocal;
-        currentDevice.toolPosition = torusRotation * toolLocalPosition;
-
-        Utils::forceOnTool = forceTool;
-
-        // Update the torus angular velocity.
-        torusAngularVelocity += -1.0 / Mass * timeStep * (currentDevice.toolPosition - torusPosition).cross(forceTool);
-
-        // Compute the force to render on the haptic device.
-        Eigen::Vector3d force;
-        force = forceTool;
-
-        // Only enable haptic rendering once the device is in free space.
-        static bool safeToRenderHaptics = false;
-        if (!safeToRenderHaptics)
+        // Apply the forces to all devices, and request the physics thread to
+        // stop the torus rotation if any of the devices button is pressed.
+        double gripperForceMagnitude = 0.0;
+        for (size_t deviceIndex = 0; deviceIndex < devicesCount; deviceIndex++)
         {
-            if (force.norm() == 0.0)
+            const HapticDevice& currentDevice = devicesList[deviceIndex];
+            char deviceId = static_cast<char>(currentDevice.deviceId);
+            dhdSetForceAndGripperForce(currentDevice.force(0), currentDevice.force(1), currentDevice.force(2), gripperForceMagnitude, deviceId);
+            bool buttonPressed = (dhdGetButton(0, deviceId) != DHD_OFF);
+            if (buttonPressed)
             {
-                safeToRenderHaptics = true;
+                stopRequests++;
             }
-            else
+
+            // Record the iteration without blocking, if requested.
+            if (telemetry.isOpen())
             {
-                force.setZero();
+                telemetry.record(time, currentDevice.devicePosition.data(), currentDevice.deviceVelocity.data(), currentDevice.force.data(),
+                                 buttonPressed ? 1 : 0, hapticTiming, static_cast<uint16_t>(deviceIndex));
             }
         }
 
-        // Apply all forces at once.
-        double gripperForceMagnitude = 0.0;
-        dhdSetForceAndGripperForce(force(0), force(1), force(2), gripperForceMagnitude);
-
-        // Stop the torus rotation if any of the devices button is pressed.
+        // Publish the tool positions and reactions to the physics thread without blocking.
+        HapticFeedback& feedback = hapticFeedback.back();
+        feedback.time = time;
+        feedback.toolCount = devicesCount;
         for (size_t deviceIndex = 0; deviceIndex < devicesCount; deviceIndex++)
         {
-            if (dhdGetButton(0, devicesList[deviceIndex].deviceId) != DHD_OFF)
-            {
-                torusAngularVelocity.setZero();
-            }
+            feedback.toolPositions[deviceIndex] = devicesList[deviceIndex].devicePosition;
         }
-
-        // Add damping to slow down the torus rotation over time.
-        torusAngularVelocity *= (1.0 - Kv * timeStep);
-
-        // Compute the next pose of the torus.
-        if (torusAngularVelocity.norm() > 1e-10)
+        feedback.angularImpulse = angularImpulse;
+        feedback.stopRequests = stopRequests;
+        hapticFeedback.publish();
+
+        // Publish a consistent scene snapshot to the graphics thread without blocking.
+        SceneSnapshot& scene = sceneSnapshot.back();
+        scene.torusPosition = physics.torusPosition;
+        scene.torusRotation = physics.torusRotation;
+        scene.toolCount = devicesCount;
+        for (size_t deviceIndex = 0; deviceIndex < devicesCount; deviceIndex++)
         {
-            Eigen::Matrix3d torusRotationIncrement;
-            torusRotationIncrement = Eigen::AngleAxisd(torusAngularVelocity.norm(), torusAngularVelocity.normalized());
-            torusRotation = torusRotationIncrement * torusRotation;
+            ToolSnapshot& tool = scene.tools[deviceIndex];
+            tool.position = devicesList[deviceIndex].toolPosition;
+            tool.rotation = devicesList[deviceIndex].rotation;
+            tool.forceOnTool = devicesList[deviceIndex].force;
         }
+        sceneSnapshot.publish();
+
+        // Stop timing the iteration.
+        hapticTiming.endIteration();
     }
 
     // Flag the simulation as having finished.
@@ -251,6 +350,52 @@ void* hapticsLoop(void* a_userData)
     return nullptr;
 }
 
+void physicsLoop()
+{
+    // Start from the initial feedback published by initializeSimulation().
+    hapticFeedback.update();
+    double timePrevious = hapticFeedback.front().time;
+    Eigen::Vector3d appliedImpulse = Eigen::Vector3d::Zero();
+    uint64_t appliedStopRequests = 0;
+    torus.stop();
+
+    // Run the physics loop at its own rate, on the haptic loop clock.
+    physicsScheduler.start();
+    while (physicsRunning)
+    {
+        // Fetch the latest tool positions and reactions published by the haptic thread.
+        hapticFeedback.update();
+        const HapticFeedback& feedback = hapticFeedback.front();
+
+        // Apply the reactions accumulated since the previous step, and stop the
+        // torus rotation if any button was pressed meanwhile.
+        torus.applyImpulse(feedback.angularImpulse - appliedImpulse);
+        appliedImpulse = feedback.angularImpulse;
+        if (feedback.stopRequests != appliedStopRequests)
+        {
+            torus.stop();
+            appliedStopRequests = feedback.stopRequests;
+        }
+
+        // Advance the torus dynamics to the time of the feedback.
+        torus.integrate(feedback.time - timePrevious);
+        timePrevious = feedback.time;
+
+        // Publish the torus pose and the patch nearest to every tool without blocking.
+        PhysicsSnapshot& snapshot = physicsSnapshot.back();
+        snapshot.torusPosition = torus.position;
+        snapshot.torusRotation = torus.rotation;
+        for (size_t toolIndex = 0; toolIndex < feedback.toolCount; toolIndex++)
+        {
+            snapshot.patches[toolIndex] = torus.computePatch(feedback.toolPositions[toolIndex], feedback.time);
+        }
+        physicsSnapshot.publish();
+
+        // Wait for the next physics step.
+        physicsScheduler.waitForNextPeriod();
+    }
+}
+
 void onExit()
 {
     // Wait for the haptic loop to finish.
@@ -259,13 +404,40 @@ void onExit()
     {
         dhdSleep(0.1);
     }
+    hapticThread.join();
+
+    // Stop the physics loop.
+    physicsRunning = false;
+    if (physicsThread.joinable())
+    {
+        physicsThread.join();
+    }
+
+    // Report the haptic loop timing statistics.
+    std::cout << std::endl;
+    hapticTiming.printReport(std::cout);
+    std::cout << "physics loop: " << physicsScheduler.rate() << " Hz, " << physicsScheduler.overruns() << " overruns" << std::endl;
+
+    // Write the remaining telemetry samples and the chunk index.
+    if (telemetry.isOpen())
+    {
+        telemetry.setNominalRate(hapticTiming.nominalRate());
+        if (!telemetry.close())
+        {
+            std::cout << "error: " << telemetry.lastError() << std::endl;
+        }
+        std::cout << "telemetry: " << telemetry.written() << " samples written, " << telemetry.dropped() << " dropped" << std::endl;
+    }
 
     // Close the connection to all the haptic devices.
     size_t devicesCount = devicesList.size();
-    if (dhdClose() < 0)
+    for (size_t deviceIndex = 0; deviceIndex < devicesCount; deviceIndex++)
     {
-        std::cout << "error: failed to close the connection to device ID " << devicesList[0].deviceId << " (" << dhdErrorGetLastStr() << ")" << std::endl;
-        return;
+        if (dhdClose(static_cast<char>(devicesList[deviceIndex].deviceId)) < 0)
+        {
+            std::cout << "error: failed to close the connection to device ID " << devicesList[deviceIndex].deviceId << " (" << dhdErrorGetLastStr() << ")" << std::endl;
+            return;
+        }
     }
 
     // Report success.
@@ -281,37 +453,8 @@ void DrawTorus(float a_outerRadius,
 {
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-    double majorStep = 2.0 * M_PI / a_majorNumSegments;
-    for (int majorIndex = 0; majorIndex < a_majorNumSegments; ++majorIndex)
-    {
-        double a0 = majorIndex * majorStep;
-        double a1 = a0 + majorStep;
-        GLdouble x0 = cos(a0);
-        GLdouble y0 = sin(a0);
-        GLdouble x1 = cos(a1);
-        GLdouble y1 = sin(a1);
-
-        glBegin(GL_TRIANGLE_STRIP);
-
-        double minorStep = 2.0 * M_PI / a_minorNumSegments;
-        for (int minorIndex = 0; minorIndex <= a_minorNumSegments; ++minorIndex)
-        {
-            double b = minorIndex * minorStep;
-            GLdouble c = cos(b);
-            GLdouble r = a_innerRadius * c + a_outerRadius;
-            GLdouble z = a_innerRadius * sin(b);
-
-            glNormal3d(x0 * c, y0 * c, z / a_innerRadius);
-            glTexCoord2d(majorIndex / static_cast<GLdouble>(a_majorNumSegments), minorIndex / static_cast<GLdouble>(a_minorNumSegments));
-            glVertex3d(x0 * r, y0 * r, z);
-
-            glNormal3d(x1 * c, y1 * c, z / a_innerRadius);
-            glTexCoord2d((majorIndex + 1) / static_cast<GLdouble>(a_majorNumSegments), minorIndex / static_cast<GLdouble>(a_minorNumSegments));
-            glVertex3d(x1 * r, y1 * r, z);
-        }
-
-        glEnd();
-    }
+    // The torus is tessellated on the first frame only.
+    geometryCache.drawTorus(a_outerRadius, a_innerRadius, a_majorNumSegments, a_minorNumSegments);
 }
 
 int updateGraphics()
@@ -319,6 +462,10 @@ int updateGraphics()
     // Clean up.
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    // Fetch the latest scene snapshot published by the haptic thread.
+    sceneSnapshot.update();
+    const SceneSnapshot& scene = sceneSnapshot.front();
+
     // Render the torus.
     static const GLfloat mat_ambient0[] = { 0.1f, 0.1f, 0.3f };
     static const GLfloat mat_diffuse0[] = { 0.1f, 0.3f, 0.5f };
@@ -330,9 +477,9 @@ int updateGraphics()
 
     // Render the torus at its current position and rotation.
     cMatrixGL matrix;
-    matrix.set(torusPosition, torusRotation);
+    matrix.set(scene.torusPosition, scene.torusRotation);
     matrix.glMatrixPushMultiply();
-    DrawTorus(TorusOuterRadius, TorusInnerRadius, 64, 64);
+    DrawTorus(static_cast<float>(torus.outerRadius), static_cast<float>(torus.innerRadius), 64, 64);
     matrix.glMatrixPop();
 
     // Configure OpenGL for tool rendering.
@@ -345,16 +492,18 @@ int updateGraphics()
     glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 1.0);
 
     // Render all tools for all devices.
-    HapticDevice& currentDevice = devicesList[0];
-    matrix.set(currentDevice.toolPosition, currentDevice.rotation);
-    matrix.glMatrixPushMultiply();
-    GLUquadricObj* sphere = gluNewQuadric();
-    gluSphere(sphere, ToolRadius, 32, 32);
+    for (size_t toolIndex = 0; toolIndex < scene.toolCount; toolIndex++)
+    {
+        const ToolSnapshot& tool = scene.tools[toolIndex];
+        matrix.set(tool.position, tool.rotation);
+        matrix.glMatrixPushMultiply();
+        geometryCache.drawSphere(torus.toolRadius, 32, 32);
 
-    // Drawing force acting over the tool
-    Utils::drawForceOnTool();
+        // Drawing force acting over the tool
+        Utils::drawForceOnTool(tool.forceOnTool);
 
-    matrix.glMatrixPop();
+        matrix.glMatrixPop();
+    }
 
     // Report any issue.
     GLenum err = glGetError();
@@ -403,6 +552,13 @@ void onKeyPressed(GLFWwindow* a_window,
     {
         exit(0);
     }
+
+    // Toggle the display of the haptic rate.
+    if (a_key == GLFW_KEY_R)
+    {
+        showHapticRate = !showHapticRate;
+        std::cout << std::endl;
+    }
 }
 
 void onError(int a_error,
@@ -411,6 +567,44 @@ void onError(int a_error,
     std::cout << "error: " << a_description << std::endl;
 }
 
+void initializeOpenGL()
+{
+    // Define material properties.
+    GLfloat mat_ambient[] = { 0.5f, 0.5f, 0.5f };
+    GLfloat mat_diffuse[] = { 0.5f, 0.5f, 0.5f };
+    GLfloat mat_specular[] = { 0.5f, 0.5f, 0.5f };
+    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, mat_ambient);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, mat_diffuse);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, mat_specular);
+    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 1.0);
+
+    // Define light sources.
+    GLfloat ambient[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+    GLfloat diffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
+    GLfloat specular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glLightfv(GL_LIGHT0, GL_AMBIENT, ambient);
+    glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuse);
+    glLightfv(GL_LIGHT0, GL_SPECULAR, specular);
+    glLightf(GL_LIGHT0, GL_CONSTANT_ATTENUATION, 1.0);
+    glLightf(GL_LIGHT0, GL_LINEAR_ATTENUATION, 0.0);
+    glLightf(GL_LIGHT0, GL_QUADRATIC_ATTENUATION, 0.0);
+
+    GLfloat lightPos[] = { 2.0, 0.0, 0.0, 1.0f };
+    GLfloat lightDir[] = { -1.0, 0.0, 0.0, 1.0f };
+    glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
+    glLightfv(GL_LIGHT0, GL_SPOT_DIRECTION, lightDir);
+    glLightf(GL_LIGHT0, GL_SPOT_CUTOFF, 180);
+    glLightf(GL_LIGHT0, GL_SPOT_EXPONENT, 1.0);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_LIGHT0);
+
+    // Use depth buffering for hidden surface elimination.
+    glEnable(GL_DEPTH_TEST);
+
+    // Clear the OpenGL color buffer.
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+}
+
 int initializeGLFW()
 {
     // Initialize the GLFW library.
@@ -423,7 +617,13 @@ int initializeGLFW()
     glfwSetErrorCallback(onError);
 
     // Compute the desired window size.
-    const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+    const GLFWvidmode* mode = (monitor != nullptr) ? glfwGetVideoMode(monitor) : nullptr;
+    if (mode == nullptr)
+    {
+        std::cout << "error: no monitor found, use --headless to render offscreen" << std::endl;
+        return -1;
+    }
     windowWidth = static_cast<int>(0.8 *  mode->height);
     windowHeight = static_cast<int>(0.5 * mode->height);
     int x = static_cast<int>(0.5 * (mode->width - windowWidth));
@@ -453,40 +653,8 @@ int initializeGLFW()
     // Adjust initial window size
     onWindowResized(window, windowWidth, windowHeight);
 
-    // Define material properties.
-    GLfloat mat_ambient[] = { 0.5f, 0.5f, 0.5f };
-    GLfloat mat_diffuse[] = { 0.5f, 0.5f, 0.5f };
-    GLfloat mat_specular[] = { 0.5f, 0.5f, 0.5f };
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, mat_ambient);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, mat_diffuse);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, mat_specular);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 1.0);
-
-    // Define light sources.
-    GLfloat ambient[] = { 0.5f, 0.5f, 0.5f, 1.0f };
-    GLfloat diffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
-    GLfloat specular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glLightfv(GL_LIGHT0, GL_AMBIENT, ambient);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuse);
-    glLightfv(GL_LIGHT0, GL_SPECULAR, specular);
-    glLightf(GL_LIGHT0, GL_CONSTANT_ATTENUATION, 1.0);
-    glLightf(GL_LIGHT0, GL_LINEAR_ATTENUATION, 0.0);
-    glLightf(GL_LIGHT0, GL_QUADRATIC_ATTENUATION, 0.0);
-
-    GLfloat lightPos[] = { 2.0, 0.0, 0.0, 1.0f };
-    GLfloat lightDir[] = { -1.0, 0.0, 0.0, 1.0f };
-    glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
-    glLightfv(GL_LIGHT0, GL_SPOT_DIRECTION, lightDir);
-    glLightf(GL_LIGHT0, GL_SPOT_CUTOFF, 180);
-    glLightf(GL_LIGHT0, GL_SPOT_EXPONENT, 1.0);
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-
-    // Use depth buffering for hidden surface elimination.
-    glEnable(GL_DEPTH_TEST);
-
-    // Clear the OpenGL color buffer.
-    glClearColor(0.0, 0.0, 0.0, 1.0);
+    // Set up materials and lights.
+    initializeOpenGL();
 
     // Report success.
     return 0;
@@ -495,16 +663,128 @@ int initializeGLFW()
 int initializeSimulation()
 {
     size_t devicesCount = devicesList.size();
-    devicesList[0].toolPosition.setZero();
-    torusPosition.setZero();
-    torusRotation.Identity();
-    torusRotation = Eigen::AngleAxisd(M_PI * 45.0 / 180.0, Eigen::Vector3d(0.0, 1.0, -1.0));
+    for (size_t deviceIndex = 0; deviceIndex < devicesCount; deviceIndex++)
+    {
+        devicesList[deviceIndex].toolPosition.setZero();
+        devicesList[deviceIndex].force.setZero();
+    }
+    torus.setPose(Eigen::Vector3d::Zero(), Eigen::Matrix3d(Eigen::AngleAxisd(M_PI * 45.0 / 180.0, Eigen::Vector3d(0.0, 1.0, -1.0))));
+
+    // Publish the initial scene before the haptic and physics threads start.
+    SceneSnapshot scene;
+    scene.torusPosition = torus.position;
+    scene.torusRotation = torus.rotation;
+    scene.toolCount = devicesCount;
+    sceneSnapshot.write(scene);
+
+    PhysicsSnapshot physics;
+    physics.torusPosition = torus.position;
+    physics.torusRotation = torus.rotation;
+    physicsSnapshot.write(physics);
+
+    HapticFeedback feedback;
+    feedback.time = dhdGetTime();
+    hapticFeedback.write(feedback);
     return 0;
 }
 
+int runHeadless(const HeadlessOptions& a_options)
+{
+    // Render into an offscreen framebuffer, without window nor monitor.
+    OffscreenContext context;
+    if (!context.create(a_options.width, a_options.height))
+    {
+        std::cout << "error: " << context.lastError() << std::endl;
+        return -1;
+    }
+    initializeOpenGL();
+    onWindowResized(nullptr, a_options.width, a_options.height);
+
+    // Script one tool per emulated device, so that frames are reproducible.
+    DeviceEmulator& emulator = DeviceEmulator::instance();
+    if (!emulator.open() || !emulator.isScripted())
+    {
+        std::cout << "error: headless mode needs a scripted DHD_EMULATOR mode" << std::endl;
+        return -1;
+    }
+    initializeSimulation();
+    const Eigen::Matrix3d initialRotation = torus.rotation;
+    size_t toolCount = std::min(emulator.deviceCount(), MaxDevices);
+
+    int result = runHeadlessFrames(a_options, context, std::cout,
+        [&](double a_time)
+        {
+            // Spin the torus at a constant rate instead of simulating its dynamics.
+            torus.setPose(torus.position, Eigen::AngleAxisd(0.5 * a_time, Eigen::Vector3d(0.0, 0.0, 1.0)) * initialRotation);
+            emulator.advanceTo(a_time);
+
+            SceneSnapshot& scene = sceneSnapshot.back();
+            scene.torusPosition = torus.position;
+            scene.torusRotation = torus.rotation;
+            scene.toolCount = toolCount;
+            for (size_t toolIndex = 0; toolIndex < toolCount; toolIndex++)
+            {
+                EmulatedSample sample;
+                emulator.sample(sample, static_cast<int>(toolIndex));
+                ToolSnapshot& tool = scene.tools[toolIndex];
+                Eigen::Vector3d devicePosition(sample.position[0], sample.position[1], sample.position[2]);
+                tool.forceOnTool = torus.computeForce(devicePosition, tool.position);
+                tool.rotation.setIdentity();
+            }
+            sceneSnapshot.publish();
+        },
+        []() { return updateGraphics(); });
+
+    geometryCache.clear();
+    return result;
+}
+
 int main(int argc,
          char* argv[])
 {
+    // Render a scripted scene offscreen and report frame times (--headless),
+    // record every haptic iteration to a telemetry file (--record=FILE), or
+    // step the torus dynamics at another rate (--physics-rate=HZ). Run the
+    // haptic thread at real-time priority with --realtime (always in production).
+    HeadlessOptions headless;
+    std::string recordPath;
+#ifdef PROD_BUILD
+    bool realtime = true;
+#else
+    bool realtime = false;
+#endif
+    physicsScheduler.setRateRange(MinPhysicsRate, LoopScheduler::MaxRate);
+    physicsScheduler.setRate(DefaultPhysicsRate);
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument.rfind("--record=", 0) == 0)
+        {
+            recordPath = argument.substr(9);
+        }
+        else if (argument.rfind("--physics-rate=", 0) == 0)
+        {
+            if (!physicsScheduler.setRate(std::atof(argument.c_str() + 15)))
+            {
+                std::cout << "error: physics rate must be between " << physicsScheduler.minRate() << " and "
+                          << physicsScheduler.maxRate() << " Hz" << std::endl;
+                return -1;
+            }
+        }
+        else if (argument == "--realtime")
+        {
+            realtime = true;
+        }
+        else if (!headless.parse(argument))
+        {
+            std::cout << "warning: ignoring unknown option " << argument << std::endl;
+        }
+    }
+    if (headless.enabled)
+    {
+        return runHeadless(headless);
+    }
+
     // Display version information.
     std::cout << "OpenGL Torus Example " << dhdGetSDKVersionStr() << std::endl;
     std::cout << "Copyright (C) 2001-2023 Force Dimension" << std::endl;
@@ -517,6 +797,17 @@ int main(int argc,
         return -1;
     }
 
+    // Start the telemetry writer before the haptic thread.
+    if (!recordPath.empty())
+    {
+        if (!telemetry.open(recordPath, 0.0, "torus"))
+        {
+            std::cout << "error: " << telemetry.lastError() << std::endl;
+            return -1;
+        }
+        std::cout << "recording telemetry to " << recordPath << std::endl;
+    }
+
     // Open a GLFW window to render the simulation.
     if (initializeGLFW() < 0)
     {
@@ -531,10 +822,21 @@ int main(int argc,
         return -1;
     }
 
-    // Create a high priority haptic thread.
-    DWORD threadHandle;
-    CreateThread(nullptr, 0, (LPTHREAD_START_ROUTINE)(HapticsMetods::hapticsLoop), nullptr, 0x0000, &threadHandle);
-    SetThreadPriority(&threadHandle, THREAD_PRIORITY_ABOVE_NORMAL);
+    // Step the torus dynamics on a separate thread, so that the haptic rate
+    // does not depend on their cost.
+    physicsThread = std::thread(HapticsMetods::physicsLoop);
+    std::cout << "physics rate: " << physicsScheduler.rate() << " Hz" << std::endl;
+
+    // Create a haptic thread pinned to its own core, at real-time priority
+    // with locked memory in production builds or with --realtime.
+    RealtimeThreadConfig hapticConfig;
+    if (!realtime)
+    {
+        hapticConfig.priority = 0;
+        hapticConfig.lockMemory = false;
+    }
+    hapticThread.start(hapticConfig, []() { HapticsMetods::hapticsLoop(nullptr); });
+    hapticThread.report().print(std::cout);
 
     // Register a callback that stops the haptic thread when the application exits.
     atexit(HapticsMetods::onExit);
@@ -545,8 +847,18 @@ int main(int argc,
     std::cout << "      'q' to quit" << std::endl << std::endl;
 
     // Main graphic loop
+    double statusTime = glfwGetTime();
     while (simulationRunning && !glfwWindowShouldClose(window))
     {
+        // Display the haptic rate and jitter twice per second.
+        if (showHapticRate && (glfwGetTime() - statusTime > 0.5))
+        {
+            statusTime = glfwGetTime();
+            std::cout << "\r";
+            hapticTiming.printStatus(std::cout);
+            std::cout << "    " << std::flush;
+        }
+
         // Render graphics.
         if (updateGraphics() < 0)
         {
@@ -561,6 +873,9 @@ int main(int argc,
         glfwPollEvents();
     }
 
+    // Release the cached geometry while the OpenGL context still exists.
+    geometryCache.clear();
+
     // Close the GLFW window.
     glfwDestroyWindow(window);
 
@@ -0,0 +1,533 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Signed distance field baking tool.
+///
+/// Samples the signed distance of an analytic shape or of a closed triangle
+/// mesh on a bricked grid, and at the brick corners for the coarse interior
+/// field, and writes the result in the format read by SdfField
+/// (common/sdf_field.h).
+///
+/// Usage:
+///
+///   sdf_bake --shape=sphere --radius=0.03 --out=sphere.sdf
+///   sdf_bake --shape=torus --major=0.05 --minor=0.027 --out=torus.sdf
+///   sdf_bake --shape=mesh --mesh=organ.obj [--scale=0.001] --out=organ.sdf
+///
+/// Options:
+///
+///   --resolution=N   cells along the largest axis of the field (default 256)
+///   --band=D         narrow band half width in [m], which should exceed the
+///                    tool radius plus the usual penetration; deeper, SdfField
+///                    falls back to a coarse interior field
+///                    (default 10 mm, at least 8 cells)
+///   --budget=MB      maximum file size; the resolution is lowered to fit (default 64)
+///
+/// The sign of mesh distances is taken from angle-weighted pseudo-normals
+/// (Baerentzen and Aanaes), which is exact for closed, consistently oriented
+/// meshes.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// C++ library headers
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Eigen library header
+#include <Eigen/Dense>
+
+// Project headers
+#include "mesh_bvh.h"
+#include "sdf_field.h"
+#include "triangle_mesh.h"
+
+using DistanceFunction = std::function<double(const Eigen::Vector3d&)>;
+
+struct Shape
+{
+    std::string description;
+    Eigen::Vector3d low;
+    Eigen::Vector3d high;
+    DistanceFunction distance;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Signed distance to a closed mesh, using a BVH for the closest point and
+/// the pseudo-normal of the closest feature (face, edge or vertex) for the
+/// sign.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+class MeshDistance
+{
+public:
+    explicit MeshDistance(const TriangleMesh& a_mesh)
+    {
+        weld(a_mesh);
+        m_bvh.build(m_mesh);
+
+        // Face normals, angle-weighted vertex normals and edge normals.
+        m_faceNormals.resize(m_mesh.triangles.size());
+        m_vertexNormals.assign(m_mesh.vertices.size(), Eigen::Vector3d::Zero());
+        for (size_t i = 0; i < m_mesh.triangles.size(); i++)
+        {
+            const auto& triangle = m_mesh.triangles[i];
+            Eigen::Vector3d v[3];
+            for (int j = 0; j < 3; j++)
+            {
+                v[j] = m_mesh.vertices[triangle[j]].cast<double>();
+            }
+            Eigen::Vector3d normal = (v[1] - v[0]).cross(v[2] - v[0]);
+            normal = (normal.norm() > 0.0) ? normal.normalized() : Eigen::Vector3d::Zero();
+            m_faceNormals[i] = normal;
+            for (int j = 0; j < 3; j++)
+            {
+                Eigen::Vector3d a = (v[(j + 1) % 3] - v[j]).normalized();
+                Eigen::Vector3d b = (v[(j + 2) % 3] - v[j]).normalized();
+                double angle = std::acos(std::clamp(a.dot(b), -1.0, 1.0));
+                m_vertexNormals[triangle[j]] += angle * normal;
+                m_edgeNormals[edgeKey(triangle[j], triangle[(j + 1) % 3])] += normal;
+            }
+        }
+    }
+
+    const Eigen::Vector3f& low() const
+    {
+        return m_low;
+    }
+
+    const Eigen::Vector3f& high() const
+    {
+        return m_high;
+    }
+
+    double operator()(const Eigen::Vector3d& a_point) const
+    {
+        ClosestHit hit;
+        if (!m_bvh.closestPoint(a_point, 1e30, hit, m_hint))
+        {
+            return 1e30;
+        }
+        m_hint = hit.triangle;
+
+        // Barycentric coordinates of the closest point tell which feature it lies on.
+        uint32_t index = m_bvh.sourceTriangle(hit.triangle);
+        const auto& triangle = m_mesh.triangles[index];
+        Eigen::Vector3d a = m_mesh.vertices[triangle[0]].cast<double>();
+        Eigen::Vector3d b = m_mesh.vertices[triangle[1]].cast<double>();
+        Eigen::Vector3d c = m_mesh.vertices[triangle[2]].cast<double>();
+        Eigen::Vector3d ab = b - a;
+        Eigen::Vector3d ac = c - a;
+        Eigen::Vector3d ap = hit.point - a;
+        double d00 = ab.dot(ab);
+        double d01 = ab.dot(ac);
+        double d11 = ac.dot(ac);
+        double d20 = ap.dot(ab);
+        double d21 = ap.dot(ac);
+        double denominator = d00 * d11 - d01 * d01;
+        double v = (denominator != 0.0) ? (d11 * d20 - d01 * d21) / denominator : 0.0;
+        double w = (denominator != 0.0) ? (d00 * d21 - d01 * d20) / denominator : 0.0;
+        double barycentric[3] = { 1.0 - v - w, v, w };
+
+        constexpr double Epsilon = 1e-5;
+        int zeros = 0;
+        int nonZero[3];
+        int nonZeroCount = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            if (barycentric[i] < Epsilon)
+            {
+                zeros++;
+            }
+            else
+            {
+                nonZero[nonZeroCount++] = i;
+            }
+        }
+
+        Eigen::Vector3d normal = m_faceNormals[index];
+        if (zeros == 2 && nonZeroCount == 1)
+        {
+            normal = m_vertexNormals[triangle[nonZero[0]]];
+        }
+        else if (zeros == 1 && nonZeroCount == 2)
+        {
+            auto edge = m_edgeNormals.find(edgeKey(triangle[nonZero[0]], triangle[nonZero[1]]));
+            if (edge != m_edgeNormals.end())
+            {
+                normal = edge->second;
+            }
+        }
+
+        double distance = (a_point - hit.point).norm();
+        return ((a_point - hit.point).dot(normal) < 0.0) ? -distance : distance;
+    }
+
+private:
+    static uint64_t edgeKey(uint32_t a_first,
+                            uint32_t a_second)
+    {
+        return (uint64_t(std::min(a_first, a_second)) << 32) | std::max(a_first, a_second);
+    }
+
+    /// Merges vertices at identical positions, as STL files repeat them per triangle.
+    void weld(const TriangleMesh& a_mesh)
+    {
+        std::map<std::array<float, 3>, uint32_t> indices;
+        std::vector<uint32_t> remap(a_mesh.vertices.size());
+        m_low = Eigen::Vector3f::Constant(FLT_MAX);
+        m_high = Eigen::Vector3f::Constant(-FLT_MAX);
+        for (size_t i = 0; i < a_mesh.vertices.size(); i++)
+        {
+            const Eigen::Vector3f& vertex = a_mesh.vertices[i];
+            auto inserted = indices.emplace(std::array<float, 3> { vertex(0), vertex(1), vertex(2) }, static_cast<uint32_t>(m_mesh.vertices.size()));
+            if (inserted.second)
+            {
+                m_mesh.vertices.push_back(vertex);
+                m_low = m_low.cwiseMin(vertex);
+                m_high = m_high.cwiseMax(vertex);
+            }
+            remap[i] = inserted.first->second;
+        }
+        for (const auto& triangle : a_mesh.triangles)
+        {
+            std::array<uint32_t, 3> welded = { remap[triangle[0]], remap[triangle[1]], remap[triangle[2]] };
+            if (welded[0] != welded[1] && welded[1] != welded[2] && welded[2] != welded[0])
+            {
+                m_mesh.triangles.push_back(welded);
+            }
+        }
+    }
+
+    TriangleMesh m_mesh;
+    MeshBvh m_bvh;
+    std::vector<Eigen::Vector3d> m_faceNormals;
+    std::vector<Eigen::Vector3d> m_vertexNormals;
+    std::map<uint64_t, Eigen::Vector3d> m_edgeNormals;
+    Eigen::Vector3f m_low;
+    Eigen::Vector3f m_high;
+    mutable int m_hint = -1;
+};
+
+struct Grid
+{
+    Eigen::Vector3d origin;
+    double voxelSize;
+    int brickCount[3];
+
+    size_t bricks() const
+    {
+        return size_t(brickCount[0]) * brickCount[1] * brickCount[2];
+    }
+
+    Eigen::Vector3d samplePosition(int a_x,
+                                   int a_y,
+                                   int a_z) const
+    {
+        return origin + voxelSize * Eigen::Vector3d(a_x, a_y, a_z);
+    }
+};
+
+static Grid makeGrid(const Shape& a_shape,
+                     int a_resolution,
+                     double a_band)
+{
+    Eigen::Vector3d low = a_shape.low - Eigen::Vector3d::Constant(a_band);
+    Eigen::Vector3d high = a_shape.high + Eigen::Vector3d::Constant(a_band);
+    Grid grid;
+    grid.voxelSize = (high - low).maxCoeff() / a_resolution;
+    grid.origin = low;
+    for (int i = 0; i < 3; i++)
+    {
+        double cells = std::ceil((high(i) - low(i)) / grid.voxelSize);
+        grid.brickCount[i] = std::max(1, static_cast<int>(std::ceil(cells / SdfFileHeader::BrickCells)));
+    }
+    return grid;
+}
+
+/// Classifies each brick from the distance at its center.
+static std::vector<uint32_t> classifyBricks(const Shape& a_shape,
+                                            const Grid& a_grid,
+                                            double a_band,
+                                            uint32_t& a_stored)
+{
+    constexpr int Cells = SdfFileHeader::BrickCells;
+    double halfDiagonal = 0.5 * std::sqrt(3.0) * Cells * a_grid.voxelSize;
+    std::vector<uint32_t> index(a_grid.bricks());
+    a_stored = 0;
+    size_t brick = 0;
+    for (int z = 0; z < a_grid.brickCount[2]; z++)
+    {
+        for (int y = 0; y < a_grid.brickCount[1]; y++)
+        {
+            for (int x = 0; x < a_grid.brickCount[0]; x++, brick++)
+            {
+                Eigen::Vector3d center = a_grid.samplePosition(x * Cells, y * Cells, z * Cells)
+                                       + Eigen::Vector3d::Constant(0.5 * Cells * a_grid.voxelSize);
+                double distance = a_shape.distance(center);
+                if (std::abs(distance) > a_band + halfDiagonal)
+                {
+                    index[brick] = (distance < 0.0) ? SdfFileHeader::EmptyInside : SdfFileHeader::EmptyOutside;
+                }
+                else
+                {
+                    index[brick] = a_stored++;
+                }
+            }
+        }
+    }
+    return index;
+}
+
+/// Samples the distance at every brick corner, for the coarse interior field.
+static std::vector<float> sampleCorners(const Shape& a_shape,
+                                        const Grid& a_grid)
+{
+    constexpr int Cells = SdfFileHeader::BrickCells;
+    std::vector<float> corners;
+    corners.reserve(size_t(a_grid.brickCount[0] + 1) * (a_grid.brickCount[1] + 1) * (a_grid.brickCount[2] + 1));
+    for (int z = 0; z <= a_grid.brickCount[2]; z++)
+    {
+        for (int y = 0; y <= a_grid.brickCount[1]; y++)
+        {
+            for (int x = 0; x <= a_grid.brickCount[0]; x++)
+            {
+                corners.push_back(static_cast<float>(a_shape.distance(a_grid.samplePosition(x * Cells, y * Cells, z * Cells))));
+            }
+        }
+    }
+    return corners;
+}
+
+static size_t align64(size_t a_offset)
+{
+    return (a_offset + 63) / 64 * 64;
+}
+
+static size_t brickOffset(const Grid& a_grid)
+{
+    return align64(sizeof(SdfFileHeader) + a_grid.bricks() * sizeof(uint32_t));
+}
+
+static size_t interiorOffset(const Grid& a_grid,
+                             uint32_t a_stored)
+{
+    return align64(brickOffset(a_grid) + size_t(a_stored) * SdfFileHeader::SamplesPerBrick * sizeof(int16_t));
+}
+
+static size_t fileSize(const Grid& a_grid,
+                       uint32_t a_stored)
+{
+    size_t corners = size_t(a_grid.brickCount[0] + 1) * (a_grid.brickCount[1] + 1) * (a_grid.brickCount[2] + 1);
+    return interiorOffset(a_grid, a_stored) + corners * sizeof(float);
+}
+
+static bool parseVector(const char* a_text,
+                        Eigen::Vector3d& a_vector)
+{
+    return std::sscanf(a_text, "%lf,%lf,%lf", &a_vector(0), &a_vector(1), &a_vector(2)) == 3;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string shapeName;
+    std::string meshPath;
+    std::string outputPath;
+    Eigen::Vector3d center = Eigen::Vector3d::Zero();
+    double radius = 0.03;
+    double major = 0.05;
+    double minor = 0.027;
+    double scale = 1.0;
+    int resolution = 256;
+    double band = 0.0;
+    double budget = 64.0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        std::string value = argument.substr(argument.find('=') + 1);
+        if (argument.rfind("--shape=", 0) == 0) shapeName = value;
+        else if (argument.rfind("--mesh=", 0) == 0) meshPath = value;
+        else if (argument.rfind("--out=", 0) == 0) outputPath = value;
+        else if (argument.rfind("--radius=", 0) == 0) radius = std::atof(value.c_str());
+        else if (argument.rfind("--major=", 0) == 0) major = std::atof(value.c_str());
+        else if (argument.rfind("--minor=", 0) == 0) minor = std::atof(value.c_str());
+        else if (argument.rfind("--scale=", 0) == 0) scale = std::atof(value.c_str());
+        else if (argument.rfind("--resolution=", 0) == 0) resolution = std::max(8, std::atoi(value.c_str()));
+        else if (argument.rfind("--band=", 0) == 0) band = std::atof(value.c_str());
+        else if (argument.rfind("--budget=", 0) == 0) budget = std::atof(value.c_str());
+        else if (argument.rfind("--center=", 0) == 0)
+        {
+            if (!parseVector(value.c_str(), center))
+            {
+                std::cerr << "error: expected --center=x,y,z" << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            std::cerr << "error: unknown argument " << argument << std::endl;
+            return 1;
+        }
+    }
+
+    if (outputPath.empty())
+    {
+        std::cerr << "usage: sdf_bake --shape=sphere|torus|mesh [--mesh=file] --out=file.sdf" << std::endl;
+        return 1;
+    }
+
+    // Describe the shape by its bounds and distance function.
+    Shape shape;
+    std::unique_ptr<MeshDistance> meshDistance;
+    if (shapeName == "sphere")
+    {
+        shape.description = "sphere r=" + std::to_string(radius);
+        shape.low = center - Eigen::Vector3d::Constant(radius);
+        shape.high = center + Eigen::Vector3d::Constant(radius);
+        shape.distance = [=](const Eigen::Vector3d& a_point) { return (a_point - center).norm() - radius; };
+    }
+    else if (shapeName == "torus")
+    {
+        // Same orientation as torus.cpp: axis along z.
+        shape.description = "torus R=" + std::to_string(major) + " r=" + std::to_string(minor);
+        shape.low = center - Eigen::Vector3d(major + minor, major + minor, minor);
+        shape.high = center + Eigen::Vector3d(major + minor, major + minor, minor);
+        shape.distance = [=](const Eigen::Vector3d& a_point)
+        {
+            Eigen::Vector3d local = a_point - center;
+            return Eigen::Vector2d(local.head<2>().norm() - major, local(2)).norm() - minor;
+        };
+    }
+    else if (shapeName == "mesh")
+    {
+        TriangleMesh mesh;
+        if (!mesh.load(meshPath))
+        {
+            std::cerr << "error: cannot load mesh " << meshPath << std::endl;
+            return 1;
+        }
+        mesh.transform(scale, center);
+        meshDistance = std::make_unique<MeshDistance>(mesh);
+        shape.description = "mesh " + meshPath.substr(meshPath.find_last_of("/\\") + 1);
+        shape.low = meshDistance->low().cast<double>();
+        shape.high = meshDistance->high().cast<double>();
+        MeshDistance* distance = meshDistance.get();
+        shape.distance = [distance](const Eigen::Vector3d& a_point) { return (*distance)(a_point); };
+    }
+    else
+    {
+        std::cerr << "error: unknown shape '" << shapeName << "'" << std::endl;
+        return 1;
+    }
+
+    // Lower the resolution until the file fits in the memory budget.
+    auto start = std::chrono::steady_clock::now();
+    Grid grid;
+    std::vector<uint32_t> index;
+    uint32_t stored = 0;
+    double bandWidth = 0.0;
+    while (true)
+    {
+        double extent = (shape.high - shape.low).maxCoeff();
+        double voxelSize = extent / resolution;
+        bandWidth = (band > 0.0) ? band : std::max(0.01, 8.0 * voxelSize);
+        grid = makeGrid(shape, resolution, bandWidth);
+        index = classifyBricks(shape, grid, bandWidth, stored);
+        if (fileSize(grid, stored) <= budget * 1024.0 * 1024.0 || resolution <= 8)
+        {
+            break;
+        }
+        resolution = std::max(8, static_cast<int>(resolution * 0.8));
+    }
+
+    // Sample the stored bricks.
+    constexpr int Samples = SdfFileHeader::BrickSamples;
+    constexpr int Cells = SdfFileHeader::BrickCells;
+    float quantization = static_cast<float>(bandWidth / 32767.0);
+    std::vector<int16_t> samples(size_t(stored) * SdfFileHeader::SamplesPerBrick);
+    size_t brick = 0;
+    for (int bz = 0; bz < grid.brickCount[2]; bz++)
+    {
+        for (int by = 0; by < grid.brickCount[1]; by++)
+        {
+            for (int bx = 0; bx < grid.brickCount[0]; bx++, brick++)
+            {
+                if (index[brick] >= SdfFileHeader::EmptyInside)
+                {
+                    continue;
+                }
+                int16_t* output = &samples[size_t(index[brick]) * SdfFileHeader::SamplesPerBrick];
+                for (int z = 0; z < Samples; z++)
+                {
+                    for (int y = 0; y < Samples; y++)
+                    {
+                        for (int x = 0; x < Samples; x++)
+                        {
+                            double distance = shape.distance(grid.samplePosition(bx * Cells + x, by * Cells + y, bz * Cells + z));
+                            distance = std::clamp(distance, -bandWidth, bandWidth);
+                            *output++ = static_cast<int16_t>(std::lround(distance / quantization));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<float> corners = sampleCorners(shape, grid);
+
+    // Write the file.
+    SdfFileHeader header {};
+    header.magic = SdfFileHeader::Magic;
+    header.version = SdfFileHeader::Version;
+    header.headerSize = sizeof(SdfFileHeader);
+    header.brickCells = SdfFileHeader::BrickCells;
+    for (int i = 0; i < 3; i++)
+    {
+        header.brickCount[i] = static_cast<uint32_t>(grid.brickCount[i]);
+        header.origin[i] = static_cast<float>(grid.origin(i));
+    }
+    header.storedBricks = stored;
+    header.voxelSize = static_cast<float>(grid.voxelSize);
+    header.band = static_cast<float>(bandWidth);
+    header.quantization = quantization;
+    header.indexOffset = sizeof(SdfFileHeader);
+    header.brickOffset = brickOffset(grid);
+    header.interiorOffset = interiorOffset(grid, stored);
+    header.fileSize = fileSize(grid, stored);
+    std::strncpy(header.description, shape.description.c_str(), sizeof(header.description) - 1);
+
+    std::ofstream file(outputPath, std::ios::binary);
+    std::vector<char> padding(64, 0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(uint32_t));
+    file.write(padding.data(), header.brickOffset - header.indexOffset - index.size() * sizeof(uint32_t));
+    file.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(int16_t));
+    file.write(padding.data(), header.interiorOffset - header.brickOffset - samples.size() * sizeof(int16_t));
+    file.write(reinterpret_cast<const char*>(corners.data()), corners.size() * sizeof(float));
+    if (!file)
+    {
+        std::cerr << "error: cannot write " << outputPath << std::endl;
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << shape.description << ": " << grid.brickCount[0] * Cells << "x" << grid.brickCount[1] * Cells << "x" << grid.brickCount[2] * Cells
+              << " cells of " << grid.voxelSize * 1e3 << " mm, band " << bandWidth * 1e3 << " mm, "
+              << stored << "/" << grid.bricks() << " bricks stored, "
+              << header.fileSize / 1024 << " KB, baked in " << seconds << " s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,494 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Offline replay of recorded haptic sessions.
+///
+/// Feeds the device trajectory of a telemetry recording (--record=FILE of the
+/// haptic applications, common/telemetry_recorder.h) back through the force
+/// models of common/force_models.h, with no device, window or clock, as fast
+/// as the CPU allows. Reports the replay speed, the compute time of every
+/// step and the difference between the replayed and the recorded forces.
+///
+/// Usage:
+///
+///   telemetry_replay --model=sphere --in=session.tlm
+///   telemetry_replay --model=torus --in=session.tlm --out=forces.csv
+///   telemetry_replay --model=tube --in=session.tlm [--centerline=path.txt]
+///
+/// Options:
+///
+///   --out=FILE     write one line "time,device,fx,fy,fz,step_ns" per sample
+///   --repeat=N     replay the recording N times, for profiling (default 1)
+///   --physics-rate=HZ  rate of the torus physics step (default 500, as in torus.cpp)
+///
+/// A step is one haptic loop iteration: all samples recorded with the same
+/// iteration number (one per device for torus recordings). As in the
+/// applications, forces are only rendered once a tool has reached free
+/// space, and the torus dynamics use the recorded time steps and buttons.
+/// As in torus.cpp, the torus is integrated and its patch nearest to every
+/// tool computed at the physics rate, and the forces are computed against
+/// the latest patches at every step.
+/// Damping terms use the recorded velocities, which the applications
+/// estimate in the loop (common/velocity_estimator.h).
+///
+/// Positions and velocities are recorded in single precision, so replayed
+/// forces match the recorded ones to about 1e-6 relative, not bit for bit.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// C++ library headers
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Eigen library header
+#include <Eigen/Dense>
+
+// Project headers
+#include "force_models.h"
+#include "loop_timing.h"
+#include "polyline_centerline.h"
+#include "telemetry_recorder.h"
+
+using Clock = std::chrono::steady_clock;
+
+/// Maximum number of devices in one step, as in torus.cpp.
+constexpr size_t MaxDevices = 8;
+
+/// Default rate of the torus physics thread in [Hz], as in torus.cpp.
+constexpr double DefaultPhysicsRate = 500.0;
+
+/// Force replayed for one recorded sample.
+struct ReplayedForce
+{
+    Eigen::Vector3d force = Eigen::Vector3d::Zero();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Replays one step of a force model. 'a_samples' holds the 'a_count'
+/// samples of the step and 'a_forces' receives their forces.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+class ReplayModel
+{
+public:
+    virtual ~ReplayModel() = default;
+
+    virtual void reset() = 0;
+
+    virtual void step(const TelemetrySample* a_samples,
+                      size_t a_count,
+                      double a_timeStep,
+                      ReplayedForce* a_forces) = 0;
+};
+
+/// Forces are only rendered once the tool has been in free space, as in the applications.
+class SafetyGate
+{
+public:
+    void reset()
+    {
+        m_safe.fill(false);
+    }
+
+    Eigen::Vector3d apply(size_t a_device,
+                          const Eigen::Vector3d& a_force)
+    {
+        bool& safe = m_safe[std::min(a_device, MaxDevices - 1)];
+        if (!safe)
+        {
+            if (a_force.norm() == 0.0)
+            {
+                safe = true;
+            }
+            else
+            {
+                return Eigen::Vector3d::Zero();
+            }
+        }
+        return a_force;
+    }
+
+private:
+    std::array<bool, MaxDevices> m_safe {};
+};
+
+Eigen::Vector3d samplePosition(const TelemetrySample& a_sample)
+{
+    return Eigen::Vector3d(a_sample.position[0], a_sample.position[1], a_sample.position[2]);
+}
+
+Eigen::Vector3d sampleVelocity(const TelemetrySample& a_sample)
+{
+    return Eigen::Vector3d(a_sample.velocity[0], a_sample.velocity[1], a_sample.velocity[2]);
+}
+
+class SphereReplay : public ReplayModel
+{
+public:
+    void reset() override
+    {
+        m_gate.reset();
+    }
+
+    void step(const TelemetrySample* a_samples,
+              size_t a_count,
+              double,
+              ReplayedForce* a_forces) override
+    {
+        for (size_t i = 0; i < a_count; i++)
+        {
+            a_forces[i].force = m_gate.apply(a_samples[i].device, m_sphere.computeForce(samplePosition(a_samples[i]), sampleVelocity(a_samples[i])));
+        }
+    }
+
+private:
+    SphereContactModel m_sphere;
+    SafetyGate m_gate;
+};
+
+class TorusReplay : public ReplayModel
+{
+public:
+    explicit TorusReplay(double a_physicsRate) :
+        m_physicsPeriod(1.0 / a_physicsRate)
+    {}
+
+    void reset() override
+    {
+        // Initial pose of torus.cpp.
+        m_torus.setPose(Eigen::Vector3d::Zero(), Eigen::Matrix3d(Eigen::AngleAxisd(M_PI * 45.0 / 180.0, Eigen::Vector3d(0.0, 1.0, -1.0))));
+        m_gate.reset();
+        m_time = 0.0;
+        m_physicsTime = 0.0;
+        m_angularImpulse.setZero();
+        m_stopRequested = false;
+        m_toolCount = 0;
+    }
+
+    void step(const TelemetrySample* a_samples,
+              size_t a_count,
+              double a_timeStep,
+              ReplayedForce* a_forces) override
+    {
+        // Run the physics thread step when due, on the tool positions and
+        // reactions of the previous steps, as physicsLoop() of torus.cpp does.
+        // The first step computes the patches of the first tool positions.
+        m_time += a_timeStep;
+        if (m_toolCount == 0)
+        {
+            stepPhysics(a_samples, a_count);
+        }
+        else if (m_time >= m_physicsTime + m_physicsPeriod)
+        {
+            stepPhysics(nullptr, m_toolCount);
+        }
+
+        // Contact forces of all tools against their patch of the torus.
+        for (size_t i = 0; i < a_count; i++)
+        {
+            Eigen::Vector3d proxy;
+            Eigen::Vector3d force = m_torus.computePatchForce(m_patches[i], m_time, samplePosition(a_samples[i]), proxy, sampleVelocity(a_samples[i]));
+            m_angularImpulse += m_torus.reactionImpulse(proxy, force, a_timeStep);
+            a_forces[i].force = m_gate.apply(a_samples[i].device, force);
+            m_stopRequested |= (a_samples[i].buttons & 1) != 0;
+            m_tools[i] = samplePosition(a_samples[i]);
+        }
+        m_toolCount = a_count;
+    }
+
+private:
+    /// Applies the accumulated reactions and stop requests, integrates the
+    /// torus up to the current time and computes the patch of every tool, at
+    /// the positions of 'a_samples' if given, else at the last tool positions.
+    void stepPhysics(const TelemetrySample* a_samples,
+                     size_t a_count)
+    {
+        m_torus.applyImpulse(m_angularImpulse);
+        m_angularImpulse.setZero();
+        if (m_stopRequested)
+        {
+            m_torus.stop();
+            m_stopRequested = false;
+        }
+        m_torus.integrate(m_time - m_physicsTime);
+        m_physicsTime = m_time;
+        for (size_t i = 0; i < a_count; i++)
+        {
+            if (a_samples != nullptr)
+            {
+                m_tools[i] = samplePosition(a_samples[i]);
+            }
+            m_patches[i] = m_torus.computePatch(m_tools[i], m_time);
+        }
+    }
+
+    TorusContactModel m_torus;
+    SafetyGate m_gate;
+    const double m_physicsPeriod;
+
+    /// Replay time and time of the last physics step in [s].
+    double m_time = 0.0;
+    double m_physicsTime = 0.0;
+
+    /// Reactions and stop requests accumulated since the last physics step.
+    Eigen::Vector3d m_angularImpulse = Eigen::Vector3d::Zero();
+    bool m_stopRequested = false;
+
+    /// Tool positions of the last step and their patches.
+    size_t m_toolCount = 0;
+    std::array<Eigen::Vector3d, MaxDevices> m_tools;
+    std::array<ContactPatch, MaxDevices> m_patches;
+};
+
+class TubeReplay : public ReplayModel
+{
+public:
+    explicit TubeReplay(const PolylineCenterline& a_centerline) :
+        m_initialCenterline(a_centerline)
+    {}
+
+    void reset() override
+    {
+        // Restart from a cold warm start, as a new session would.
+        m_centerline = m_initialCenterline;
+    }
+
+    void step(const TelemetrySample* a_samples,
+              size_t a_count,
+              double,
+              ReplayedForce* a_forces) override
+    {
+        for (size_t i = 0; i < a_count; i++)
+        {
+            double position[3];
+            double velocity[3];
+            double projectedPosition[3] = {};
+            double force[3];
+            for (int j = 0; j < 3; j++)
+            {
+                position[j] = a_samples[i].position[j];
+                velocity[j] = a_samples[i].velocity[j];
+            }
+            m_guidance.computeForce(m_centerline, position, velocity, projectedPosition, force);
+            a_forces[i].force = Eigen::Vector3d(force[0], force[1], force[2]);
+        }
+    }
+
+private:
+    TubeGuidanceModel m_guidance;
+    const PolylineCenterline m_initialCenterline;
+    PolylineCenterline m_centerline;
+};
+
+/// Difference between replayed and recorded forces in [N].
+struct ForceError
+{
+    double maximum = 0.0;
+    double sumSquared = 0.0;
+    uint64_t count = 0;
+
+    void add(const Eigen::Vector3d& a_replayed,
+             const float a_recorded[3])
+    {
+        double error = (a_replayed - Eigen::Vector3d(a_recorded[0], a_recorded[1], a_recorded[2])).norm();
+        maximum = std::max(maximum, error);
+        sumSquared += error * error;
+        count++;
+    }
+
+    double rms() const
+    {
+        return (count > 0) ? std::sqrt(sumSquared / count) : 0.0;
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    std::string modelName;
+    std::string inputPath;
+    std::string outputPath;
+    std::string centerlinePath;
+    int repeat = 1;
+    double physicsRate = DefaultPhysicsRate;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        std::string value = argument.substr(argument.find('=') + 1);
+        if (argument.rfind("--model=", 0) == 0) modelName = value;
+        else if (argument.rfind("--in=", 0) == 0) inputPath = value;
+        else if (argument.rfind("--out=", 0) == 0) outputPath = value;
+        else if (argument.rfind("--centerline=", 0) == 0) centerlinePath = value;
+        else if (argument.rfind("--repeat=", 0) == 0) repeat = std::max(1, std::atoi(value.c_str()));
+        else if (argument.rfind("--physics-rate=", 0) == 0) physicsRate = std::atof(value.c_str());
+        else
+        {
+            std::cerr << "error: unknown argument " << argument << std::endl;
+            return 1;
+        }
+    }
+
+    if (inputPath.empty() || modelName.empty() || !(physicsRate > 0.0))
+    {
+        std::cerr << "usage: telemetry_replay --model=sphere|torus|tube --in=file [--out=file.csv]" << std::endl;
+        return 1;
+    }
+
+    // Select the force model.
+    std::unique_ptr<ReplayModel> model;
+    if (modelName == "sphere")
+    {
+        model.reset(new SphereReplay());
+    }
+    else if (modelName == "torus")
+    {
+        model.reset(new TorusReplay(physicsRate));
+    }
+    else if (modelName == "tube")
+    {
+        // Same default segment as the tube simulator.
+        PolylineCenterline centerline;
+        if (centerlinePath.empty())
+        {
+            centerline.setPoints({ { 0.060909, -0.00278975, 0.0402634 }, { -0.0415639, -0.0158245, 0.0411088 } });
+        }
+        else if (!centerline.load(centerlinePath))
+        {
+            std::cerr << "error: failed to load centerline " << centerlinePath << std::endl;
+            return 1;
+        }
+        model.reset(new TubeReplay(centerline));
+    }
+    else
+    {
+        std::cerr << "error: unknown model " << modelName << std::endl;
+        return 1;
+    }
+
+    TelemetryReader reader;
+    if (!reader.open(inputPath))
+    {
+        std::cerr << "error: " << reader.lastError() << std::endl;
+        return 1;
+    }
+    std::cout << inputPath << ": " << reader.header().description << ", " << reader.sampleCount() << " samples in "
+              << reader.chunkCount() << " chunks" << (reader.isComplete() ? "" : " (recording was not closed)") << std::endl;
+
+    std::ofstream output;
+    if (!outputPath.empty())
+    {
+        output.open(outputPath);
+        if (!output)
+        {
+            std::cerr << "error: cannot create " << outputPath << std::endl;
+            return 1;
+        }
+        output << "time,device,fx,fy,fz,step_ns\n" << std::setprecision(9);
+    }
+
+    LatencyHistogram stepTime;
+    ForceError error;
+    uint64_t steps = 0;
+    uint64_t replayed = 0;
+    double recordedDuration = 0.0;
+    Clock::duration replayDuration = Clock::duration::zero();
+
+    std::vector<TelemetrySample> chunk;
+    std::vector<TelemetrySample> samples;
+    std::array<ReplayedForce, MaxDevices> forces;
+    for (int pass = 0; pass < repeat; pass++)
+    {
+        model->reset();
+        uint64_t firstTime = 0;
+        uint64_t previousTime = 0;
+        bool started = false;
+
+        // Chunks are read one at a time, so memory does not grow with the recording.
+        samples.clear();
+        for (size_t chunkIndex = 0; chunkIndex < reader.chunkCount(); chunkIndex++)
+        {
+            if (!reader.readChunk(chunkIndex, chunk))
+            {
+                std::cerr << "error: failed to read chunk " << chunkIndex << std::endl;
+                return 1;
+            }
+            samples.insert(samples.end(), chunk.begin(), chunk.end());
+            bool lastChunk = (chunkIndex + 1 == reader.chunkCount());
+
+            size_t begin = 0;
+            while (begin < samples.size())
+            {
+                // Group the samples of one loop iteration. A step that may
+                // continue in the next chunk is kept for the next pass.
+                size_t end = begin + 1;
+                while (end < samples.size() && end - begin < MaxDevices && samples[end].iteration == samples[begin].iteration
+                       && samples[end].time == samples[begin].time)
+                {
+                    end++;
+                }
+                if (end == samples.size() && !lastChunk)
+                {
+                    break;
+                }
+
+                uint64_t time = samples[begin].time;
+                if (!started)
+                {
+                    firstTime = time;
+                    previousTime = time;
+                    started = true;
+                }
+                double timeStep = (time > previousTime) ? 1e-9 * (time - previousTime) : 0.0;
+                previousTime = time;
+
+                Clock::time_point start = Clock::now();
+                model->step(&samples[begin], end - begin, timeStep, forces.data());
+                Clock::duration elapsed = Clock::now() - start;
+                replayDuration += elapsed;
+
+                uint64_t elapsedNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+                stepTime.record(elapsedNs);
+                for (size_t i = begin; i < end; i++)
+                {
+                    const Eigen::Vector3d& force = forces[i - begin].force;
+                    error.add(force, samples[i].force);
+                    if (output.is_open() && pass == 0)
+                    {
+                        output << 1e-9 * samples[i].time << ',' << samples[i].device << ',' << force.x() << ','
+                               << force.y() << ',' << force.z() << ',' << elapsedNs << '\n';
+                    }
+                }
+                replayed += end - begin;
+                steps++;
+                begin = end;
+            }
+            samples.erase(samples.begin(), samples.begin() + begin);
+        }
+        recordedDuration += started ? 1e-9 * (previousTime - firstTime) : 0.0;
+    }
+
+    // Report the replay speed, step compute time and force difference.
+    double replaySeconds = std::chrono::duration<double>(replayDuration).count();
+    std::cout << std::fixed << std::setprecision(3)
+              << "replayed " << replayed << " samples in " << steps << " steps, " << recordedDuration << " s of recording in "
+              << replaySeconds << " s (" << std::setprecision(0) << (replaySeconds > 0.0 ? recordedDuration / replaySeconds : 0.0)
+              << "x real time, " << (replaySeconds > 0.0 ? steps / replaySeconds : 0.0) << " steps/s)" << std::endl;
+    std::cout << std::setprecision(1)
+              << "step time: mean " << stepTime.mean() << " ns | p50 " << stepTime.percentile(50.0)
+              << " ns | p99 " << stepTime.percentile(99.0) << " ns | p99.9 " << stepTime.percentile(99.9)
+              << " ns | max " << stepTime.max() << " ns" << std::endl;
+    std::cout << std::scientific << std::setprecision(3)
+              << "force difference to recording: max " << error.maximum << " N | rms " << error.rms() << " N" << std::endl;
+    return 0;
+}
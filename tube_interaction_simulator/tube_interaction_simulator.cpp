@@ -10,11 +10,17 @@
 ////////////////////////////////////////////////////////////////////////////////
 ///
 /// This example illustrates how to constrain a Force Dimension haptic device on
-/// an arbitrary segment defined using the user button on the haptic device end-
-/// effector.
+/// a tube centerline, defined as a polyline loaded at startup from the file
+/// given on the command line (one "x y z" point per line, in [m]). Without a
+/// file, the centerline is the single segment A-B.
 ///
-/// The constraint force model parameters are defined and documented in the
-/// haptic loop and can be adjusted to modify the behavior of the application.
+/// With --record=FILE, every haptic loop iteration is recorded to a telemetry
+/// file without blocking the loop.
+///
+/// The constraint force model parameters are defined and documented in
+/// TubeGuidanceModel (common/force_models.h) and can be adjusted to modify
+/// the behavior of the application. The velocity of the damping term is
+/// estimated in the loop from the device positions (VelocityEstimator).
 ///
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -22,132 +28,18 @@
 #include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <string>
 
 // Force Dimension SDK library header
 #include "dhdc.h"
 
-////////////////////////////////////////////////////////////////////////////////
-///
-/// This function computes the projection of a 'point' onto a segment defined
-/// by two points 'A' and 'B'. The projection is returned as the point
-/// 'projection'.
-///
-////////////////////////////////////////////////////////////////////////////////
-
-void projectPointOnSegment(double a_point[3],
-                           double a_A[3],
-                           double a_B[3],
-                           double a_projection[3])
-{
-    // Compute Ap vector.
-    double Ap[] =
-    {
-     a_point[0] - a_A[0],
-     a_point[1] - a_A[1],
-     a_point[2] - a_A[2]
-    };
-
-    // Compute AB segment vector.
-    double AB[3] =
-    {
-     a_B[0] - a_A[0],
-     a_B[1] - a_A[1],
-     a_B[2] - a_A[2]
-    };
-
-    // Compute the segment norm, and return the current input point if it is too small.
-    double norm = std::sqrt(AB[0] * AB[0] + AB[1] * AB[1] + AB[2] * AB[2]);
-    if (norm <= 1e-6)
-    {
-        a_projection[0] = a_point[0];
-        a_projection[1] = a_point[1];
-        a_projection[2] = a_point[2];
-
-        return;
-    }
-
-    // Compute the segment direction unit vector.
-    double direction[3] =
-    {
-     AB[0] / norm,
-     AB[1] / norm,
-     AB[2] / norm,
-    };
-
-    // Compute the projection ratio.
-    double projectionRatio = Ap[0] * direction[0] + Ap[1] * direction[1] + Ap[2] * direction[2];
-
-    // Compute the point projection on the segment.
-    if (projectionRatio < 0.0)
-    {
-        a_projection[0] = a_A[0];
-        a_projection[1] = a_A[1];
-        a_projection[2] = a_A[2];
-    }
-    else if (projectionRatio > norm)
-    {
-        a_projection[0] = a_B[0];
-        a_projection[1] = a_B[1];
-        a_projection[2] = a_B[2];
-    }
-    else
-    {
-        a_projection[0] = a_A[0] + projectionRatio * direction[0];
-        a_projection[1] = a_A[1] + projectionRatio * direction[1];
-        a_projection[2] = a_A[2] + projectionRatio * direction[2];
-    }
-}
-
-////////////////////////////////////////////////////////////////////////////////
-///
-/// This function computes the projection of a 'force' onto a direction
-/// defined by two points 'A' and 'B'. The projection is returned as the point
-/// 'projectedForce'.
-///
-////////////////////////////////////////////////////////////////////////////////
-
-void projectForceOnDirection(double a_force[3],
-                             double a_A[3],
-                             double a_B[3],
-                             double a_projectedForce[3])
-{
-    // Compute AB segment vector.
-    double AB[3] =
-    {
-     a_B[0] - a_A[0],
-     a_B[1] - a_A[1],
-     a_B[2] - a_A[2]
-    };
-
-    // Compute the segment norm, and return the current input point if it is too small.
-    double norm = std::sqrt(AB[0] * AB[0] + AB[1] * AB[1] + AB[2] * AB[2]);
-    if (norm <= 1e-6)
-    {
-        a_projectedForce[0] = 0.0;
-        a_projectedForce[1] = 0.0;
-        a_projectedForce[2] = 0.0;
-
-        return;
-    }
-
-    // Compute the segment direction unit vector.
-    double direction[3] =
-    {
-     AB[0] / norm,
-     AB[1] / norm,
-     AB[2] / norm,
-    };
-
-    // Compute the projection ratio.
-    double projectionRatio = a_force[0] * direction[0] + a_force[1] * direction[1] + a_force[2] * direction[2];
-
-    // Compute the force projection on the segment.
-    a_projectedForce[0] = projectionRatio * direction[0];
-    a_projectedForce[1] = projectionRatio * direction[1];
-    a_projectedForce[2] = projectionRatio * direction[2];
-}
-
-////////////////////////////////////////////////////////////////////////////////
+// Project headers
+#include "device_emulator.h"
+#include "force_models.h"
+#include "loop_timing.h"
+#include "polyline_centerline.h"
+#include "telemetry_recorder.h"
+#include "velocity_estimator.h"
 
 int main(int argc,
          char *argv[])
@@ -157,6 +49,22 @@ int main(int argc,
     std::cout << std::nounitbuf;
     std::ios_base::sync_with_stdio(false);
 
+    // Parse the command line: an optional centerline file and --record=FILE.
+    std::string centerlinePath;
+    std::string recordPath;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument.rfind("--record=", 0) == 0)
+        {
+            recordPath = argument.substr(9);
+        }
+        else
+        {
+            centerlinePath = argument;
+        }
+    }
+
     // Display version information.
     std::cout << "Segment Constraint Example " << dhdGetSDKVersionStr() << std::endl;
     std::cout << "Copyright (C) 2001-2023 Force Dimension" << std::endl;
@@ -173,14 +81,29 @@ int main(int argc,
     // Display the device type.
     std::cout << dhdGetSystemName() << " device detected" << std::endl << std::endl;
 
-    // Automatically define the constraint segment points.
-    double numPoints = 2;
-    double A[3] = {0.060909, -0.00278975, 0.0402634};
-    double B[3] = {-0.0415639, -0.0158245, 0.0411088};
+    // Load the constraint centerline, or fall back to the default segment.
+    PolylineCenterline centerline;
+    if (!centerlinePath.empty())
+    {
+        if (!centerline.load(centerlinePath))
+        {
+            std::cout << "error: failed to load centerline (" << centerlinePath << ")" << std::endl;
+            dhdClose();
+            return -1;
+        }
+        std::cout << "Centerline constraint loaded from " << centerlinePath << std::endl;
+        std::cout << centerline.pointCount() << " points, " << centerline.segmentCount() << " segments" << std::endl;
+    }
+    else
+    {
+        double A[3] = {0.060909, -0.00278975, 0.0402634};
+        double B[3] = {-0.0415639, -0.0158245, 0.0411088};
+        centerline.setPoints({ { A[0], A[1], A[2] }, { B[0], B[1], B[2] } });
 
-    std::cout << "Segment constraint activated at startup." << std::endl;
-    std::cout << "Point A: [" << A[0] << ", " << A[1] << ", " << A[2] << "]" << std::endl;
-    std::cout << "Point B: [" << B[0] << ", " << B[1] << ", " << B[2] << "]" << std::endl;
+        std::cout << "Segment constraint activated at startup." << std::endl;
+        std::cout << "Point A: [" << A[0] << ", " << A[1] << ", " << A[2] << "]" << std::endl;
+        std::cout << "Point B: [" << B[0] << ", " << B[1] << ", " << B[2] << "]" << std::endl;
+    }
     std::cout << "Constraint is active.\n" << std::endl;
 
     // Enable force rendering on the haptic device.
@@ -195,58 +118,52 @@ int main(int argc,
     double position[3] = {};
     double velocity[3] = {};
     double projectedPosition[3] = {};
-    double force[3] = {};
     double projectedForce[3] = {};
+    TubeGuidanceModel guidance;
+    VelocityEstimator velocityEstimator;
     bool previousUserButton = false;
+    LoopTiming timing;
+
+    // Start the telemetry writer before the haptic loop.
+    TelemetryRecorder telemetry;
+    if (!recordPath.empty())
+    {
+        if (!telemetry.open(recordPath, 0.0, "tube_interaction_simulator"))
+        {
+            std::cout << "error: " << telemetry.lastError() << std::endl;
+            dhdClose();
+            return -1;
+        }
+        std::cout << "Recording telemetry to " << recordPath << std::endl;
+    }
 
     // Run haptic loop.
     bool running = true;
     while(running)
     {
+        timing.beginIteration();
+
         // Retrieve the device position.
         if (dhdGetPosition(&(position[0]), &(position[1]), &(position[2])) < 0)
         {
+            // The end of a scripted trajectory is not an error.
+            if (DeviceEmulator::instance().isFinished())
+            {
+                break;
+            }
             std::cout << "error: failed to retrieve device position (" << dhdErrorGetLastStr() << ")" << std::endl;
             dhdSleep(2.0);
             break;
         }
 
-        // Retrieve the device velocity.
-        if (dhdGetLinearVelocity(&(velocity[0]), &(velocity[1]), &(velocity[2])) < 0)
-        {
-            std::cout << "error: failed to retrieve linear velocity (" << dhdErrorGetLastStr() << ")" << std::endl;
-            dhdSleep(2.0);
-            break;
-        }
-
-        // If a segment is defined, compute the force required to keep the device on the segment.
-        if (numPoints >= 2)
-        {
-            /// Guidance spring stiffness in [N/m]
-            constexpr double Kp = 2000.0;
+        // Estimate the device velocity from its positions; see VelocityEstimator for its bandwidth and delay.
+        double time = dhdGetTime();
+        velocityEstimator.update(time, position);
+        velocityEstimator.getVelocity(velocity);
 
-            /// Guidance spring damping in [N/(m/s)]
-            constexpr double Kv = 20.0;
-
-            // Compute the projection of the device position onto the segment.
-            projectPointOnSegment(position, A, B, projectedPosition);
-
-            // Compute the guidance force, modeled as a spring-damper system that pulls
-            // the device towards its projection on the constraint segment.
-            force[0] = Kp * (projectedPosition[0] - position[0]) - Kv * velocity[0];
-            force[1] = Kp * (projectedPosition[1] - position[1]) - Kv * velocity[1];
-            force[2] = Kp * (projectedPosition[2] - position[2]) - Kv * velocity[2];
-
-            // Project the guidance force onto the vector defined by the device position and its projection;
-            // this removes all unwanted force components (e.g. damping along the "free" direction).
-            projectForceOnDirection(force, position, projectedPosition, projectedForce);
-        }
-        else
-        {
-            projectedForce[0] = 0.0;
-            projectedForce[1] = 0.0;
-            projectedForce[2] = 0.0;
-        }
+        // Compute the force required to keep the device on the centerline, if one is defined.
+        // The spring-damper model parameters are defined and documented in TubeGuidanceModel.
+        guidance.computeForce(centerline, position, velocity, projectedPosition, projectedForce);
 
         // Apply the required force.
         if (dhdSetForceAndTorqueAndGripperForce (projectedForce[0], projectedForce[1], projectedForce[2], 0.0, 0.0, 0.0, 0.0) < DHD_NO_ERROR)
@@ -256,6 +173,14 @@ int main(int argc,
             break;
         }
 
+        // Record the iteration without blocking, if requested.
+        if (telemetry.isOpen())
+        {
+            uint32_t buttons = (dhdGetButton(0) != DHD_OFF) ? 1 : 0;
+            telemetry.record(time, position, velocity, projectedForce, buttons, timing);
+        }
+        timing.endIteration();
+
         // Allow the user to exit.
         if (dhdKbHit())
         {
@@ -271,6 +196,21 @@ int main(int argc,
         }
     }
 
+    // Write the remaining telemetry samples and the chunk index.
+    if (telemetry.isOpen())
+    {
+        telemetry.setNominalRate(timing.nominalRate());
+        if (!telemetry.close())
+        {
+            std::cout << "error: " << telemetry.lastError() << std::endl;
+        }
+        std::cout << "Telemetry: " << telemetry.written() << " samples written, " << telemetry.dropped() << " dropped" << std::endl;
+    }
+
+    // Report how the closest segment queries were resolved.
+    std::cout << "Centerline queries: " << centerline.warmStartHits() << " warm start, "
+              << centerline.treeHits() << " tree search" << std::endl;
+
     // Close the connection to the haptic device.
     if (dhdClose() < 0)
     {